@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "bench.h"
+#include "bot.h"
+#include "control.h"
+#include "tiny-json.h"
+
+#define ROUNDS CONFIG_BENCH_ROUNDS
+// twice the flash cache, reading it all leaves none of the case in there
+#define EVICT_SIZE (64 * 1024)
+#define CACHE_LINE 32
+#define POOL_SIZE 1024
+
+#ifdef CONFIG_BENCH_TINY_JSON_IRAM
+#    define TINY_JSON_CODE "iram"
+#else
+#    define TINY_JSON_CODE "flash"
+#endif
+
+static const char * TAG = "bench";
+
+// EMBED_TXTFILES adds a terminating zero
+extern const char updates_1_start[] asm("_binary_getupdates_1_json_start");
+extern const char updates_1_end[] asm("_binary_getupdates_1_json_end");
+extern const char updates_20_start[] asm("_binary_getupdates_20_json_start");
+extern const char updates_20_end[] asm("_binary_getupdates_20_json_end");
+
+typedef struct
+{
+    const char * name;
+    const char * input;
+    const char * code;
+    // untimed, before every round
+    void (*prepare)(void);
+    void (*run)(void);
+} bench_case_t;
+
+static const uint32_t evict_table[EVICT_SIZE / sizeof(uint32_t)] = {1};
+
+static const char * updates_1;
+static size_t updates_1_len;
+static const char * updates_20;
+static size_t updates_20_len;
+// a copy of the 20 updates in RAM, read only
+static char * updates_20_ram;
+// what the in place parser works on, refilled before every round
+static char * scratch;
+static json_t * pool;
+static jsonv_t * vpool;
+static volatile uint32_t sink;
+
+static void evict_cache(void)
+{
+    const volatile uint32_t * table = evict_table;
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < EVICT_SIZE / sizeof(uint32_t); i += CACHE_LINE / sizeof(uint32_t))
+        sum += table[i];
+    sink = sum;
+}
+
+/* The same loop twice, only the placement differs. */
+static uint32_t IRAM_ATTR fnv1a_iram(const char * str, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+    return h;
+}
+
+static uint32_t __attribute__((noinline)) fnv1a_flash(const char * str, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+    return h;
+}
+
+static void copy_1(void)
+{
+    memcpy(scratch, updates_1, updates_1_len + 1);
+}
+
+static void copy_20(void)
+{
+    memcpy(scratch, updates_20, updates_20_len + 1);
+}
+
+static void run_json_create(void)
+{
+    sink = json_create(scratch, pool, POOL_SIZE) != NULL;
+}
+
+static void run_jsonv_flash(void)
+{
+    sink = jsonv_create(updates_20, updates_20_len, vpool, POOL_SIZE) != NULL;
+}
+
+static void run_jsonv_ram(void)
+{
+    sink = jsonv_create(updates_20_ram, updates_20_len, vpool, POOL_SIZE) != NULL;
+}
+
+static void run_response(void)
+{
+    bot_bench_response(updates_20_ram, updates_20_len);
+}
+
+static void run_format(void)
+{
+    bot_bench_format("The starter turned off\n\"gen2\" ran for 5 s");
+}
+
+static void run_fnv1a_iram(void)
+{
+    sink = fnv1a_iram(updates_20_ram, updates_20_len);
+}
+
+static void run_fnv1a_flash(void)
+{
+    sink = fnv1a_flash(updates_20_ram, updates_20_len);
+}
+
+static const bench_case_t cases[] = {
+    {"json_create", "updates-1", TINY_JSON_CODE, copy_1, run_json_create},
+    {"json_create", "updates-20", TINY_JSON_CODE, copy_20, run_json_create},
+    {"jsonv_create", "updates-20-flash", TINY_JSON_CODE, NULL, run_jsonv_flash},
+    {"jsonv_create", "updates-20", TINY_JSON_CODE, NULL, run_jsonv_ram},
+    {"process_api_response", "updates-20", "flash", NULL, run_response},
+    {"message_post_data", "text-40", "flash", NULL, run_format},
+    {"button_to_relay", "-", "iram+flash", NULL, control_bench_button},
+    {"fnv1a", "updates-20", "iram", NULL, run_fnv1a_iram},
+    {"fnv1a", "updates-20", "flash", NULL, run_fnv1a_flash},
+};
+
+static int compare_cycles(const void * a, const void * b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Warm runs go back to back after one untimed run, cold runs read the
+ * eviction table first so code and flash data come from flash again. */
+static void run_case(const bench_case_t * bench, bool cold, uint32_t * cycles, int mhz)
+{
+    if (!cold)
+    {
+        if (bench->prepare)
+            bench->prepare();
+        bench->run();
+    }
+
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        if (bench->prepare)
+            bench->prepare();
+        if (cold)
+            evict_cache();
+        // the counter is per core, the task is pinned
+        uint32_t start = esp_cpu_get_cycle_count();
+        bench->run();
+        cycles[i] = esp_cpu_get_cycle_count() - start;
+    }
+
+    qsort(cycles, ROUNDS, sizeof(cycles[0]), compare_cycles);
+    printf("BENCH,%s,%s,%s,%s,%d,%lu,%lu,%lu,%d\n", bench->name, bench->input, bench->code, cold ? "cold" : "warm",
+           ROUNDS, (unsigned long)cycles[0], (unsigned long)cycles[ROUNDS / 2], (unsigned long)cycles[ROUNDS - 1], mhz);
+}
+
+static void bench_task(void * arg)
+{
+    static uint32_t cycles[ROUNDS];
+    const int mhz = esp_rom_get_cpu_ticks_per_us();
+
+    updates_1 = updates_1_start;
+    updates_1_len = updates_1_end - updates_1_start - 1;
+    updates_20 = updates_20_start;
+    updates_20_len = updates_20_end - updates_20_start - 1;
+
+    updates_20_ram = malloc(updates_20_len + 1);
+    scratch = malloc(updates_20_len + 1);
+    pool = malloc(POOL_SIZE * sizeof(json_t));
+    vpool = malloc(POOL_SIZE * sizeof(jsonv_t));
+    if (updates_20_ram == NULL || scratch == NULL || pool == NULL || vpool == NULL)
+    {
+        ESP_LOGE(TAG, "no memory for the inputs");
+        vTaskDelete(NULL);
+        return;
+    }
+    memcpy(updates_20_ram, updates_20, updates_20_len + 1);
+    control_bench_init();
+
+    // the bot code in the cases logs per update
+    ESP_LOGW(TAG, "running %d cases, %d rounds each", (int)(sizeof(cases) / sizeof(cases[0])), ROUNDS);
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    printf("BENCH,case,input,code,cache,rounds,min_cycles,median_cycles,max_cycles,cpu_mhz\n");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        run_case(&cases[i], false, cycles, mhz);
+        run_case(&cases[i], true, cycles, mhz);
+    }
+    printf("BENCH_DONE\n");
+
+    esp_log_level_set("*", CONFIG_LOG_DEFAULT_LEVEL);
+    vTaskDelete(NULL);
+}
+
+void bench_run(void)
+{
+    // on the app core, away from the esp_timer task
+    xTaskCreatePinnedToCore(bench_task, "bench", 4096, NULL, configMAX_PRIORITIES - 2, NULL, portNUM_PROCESSORS - 1);
+}
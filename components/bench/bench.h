@@ -0,0 +1,6 @@
+#pragma once
+
+/* Start the benchmark suite in its own task. Results go to the console as
+ * BENCH,<case>,<input>,<code>,<cache>,<rounds>,<min>,<median>,<max>,<mhz>
+ * lines, times in cpu cycles, and a BENCH_DONE line at the end. */
+void bench_run(void);
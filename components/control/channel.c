@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <string.h>
+#include "channel.h"
+
+static void off_callback(void * arg)
+{
+    channel_switch(arg, false);
+}
+
+void channel_init(channel_t * channel, const channel_io_t * io)
+{
+    channel->io = io;
+    channel->turned_on = false;
+    channel->on_at_us = 0;
+    channel->ts = 0;
+    wheel_timer_init(&channel->off_timer, off_callback, channel);
+}
+
+bool channel_crank(channel_t * channel)
+{
+    char text[64];
+
+    if (channel->turned_on)
+        return false;
+
+    snprintf(text, sizeof(text), "Turning on the %s in few seconds", channel->name);
+    channel->io->notify(text);
+    channel->io->timer_start(&channel->off_timer, (uint64_t)channel->on_time_s * 1000);
+    channel_switch(channel, true);
+    return true;
+}
+
+void channel_switch(channel_t * channel, bool on)
+{
+    char text[64];
+
+    channel->io->relay(channel, on);
+    channel->turned_on = on;
+    if (on)
+    {
+        channel->on_at_us = channel->io->now_us();
+        return;
+    }
+    snprintf(text, sizeof(text), "The %s turned off", channel->name);
+    channel->io->notify(text);
+}
+
+channel_t * channel_find(channel_t * channels, size_t count, const char * name)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strcmp(channels[i].name, name) == 0)
+            return &channels[i];
+    }
+    return NULL;
+}
+
+bool channel_any_on(const channel_t * channels, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (channels[i].turned_on)
+            return true;
+    }
+    return false;
+}
+
+int channel_format_state(const channel_t * channels, size_t count, char * buf, size_t size)
+{
+    int pos = 0;
+
+    for (size_t i = 0; i < count && pos < (int)size; i++)
+        pos += snprintf(buf + pos, size - pos, "%s: %s\n", channels[i].name, channels[i].turned_on ? "on" : "off");
+    return pos;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "timer_wheel.h"
+
+/* Relay channels: cranking, the off timer and the messages around them. No
+ * IDF in here, control.c does the pins, the wheel and the lock through
+ * channel_io_t and the host tests drive the same code. */
+
+typedef struct channel_s channel_t;
+
+typedef struct
+{
+    // set the relay pin
+    void (*relay)(channel_t * channel, bool on);
+    // run timer after ms, its callback switches the channel off
+    void (*timer_start)(wheel_timer_t * timer, uint64_t ms);
+    void (*notify)(const char * text);
+    int64_t (*now_us)(void);
+} channel_io_t;
+
+struct channel_s
+{
+    const char * name;
+    int relay_pin;
+    int button_pin; // GPIO_NUM_NC for none
+    int on_time_s;
+
+    const channel_io_t * io;
+    bool turned_on;
+    // now_us of the last switch on
+    int64_t on_at_us;
+    wheel_timer_t off_timer;
+    // button debounce, touched by the isr
+    volatile uint32_t ts;
+};
+
+#define CHANNEL_DEBOUNCE_MS 200
+
+void channel_init(channel_t * channel, const channel_io_t * io);
+
+/* Tell the admin, start the off timer and switch the relay on. Returns
+ * false without doing anything if the channel is on already. */
+bool channel_crank(channel_t * channel);
+
+void channel_switch(channel_t * channel, bool on);
+
+channel_t * channel_find(channel_t * channels, size_t count, const char * name);
+
+bool channel_any_on(const channel_t * channels, size_t count);
+
+/* One line per channel with its relay state. Returns the length. */
+int channel_format_state(const channel_t * channels, size_t count, char * buf, size_t size);
+
+/* Whether a button edge at now_ms is a press and not a bounce of the last
+ * one. Called from the isr, so it has to stay inline. */
+static inline __attribute__((always_inline)) bool channel_debounce(channel_t * channel, uint32_t now_ms)
+{
+    uint32_t last_ts = channel->ts;
+    channel->ts = now_ms;
+    return last_ts == 0 || now_ms - last_ts > CHANNEL_DEBOUNCE_MS;
+}
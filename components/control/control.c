@@ -4,129 +4,444 @@
 #include "driver/gpio.h"
 #include "driver/rtc_io.h"
 #include "esp_intr_alloc.h"
+#include "esp_ipc.h"
 #include "esp_log.h"
 #include "esp_sleep.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/portmacro.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
-#include "freertos/timers.h"
 
 #include "hal/gpio_types.h"
 #include "bot.h"
+#include "channel.h"
+#include "control.h"
+#include "journal.h"
+#include "latency_hist.h"
+#include "metrics.h"
+#include "task_plan.h"
+#include "timer_wheel.h"
 
-static int STARTER_ON_TIME = 5;
+#define WHEEL_TICK_MS 100
+
+/* One entry per generator, the first one is what /starter_on and
+ * open_relay() crank. */
+static channel_t channels[] = {
+    {.name = "starter", .relay_pin = GPIO_NUM_4, .button_pin = GPIO_NUM_0, .on_time_s = 5},
+    // {.name = "reserve", .relay_pin = GPIO_NUM_16, .button_pin = GPIO_NUM_17, .on_time_s = 5},
+#ifdef CONFIG_BENCH_ON_DEVICE
+    // the last one, switched by the button benchmark only
+    {.name = "bench", .relay_pin = CONFIG_BENCH_RELAY_GPIO, .button_pin = GPIO_NUM_NC, .on_time_s = 5},
+#endif
+};
+
+#define CHANNELS_COUNT (sizeof(channels) / sizeof(channels[0]))
 
 typedef struct
 {
-    gpio_num_t pin;
-    int btn;
-    QueueHandle_t qu;
-    volatile uint32_t ts;
-} isr_context;
+    channel_t * channel;
+    // esp_timer time of the edge, taken in the isr
+    int64_t edge_us;
+} button_event_t;
 
-static void IRAM_ATTR gpio_isr_handler(void * arg)
+static QueueHandle_t buttons_q;
+
+typedef enum
 {
-    isr_context * ctx = arg;
-    uint32_t last_ts = ctx->ts;
-    ctx->ts = xTaskGetTickCountFromISR() * portTICK_PERIOD_MS;
+    STAGE_WAKEUP,
+    STAGE_RELAY,
+    STAGE_TOTAL,
+    STAGES_COUNT
+} button_stage_t;
 
-    if (last_ts != 0 && ctx->ts - last_ts <= 200)
-        return;
+static const char * stage_names[STAGES_COUNT] = {
+    [STAGE_WAKEUP] = "edge to task",
+    [STAGE_RELAY] = "task to relay",
+    [STAGE_TOTAL] = "edge to relay",
+};
 
-    xQueueSendFromISR(ctx->qu, &ctx->btn, NULL);
-}
+// presses that switched a relay on
+static latency_hist_t button_latency[STAGES_COUNT];
 
-const int buttons_count = 1;
-static isr_context contexts[] = {
-    {GPIO_NUM_0, 666, NULL, 0},
+#ifdef CONFIG_CONTROL_LATENCY_PROBE
+/* A button on a spare pin pressed from an esp_timer. It shares the isr, the
+ * queue and the task with the real ones, only the relay is the probe pin. */
+static channel_t probe = {
+    .name = "probe",
+    .relay_pin = CONFIG_CONTROL_PROBE_RELAY_GPIO,
+    .button_pin = CONFIG_CONTROL_PROBE_BUTTON_GPIO,
 };
+static esp_timer_handle_t probe_timer;
+// whether the bot had a request open when the probe pressed
+static volatile bool probe_loaded;
+// [0] idle, [1] during a bot request
+static latency_hist_t probe_latency[2][STAGES_COUNT];
+#endif
 
-#define RELAY_PIN GPIO_NUM_4
+/* Channel off timers and scheduled jobs share one wheel. A one shot
+ * esp_timer is armed for the next expiry only, nothing runs in between.
+ * The lock covers the wheel and the channel states, it is recursive since
+ * wheel callbacks crank channels. */
+static timer_wheel_t wheel;
+static esp_timer_handle_t wheel_timer;
+static SemaphoreHandle_t lock;
 
-static void control_relay(bool power_on)
+/* The event for a button edge, false for a bounce. Shared by the isr and
+ * the benchmark, inline so it stays in IRAM. */
+static inline __attribute__((always_inline)) bool button_edge(channel_t * channel, uint32_t now_ms, button_event_t * event)
 {
-    static bool turned_on = false;
+    if (!channel_debounce(channel, now_ms))
+        return false;
+    event->channel = channel;
+    event->edge_us = esp_timer_get_time();
+    return true;
+}
 
-    if (power_on && turned_on)
-    {
-        ESP_LOGI("relay", "relay is busy");
+static void IRAM_ATTR gpio_isr_handler(void * arg)
+{
+    button_event_t event;
+    if (!button_edge(arg, xTaskGetTickCountFromISR() * portTICK_PERIOD_MS, &event))
         return;
-    }
 
-    gpio_set_level(RELAY_PIN, power_on ? 1 : 0);
-    turned_on = power_on;
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR(buttons_q, &event, &woken);
+    // switch to the button task now, not on the next tick
+    portYIELD_FROM_ISR(woken);
+}
+
+static void set_relay_pin(channel_t * channel, bool power_on)
+{
+    gpio_set_level(channel->relay_pin, power_on ? 1 : 0);
+}
+
+static void switch_relay(channel_t * channel, bool power_on)
+{
+    set_relay_pin(channel, power_on);
 
     if (power_on)
     {
-        ESP_LOGI("relay", "turning on");
+        journal_log(JOURNAL_RELAY_ON, "%s", channel->name);
+        ESP_LOGI("relay", "%s: turning on", channel->name);
     }
     else
     {
-        sendMessageToAdmin("The starter turned off");
-        ESP_LOGI("relay", "turning off");
+        journal_log(JOURNAL_RELAY_OFF, "%s", channel->name);
+        ESP_LOGI("relay", "%s: turning off", channel->name);
     }
 }
 
-static void timer_callback(TimerHandle_t arg)
+static void notify_admin(const char * text)
+{
+    sendMessageToAdmin((char *)text);
+}
+
+static const channel_io_t channel_io = {
+    .relay = switch_relay,
+    .timer_start = control_timer_start,
+    .notify = notify_admin,
+    .now_us = esp_timer_get_time,
+};
+
+#ifdef CONFIG_BENCH_ON_DEVICE
+/* The relay without the journal and the console, they come after the pin
+ * in a real press and would dominate the cycle count. There is no bot and
+ * no wheel in the benchmark firmware. */
+static void bench_notify(const char * text)
+{
+}
+
+static void bench_timer_start(wheel_timer_t * timer, uint64_t ms)
+{
+}
+
+static const channel_io_t bench_io = {
+    .relay = set_relay_pin,
+    .timer_start = bench_timer_start,
+    .notify = bench_notify,
+    .now_us = esp_timer_get_time,
+};
+
+void control_bench_init(void)
+{
+    channel_t * channel = &channels[CHANNELS_COUNT - 1];
+
+    buttons_q = xQueueCreate(10, sizeof(button_event_t));
+    channel_init(channel, &bench_io);
+    gpio_reset_pin(channel->relay_pin);
+    gpio_set_direction(channel->relay_pin, GPIO_MODE_OUTPUT);
+}
+
+/* What a press does up to the relay, minus the interrupt entry and the
+ * switch to the buttons task: the isr body with the task variant of the
+ * queue call, then the crank. */
+void control_bench_button(void)
+{
+    channel_t * channel = &channels[CHANNELS_COUNT - 1];
+    button_event_t event;
+
+    // no debounce, every round is a fresh press
+    channel->ts = 0;
+    channel->turned_on = false;
+    if (button_edge(channel, xTaskGetTickCount() * portTICK_PERIOD_MS, &event))
+        xQueueSend(buttons_q, &event, 0);
+    if (xQueueReceive(buttons_q, &event, 0))
+        channel_crank(event.channel);
+}
+#endif
+
+static uint64_t wheel_now(void)
+{
+    return esp_timer_get_time() / (WHEEL_TICK_MS * 1000);
+}
+
+// called with the lock held
+static void wheel_rearm(void)
+{
+    esp_timer_stop(wheel_timer);
+
+    uint64_t next = wheel_next_expiry(&wheel);
+    if (next == WHEEL_NEVER)
+        return;
+
+    int64_t delay_us = (int64_t)next * WHEEL_TICK_MS * 1000 - esp_timer_get_time();
+    esp_timer_start_once(wheel_timer, delay_us > 0 ? delay_us : 1);
+}
+
+static void wheel_wakeup(void * arg)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    wheel_advance_to(&wheel, wheel_now());
+    wheel_rearm();
+    xSemaphoreGiveRecursive(lock);
+}
+
+void control_timer_start(wheel_timer_t * timer, uint64_t ms)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    // catch up first, delays count from the current time
+    wheel_advance_to(&wheel, wheel_now());
+    wheel_add(&wheel, timer, (ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS);
+    wheel_rearm();
+    xSemaphoreGiveRecursive(lock);
+}
+
+void control_timer_stop(wheel_timer_t * timer)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    wheel_cancel(&wheel, timer);
+    wheel_rearm();
+    xSemaphoreGiveRecursive(lock);
+}
+
+/* Returns true if the relay was switched on, false if it was on already. */
+static bool open_channel_relay(channel_t * channel)
 {
-    (void)arg;
-    control_relay(false);
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    bool cranked = channel_crank(channel);
+    xSemaphoreGiveRecursive(lock);
+
+    if (!cranked)
+        ESP_LOGI("power", "%s already on, skipping commmand", channel->name);
+    return cranked;
 }
 
 void open_relay(void)
 {
-    static TimerHandle_t timer_handle = NULL;
+    open_channel_relay(&channels[0]);
+}
 
-    if (timer_handle && xTimerIsTimerActive(timer_handle))
-    {
-        ESP_LOGI("power", "already on, skipping commmand");
-        //xTimerReset(timer_handle, 0);
-    }
-    else
-    {
-        sendMessageToAdmin("Turning on the starter in few seconds");
-        timer_handle = xTimerCreate("relay pin control off", pdMS_TO_TICKS(STARTER_ON_TIME * 1000), pdFALSE, NULL, timer_callback);
-        if (timer_handle)
-        {
-            BaseType_t res = xTimerStart(timer_handle, 0);
-            if (res == pdPASS)
-                // enable relay if only everthing ok with timers
-                control_relay(true);
-        }
-    }
+static channel_t * find_channel(const char * name)
+{
+    return channel_find(channels, CHANNELS_COUNT, name);
+}
+
+bool open_channel(const char * name)
+{
+    channel_t * channel = find_channel(name);
+    if (channel)
+        open_channel_relay(channel);
+    return channel != NULL;
+}
+
+bool control_channel_exists(const char * name)
+{
+    return find_channel(name) != NULL;
+}
+
+int64_t control_turned_on_at(const char * name)
+{
+    channel_t * channel = name[0] ? find_channel(name) : &channels[0];
+    int64_t at = 0;
+
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    if (channel)
+        at = channel->on_at_us;
+    xSemaphoreGiveRecursive(lock);
+    return at;
+}
+
+bool control_any_on(void)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    bool on = channel_any_on(channels, CHANNELS_COUNT);
+    xSemaphoreGiveRecursive(lock);
+    return on;
+}
+
+int control_format_state(char * buf, size_t size)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    int pos = channel_format_state(channels, CHANNELS_COUNT, buf, size);
+    xSemaphoreGiveRecursive(lock);
+    return pos;
+}
+
+static void record_press(latency_hist_t * hist, const button_event_t * event, int64_t received_us, int64_t relay_us)
+{
+    latency_hist_record(&hist[STAGE_WAKEUP], received_us - event->edge_us);
+    latency_hist_record(&hist[STAGE_RELAY], relay_us - received_us);
+    latency_hist_record(&hist[STAGE_TOTAL], relay_us - event->edge_us);
 }
 
+#ifdef CONFIG_CONTROL_LATENCY_PROBE
+static void probe_press(void * arg)
+{
+    // the previous press is long recorded
+    gpio_set_level(probe.relay_pin, 0);
+    probe_loaded = bot_request_in_flight();
+    gpio_set_level(probe.button_pin, 1);
+    gpio_set_level(probe.button_pin, 0);
+}
+
+/* The part of open_channel_relay a press waits for: the lock, which the
+ * wheel callbacks hold at times, and the pin. */
+static void probe_relay(const button_event_t * event, int64_t received_us)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    gpio_set_level(probe.relay_pin, 1);
+    probe.on_at_us = esp_timer_get_time();
+    xSemaphoreGiveRecursive(lock);
+    record_press(probe_latency[probe_loaded ? 1 : 0], event, received_us, probe.on_at_us);
+}
+
+static void probe_init(void)
+{
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << probe.button_pin,
+        // the input path stays on, the isr sees the edges the output makes
+        .mode = GPIO_MODE_INPUT_OUTPUT,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+    gpio_set_level(probe.button_pin, 1);
+    gpio_reset_pin(probe.relay_pin);
+    gpio_set_direction(probe.relay_pin, GPIO_MODE_OUTPUT);
+    gpio_isr_handler_add(probe.button_pin, gpio_isr_handler, &probe);
+
+    esp_timer_create_args_t args = {
+        .callback = probe_press,
+        .name = "latency probe",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &probe_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(probe_timer, CONFIG_CONTROL_PROBE_PERIOD_MS * 1000ULL));
+}
+#endif
+
 static void gpio_handle_buttons(void * queue)
 {
     while (true)
     {
-        int btn;
-        if (xQueueReceive(queue, &btn, portMAX_DELAY))
+        button_event_t event;
+        if (xQueueReceive(queue, &event, portMAX_DELAY))
         {
-            ESP_LOGI("gpio", "clicked button");
-            open_relay();
+            int64_t received_us = esp_timer_get_time();
+#ifdef CONFIG_CONTROL_LATENCY_PROBE
+            if (event.channel == &probe)
+            {
+                probe_relay(&event, received_us);
+                continue;
+            }
+#endif
+            // logged after the relay, the console is slow
+            if (open_channel_relay(event.channel))
+                record_press(button_latency, &event, received_us, event.channel->on_at_us);
+            ESP_LOGI("gpio", "clicked button of %s", event.channel->name);
         }
     }
 }
 
+static int format_stages(const latency_hist_t * hist, const char * title, char * buf, size_t size)
+{
+    int pos = 0;
+
+    if (hist[STAGE_TOTAL].total == 0)
+        return 0;
+
+    pos += snprintf(buf + pos, size - pos, "%s\n", title);
+    for (int stage = 0; stage < STAGES_COUNT && pos < (int)size; stage++)
+    {
+        char line[64];
+        latency_hist_format(&hist[stage], line, sizeof(line));
+        pos += snprintf(buf + pos, size - pos, "  %s: %s\n", stage_names[stage], line);
+
+        // the full buckets go to the serial console
+        char name[48];
+        snprintf(name, sizeof(name), "%s %s", title, stage_names[stage]);
+        latency_hist_dump(&hist[stage], name);
+    }
+    return pos;
+}
+
+int control_format_latency(char * buf, size_t size)
+{
+    int pos = format_stages(button_latency, "buttons", buf, size);
+#ifdef CONFIG_CONTROL_LATENCY_PROBE
+    if (pos < (int)size)
+        pos += format_stages(probe_latency[0], "probe, idle", buf + pos, size - pos);
+    if (pos < (int)size)
+        pos += format_stages(probe_latency[1], "probe, bot request open", buf + pos, size - pos);
+#endif
+    return pos;
+}
+
+/* The gpio isr service allocates its interrupt on the calling core. */
+static void install_isr_service(void * arg)
+{
+    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+}
+
 
 void init_gpio()
 {
     gpio_config_t io_conf = {};
 
+    lock = xSemaphoreCreateRecursiveMutex();
+    configASSERT(lock);
+    wheel_init(&wheel);
+    wheel.now = wheel_now();
+    esp_timer_create_args_t args = {
+        .callback = wheel_wakeup,
+        .name = "timer wheel",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &wheel_timer));
+
     /* init task */
-    QueueHandle_t qu = xQueueCreate(10, sizeof(int));
-    xTaskCreate(gpio_handle_buttons, "handle_buttons", 2048, (void *)qu, 0, NULL);
+    buttons_q = xQueueCreate(10, sizeof(button_event_t));
+    TaskHandle_t task = NULL;
+    xTaskCreatePinnedToCore(gpio_handle_buttons, "handle_buttons", 2048, (void *)buttons_q, TASK_PRIO_BUTTONS, &task,
+                            TASK_CORE_CONTROL);
+    metrics_register_task(task);
 
     // set up pin mask
     memset(&io_conf, 0, sizeof(io_conf));
-    for (size_t i = 0; i < buttons_count; i++)
+    for (size_t i = 0; i < CHANNELS_COUNT; i++)
     {
-        isr_context * ctx = &contexts[i];
-        io_conf.pin_bit_mask |= 1ULL << ctx->pin;
+        if (channels[i].button_pin != GPIO_NUM_NC)
+            io_conf.pin_bit_mask |= 1ULL << channels[i].button_pin;
     }
 
     //interrupt of low level
@@ -136,21 +451,29 @@ void init_gpio()
     //io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
 
     ESP_ERROR_CHECK(gpio_config(&io_conf));
-    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    // the button interrupts land on the control core, next to their task
+    ESP_ERROR_CHECK(esp_ipc_call_blocking(TASK_CORE_CONTROL, install_isr_service, NULL));
 
     /* connect pins with corresponding action */
-    for (size_t i = 0; i < buttons_count; i++)
+    for (size_t i = 0; i < CHANNELS_COUNT; i++)
     {
-        isr_context * ctx = &contexts[i];
-        ctx->qu = qu;
-        gpio_isr_handler_add(ctx->pin, gpio_isr_handler, (void *)ctx);
+        channel_t * channel = &channels[i];
+        channel_init(channel, &channel_io);
+        if (channel->button_pin != GPIO_NUM_NC)
+            gpio_isr_handler_add(channel->button_pin, gpio_isr_handler, (void *)channel);
     }
 
-    /* setup pin for relay control */
+    /* setup pins for relay control */
     io_conf.intr_type = GPIO_INTR_DISABLE;
     io_conf.mode = GPIO_MODE_OUTPUT;
-    io_conf.pin_bit_mask = 1ULL << RELAY_PIN;
+    io_conf.pin_bit_mask = 0;
+    for (size_t i = 0; i < CHANNELS_COUNT; i++)
+        io_conf.pin_bit_mask |= 1ULL << channels[i].relay_pin;
     io_conf.pull_down_en = 0;
     io_conf.pull_up_en = 0;
     ESP_ERROR_CHECK(gpio_config(&io_conf));
+
+#ifdef CONFIG_CONTROL_LATENCY_PROBE
+    probe_init();
+#endif
 }
@@ -1,3 +1,41 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "timer_wheel.h"
+
+/* Crank the default channel, the first one in the table. */
 void open_relay(void);
+
+/* Crank the channel with this name. Returns false if there is no such channel. */
+bool open_channel(const char * name);
+
+bool control_channel_exists(const char * name);
+
+/* esp_timer time the relay of the channel was last switched on, 0 if never.
+ * An empty name is the default channel. */
+int64_t control_turned_on_at(const char * name);
+
+/* True while the relay of any channel is on. */
+bool control_any_on(void);
+
+/* One line per channel with its relay state. Returns the length. */
+int control_format_state(char * buf, size_t size);
+
+/* Button edge to relay latencies, empty if no button was pressed yet.
+ * Returns the length. */
+int control_format_latency(char * buf, size_t size);
+
+/* Run the timer callback after ms on the shared wheel, in the esp_timer task.
+ * The callback may use the functions above. */
+void control_timer_start(wheel_timer_t * timer, uint64_t ms);
+
+void control_timer_stop(wheel_timer_t * timer);
+
+#include "sdkconfig.h"
+#ifdef CONFIG_BENCH_ON_DEVICE
+/* The button benchmark of components/bench, instead of init_gpio(). */
+void control_bench_init(void);
+void control_bench_button(void);
+#endif
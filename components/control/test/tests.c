@@ -0,0 +1,456 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "channel.h"
+#include "timer_wheel.h"
+
+// ----------------------------------------------------- Test "framework": ---
+
+#define done() return 0
+#define fail() return __LINE__
+static int checkqty = 0;
+#define check(x) \
+    do \
+    { \
+        ++checkqty; \
+        if (!(x)) \
+            fail(); \
+    } while (0)
+
+struct test
+{
+    int (*func)(void);
+    char const * name;
+};
+
+static int test_suit(struct test const * tests, int numtests)
+{
+    printf("%s", "\n\nTests:\n");
+    int failed = 0;
+    for (int i = 0; i < numtests; ++i)
+    {
+        printf(" %02d%s%-25s ", i, ": ", tests[i].name);
+        int linerr = tests[i].func();
+        if (0 == linerr)
+            printf("%s", "OK\n");
+        else
+        {
+            printf("%s%d\n", "Failed, line: ", linerr);
+            ++failed;
+        }
+    }
+    printf("\n%s%d\n", "Total checks: ", checkqty);
+    printf("%s[ %d / %d ]\r\n\n\n", "Tests PASS: ", numtests - failed, numtests);
+    return failed;
+}
+
+// ------------------------------------------------- control.c channels: ---
+
+/* channel.c on a wheel that ticks once a second here, the io records what
+ * control.c would do with the pins and the bot. */
+
+#define MAX_CHANNELS 8
+
+static timer_wheel_t wheel;
+static channel_t * tested;
+static int cranks[MAX_CHANNELS];
+static uint32_t off_at[MAX_CHANNELS];
+// n for a message, 1 and 0 for the relay, in the order they happened
+static char events[64];
+static char last_text[64];
+
+static void append_event(char event)
+{
+    size_t len = strlen(events);
+    if (len + 1 < sizeof(events))
+    {
+        events[len] = event;
+        events[len + 1] = '\0';
+    }
+}
+
+static void test_relay(channel_t * channel, bool on)
+{
+    int i = channel - tested;
+    if (on)
+        cranks[i]++;
+    else
+        off_at[i] = wheel.now;
+    append_event(on ? '1' : '0');
+}
+
+static void test_timer_start(wheel_timer_t * timer, uint64_t ms)
+{
+    wheel_add(&wheel, timer, ms / 1000);
+}
+
+static void test_notify(const char * text)
+{
+    snprintf(last_text, sizeof(last_text), "%s", text);
+    append_event('n');
+}
+
+static int64_t test_now_us(void)
+{
+    return wheel.now * 1000000;
+}
+
+static const channel_io_t test_io = {
+    .relay = test_relay,
+    .timer_start = test_timer_start,
+    .notify = test_notify,
+    .now_us = test_now_us,
+};
+
+static const char * names[MAX_CHANNELS] = {"c0", "c1", "c2", "c3", "c4", "c5", "c6", "c7"};
+
+// on_time_s are wheel ticks here
+static void channels_init(channel_t * channels, int count, int on_ticks)
+{
+    wheel_init(&wheel);
+    memset(channels, 0, sizeof(channel_t) * count);
+    memset(cranks, 0, sizeof(cranks));
+    memset(off_at, 0, sizeof(off_at));
+    events[0] = '\0';
+    tested = channels;
+    for (int i = 0; i < count; i++)
+    {
+        channels[i].name = names[i];
+        channels[i].on_time_s = on_ticks + i;
+        channel_init(&channels[i], &test_io);
+    }
+}
+
+static void run(int ticks)
+{
+    for (int i = 0; i < ticks; i++)
+        wheel_advance(&wheel);
+}
+
+// ----------------------------------------------------------- Unit tests: ---
+
+static int single(void)
+{
+    channel_t channels[1];
+    channels_init(channels, 1, 50);
+
+    check(channel_crank(&channels[0]));
+    check(wheel.count == 1);
+    check(channels[0].on_at_us == 0);
+    run(49);
+    check(channels[0].turned_on);
+    check(wheel_advance(&wheel) == 1);
+    check(!channels[0].turned_on);
+    check(off_at[0] == 50);
+    check(wheel.count == 0);
+    done();
+}
+
+static int messages(void)
+{
+    channel_t channels[2];
+    channels_init(channels, 2, 3);
+
+    // the admin hears about it before the relay clicks, like it always was
+    check(channel_crank(&channels[1]));
+    check(strcmp(events, "n1") == 0);
+    check(strcmp(last_text, "Turning on the c1 in few seconds") == 0);
+
+    // nothing at all for a press while it is on
+    check(!channel_crank(&channels[1]));
+    check(strcmp(events, "n1") == 0);
+
+    run(4);
+    check(strcmp(events, "n10n") == 0);
+    check(strcmp(last_text, "The c1 turned off") == 0);
+    check(!channels[0].turned_on && cranks[0] == 0);
+    done();
+}
+
+static int concurrent(void)
+{
+    channel_t channels[8];
+    channels_init(channels, 8, 10);
+
+    // everything cranked on the same tick, each channel has its own on time
+    for (int i = 0; i < 8; i++)
+        check(channel_crank(&channels[i]));
+    // a second press does not extend or restart a running crank
+    check(!channel_crank(&channels[3]));
+    check(wheel.count == 8);
+    check(channel_any_on(channels, 8));
+
+    run(5);
+    // more presses while the others are still on
+    check(!channel_crank(&channels[0]));
+    run(100);
+    for (int i = 0; i < 8; i++)
+    {
+        check(!channels[i].turned_on);
+        check(cranks[i] == 1);
+        check(off_at[i] == (uint32_t)(10 + i));
+    }
+    check(wheel.count == 0);
+    check(!channel_any_on(channels, 8));
+    done();
+}
+
+static int staggered(void)
+{
+    channel_t channels[4];
+    channels_init(channels, 4, 5);
+
+    // cranked on different ticks, off times land in the same slots
+    for (int i = 0; i < 4; i++)
+    {
+        check(channel_crank(&channels[i]));
+        check(channels[i].on_at_us == (int64_t)i * 1000000);
+        run(1);
+    }
+    run(20);
+    for (int i = 0; i < 4; i++)
+        check(off_at[i] == (uint32_t)(i + 5 + i));
+
+    // crank again once off
+    check(channel_crank(&channels[2]));
+    run(7);
+    check(!channels[2].turned_on);
+    check(cranks[2] == 2);
+    done();
+}
+
+static int long_timers(void)
+{
+    channel_t channels[3];
+    channels_init(channels, 3, 1);
+    channels[0].on_time_s = WHEEL_SLOTS;
+    channels[1].on_time_s = WHEEL_SLOTS + 1;
+    channels[2].on_time_s = WHEEL_SLOTS * 5 + 3;
+
+    for (int i = 0; i < 3; i++)
+        check(channel_crank(&channels[i]));
+    run(WHEEL_SLOTS * 6);
+    check(off_at[0] == WHEEL_SLOTS);
+    check(off_at[1] == WHEEL_SLOTS + 1);
+    check(off_at[2] == WHEEL_SLOTS * 5 + 3);
+    done();
+}
+
+static int cancel(void)
+{
+    channel_t channels[3];
+    channels_init(channels, 3, 10);
+    channels[1].on_time_s = 10;
+    channels[2].on_time_s = 10;
+
+    for (int i = 0; i < 3; i++)
+        check(channel_crank(&channels[i]));
+    // the middle one of a slot list
+    wheel_cancel(&wheel, &channels[1].off_timer);
+    wheel_cancel(&wheel, &channels[1].off_timer);
+    check(wheel.count == 2);
+    run(10);
+    check(!channels[0].turned_on);
+    check(channels[1].turned_on);
+    check(off_at[1] == 0);
+    check(!channels[2].turned_on);
+    check(wheel.count == 0);
+    done();
+}
+
+static int lookup(void)
+{
+    channel_t channels[3];
+    char buf[64];
+    channels_init(channels, 3, 10);
+
+    check(channel_find(channels, 3, "c2") == &channels[2]);
+    check(channel_find(channels, 3, "c3") == NULL);
+    check(channel_find(channels, 3, "") == NULL);
+
+    check(channel_crank(&channels[1]));
+    check(channel_format_state(channels, 3, buf, sizeof(buf)) == 23);
+    check(strcmp(buf, "c0: off\nc1: on\nc2: off\n") == 0);
+    // cut short, the length says how much was left out
+    check(channel_format_state(channels, 3, buf, 10) > 10);
+    check(strcmp(buf, "c0: off\nc") == 0);
+    done();
+}
+
+static int debounce(void)
+{
+    channel_t channels[1];
+    channels_init(channels, 1, 10);
+
+    check(channel_debounce(&channels[0], 1000));
+    check(!channel_debounce(&channels[0], 1100));
+    // every bounce restarts the window
+    check(!channel_debounce(&channels[0], 1100 + CHANNEL_DEBOUNCE_MS));
+    check(channel_debounce(&channels[0], 1101 + 2 * CHANNEL_DEBOUNCE_MS));
+    // the tick count wraps around
+    channels[0].ts = UINT32_MAX - 50;
+    check(!channel_debounce(&channels[0], 100));
+    check(channel_debounce(&channels[0], 400));
+    done();
+}
+
+// callbacks that touch other timers of the slot being run
+static wheel_timer_t chained[3];
+static int chained_fired[3];
+
+static void chained_callback(void * arg)
+{
+    int i = (int)(intptr_t)arg;
+    chained_fired[i]++;
+    if (i == 0)
+    {
+        // cancel a neighbour that is due on this very tick
+        wheel_cancel(&wheel, &chained[1]);
+        // and rearm itself, like a crank retry
+        if (chained_fired[0] < 3)
+            wheel_add(&wheel, &chained[0], WHEEL_SLOTS);
+    }
+}
+
+static int reentrant(void)
+{
+    wheel_init(&wheel);
+    memset(chained_fired, 0, sizeof(chained_fired));
+    for (int i = 0; i < 3; i++)
+        wheel_timer_init(&chained[i], chained_callback, (void *)(intptr_t)i);
+
+    // 1 is linked first so it is run after 0
+    wheel_add(&wheel, &chained[2], 7);
+    wheel_add(&wheel, &chained[1], 7);
+    wheel_add(&wheel, &chained[0], 7);
+    check(wheel_advance(&wheel) == 0);
+    run(6);
+    check(chained_fired[0] == 1);
+    check(chained_fired[1] == 0);
+    check(chained_fired[2] == 1);
+    check(wheel.count == 1);
+
+    run(WHEEL_SLOTS * 3);
+    check(chained_fired[0] == 3);
+    check(chained_fired[1] == 0);
+    check(wheel.count == 0);
+    done();
+}
+
+// the owner sleeps until the next expiry, like control.c does
+static int wakeups;
+
+static void tickless_run(uint64_t until)
+{
+    while (true)
+    {
+        uint64_t next = wheel_next_expiry(&wheel);
+        if (next == WHEEL_NEVER || next > until)
+            break;
+        wakeups++;
+        wheel_advance_to(&wheel, next);
+    }
+    wheel_advance_to(&wheel, until);
+}
+
+static int tickless(void)
+{
+    channel_t channels[3];
+    channels_init(channels, 3, 1);
+    // a crank, a weekly run at 100 ms ticks and one beyond the top level
+    channels[0].on_time_s = 50;
+    channels[1].on_time_s = 7 * 24 * 36000;
+    channels[2].on_time_s = 1;
+    for (int i = 0; i < WHEEL_LEVELS; i++)
+        channels[2].on_time_s *= WHEEL_SLOTS;
+    channels[2].on_time_s += 12345;
+
+    wakeups = 0;
+    for (int i = 0; i < 3; i++)
+        check(channel_crank(&channels[i]));
+    check(wheel_next_expiry(&wheel) == 50);
+
+    tickless_run(channels[2].on_time_s + 10);
+    for (int i = 0; i < 3; i++)
+        check(off_at[i] == (uint32_t)channels[i].on_time_s);
+    // one wakeup per timer, none for the empty stretches in between
+    check(wakeups == 3);
+    check(wheel_next_expiry(&wheel) == WHEEL_NEVER);
+    done();
+}
+
+// timers added at random times fire in order at their own tick
+#define STRESS_TIMERS 200
+
+static wheel_timer_t stress_timers[STRESS_TIMERS];
+static uint64_t stress_due[STRESS_TIMERS];
+static int stress_late;
+static uint64_t stress_last;
+
+static void stress_callback(void * arg)
+{
+    int i = (int)(intptr_t)arg;
+    if (wheel.now != stress_due[i] || wheel.now < stress_last)
+        stress_late++;
+    stress_last = wheel.now;
+    // keep the wheel busy: rearm some of them from the callback
+    if (i % 3 == 0)
+    {
+        uint64_t ticks = 1 + rand() % 100000;
+        stress_due[i] = wheel.now + ticks;
+        wheel_add(&wheel, &stress_timers[i], ticks);
+    }
+}
+
+static int stress(void)
+{
+    wheel_init(&wheel);
+    srand(7);
+    stress_late = 0;
+    stress_last = 0;
+    wheel.now = 1000000 - 3;
+
+    for (int i = 0; i < STRESS_TIMERS; i++)
+    {
+        uint64_t ticks = 1 + (rand() % 4 == 0 ? rand() % 50 : (uint64_t)rand() * rand() % 20000000);
+        wheel_timer_init(&stress_timers[i], stress_callback, (void *)(intptr_t)i);
+        stress_due[i] = wheel.now + ticks;
+        wheel_add(&wheel, &stress_timers[i], ticks);
+    }
+    // cancel a few
+    for (int i = 1; i < STRESS_TIMERS; i += 7)
+        wheel_cancel(&wheel, &stress_timers[i]);
+
+    // wake at odd times as well as at the expiries
+    uint64_t end = wheel.now + 25000000;
+    while (wheel.now < end)
+    {
+        uint64_t next = wheel_next_expiry(&wheel);
+        uint64_t step = wheel.now + 1 + rand() % 300000;
+        wheel_advance_to(&wheel, next < step ? next : step);
+    }
+    check(stress_late == 0);
+    for (int i = 0; i < STRESS_TIMERS; i++)
+        check(!stress_timers[i].active || stress_due[i] > end);
+    done();
+}
+
+int main(void)
+{
+    static struct test const tests[] = {
+        {single, "Single channel"},
+        {messages, "Messages"},
+        {concurrent, "Concurrent cranking"},
+        {staggered, "Staggered cranking"},
+        {long_timers, "Longer than a turn"},
+        {cancel, "Cancel"},
+        {lookup, "Find and format"},
+        {debounce, "Button debounce"},
+        {reentrant, "Callbacks touch the slot"},
+        {tickless, "Tickless"},
+        {stress, "Random timers"},
+    };
+    return test_suit(tests, sizeof tests / sizeof *tests);
+}
@@ -0,0 +1,203 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define LEVEL_SHIFT(level) (WHEEL_BITS * (level))
+// the longest delay the top level can hold, longer timers are cascaded again
+#define WHEEL_RANGE (1ULL << LEVEL_SHIFT(WHEEL_LEVELS))
+
+static void link_timer(wheel_timer_t ** head, wheel_timer_t * timer)
+{
+    timer->next = *head;
+    if (timer->next)
+        timer->next->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void unlink_timer(wheel_timer_t * timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/* A timer goes to the lowest level that covers its delay. Its slot there is
+ * picked by the expiry bits, so a level L slot comes up 1 to WHEEL_SLOTS
+ * slot widths later. */
+static void place(timer_wheel_t * wheel, wheel_timer_t * timer)
+{
+    uint64_t at = timer->expires;
+    uint64_t delta = at - wheel->now;
+    int level = 0;
+
+    if (delta >= WHEEL_RANGE)
+        at = wheel->now + WHEEL_RANGE - 1;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << LEVEL_SHIFT(level + 1)))
+        level++;
+
+    link_timer(&wheel->slots[level][(at >> LEVEL_SHIFT(level)) & WHEEL_MASK], timer);
+}
+
+/* Detach a slot list so its timers can be moved or fired one by one while
+ * callbacks add and cancel timers anywhere, this slot included. */
+static wheel_timer_t * take_slot(wheel_timer_t ** slot, wheel_timer_t ** pending)
+{
+    *pending = *slot;
+    *slot = NULL;
+    if (*pending)
+        (*pending)->pprev = pending;
+    return *pending;
+}
+
+static int run_tick(timer_wheel_t * wheel, uint64_t tick)
+{
+    wheel_timer_t * pending;
+    int fired = 0;
+
+    wheel->now = tick;
+
+    // top down, so a cascaded timer can land in a slot cascaded right after
+    for (int level = WHEEL_LEVELS - 1; level > 0; level--)
+    {
+        if (tick & ((1ULL << LEVEL_SHIFT(level)) - 1))
+            continue;
+
+        take_slot(&wheel->slots[level][(tick >> LEVEL_SHIFT(level)) & WHEEL_MASK], &pending);
+        while (pending)
+        {
+            wheel_timer_t * timer = pending;
+            unlink_timer(timer);
+            place(wheel, timer);
+        }
+    }
+
+    take_slot(&wheel->slots[0][tick & WHEEL_MASK], &pending);
+    while (pending)
+    {
+        wheel_timer_t * timer = pending;
+        unlink_timer(timer);
+        timer->active = false;
+        wheel->count--;
+        fired++;
+        timer->callback(timer->arg);
+    }
+    return fired;
+}
+
+/* The next tick with something to do: a level 0 slot to fire or a slot of
+ * an upper level to cascade. */
+static uint64_t next_event(const timer_wheel_t * wheel)
+{
+    uint64_t next = WHEEL_NEVER;
+
+    for (uint64_t tick = wheel->now + 1; tick < wheel->now + WHEEL_SLOTS; tick++)
+    {
+        if (wheel->slots[0][tick & WHEEL_MASK])
+        {
+            next = tick;
+            break;
+        }
+    }
+
+    for (int level = 1; level < WHEEL_LEVELS; level++)
+    {
+        uint64_t bucket = wheel->now >> LEVEL_SHIFT(level);
+        for (int i = 1; i <= WHEEL_SLOTS; i++)
+        {
+            if (wheel->slots[level][(bucket + i) & WHEEL_MASK])
+            {
+                uint64_t tick = (bucket + i) << LEVEL_SHIFT(level);
+                if (tick < next)
+                    next = tick;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+void wheel_init(timer_wheel_t * wheel)
+{
+    memset(wheel, 0, sizeof(timer_wheel_t));
+}
+
+void wheel_timer_init(wheel_timer_t * timer, void (*callback)(void *), void * arg)
+{
+    memset(timer, 0, sizeof(wheel_timer_t));
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+void wheel_add(timer_wheel_t * wheel, wheel_timer_t * timer, uint64_t ticks)
+{
+    wheel_cancel(wheel, timer);
+
+    timer->expires = wheel->now + (ticks ? ticks : 1);
+    timer->active = true;
+    place(wheel, timer);
+    wheel->count++;
+}
+
+void wheel_cancel(timer_wheel_t * wheel, wheel_timer_t * timer)
+{
+    if (!timer->active)
+        return;
+
+    unlink_timer(timer);
+    timer->active = false;
+    wheel->count--;
+}
+
+uint64_t wheel_next_expiry(const timer_wheel_t * wheel)
+{
+    uint64_t next = WHEEL_NEVER;
+
+    if (wheel->count == 0)
+        return next;
+
+    // per level the first busy slot holds the earliest timers of that level
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+    {
+        uint64_t bucket = wheel->now >> LEVEL_SHIFT(level);
+        for (int i = 1; i <= WHEEL_SLOTS; i++)
+        {
+            const wheel_timer_t * timer = wheel->slots[level][(bucket + i) & WHEEL_MASK];
+            if (timer == NULL)
+                continue;
+            for (; timer; timer = timer->next)
+            {
+                if (timer->expires < next)
+                    next = timer->expires;
+            }
+            break;
+        }
+    }
+    return next;
+}
+
+int wheel_advance_to(timer_wheel_t * wheel, uint64_t tick)
+{
+    int fired = 0;
+
+    while (wheel->now < tick)
+    {
+        uint64_t next = next_event(wheel);
+        if (next > tick)
+        {
+            // nothing in between, the empty slots do not need a visit
+            wheel->now = tick;
+            break;
+        }
+        fired += run_tick(wheel, next);
+    }
+    return fired;
+}
+
+int wheel_advance(timer_wheel_t * wheel)
+{
+    return wheel_advance_to(wheel, wheel->now + 1);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Hierarchical timer wheel. Level 0 has one slot per tick, every next level
+ * has slots WHEEL_SLOTS times wider and its timers are cascaded down when
+ * their slot comes up. The owner does not tick it: it asks for the next
+ * expiry, sleeps until then and calls wheel_advance_to, empty stretches are
+ * skipped. Not thread safe, callbacks run from wheel_advance_to. */
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 5
+#define WHEEL_NEVER UINT64_MAX
+
+typedef struct wheel_timer_s
+{
+    struct wheel_timer_s * next;
+    struct wheel_timer_s ** pprev;
+    uint64_t expires;
+    bool active;
+    void (*callback)(void * arg);
+    void * arg;
+} wheel_timer_t;
+
+typedef struct
+{
+    wheel_timer_t * slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t now;
+    int count;
+} timer_wheel_t;
+
+void wheel_init(timer_wheel_t * wheel);
+
+void wheel_timer_init(wheel_timer_t * timer, void (*callback)(void *), void * arg);
+
+/* Fire the timer ticks from now, at least one tick. Rearms an active timer. */
+void wheel_add(timer_wheel_t * wheel, wheel_timer_t * timer, uint64_t ticks);
+
+void wheel_cancel(timer_wheel_t * wheel, wheel_timer_t * timer);
+
+/* Tick of the earliest timer or WHEEL_NEVER. */
+uint64_t wheel_next_expiry(const timer_wheel_t * wheel);
+
+/* Move forward to tick and run what expired on the way, in order.
+ * Returns how many fired. */
+int wheel_advance_to(timer_wheel_t * wheel, uint64_t tick);
+
+/* Move one tick forward. */
+int wheel_advance(timer_wheel_t * wheel);
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "bot.h"
+#include "control.h"
+#include "health.h"
+#include "journal.h"
+#include "mains.h"
+#include "metrics.h"
+#include "recovery.h"
+#include "task_plan.h"
+
+static const char * TAG = "health";
+
+#define HEALTH_MAGIC 0x48454c54UL
+#define CHECK_PERIOD_MS 5000
+
+/* Survives the reboot the watchdog does itself, so the outage and the
+ * backoff go on where they were. */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t reboots;
+    int64_t carried_ms;
+} saved_t;
+
+static RTC_NOINIT_ATTR saved_t saved;
+
+static recovery_t rec;
+// NULL until rec is set up, the bot reports and asks before health_init
+static SemaphoreHandle_t lock;
+
+static int64_t now_ms(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+void health_report(bool ok)
+{
+    int64_t ttr_ms = 0;
+    recovery_action_t by = RECOVERY_NONE;
+
+    if (lock == NULL)
+        return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (ok)
+    {
+        ttr_ms = recovery_ok(&rec, now_ms());
+        by = rec.last_by;
+    }
+    else
+        recovery_failed(&rec, now_ms());
+    xSemaphoreGive(lock);
+
+    if (ttr_ms == 0)
+        return;
+
+    char text[96];
+    snprintf(text, sizeof(text), "Back online after %lld s, recovered by %s", ttr_ms / 1000, recovery_action_name(by));
+    ESP_LOGI(TAG, "%s", text);
+    journal_log(JOURNAL_NOTE, "api back, %lld s, %s", ttr_ms / 1000, recovery_action_name(by));
+    sendMessageToAdmin(text);
+}
+
+/* Nothing must be left half done by the reboot. */
+static bool can_reboot(void)
+{
+    return !control_any_on() && !mains_busy();
+}
+
+static void reboot(int64_t down_ms)
+{
+    char text[96];
+
+    snprintf(text, sizeof(text), "No api for %lld s, rebooting", down_ms / 1000);
+    ESP_LOGE(TAG, "%s", text);
+    // into the outbox, it goes out once the api is back
+    sendMessageToAdmin(text);
+    // written out by the journal's shutdown handler
+    journal_log(JOURNAL_NOTE, "watchdog reboot, down %lld s", down_ms / 1000);
+
+    saved.magic = HEALTH_MAGIC;
+    saved.reboots = rec.reboots + 1;
+    saved.carried_ms = down_ms;
+    esp_restart();
+}
+
+static void take_action(recovery_action_t action, int64_t down_ms)
+{
+    ESP_LOGW(TAG, "no api for %lld s, %s", down_ms / 1000, recovery_action_name(action));
+
+    switch (action)
+    {
+        case RECOVERY_RESET_SOCKETS:
+            bot_reset_connections();
+            break;
+        case RECOVERY_RECONNECT_WIFI:
+            // the disconnect handler connects again
+            esp_wifi_disconnect();
+            break;
+        case RECOVERY_RESTART_NETIF:
+            // the station netif goes down with it and dhcp starts over
+            esp_wifi_stop();
+            esp_wifi_start();
+            break;
+        case RECOVERY_REBOOT:
+            reboot(down_ms);
+            break;
+        default:
+            break;
+    }
+}
+
+static void health_task(void * pv)
+{
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(CHECK_PERIOD_MS));
+
+        bool allowed = can_reboot();
+        int64_t now = now_ms();
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        recovery_action_t action = recovery_check(&rec, now, allowed);
+        int64_t down_ms = recovery_down_ms(&rec, now);
+        xSemaphoreGive(lock);
+
+        if (action != RECOVERY_NONE)
+            take_action(action, down_ms);
+    }
+}
+
+int health_format(char * buf, size_t size)
+{
+    int pos = 0;
+    int64_t now = now_ms();
+
+    if (lock == NULL)
+        return snprintf(buf, size, "health check is starting\n");
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (rec.down)
+        pos += snprintf(
+            buf + pos,
+            size - pos,
+            "api down for %lld s, last step: %s\n",
+            recovery_down_ms(&rec, now) / 1000,
+            recovery_action_name(rec.taken));
+    else
+        pos += snprintf(buf + pos, size - pos, "api up, last round trip %lld s ago\n", (now - rec.last_ok_ms) / 1000);
+
+    if (pos < (int)size)
+        pos += snprintf(
+            buf + pos,
+            size - pos,
+            "outages: %lu, time to recover: last %lld s, max %lld s, mean %lld s\n",
+            (unsigned long)rec.outages,
+            rec.last_ttr_ms / 1000,
+            rec.max_ttr_ms / 1000,
+            rec.outages ? rec.total_ttr_ms / rec.outages / 1000 : 0);
+
+    for (int i = 0; i < RECOVERY_ACTIONS && pos < (int)size; i++)
+        pos += snprintf(
+            buf + pos,
+            size - pos,
+            "%s: %lu\n",
+            recovery_action_name(i),
+            (unsigned long)rec.recovered_by[i]);
+
+    if (pos < (int)size)
+        pos += snprintf(buf + pos, size - pos, "next reboot after %lu s\n", (unsigned long)recovery_reboot_after_s(&rec));
+    xSemaphoreGive(lock);
+    return pos;
+}
+
+void health_init(void)
+{
+    recovery_config_t config = {
+        .after_s = {
+            [RECOVERY_RESET_SOCKETS] = CONFIG_HEALTH_SOCKET_RESET_S,
+            [RECOVERY_RECONNECT_WIFI] = CONFIG_HEALTH_WIFI_RECONNECT_S,
+            [RECOVERY_RESTART_NETIF] = CONFIG_HEALTH_NETIF_RESTART_S,
+            [RECOVERY_REBOOT] = CONFIG_HEALTH_REBOOT_MIN * 60,
+        },
+        .settle_s = CONFIG_HEALTH_SETTLE_S,
+        .max_reboot_s = CONFIG_HEALTH_REBOOT_MAX_H * 3600,
+    };
+
+    // only a restart of our own carries an outage over
+    if (saved.magic != HEALTH_MAGIC || esp_reset_reason() != ESP_RST_SW)
+    {
+        saved.reboots = 0;
+        saved.carried_ms = 0;
+    }
+    saved.magic = 0;
+    if (saved.carried_ms)
+        ESP_LOGW(TAG, "rebooted after %lld s without api, %lu in a row", saved.carried_ms / 1000, (unsigned long)saved.reboots);
+
+    SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+    configASSERT(mutex);
+    recovery_init(&rec, &config, now_ms(), saved.carried_ms, saved.reboots);
+    lock = mutex;
+
+    TaskHandle_t handle = NULL;
+    xTaskCreatePinnedToCore(&health_task, "health", 3072, NULL, TASK_PRIO_HEALTH, &handle, TASK_CORE_NET);
+    metrics_register_task(handle);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Connectivity watchdog. The bot reports every api request, the supervisor
+ * escalates while none goes through: socket reset, Wi-Fi reconnect, netif
+ * restart and at last a reboot, held back while a relay is on or the mains
+ * monitor is busy. Call after wifi and the bot are up. */
+void health_init(void);
+
+/* A request reached the api, or did not. */
+void health_report(bool ok);
+
+/* State of the link, what the last outages took and which step fixed them.
+ * Returns the length. */
+int health_format(char * buf, size_t size);
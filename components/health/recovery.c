@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "recovery.h"
+
+static const char * action_names[RECOVERY_ACTIONS] = {
+    [RECOVERY_NONE] = "retries",
+    [RECOVERY_RESET_SOCKETS] = "socket reset",
+    [RECOVERY_RECONNECT_WIFI] = "wifi reconnect",
+    [RECOVERY_RESTART_NETIF] = "netif restart",
+    [RECOVERY_REBOOT] = "reboot",
+};
+
+void recovery_init(recovery_t * rec, const recovery_config_t * config, int64_t now_ms, int64_t carried_ms, uint32_t reboots)
+{
+    memset(rec, 0, sizeof(recovery_t));
+    rec->config = *config;
+    // a fresh boot gets the whole ladder again
+    rec->last_ok_ms = now_ms;
+    rec->reboots = reboots;
+    if (carried_ms > 0)
+    {
+        rec->down = true;
+        rec->down_since_ms = now_ms - carried_ms;
+        rec->rebooted = true;
+    }
+}
+
+int64_t recovery_ok(recovery_t * rec, int64_t now_ms)
+{
+    int64_t ttr = 0;
+
+    if (rec->down)
+    {
+        ttr = now_ms - rec->down_since_ms;
+        recovery_action_t by = rec->taken;
+        if (by == RECOVERY_NONE && rec->rebooted)
+            by = RECOVERY_REBOOT;
+
+        rec->outages++;
+        rec->recovered_by[by]++;
+        rec->last_by = by;
+        rec->last_ttr_ms = ttr;
+        rec->total_ttr_ms += ttr;
+        if (ttr > rec->max_ttr_ms)
+            rec->max_ttr_ms = ttr;
+    }
+
+    rec->last_ok_ms = now_ms;
+    rec->down = false;
+    rec->taken = RECOVERY_NONE;
+    rec->rebooted = false;
+    rec->reboots = 0;
+    return ttr;
+}
+
+void recovery_failed(recovery_t * rec, int64_t now_ms)
+{
+    if (rec->down)
+        return;
+    rec->down = true;
+    rec->down_since_ms = now_ms;
+}
+
+uint32_t recovery_reboot_after_s(const recovery_t * rec)
+{
+    uint64_t after = rec->config.after_s[RECOVERY_REBOOT];
+
+    for (uint32_t i = 0; i < rec->reboots && after < rec->config.max_reboot_s; i++)
+        after *= 2;
+    return after < rec->config.max_reboot_s ? after : rec->config.max_reboot_s;
+}
+
+recovery_action_t recovery_check(recovery_t * rec, int64_t now_ms, bool can_reboot)
+{
+    int64_t silent_ms = now_ms - rec->last_ok_ms;
+
+    if (rec->taken == RECOVERY_REBOOT)
+        return RECOVERY_NONE;
+    if (rec->taken != RECOVERY_NONE && now_ms - rec->taken_ms < rec->config.settle_s * 1000LL)
+        return RECOVERY_NONE;
+
+    recovery_action_t next = rec->taken + 1;
+    uint32_t after_s = next == RECOVERY_REBOOT ? recovery_reboot_after_s(rec) : rec->config.after_s[next];
+    if (silent_ms < after_s * 1000LL)
+        return RECOVERY_NONE;
+    if (next == RECOVERY_REBOOT && !can_reboot)
+        return RECOVERY_NONE;
+
+    // silent without a single failure, requests are stuck somewhere
+    if (!rec->down)
+    {
+        rec->down = true;
+        rec->down_since_ms = rec->last_ok_ms;
+    }
+    rec->taken = next;
+    rec->taken_ms = now_ms;
+    return next;
+}
+
+int64_t recovery_down_ms(const recovery_t * rec, int64_t now_ms)
+{
+    return rec->down ? now_ms - rec->down_since_ms : 0;
+}
+
+const char * recovery_action_name(recovery_action_t action)
+{
+    return action < RECOVERY_ACTIONS ? action_names[action] : "?";
+}
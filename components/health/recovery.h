@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Escalation ladder for a lost api link, no IDF in here. The owner reports
+ * every request and asks now and then what to do: each action is taken
+ * once per outage, when the api has been silent for its threshold and the
+ * previous action had some time to work. Times are in milliseconds. */
+
+typedef enum
+{
+    RECOVERY_NONE,
+    RECOVERY_RESET_SOCKETS,
+    RECOVERY_RECONNECT_WIFI,
+    RECOVERY_RESTART_NETIF,
+    RECOVERY_REBOOT,
+    RECOVERY_ACTIONS
+} recovery_action_t;
+
+typedef struct
+{
+    // seconds without a successful round trip before each action
+    uint32_t after_s[RECOVERY_ACTIONS];
+    // at least that long between two actions
+    uint32_t settle_s;
+    // the reboot threshold doubles with every reboot in a row up to this
+    uint32_t max_reboot_s;
+} recovery_config_t;
+
+typedef struct
+{
+    recovery_config_t config;
+    int64_t last_ok_ms;
+    bool down;
+    int64_t down_since_ms;
+    recovery_action_t taken; // the last action of this outage
+    int64_t taken_ms;
+    bool rebooted; // this boot was one of the actions
+    uint32_t reboots; // in a row, without a success in between
+
+    uint32_t outages;
+    uint32_t recovered_by[RECOVERY_ACTIONS];
+    recovery_action_t last_by; // what ended the last outage
+    int64_t last_ttr_ms;
+    int64_t max_ttr_ms;
+    int64_t total_ttr_ms;
+} recovery_t;
+
+/* carried_ms is how long the api was gone before a reboot by the ladder,
+ * reboots how many of them came in a row, both 0 after a normal boot. */
+void recovery_init(recovery_t * rec, const recovery_config_t * config, int64_t now_ms, int64_t carried_ms, uint32_t reboots);
+
+/* A request reached the api. Returns how long the outage it ended took,
+ * 0 if there was none. */
+int64_t recovery_ok(recovery_t * rec, int64_t now_ms);
+
+void recovery_failed(recovery_t * rec, int64_t now_ms);
+
+/* The action due now or RECOVERY_NONE. A reboot is held back while it is
+ * not allowed, the ladder stays where it is until it is. */
+recovery_action_t recovery_check(recovery_t * rec, int64_t now_ms, bool can_reboot);
+
+/* Silence before a reboot, with the backoff for reboots in a row. */
+uint32_t recovery_reboot_after_s(const recovery_t * rec);
+
+/* How long the current outage lasts, 0 if there is none. */
+int64_t recovery_down_ms(const recovery_t * rec, int64_t now_ms);
+
+const char * recovery_action_name(recovery_action_t action);
@@ -0,0 +1,402 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "recovery.h"
+
+// ----------------------------------------------------- Test "framework": ---
+
+#define done() return 0
+#define fail() return __LINE__
+static int checkqty = 0;
+#define check(x) \
+    do \
+    { \
+        ++checkqty; \
+        if (!(x)) \
+            fail(); \
+    } while (0)
+
+struct test
+{
+    int (*func)(void);
+    char const * name;
+};
+
+static int test_suit(struct test const * tests, int numtests)
+{
+    printf("%s", "\n\nTests:\n");
+    int failed = 0;
+    for (int i = 0; i < numtests; ++i)
+    {
+        printf(" %02d%s%-25s ", i, ": ", tests[i].name);
+        int linerr = tests[i].func();
+        if (0 == linerr)
+            printf("%s", "OK\n");
+        else
+        {
+            printf("%s%d\n", "Failed, line: ", linerr);
+            ++failed;
+        }
+    }
+    printf("\n%s%d\n", "Total checks: ", checkqty);
+    printf("%s[ %d / %d ]\r\n\n\n", "Tests PASS: ", numtests - failed, numtests);
+    return failed;
+}
+
+// ------------------------------------------------------ Link simulator: ---
+
+/* The device loop on a simulated clock: the bot long polls while the link
+ * works and backs off while it does not, the supervisor checks every few
+ * seconds. A fault is injected at some point and says which action clears
+ * it, a hung link never answers at all. Reboots start the ladder over with
+ * the outage carried like the device does. */
+
+#define STEP_MS 1000
+#define CHECK_MS 5000
+#define POLL_MS 50000
+#define RETRY_MS 30000
+#define BOOT_MS 15000
+
+typedef enum
+{
+    FAULT_NONE,
+    FAULT_BRIEF, // gone by itself after a while
+    FAULT_STALE_SOCKET,
+    FAULT_WIFI_STUCK,
+    FAULT_NETIF_WEDGED,
+    FAULT_STACK_WEDGED,
+    FAULT_HUNG, // requests never return, not even with an error
+    FAULT_AP_DOWN, // nothing helps until it is back
+} fault_t;
+
+typedef struct
+{
+    recovery_t rec;
+    int64_t now;
+    int64_t next_request;
+    int64_t next_check;
+    bool busy; // a relay is on, no reboots
+
+    fault_t fault;
+    int64_t fault_until; // for the faults that go away by themselves
+
+    int actions[RECOVERY_ACTIONS];
+    recovery_action_t order[16];
+    int order_count;
+    int64_t action_at;
+    int64_t ttr;
+} sim_t;
+
+static const recovery_config_t config = {
+    .after_s = {
+        [RECOVERY_RESET_SOCKETS] = 120,
+        [RECOVERY_RECONNECT_WIFI] = 300,
+        [RECOVERY_RESTART_NETIF] = 600,
+        [RECOVERY_REBOOT] = 1200,
+    },
+    .settle_s = 30,
+    .max_reboot_s = 24 * 3600,
+};
+
+static void sim_init(sim_t * sim)
+{
+    memset(sim, 0, sizeof(sim_t));
+    recovery_init(&sim->rec, &config, 0, 0, 0);
+}
+
+static void inject(sim_t * sim, fault_t fault, int64_t length_ms)
+{
+    sim->fault = fault;
+    sim->fault_until = sim->now + length_ms;
+    sim->order_count = 0;
+    memset(sim->actions, 0, sizeof(sim->actions));
+    sim->ttr = 0;
+}
+
+/* Whether the action clears the fault, a stronger one clears it too. */
+static bool clears(fault_t fault, recovery_action_t action)
+{
+    switch (fault)
+    {
+        case FAULT_STALE_SOCKET:
+        case FAULT_HUNG:
+            return action >= RECOVERY_RESET_SOCKETS;
+        case FAULT_WIFI_STUCK:
+            return action >= RECOVERY_RECONNECT_WIFI;
+        case FAULT_NETIF_WEDGED:
+            return action >= RECOVERY_RESTART_NETIF;
+        case FAULT_STACK_WEDGED:
+            return action >= RECOVERY_REBOOT;
+        default:
+            return false;
+    }
+}
+
+static void take(sim_t * sim, recovery_action_t action)
+{
+    sim->actions[action]++;
+    sim->action_at = sim->now;
+    if (sim->order_count < 16)
+        sim->order[sim->order_count++] = action;
+    if (clears(sim->fault, action))
+        sim->fault = FAULT_NONE;
+
+    if (action == RECOVERY_REBOOT)
+    {
+        int64_t carried = recovery_down_ms(&sim->rec, sim->now);
+        uint32_t reboots = sim->rec.reboots + 1;
+        recovery_t old = sim->rec;
+
+        sim->now += BOOT_MS;
+        recovery_init(&sim->rec, &config, sim->now, carried + BOOT_MS, reboots);
+        // the device keeps the statistics in ram, the test does across boots
+        sim->rec.outages = old.outages;
+        memcpy(sim->rec.recovered_by, old.recovered_by, sizeof(old.recovered_by));
+        sim->rec.max_ttr_ms = old.max_ttr_ms;
+        sim->rec.total_ttr_ms = old.total_ttr_ms;
+        sim->next_request = sim->now;
+        sim->next_check = sim->now + CHECK_MS;
+    }
+    else
+        // the bot tries at once with a fresh connection
+        sim->next_request = sim->now;
+}
+
+static void sim_run(sim_t * sim, int64_t until)
+{
+    while (sim->now < until)
+    {
+        if (sim->fault_until && sim->now >= sim->fault_until && (sim->fault == FAULT_BRIEF || sim->fault == FAULT_AP_DOWN))
+            sim->fault = FAULT_NONE;
+
+        if (sim->now >= sim->next_request && sim->fault != FAULT_HUNG)
+        {
+            if (sim->fault == FAULT_NONE)
+            {
+                int64_t ttr = recovery_ok(&sim->rec, sim->now);
+                if (ttr)
+                    sim->ttr = ttr;
+                sim->next_request = sim->now + POLL_MS;
+            }
+            else
+            {
+                recovery_failed(&sim->rec, sim->now);
+                sim->next_request = sim->now + RETRY_MS;
+            }
+        }
+
+        if (sim->now >= sim->next_check)
+        {
+            sim->next_check = sim->now + CHECK_MS;
+            recovery_action_t action = recovery_check(&sim->rec, sim->now, !sim->busy);
+            if (action != RECOVERY_NONE)
+            {
+                take(sim, action);
+                continue;
+            }
+        }
+        sim->now += STEP_MS;
+    }
+}
+
+static int taken_total(const sim_t * sim)
+{
+    int total = 0;
+    for (int i = RECOVERY_RESET_SOCKETS; i < RECOVERY_ACTIONS; i++)
+        total += sim->actions[i];
+    return total;
+}
+
+// ----------------------------------------------------------- Unit tests: ---
+
+static sim_t sim;
+
+static int brief(void)
+{
+    sim_init(&sim);
+    sim_run(&sim, 600000);
+
+    // shorter than the first threshold, the retries are enough
+    inject(&sim, FAULT_BRIEF, 30000);
+    sim_run(&sim, sim.now + 3600000);
+    check(taken_total(&sim) == 0);
+    check(sim.rec.outages == 1);
+    check(sim.rec.recovered_by[RECOVERY_NONE] == 1);
+    check(sim.ttr <= 30000 + RETRY_MS);
+    check(!sim.rec.down);
+    done();
+}
+
+static int ladder(void)
+{
+    static const struct
+    {
+        fault_t fault;
+        recovery_action_t fixed_by;
+    } cases[] = {
+        {FAULT_STALE_SOCKET, RECOVERY_RESET_SOCKETS},
+        {FAULT_HUNG, RECOVERY_RESET_SOCKETS},
+        {FAULT_WIFI_STUCK, RECOVERY_RECONNECT_WIFI},
+        {FAULT_NETIF_WEDGED, RECOVERY_RESTART_NETIF},
+        {FAULT_STACK_WEDGED, RECOVERY_REBOOT},
+    };
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        sim_init(&sim);
+        sim_run(&sim, 600000);
+        inject(&sim, cases[c].fault, 0);
+        sim_run(&sim, sim.now + 6 * 3600000LL);
+
+        // every step up to the one that works, in order, once
+        check(sim.order_count == (int)cases[c].fixed_by);
+        for (int i = 0; i < sim.order_count; i++)
+            check(sim.order[i] == (recovery_action_t)(i + 1));
+        check(sim.rec.recovered_by[cases[c].fixed_by] == 1);
+        check(sim.rec.last_by == cases[c].fixed_by);
+        check(sim.rec.reboots == 0);
+
+        // the threshold of the step and a round trip at most
+        uint32_t after_s = config.after_s[cases[c].fixed_by];
+        check(sim.ttr <= after_s * 1000LL + POLL_MS + CHECK_MS + BOOT_MS);
+        check(sim.ttr >= (after_s * 1000LL) - POLL_MS);
+        printf("\n    %-14s back after %lld s", recovery_action_name(sim.rec.last_by), (long long)sim.ttr / 1000);
+    }
+    printf("\n    ");
+    done();
+}
+
+static int held_reboot(void)
+{
+    sim_init(&sim);
+    sim_run(&sim, 600000);
+
+    // the generator is cranking, the ladder stops before the reboot
+    sim.busy = true;
+    inject(&sim, FAULT_STACK_WEDGED, 0);
+    sim_run(&sim, sim.now + 3 * 3600000LL);
+    check(sim.actions[RECOVERY_RESTART_NETIF] == 1);
+    check(sim.actions[RECOVERY_REBOOT] == 0);
+    check(sim.rec.down);
+    check(sim.rec.taken == RECOVERY_RESTART_NETIF);
+
+    int64_t released = sim.now;
+    sim.busy = false;
+    sim_run(&sim, sim.now + 3600000);
+    check(sim.actions[RECOVERY_REBOOT] == 1);
+    check(sim.rec.recovered_by[RECOVERY_REBOOT] == 1);
+    // right after it is allowed, not another full wait
+    check(sim.action_at - released <= CHECK_MS);
+    check(sim.ttr > 3 * 3600000LL - POLL_MS);
+    done();
+}
+
+static int reboot_backoff(void)
+{
+    sim_init(&sim);
+    sim_run(&sim, 600000);
+
+    // the AP is gone for half a day, every boot waits twice as long
+    inject(&sim, FAULT_AP_DOWN, 12 * 3600000LL);
+    sim_run(&sim, sim.now + 13 * 3600000LL);
+
+    // 20, 40, 80, 160 and 320 minutes add up to just over 10 hours
+    check(sim.actions[RECOVERY_REBOOT] == 5);
+    // each boot climbs the ladder again
+    check(sim.actions[RECOVERY_RESET_SOCKETS] == 6);
+    check(sim.rec.outages == 1);
+    // the outage is measured across the reboots
+    check(sim.ttr >= 12 * 3600000LL - POLL_MS && sim.ttr <= 12 * 3600000LL + RETRY_MS);
+    check(sim.rec.reboots == 0);
+    check(recovery_reboot_after_s(&sim.rec) == config.after_s[RECOVERY_REBOOT]);
+
+    // the backoff is capped
+    recovery_t rec;
+    recovery_init(&rec, &config, 0, 1000, 30);
+    check(recovery_reboot_after_s(&rec) == config.max_reboot_s);
+    check(recovery_down_ms(&rec, 0) == 1000);
+    done();
+}
+
+static int settle(void)
+{
+    recovery_t rec;
+
+    // silent for hours at once, e.g. the check task was starved
+    recovery_init(&rec, &config, 0, 0, 0);
+    check(recovery_check(&rec, 10 * 3600000LL, true) == RECOVERY_RESET_SOCKETS);
+    check(recovery_check(&rec, 10 * 3600000LL + 1000, true) == RECOVERY_NONE);
+    check(recovery_check(&rec, 10 * 3600000LL + 30000, true) == RECOVERY_RECONNECT_WIFI);
+    check(recovery_check(&rec, 10 * 3600000LL + 60000, true) == RECOVERY_RESTART_NETIF);
+    check(recovery_check(&rec, 10 * 3600000LL + 90000, true) == RECOVERY_REBOOT);
+    // nothing after the reboot in this boot
+    check(recovery_check(&rec, 20 * 3600000LL, true) == RECOVERY_NONE);
+    // no failure seen, the outage started with the silence
+    check(recovery_down_ms(&rec, 10 * 3600000LL) == 10 * 3600000LL);
+    done();
+}
+
+/* A week of random faults, one at a time. Each must be cleared by the
+ * weakest action that can, and the link must never stay down longer than
+ * the ladder takes. */
+static int soak(void)
+{
+    int faults = 0;
+    int64_t worst = 0;
+
+    srand(7);
+    sim_init(&sim);
+    sim_run(&sim, 600000);
+
+    while (sim.now < 7 * 24 * 3600000LL)
+    {
+        fault_t fault = 1 + rand() % (FAULT_HUNG);
+        int64_t length = fault == FAULT_BRIEF ? 5000 + rand() % 100000 : 0;
+        int outages = sim.rec.outages;
+
+        inject(&sim, fault, length);
+        sim_run(&sim, sim.now + 3 * 3600000LL);
+        faults++;
+
+        check(sim.fault == FAULT_NONE);
+        check(!sim.rec.down);
+        check(sim.rec.outages == (uint32_t)outages + 1);
+        for (int i = RECOVERY_RESET_SOCKETS; i < RECOVERY_ACTIONS; i++)
+            check(sim.actions[i] <= 1);
+        // the weakest action that works
+        check(sim.rec.last_by == RECOVERY_NONE || !clears(fault, sim.rec.last_by - 1));
+        if (sim.ttr > worst)
+            worst = sim.ttr;
+
+        // some quiet time in between
+        sim_run(&sim, sim.now + (rand() % 12) * 3600000LL);
+    }
+
+    printf("\n    %d faults, worst recovery %lld s, by retries %u, reset %u, reconnect %u, netif %u, reboot %u\n    ",
+           faults,
+           (long long)worst / 1000,
+           sim.rec.recovered_by[RECOVERY_NONE],
+           sim.rec.recovered_by[RECOVERY_RESET_SOCKETS],
+           sim.rec.recovered_by[RECOVERY_RECONNECT_WIFI],
+           sim.rec.recovered_by[RECOVERY_RESTART_NETIF],
+           sim.rec.recovered_by[RECOVERY_REBOOT]);
+    check(faults > 20);
+    check(worst <= config.after_s[RECOVERY_REBOOT] * 1000LL + POLL_MS + CHECK_MS + BOOT_MS);
+    check(sim.rec.max_ttr_ms == worst);
+    done();
+}
+
+int main(void)
+{
+    static struct test const tests[] = {
+        {brief, "Brief outage"},
+        {ladder, "Each step in turn"},
+        {held_reboot, "Reboot held back"},
+        {reboot_backoff, "Reboot backoff"},
+        {settle, "Settle time"},
+        {soak, "A week of faults"},
+    };
+    return test_suit(tests, sizeof tests / sizeof *tests);
+}
@@ -0,0 +1,364 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "journal.h"
+#include "journal_ring.h"
+#include "metrics.h"
+#include "task_plan.h"
+
+#define JOURNAL_PARTITION_SUBTYPE 0x40
+
+static const char * TAG = "journal";
+
+static const esp_partition_t * partition = NULL;
+static journal_ring_t ring;
+
+/* journal_log only appends to RAM, it is called from the relay path and
+ * from timer callbacks. The flush task swaps the buffers and writes the
+ * full one out, the appends go on into the other one meanwhile. flash_lock
+ * covers the partition and is taken before lock, which covers the buffers
+ * and the record sequence. */
+static SemaphoreHandle_t lock = NULL;
+static SemaphoreHandle_t flash_lock = NULL;
+static TaskHandle_t flush_task = NULL;
+static uint8_t ram_buf[2][CONFIG_JOURNAL_BUFFER_SIZE] __attribute__((aligned(4)));
+static int ram_active = 0;
+static size_t ram_len = 0;
+// what /history saw in RAM, under flash_lock
+static uint8_t history_buf[CONFIG_JOURNAL_BUFFER_SIZE] __attribute__((aligned(4)));
+
+// the flash side is counted in ring
+static struct
+{
+    uint32_t logical_bytes;
+    uint32_t flushes;
+    uint32_t recovery_us;
+    // the buffer was full, the flush task was behind
+    uint32_t dropped;
+} stats;
+
+static const char * event_names[] = {
+    [JOURNAL_BOOT] = "boot",
+    [JOURNAL_RELAY_ON] = "relay on",
+    [JOURNAL_RELAY_OFF] = "relay off",
+    [JOURNAL_NET_UP] = "net up",
+    [JOURNAL_NET_DOWN] = "net down",
+    [JOURNAL_NOTE] = "note",
+    [JOURNAL_MAINS_LOST] = "mains lost",
+    [JOURNAL_MAINS_BACK] = "mains back",
+};
+
+static esp_err_t partition_read(void * ctx, uint32_t offset, void * buf, size_t len)
+{
+    return esp_partition_read(partition, offset, buf, len);
+}
+
+static esp_err_t partition_write(void * ctx, uint32_t offset, const void * data, size_t len)
+{
+    return esp_partition_write(partition, offset, data, len);
+}
+
+static esp_err_t partition_erase_sector(void * ctx, uint32_t offset)
+{
+    return esp_partition_erase_range(partition, offset, JOURNAL_SECTOR_SIZE);
+}
+
+static const journal_ring_io_t partition_io = {
+    .read = partition_read,
+    .write = partition_write,
+    .erase_sector = partition_erase_sector,
+    .crc32 = esp_rom_crc32_le,
+};
+
+static void recover(void)
+{
+    int64_t start = esp_timer_get_time();
+
+    if (!journal_ring_recover(&ring, &partition_io, partition->size / JOURNAL_SECTOR_SIZE))
+        ESP_LOGI(TAG, "empty journal, started a new one");
+    if (ring.torn_records)
+        ESP_LOGW(TAG, "torn record after %lu, continuing in a fresh sector", (unsigned long)ring.recovered_records);
+    if (ring.flash_errors)
+        ESP_LOGE(TAG, "could not erase or write sector %d", ring.cur_sector);
+
+    stats.recovery_us = esp_timer_get_time() - start;
+    ESP_LOGI(
+        TAG,
+        "recovered sector %d seq %lu offset %lu in %lu us",
+        ring.cur_sector,
+        (unsigned long)ring.cur_sector_seq,
+        (unsigned long)ring.write_offset,
+        (unsigned long)stats.recovery_us);
+}
+
+/* Swap the buffers and write out what was collected. lock is only held
+ * for the swap, an erase does not hold up journal_log. */
+static void flush(void)
+{
+    xSemaphoreTake(flash_lock, portMAX_DELAY);
+    xSemaphoreTake(lock, portMAX_DELAY);
+    const uint8_t * buf = ram_buf[ram_active];
+    size_t len = ram_len;
+    ram_active ^= 1;
+    ram_len = 0;
+    xSemaphoreGive(lock);
+
+    if (len > 0)
+    {
+        esp_err_t err = journal_ring_write(&ring, buf, len);
+        if (err != ESP_OK)
+            ESP_LOGE(TAG, "flash error in sector %d, %lu bytes lost so far: %s", ring.cur_sector, (unsigned long)ring.lost_bytes, esp_err_to_name(err));
+        stats.flushes++;
+    }
+    xSemaphoreGive(flash_lock);
+}
+
+void journal_flush(void)
+{
+    if (partition == NULL)
+        return;
+
+    flush();
+}
+
+static void journal_task(void * pv)
+{
+    while (true)
+    {
+        // woken early once the buffer is half full
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_JOURNAL_FLUSH_PERIOD_S * 1000ULL));
+        flush();
+    }
+}
+
+void journal_log(journal_event_t event, const char * fmt, ...)
+{
+    char payload[JOURNAL_MAX_PAYLOAD + 1];
+    va_list args;
+
+    if (partition == NULL)
+        return;
+
+    va_start(args, fmt);
+    int len = vsnprintf(payload, sizeof(payload), fmt, args);
+    va_end(args);
+    if (len > JOURNAL_MAX_PAYLOAD)
+        len = JOURNAL_MAX_PAYLOAD;
+    if (len < 0)
+        len = 0;
+
+    journal_record_t hdr = {
+        .magic = JOURNAL_RECORD_MAGIC,
+        .event = event,
+        .len = len,
+        .time = time(NULL),
+    };
+    size_t size = JOURNAL_RECORD_SIZE(len);
+    bool full = false;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint8_t * buf = ram_buf[ram_active];
+    if (ram_len + size > sizeof(ram_buf[0]))
+    {
+        // never wait for the flash here, the flush task is behind
+        stats.dropped++;
+        full = true;
+    }
+    else
+    {
+        journal_ring_seal(&ring, &hdr, payload);
+        memcpy(buf + ram_len, &hdr, sizeof(hdr));
+        memcpy(buf + ram_len + sizeof(hdr), payload, len);
+        // padding stays erased
+        memset(buf + ram_len + sizeof(hdr) + len, 0xff, size - sizeof(hdr) - len);
+        ram_len += size;
+        stats.logical_bytes += sizeof(hdr) + len;
+        full = ram_len >= sizeof(ram_buf[0]) / 2;
+    }
+    xSemaphoreGive(lock);
+
+    if (full)
+        xTaskNotifyGive(flush_task);
+}
+
+static int format_record(char * buf, size_t size, const journal_record_t * rec, const char * payload)
+{
+    char when[24];
+    time_t t = rec->time;
+
+    // the clock is not set until the time is synced, it counts from the boot then
+    if (t > 1600000000)
+    {
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(when, sizeof(when), "%m-%d %H:%M:%S", &tm);
+    }
+    else
+        snprintf(when, sizeof(when), "boot+%lus", (unsigned long)rec->time);
+
+    const char * name = rec->event < sizeof(event_names) / sizeof(*event_names) && event_names[rec->event] ? event_names[rec->event] : "?";
+    return snprintf(buf, size, "%s %s %.*s\n", when, name, rec->len, payload);
+}
+
+int journal_format_history(char * buf, size_t size, int count)
+{
+    int pos = 0;
+
+    if (partition == NULL)
+        return snprintf(buf, size, "no journal partition");
+
+    // the records in RAM are newer than anything in flash, a flush cannot
+    // move them in between while flash_lock is held
+    xSemaphoreTake(flash_lock, portMAX_DELAY);
+    xSemaphoreTake(lock, portMAX_DELAY);
+    size_t history_len = ram_len;
+    memcpy(history_buf, ram_buf[ram_active], ram_len);
+    xSemaphoreGive(lock);
+
+    int in_ram = 0;
+    for (size_t offset = 0; offset < history_len; in_ram++)
+        offset += JOURNAL_RECORD_SIZE(((const journal_record_t *)(history_buf + offset))->len);
+
+    // walk back from the newest sector until there are enough records
+    int first = ring.cur_sector;
+    int total = in_ram;
+    for (int i = 0; i < ring.sectors_count; i++)
+    {
+        int sector = (ring.cur_sector + ring.sectors_count - i) % ring.sectors_count;
+        journal_sector_t hdr;
+        if (!journal_ring_read_sector(&ring, sector, &hdr) || hdr.seq != ring.cur_sector_seq - i)
+            break;
+
+        first = sector;
+        total += journal_ring_sector_records(&ring, sector);
+        if (total >= count)
+            break;
+    }
+
+    int skip = total > count ? total - count : 0;
+    for (int sector = first;; sector = (sector + 1) % ring.sectors_count)
+    {
+        journal_record_t rec;
+        char payload[JOURNAL_MAX_PAYLOAD];
+        uint32_t offset = sizeof(journal_sector_t);
+        bool torn;
+
+        while (journal_ring_read_record(&ring, sector, offset, &rec, payload, &torn) && pos < (int)size)
+        {
+            offset += JOURNAL_RECORD_SIZE(rec.len);
+            if (skip > 0)
+            {
+                skip--;
+                continue;
+            }
+            pos += format_record(buf + pos, size - pos, &rec, payload);
+        }
+
+        if (sector == ring.cur_sector)
+            break;
+    }
+
+    for (size_t offset = 0; offset < history_len && pos < (int)size;)
+    {
+        const journal_record_t * rec = (const journal_record_t *)(history_buf + offset);
+        offset += JOURNAL_RECORD_SIZE(rec->len);
+        if (skip > 0)
+        {
+            skip--;
+            continue;
+        }
+        pos += format_record(buf + pos, size - pos, rec, (const char *)(rec + 1));
+    }
+    xSemaphoreGive(flash_lock);
+
+    if (pos == 0)
+        return snprintf(buf, size, "journal is empty");
+    return pos < (int)size ? pos : (int)size - 1;
+}
+
+int journal_format_stats(char * buf, size_t size)
+{
+    uint32_t logical = stats.logical_bytes ? stats.logical_bytes : 1;
+    uint32_t physical = ring.programmed_bytes + ring.erased_sectors * JOURNAL_SECTOR_SIZE;
+
+    return snprintf(
+        buf,
+        size,
+        "journal: %lu B logged, %lu B programmed, %lu sectors erased in %lu flushes, "
+        "write amplification %lu.%02lu (with erases %lu.%02lu); "
+        "recovered %lu records in %lu us, %lu dropped while the buffer was full, "
+        "%lu flash errors lost %lu B",
+        (unsigned long)stats.logical_bytes,
+        (unsigned long)ring.programmed_bytes,
+        (unsigned long)ring.erased_sectors,
+        (unsigned long)stats.flushes,
+        (unsigned long)(ring.programmed_bytes / logical),
+        (unsigned long)(ring.programmed_bytes * 100ULL / logical % 100),
+        (unsigned long)(physical / logical),
+        (unsigned long)(physical * 100ULL / logical % 100),
+        (unsigned long)ring.recovered_records,
+        (unsigned long)stats.recovery_us,
+        (unsigned long)stats.dropped,
+        (unsigned long)ring.flash_errors,
+        (unsigned long)ring.lost_bytes);
+}
+
+static const char * reset_reason_name(esp_reset_reason_t reason)
+{
+    switch (reason)
+    {
+        case ESP_RST_POWERON:
+            return "power on";
+        case ESP_RST_EXT:
+            return "external pin";
+        case ESP_RST_SW:
+            return "software";
+        case ESP_RST_PANIC:
+            return "panic";
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            return "watchdog";
+        case ESP_RST_DEEPSLEEP:
+            return "deep sleep";
+        case ESP_RST_BROWNOUT:
+            return "brownout";
+        default:
+            return "unknown";
+    }
+}
+
+void journal_init(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_SUBTYPE, "journal");
+    if (partition == NULL)
+    {
+        ESP_LOGE(TAG, "no journal partition, events are not recorded");
+        return;
+    }
+
+    lock = xSemaphoreCreateMutex();
+    flash_lock = xSemaphoreCreateMutex();
+    configASSERT(lock && flash_lock);
+    recover();
+
+    // the only writer of the partition, esp_restart aside
+    xTaskCreatePinnedToCore(&journal_task, "journal", 3072, NULL, TASK_PRIO_JOURNAL, &flush_task, TASK_CORE_NET);
+    configASSERT(flush_task);
+    metrics_register_task(flush_task);
+    // do not lose the buffered events on esp_restart
+    esp_register_shutdown_handler(journal_flush);
+
+    journal_log(JOURNAL_BOOT, "reset reason: %s", reset_reason_name(esp_reset_reason()));
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Append-only log of control and network events in the "journal" partition.
+ * The partition is used as a ring of flash sectors, the oldest sector is
+ * erased when the newest one is full. */
+
+typedef enum
+{
+    JOURNAL_BOOT = 1,
+    JOURNAL_RELAY_ON,
+    JOURNAL_RELAY_OFF,
+    JOURNAL_NET_UP,
+    JOURNAL_NET_DOWN,
+    JOURNAL_NOTE,
+    JOURNAL_MAINS_LOST,
+    JOURNAL_MAINS_BACK,
+} journal_event_t;
+
+#define JOURNAL_MAX_PAYLOAD 48
+
+void journal_init(void);
+
+/* Add an event, the text is cut to JOURNAL_MAX_PAYLOAD bytes.
+ * It is kept in RAM until the flush task writes it out, the flash is never
+ * touched here, so timer callbacks may log. Dropped if the buffer is full. */
+void journal_log(journal_event_t event, const char * fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* Write everything buffered to flash in the calling task. Runs on
+ * esp_restart, everything else leaves it to the flush task. */
+void journal_flush(void);
+
+/* Print the last count events, oldest first. Returns the length. */
+int journal_format_history(char * buf, size_t size, int count);
+
+/* Print the write amplification and recovery figures. Returns the length. */
+int journal_format_stats(char * buf, size_t size);
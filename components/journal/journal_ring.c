@@ -0,0 +1,194 @@
+#include <string.h>
+
+#include "journal_ring.h"
+
+static uint32_t record_crc(const journal_ring_t * ring, const journal_record_t * rec, const void * payload)
+{
+    uint32_t crc = ring->io->crc32(0, (const uint8_t *)rec, offsetof(journal_record_t, crc));
+    return ring->io->crc32(crc, payload, rec->len);
+}
+
+static uint32_t sector_offset(int sector)
+{
+    return (uint32_t)sector * JOURNAL_SECTOR_SIZE;
+}
+
+bool journal_ring_read_sector(const journal_ring_t * ring, int sector, journal_sector_t * hdr)
+{
+    if (ring->io->read(ring->io->ctx, sector_offset(sector), hdr, sizeof(*hdr)) != ESP_OK)
+        return false;
+    return hdr->magic == JOURNAL_SECTOR_MAGIC;
+}
+
+bool journal_ring_read_record(const journal_ring_t * ring, int sector, uint32_t offset, journal_record_t * rec, char * payload, bool * torn)
+{
+    const journal_ring_io_t * io = ring->io;
+
+    *torn = false;
+    if (offset + sizeof(*rec) > JOURNAL_SECTOR_SIZE)
+        return false;
+    if (io->read(io->ctx, sector_offset(sector) + offset, rec, sizeof(*rec)) != ESP_OK)
+        return false;
+    if (rec->magic == JOURNAL_RECORD_ERASED)
+        return false;
+
+    if (rec->magic != JOURNAL_RECORD_MAGIC || rec->len > JOURNAL_MAX_PAYLOAD
+        || offset + JOURNAL_RECORD_SIZE(rec->len) > JOURNAL_SECTOR_SIZE
+        || io->read(io->ctx, sector_offset(sector) + offset + sizeof(*rec), payload, rec->len) != ESP_OK
+        || record_crc(ring, rec, payload) != rec->crc)
+    {
+        *torn = true;
+        return false;
+    }
+
+    return true;
+}
+
+int journal_ring_sector_records(const journal_ring_t * ring, int sector)
+{
+    journal_record_t rec;
+    char payload[JOURNAL_MAX_PAYLOAD];
+    uint32_t offset = sizeof(journal_sector_t);
+    bool torn;
+    int count = 0;
+
+    while (journal_ring_read_record(ring, sector, offset, &rec, payload, &torn))
+    {
+        offset += JOURNAL_RECORD_SIZE(rec.len);
+        count++;
+    }
+    return count;
+}
+
+/* Erase the oldest sector and continue writing there. A sector that cannot
+ * be erased or get its header is passed over, the next attempt takes the
+ * one after it. */
+static esp_err_t start_next_sector(journal_ring_t * ring, uint32_t first_record)
+{
+    const journal_ring_io_t * io = ring->io;
+
+    ring->cur_sector = (ring->cur_sector + 1) % ring->sectors_count;
+    ring->cur_sector_seq++;
+    // nothing goes into this sector until it has its header
+    ring->write_offset = JOURNAL_SECTOR_SIZE;
+
+    esp_err_t err = io->erase_sector(io->ctx, sector_offset(ring->cur_sector));
+    if (err != ESP_OK)
+    {
+        ring->flash_errors++;
+        return err;
+    }
+    ring->erased_sectors++;
+
+    // the magic goes last, a header cut by a power loss is not taken for one
+    journal_sector_t hdr = {.magic = JOURNAL_SECTOR_MAGIC, .seq = ring->cur_sector_seq, .first_record = first_record};
+    size_t body = offsetof(journal_sector_t, seq);
+    err = io->write(io->ctx, sector_offset(ring->cur_sector) + body, (const uint8_t *)&hdr + body, sizeof(hdr) - body);
+    if (err == ESP_OK)
+        err = io->write(io->ctx, sector_offset(ring->cur_sector), &hdr.magic, sizeof(hdr.magic));
+    if (err != ESP_OK)
+    {
+        ring->flash_errors++;
+        return err;
+    }
+    ring->programmed_bytes += sizeof(hdr);
+    ring->write_offset = sizeof(hdr);
+    return ESP_OK;
+}
+
+bool journal_ring_recover(journal_ring_t * ring, const journal_ring_io_t * io, int sectors_count)
+{
+    journal_sector_t hdr;
+    bool found = false;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->io = io;
+    ring->sectors_count = sectors_count;
+
+    for (int i = 0; i < sectors_count; i++)
+    {
+        if (journal_ring_read_sector(ring, i, &hdr) && (!found || hdr.seq > ring->cur_sector_seq))
+        {
+            found = true;
+            ring->cur_sector = i;
+            ring->cur_sector_seq = hdr.seq;
+            ring->next_record_seq = hdr.first_record;
+        }
+    }
+
+    if (!found)
+    {
+        ring->cur_sector = sectors_count - 1;
+        start_next_sector(ring, 0);
+        return false;
+    }
+
+    journal_record_t rec;
+    char payload[JOURNAL_MAX_PAYLOAD];
+    bool torn;
+
+    ring->write_offset = sizeof(journal_sector_t);
+    while (journal_ring_read_record(ring, ring->cur_sector, ring->write_offset, &rec, payload, &torn))
+    {
+        ring->next_record_seq = rec.seq + 1;
+        ring->write_offset += JOURNAL_RECORD_SIZE(rec.len);
+        ring->recovered_records++;
+    }
+
+    // do not append after the garbage
+    if (torn)
+    {
+        ring->torn_records++;
+        start_next_sector(ring, ring->next_record_seq);
+    }
+    return true;
+}
+
+void journal_ring_seal(journal_ring_t * ring, journal_record_t * rec, const void * payload)
+{
+    rec->seq = ring->next_record_seq++;
+    rec->crc = record_crc(ring, rec, payload);
+}
+
+esp_err_t journal_ring_write(journal_ring_t * ring, const uint8_t * buf, size_t len)
+{
+    const journal_ring_io_t * io = ring->io;
+    esp_err_t err = ESP_OK;
+    size_t pos = 0;
+
+    // all the records that fit into the current sector go in one write
+    while (pos < len && err == ESP_OK)
+    {
+        size_t chunk = 0;
+        while (pos + chunk < len)
+        {
+            const journal_record_t * rec = (const journal_record_t *)(buf + pos + chunk);
+            size_t size = JOURNAL_RECORD_SIZE(rec->len);
+            if (ring->write_offset + chunk + size > JOURNAL_SECTOR_SIZE)
+                break;
+            chunk += size;
+        }
+
+        if (chunk == 0)
+        {
+            err = start_next_sector(ring, ((const journal_record_t *)(buf + pos))->seq);
+            continue;
+        }
+
+        err = io->write(io->ctx, sector_offset(ring->cur_sector) + ring->write_offset, buf + pos, chunk);
+        if (err != ESP_OK)
+        {
+            // the failed write may have programmed part of it, recovery would stop there anyway
+            ring->flash_errors++;
+            ring->write_offset = JOURNAL_SECTOR_SIZE;
+            continue;
+        }
+
+        ring->write_offset += chunk;
+        ring->programmed_bytes += chunk;
+        pos += chunk;
+    }
+
+    ring->lost_bytes += len - pos;
+    return err;
+}
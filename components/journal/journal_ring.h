@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "journal.h"
+
+/* The journal partition as a ring of flash sectors, no IDF in here. Every
+ * sector starts with a header carrying a sequence number, the records follow
+ * it and never cross into the next sector. When the current sector is full
+ * the oldest one is erased and written next, so all sectors wear evenly.
+ * journal.c reaches the partition through journal_ring_io_t, the host tests
+ * put a RAM partition with power cuts behind it. */
+
+#define JOURNAL_SECTOR_SIZE 4096
+#define JOURNAL_SECTOR_MAGIC 0x4c4e524a // "JRNL"
+#define JOURNAL_RECORD_MAGIC 0x4a52
+#define JOURNAL_RECORD_ERASED 0xffff
+#define JOURNAL_RECORD_SIZE(len) ((sizeof(journal_record_t) + (len) + 3) & ~3)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t seq; // grows by one every time a sector is started
+    uint32_t first_record; // seq of the first record in the sector
+} journal_sector_t;
+
+typedef struct
+{
+    uint16_t magic;
+    uint8_t event;
+    uint8_t len;
+    uint32_t seq;
+    uint32_t time;
+    uint32_t crc; // over the fields above and the payload
+} journal_record_t;
+
+typedef struct
+{
+    void * ctx;
+    // offsets are from the start of the partition
+    esp_err_t (*read)(void * ctx, uint32_t offset, void * buf, size_t len);
+    esp_err_t (*write)(void * ctx, uint32_t offset, const void * data, size_t len);
+    esp_err_t (*erase_sector)(void * ctx, uint32_t offset);
+    // crc32 as esp_rom_crc32_le computes it
+    uint32_t (*crc32)(uint32_t crc, const uint8_t * data, uint32_t len);
+} journal_ring_io_t;
+
+typedef struct
+{
+    const journal_ring_io_t * io;
+    int sectors_count;
+    int cur_sector;
+    uint32_t cur_sector_seq;
+    uint32_t write_offset;
+    uint32_t next_record_seq;
+
+    uint32_t programmed_bytes;
+    uint32_t erased_sectors;
+    uint32_t recovered_records;
+    // found by the recovery, cut by a power loss
+    uint32_t torn_records;
+    // erases and writes the flash refused, their records are lost
+    uint32_t flash_errors;
+    uint32_t lost_bytes;
+} journal_ring_t;
+
+/* Find where writing stopped before the reboot: the sector with the newest
+ * header, then the end of its records. Only the sector headers and one sector
+ * worth of records are read. A torn record, a write cut by a power loss, is
+ * not appended to, the next records go to a fresh sector. Returns true if
+ * there was a journal, false if a new one was started. */
+bool journal_ring_recover(journal_ring_t * ring, const journal_ring_io_t * io, int sectors_count);
+
+/* Fill in seq and crc of a record, the payload follows the header. */
+void journal_ring_seal(journal_ring_t * ring, journal_record_t * rec, const void * payload);
+
+/* Append the records in buf, headers and padded payloads back to back as
+ * journal_ring_seal made them. On a flash error the rest of the current
+ * sector is given up and the error returned, the records of the failed
+ * write are counted in lost_bytes. */
+esp_err_t journal_ring_write(journal_ring_t * ring, const uint8_t * buf, size_t len);
+
+bool journal_ring_read_sector(const journal_ring_t * ring, int sector, journal_sector_t * hdr);
+
+/* Read the record at offset into the sector. Returns false at the end of
+ * the sector data, sets *torn if there is something that is not a valid
+ * record. payload has room for JOURNAL_MAX_PAYLOAD bytes. */
+bool journal_ring_read_record(const journal_ring_t * ring, int sector, uint32_t offset, journal_record_t * rec, char * payload, bool * torn);
+
+/* Count valid records in a sector. */
+int journal_ring_sector_records(const journal_ring_t * ring, int sector);
@@ -0,0 +1,153 @@
+/*
+ * Write amplification and recovery cost of the journal ring on a partition
+ * the size of the one in partitions.csv. The flash is ram_flash, so the
+ * times are host times; the reads and bytes are what the device reads too,
+ * its own recovery time is on /history.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "journal_ring.h"
+#include "ram_flash.h"
+
+// the journal partition, 0x30000
+#define SECTORS 48
+#define LOGGED (1024 * 1024)
+#define RECOVERIES 200
+
+static ram_flash_t flash;
+static uint32_t random_state = 12345;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Log events like the firmware does, "relay on" to a net note, 8 to 40
+ * bytes of text, flushed whenever batch bytes are buffered. Returns the
+ * logical bytes, header and text as journal.c counts them. */
+static uint32_t run(journal_ring_t * ring, size_t batch, uint32_t * flushes)
+{
+    static uint8_t buf[4096];
+    uint32_t logical = 0;
+    size_t len = 0;
+
+    *flushes = 0;
+    while (logical < LOGGED)
+    {
+        char payload[JOURNAL_MAX_PAYLOAD];
+        journal_record_t rec = {.magic = JOURNAL_RECORD_MAGIC, .event = 1, .len = 8 + random_next() % 33};
+        memset(payload, 'x', rec.len);
+        journal_ring_seal(ring, &rec, payload);
+
+        size_t size = JOURNAL_RECORD_SIZE(rec.len);
+        memcpy(buf + len, &rec, sizeof(rec));
+        memcpy(buf + len + sizeof(rec), payload, rec.len);
+        memset(buf + len + sizeof(rec) + rec.len, 0xff, size - sizeof(rec) - rec.len);
+        len += size;
+        logical += sizeof(rec) + rec.len;
+
+        if (len >= batch)
+        {
+            journal_ring_write(ring, buf, len);
+            (*flushes)++;
+            len = 0;
+        }
+    }
+    return logical;
+}
+
+static void amplification(void)
+{
+    // one event per flush period, then the half full RAM buffer of JOURNAL_BUFFER_SIZE 256 to 4096
+    static const size_t batches[] = {1, 128, 512, 1024, 2048};
+
+    printf("%-8s %9s %8s %10s %7s %6s %12s %10s\n", "batch", "logged", "flushes", "programmed", "erases", "wa", "wa w/ erases", "writes/KB");
+    for (int i = 0; i < sizeof batches / sizeof *batches; i++)
+    {
+        journal_ring_t ring;
+        uint32_t flushes;
+
+        ram_flash_init(&flash, SECTORS);
+        journal_ring_recover(&ring, &flash.io, SECTORS);
+        uint32_t logical = run(&ring, batches[i], &flushes);
+        uint32_t physical = ring.programmed_bytes + ring.erased_sectors * JOURNAL_SECTOR_SIZE;
+        printf(
+            "%-8zu %9lu %8lu %10lu %7lu %6.2f %12.2f %10.1f\n",
+            batches[i],
+            (unsigned long)logical,
+            (unsigned long)flushes,
+            (unsigned long)ring.programmed_bytes,
+            (unsigned long)ring.erased_sectors,
+            (double)ring.programmed_bytes / logical,
+            (double)physical / logical,
+            // a flush is one write, two if it fills a sector, a sector header is two
+            (flushes + 2.0 * ring.erased_sectors) * 1024 / logical);
+    }
+}
+
+/* Recover the same flash again and again, it is put back before each run
+ * since a recovery may start a sector. */
+static void recovery(const char * name)
+{
+    static uint8_t saved[SECTORS * JOURNAL_SECTOR_SIZE];
+    journal_ring_t ring;
+    double total = 0;
+
+    memcpy(saved, flash.data, sizeof(saved));
+    flash.reads = 0;
+    flash.read_bytes = 0;
+    for (int i = 0; i < RECOVERIES; i++)
+    {
+        memcpy(flash.data, saved, sizeof(saved));
+        double start = now_us();
+        journal_ring_recover(&ring, &flash.io, SECTORS);
+        total += now_us() - start;
+    }
+    printf(
+        "%-20s %8.2f us %4lu reads %6lu bytes read, %3lu records, %lu torn, %lu erased\n",
+        name,
+        total / RECOVERIES,
+        (unsigned long)(flash.reads / RECOVERIES),
+        (unsigned long)(flash.read_bytes / RECOVERIES),
+        (unsigned long)ring.recovered_records,
+        (unsigned long)ring.torn_records,
+        (unsigned long)ring.erased_sectors);
+}
+
+int main(void)
+{
+    journal_ring_t ring;
+    uint32_t flushes;
+
+    printf("Write amplification, %d KB of events into %d sectors:\n\n", LOGGED / 1024, SECTORS);
+    amplification();
+
+    printf("\nRecovery of a full ring of %d sectors, mean of %d:\n\n", SECTORS, RECOVERIES);
+    ram_flash_init(&flash, SECTORS);
+    journal_ring_recover(&ring, &flash.io, SECTORS);
+    run(&ring, 512, &flushes);
+    recovery("clean");
+
+    // a record header cut by a power loss after the last record
+    journal_record_t torn = {.magic = JOURNAL_RECORD_MAGIC, .len = 20, .crc = 0};
+    flash.io.write(flash.io.ctx, ring.cur_sector * JOURNAL_SECTOR_SIZE + ring.write_offset, &torn, 8);
+    recovery("torn record");
+
+    ram_flash_init(&flash, SECTORS);
+    recovery("empty");
+    return 0;
+}
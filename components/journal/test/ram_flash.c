@@ -0,0 +1,114 @@
+#include <string.h>
+#include "ram_flash.h"
+
+static bool in_range(const ram_flash_t * flash, uint32_t offset, size_t len)
+{
+    return offset + len <= (uint32_t)flash->sectors * JOURNAL_SECTOR_SIZE;
+}
+
+/* Spend the power budget on len bytes, returns how many of them happen. */
+static size_t spend(ram_flash_t * flash, size_t len)
+{
+    if (flash->power_budget < 0)
+        return len;
+    if ((long)len < flash->power_budget)
+    {
+        flash->power_budget -= len;
+        return len;
+    }
+    len = flash->power_budget;
+    flash->power_budget = 0;
+    flash->powered = false;
+    return len;
+}
+
+static esp_err_t ram_read(void * ctx, uint32_t offset, void * buf, size_t len)
+{
+    ram_flash_t * flash = ctx;
+
+    if (!flash->powered || !in_range(flash, offset, len))
+        return ESP_FAIL;
+    memcpy(buf, flash->data + offset, len);
+    flash->reads++;
+    flash->read_bytes += len;
+    return ESP_OK;
+}
+
+static esp_err_t ram_write(void * ctx, uint32_t offset, const void * data, size_t len)
+{
+    ram_flash_t * flash = ctx;
+    const uint8_t * bytes = data;
+
+    if (!flash->powered || !in_range(flash, offset, len))
+        return ESP_FAIL;
+
+    size_t done = spend(flash, len);
+    bool fail = false;
+    if (flash->fail_write_after >= 0)
+    {
+        if ((long)done > flash->fail_write_after)
+            done = flash->fail_write_after;
+        flash->fail_write_after = -1;
+        fail = true;
+    }
+    for (size_t i = 0; i < done; i++)
+        flash->data[offset + i] &= bytes[i];
+    flash->written_bytes += done;
+    return fail || done < len ? ESP_FAIL : ESP_OK;
+}
+
+static esp_err_t ram_erase_sector(void * ctx, uint32_t offset)
+{
+    ram_flash_t * flash = ctx;
+
+    if (!flash->powered || offset % JOURNAL_SECTOR_SIZE || !in_range(flash, offset, JOURNAL_SECTOR_SIZE))
+        return ESP_FAIL;
+    if (flash->fail_erase_sector == (int)(offset / JOURNAL_SECTOR_SIZE))
+    {
+        flash->fail_erase_sector = -1;
+        return ESP_FAIL;
+    }
+
+    size_t done = spend(flash, JOURNAL_SECTOR_SIZE);
+    memset(flash->data + offset, 0xff, done);
+    flash->erases++;
+    return done < JOURNAL_SECTOR_SIZE ? ESP_FAIL : ESP_OK;
+}
+
+uint32_t ram_flash_crc32(uint32_t crc, const uint8_t * data, uint32_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+void ram_flash_init(ram_flash_t * flash, int sectors)
+{
+    flash->io = (journal_ring_io_t){
+        .ctx = flash,
+        .read = ram_read,
+        .write = ram_write,
+        .erase_sector = ram_erase_sector,
+        .crc32 = ram_flash_crc32,
+    };
+    memset(flash->data, 0xff, sizeof(flash->data));
+    flash->sectors = sectors;
+    ram_flash_reboot(flash);
+    flash->reads = 0;
+    flash->read_bytes = 0;
+    flash->erases = 0;
+    flash->written_bytes = 0;
+}
+
+void ram_flash_reboot(ram_flash_t * flash)
+{
+    flash->power_budget = -1;
+    flash->powered = true;
+    flash->fail_erase_sector = -1;
+    flash->fail_write_after = -1;
+}
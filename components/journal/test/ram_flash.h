@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "journal_ring.h"
+
+/* A journal partition in RAM that behaves like NOR flash: a write only
+ * clears bits, an erase sets the whole sector. The power can be cut after
+ * a number of programmed or erased bytes, the operation it happens in is
+ * left half done. Single erases and writes can be made to fail too. */
+
+#define RAM_FLASH_MAX_SECTORS 64
+
+typedef struct
+{
+    // what the ring is given, ctx is the flash itself
+    journal_ring_io_t io;
+    uint8_t data[RAM_FLASH_MAX_SECTORS * JOURNAL_SECTOR_SIZE];
+    int sectors;
+    // bytes until the power goes, -1 for never
+    long power_budget;
+    bool powered;
+    // the next erase of this sector fails, -1 for none
+    int fail_erase_sector;
+    // the next write fails after this many bytes, -1 for none
+    long fail_write_after;
+
+    uint32_t reads;
+    uint32_t read_bytes;
+    uint32_t erases;
+    uint32_t written_bytes;
+} ram_flash_t;
+
+/* An erased partition, with the power on and no failures planned. */
+void ram_flash_init(ram_flash_t * flash, int sectors);
+
+/* The power comes back, the flash keeps whatever the cut left. */
+void ram_flash_reboot(ram_flash_t * flash);
+
+uint32_t ram_flash_crc32(uint32_t crc, const uint8_t * data, uint32_t len);
@@ -0,0 +1,292 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "journal_ring.h"
+#include "ram_flash.h"
+
+// ----------------------------------------------------- Test "framework": ---
+
+#define done() return 0
+#define fail() return __LINE__
+static int checkqty = 0;
+#define check(x) \
+    do \
+    { \
+        ++checkqty; \
+        if (!(x)) \
+            fail(); \
+    } while (0)
+
+struct test
+{
+    int (*func)(void);
+    char const * name;
+};
+
+static int test_suit(struct test const * tests, int numtests)
+{
+    printf("%s", "\n\nTests:\n");
+    int failed = 0;
+    for (int i = 0; i < numtests; ++i)
+    {
+        printf(" %02d%s%-25s ", i, ": ", tests[i].name);
+        int linerr = tests[i].func();
+        if (0 == linerr)
+            printf("%s", "OK\n");
+        else
+        {
+            printf("%s%d\n", "Failed, line: ", linerr);
+            ++failed;
+        }
+    }
+    printf("\n%s%d\n", "Total checks: ", checkqty);
+    printf("%s[ %d / %d ]\r\n\n\n", "Tests PASS: ", numtests - failed, numtests);
+    return failed;
+}
+
+// ----------------------------------------------------------- The writer: ---
+
+/* What journal.c does: records are sealed into a RAM buffer as they are
+ * logged and the buffer goes to the ring in one write. The payload tells
+ * the seq, so a reader can check every record it finds. */
+
+static ram_flash_t flash;
+
+static int payload_for(uint32_t seq, char * payload)
+{
+    int len = snprintf(payload, JOURNAL_MAX_PAYLOAD + 1, "record %lu ", (unsigned long)seq);
+    int pad = seq * 7 % (JOURNAL_MAX_PAYLOAD - len + 1);
+    memset(payload + len, 'a' + seq % 26, pad);
+    return len + pad;
+}
+
+static esp_err_t log_batch(journal_ring_t * ring, int count)
+{
+    uint8_t buf[2048];
+    size_t len = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        char payload[JOURNAL_MAX_PAYLOAD + 1];
+        journal_record_t rec = {
+            .magic = JOURNAL_RECORD_MAGIC,
+            .event = 1,
+            .len = payload_for(ring->next_record_seq, payload),
+        };
+        journal_ring_seal(ring, &rec, payload);
+        size_t size = JOURNAL_RECORD_SIZE(rec.len);
+        memcpy(buf + len, &rec, sizeof(rec));
+        memcpy(buf + len + sizeof(rec), payload, rec.len);
+        memset(buf + len + sizeof(rec) + rec.len, 0xff, size - sizeof(rec) - rec.len);
+        len += size;
+    }
+    return journal_ring_write(ring, buf, len);
+}
+
+/* Walk back from the newest sector like /history does and check that the
+ * records go up one by one with the payloads they were written with.
+ * Returns the number of records, -1 if something is wrong, *last gets the
+ * seq of the newest one. */
+static int walk(const journal_ring_t * ring, uint32_t * last)
+{
+    int count = 0;
+    bool newest = true;
+    uint32_t next_first = 0;
+
+    for (int i = 0; i < ring->sectors_count; i++)
+    {
+        int sector = (ring->cur_sector + ring->sectors_count - i) % ring->sectors_count;
+        journal_sector_t hdr;
+        if (!journal_ring_read_sector(ring, sector, &hdr) || hdr.seq != ring->cur_sector_seq - i)
+            break;
+
+        journal_record_t rec;
+        char payload[JOURNAL_MAX_PAYLOAD];
+        char expected[JOURNAL_MAX_PAYLOAD + 1];
+        uint32_t offset = sizeof(journal_sector_t);
+        uint32_t seq = hdr.first_record;
+        bool torn;
+
+        while (journal_ring_read_record(ring, sector, offset, &rec, payload, &torn))
+        {
+            if (rec.seq != seq || rec.len != payload_for(seq, expected) || memcmp(payload, expected, rec.len) != 0)
+                return -1;
+            offset += JOURNAL_RECORD_SIZE(rec.len);
+            seq++;
+            count++;
+        }
+        // a torn record only in a sector that was given up
+        if (torn && newest)
+            return -1;
+        // an older sector ends where the next one starts, or earlier if it was torn
+        if (!newest && seq != next_first && !torn)
+            return -1;
+        if (newest)
+            *last = seq - 1;
+        newest = false;
+        next_first = hdr.first_record;
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------- Tests: ---
+
+static int empty_partition(void)
+{
+    journal_ring_t ring;
+
+    ram_flash_init(&flash, 4);
+    check(!journal_ring_recover(&ring, &flash.io, 4));
+    check(ring.cur_sector == 0);
+    check(ring.cur_sector_seq == 1);
+    check(ring.write_offset == sizeof(journal_sector_t));
+    check(ring.next_record_seq == 0);
+    check(ring.erased_sectors == 1);
+    check(ring.flash_errors == 0);
+
+    check(log_batch(&ring, 3) == ESP_OK);
+    journal_ring_t again;
+    check(journal_ring_recover(&again, &flash.io, 4));
+    check(again.recovered_records == 3);
+    check(again.next_record_seq == 3);
+    check(again.write_offset == ring.write_offset);
+    done();
+}
+
+static int append_recover(void)
+{
+    journal_ring_t ring;
+    uint32_t last;
+
+    ram_flash_init(&flash, 8);
+    journal_ring_recover(&ring, &flash.io, 8);
+    // around the ring a few times, the batches end anywhere in a sector
+    uint32_t logged = 0;
+    for (int i = 0; i < 400; i++)
+    {
+        check(log_batch(&ring, 1 + i % 13) == ESP_OK);
+        logged += 1 + i % 13;
+    }
+    check(ring.next_record_seq == logged);
+    check(ring.erased_sectors > 3 * 8);
+    check(ring.lost_bytes == 0);
+
+    journal_ring_t again;
+    check(journal_ring_recover(&again, &flash.io, 8));
+    check(again.cur_sector == ring.cur_sector);
+    check(again.cur_sector_seq == ring.cur_sector_seq);
+    check(again.write_offset == ring.write_offset);
+    check(again.next_record_seq == ring.next_record_seq);
+    check(again.torn_records == 0);
+    // only the newest sector is read records by record
+    check(flash.read_bytes < 8 * sizeof(journal_sector_t) + 2 * JOURNAL_SECTOR_SIZE);
+
+    int count = walk(&again, &last);
+    check(last == logged - 1);
+    // all sectors but the one about to be erased hold records
+    check(count > 7 * JOURNAL_SECTOR_SIZE / (JOURNAL_RECORD_SIZE(JOURNAL_MAX_PAYLOAD)));
+    done();
+}
+
+/* Cut the power everywhere in a run that goes around the ring: in record
+ * writes, sector erases and sector headers. After the reboot everything
+ * that was written before the cut must be there, nothing may be garbled
+ * and writing must go on where it stopped. */
+static int power_cuts(void)
+{
+    for (long budget = 1; budget < 24000; budget += 23)
+    {
+        journal_ring_t ring;
+        uint32_t durable = 0;
+        uint32_t last;
+
+        ram_flash_init(&flash, 4);
+        journal_ring_recover(&ring, &flash.io, 4);
+        for (int i = 0; i < 60; i++)
+        {
+            check(log_batch(&ring, 1 + i % 7) == ESP_OK);
+            durable = ring.next_record_seq;
+        }
+
+        flash.power_budget = budget;
+        while (log_batch(&ring, 1 + durable % 7) == ESP_OK)
+            durable = ring.next_record_seq;
+        check(!flash.powered);
+
+        ram_flash_reboot(&flash);
+        journal_ring_t again;
+        check(journal_ring_recover(&again, &flash.io, 4));
+        check(again.flash_errors == 0);
+        // a torn batch may have left some of its records complete
+        check(again.next_record_seq >= durable);
+        check(again.next_record_seq <= ring.next_record_seq);
+        check(walk(&again, &last) > 0);
+        check(last + 1 == again.next_record_seq);
+
+        uint32_t resumed = again.next_record_seq;
+        for (int i = 0; i < 20; i++)
+            check(log_batch(&again, 5) == ESP_OK);
+        journal_ring_t third;
+        check(journal_ring_recover(&third, &flash.io, 4));
+        check(third.next_record_seq == resumed + 100);
+        check(third.torn_records == 0);
+        check(walk(&third, &last) >= 100);
+        check(last == resumed + 99);
+    }
+    done();
+}
+
+static int flash_errors(void)
+{
+    journal_ring_t ring;
+    uint32_t last;
+
+    ram_flash_init(&flash, 4);
+    journal_ring_recover(&ring, &flash.io, 4);
+    while (ring.cur_sector == 0)
+        check(log_batch(&ring, 4) == ESP_OK);
+    int next = (ring.cur_sector + 1) % 4;
+
+    // the erase of the next sector fails, its batch is lost and the sector skipped
+    flash.fail_erase_sector = next;
+    uint32_t erased = ring.erased_sectors;
+    while (log_batch(&ring, 4) == ESP_OK)
+        ;
+    check(ring.flash_errors == 1);
+    check(ring.erased_sectors == erased);
+    check(ring.lost_bytes > 0);
+    check(ring.cur_sector == next);
+    check(log_batch(&ring, 4) == ESP_OK);
+    check(ring.cur_sector == (next + 1) % 4);
+
+    // a write fails half way, the rest of its sector is given up
+    flash.fail_write_after = 10;
+    uint32_t lost = ring.lost_bytes;
+    int sector = ring.cur_sector;
+    check(log_batch(&ring, 3) != ESP_OK);
+    check(ring.flash_errors == 2);
+    check(ring.lost_bytes > lost);
+    check(log_batch(&ring, 3) == ESP_OK);
+    check(ring.cur_sector == (sector + 1) % 4);
+
+    journal_ring_t again;
+    check(journal_ring_recover(&again, &flash.io, 4));
+    check(again.next_record_seq == ring.next_record_seq);
+    check(again.write_offset == ring.write_offset);
+    check(walk(&again, &last) >= 3);
+    check(last + 1 == ring.next_record_seq);
+    done();
+}
+
+int main(void)
+{
+    static struct test const tests[] = {
+        {empty_partition, "Empty partition"},
+        {append_recover, "Append and recover"},
+        {power_cuts, "Power cuts"},
+        {flash_errors, "Flash errors"},
+    };
+    return test_suit(tests, sizeof tests / sizeof *tests);
+}
@@ -0,0 +1,361 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+
+#include "mains.h"
+
+#if CONFIG_MAINS_MONITOR
+
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#if CONFIG_MAINS_INPUT_ADC
+#    include "esp_adc/adc_oneshot.h"
+#endif
+
+#include "bot.h"
+#include "control.h"
+#include "journal.h"
+#include "latency_hist.h"
+#include "mains_fsm.h"
+#include "metrics.h"
+#include "task_plan.h"
+
+static const char * TAG = "mains";
+
+/* The task is the only writer of the state machine, the lock is for
+ * mains_format. */
+static mains_fsm_t fsm;
+static SemaphoreHandle_t lock;
+static TaskHandle_t task;
+
+// last edge of the mains input, from the isr
+static volatile int64_t edge_us;
+static int64_t lost_us;
+// detection to relay on of the first crank, less the confirmation window
+static latency_hist_t crank_delay;
+static int64_t last_delay_us;
+
+static uint32_t now_ms(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+#if CONFIG_MAINS_INPUT_GPIO || CONFIG_MAINS_RUNNING_GPIO >= 0
+static void IRAM_ATTR input_isr(void * arg)
+{
+    BaseType_t woken = pdFALSE;
+
+    if (arg)
+        edge_us = esp_timer_get_time();
+    vTaskNotifyGiveFromISR(task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+#endif
+
+#if CONFIG_MAINS_INPUT_ADC
+
+static adc_oneshot_unit_handle_t adc;
+static mains_level_t level = {.on = CONFIG_MAINS_ADC_ON, .off = CONFIG_MAINS_ADC_OFF};
+static int last_raw;
+
+static void init_input(void)
+{
+    adc_oneshot_unit_init_cfg_t unit = {.unit_id = ADC_UNIT_1};
+    adc_oneshot_chan_cfg_t channel = {.atten = ADC_ATTEN_DB_12, .bitwidth = ADC_BITWIDTH_12};
+
+    ESP_ERROR_CHECK(adc_oneshot_new_unit(&unit, &adc));
+    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc, CONFIG_MAINS_ADC_CHANNEL, &channel));
+}
+
+static bool read_mains(void)
+{
+    if (adc_oneshot_read(adc, CONFIG_MAINS_ADC_CHANNEL, &last_raw) == ESP_OK)
+        mains_level_update(&level, last_raw);
+    return level.present;
+}
+
+#else
+
+static void init_input(void)
+{
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << CONFIG_MAINS_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(CONFIG_MAINS_GPIO, input_isr, (void *)1));
+}
+
+static bool read_mains(void)
+{
+#if CONFIG_MAINS_GPIO_ACTIVE_LOW
+    return gpio_get_level(CONFIG_MAINS_GPIO) == 0;
+#else
+    return gpio_get_level(CONFIG_MAINS_GPIO) == 1;
+#endif
+}
+
+#endif
+
+static void init_running(void)
+{
+#if CONFIG_MAINS_RUNNING_GPIO >= 0
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << CONFIG_MAINS_RUNNING_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(CONFIG_MAINS_RUNNING_GPIO, input_isr, NULL));
+#endif
+}
+
+static bool read_running(void)
+{
+#if CONFIG_MAINS_RUNNING_GPIO >= 0
+    return gpio_get_level(CONFIG_MAINS_RUNNING_GPIO) == 1;
+#else
+    return false;
+#endif
+}
+
+/* When the mains went away: the edge that woke the task, or the sample
+ * that found it gone. */
+static int64_t detected_at(int64_t now_us)
+{
+    int64_t edge = edge_us;
+
+    if (edge && now_us - edge < CONFIG_MAINS_SAMPLE_MS * 1000LL)
+        return edge;
+    return now_us;
+}
+
+static int64_t crank(void)
+{
+    const char * name = CONFIG_MAINS_CHANNEL;
+
+    if (name[0] == '\0')
+        open_relay();
+    else if (!open_channel(name))
+        ESP_LOGE(TAG, "no channel %s", name);
+    return control_turned_on_at(name);
+}
+
+static void notify(const char * fmt, ...)
+{
+    char text[160];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    ESP_LOGW(TAG, "%s", text);
+    sendMessageToAdmin(text);
+}
+
+static void handle_event(mains_event_t event, int64_t now_us)
+{
+    const mains_config_t * config = &fsm.config;
+    int64_t out_s = (now_us - lost_us) / 1000000;
+
+    switch (event)
+    {
+        case MAINS_EVENT_LOST:
+            lost_us = detected_at(now_us);
+            journal_log(JOURNAL_MAINS_LOST, "confirming %d s", CONFIG_MAINS_CONFIRM_S);
+            ESP_LOGW(TAG, "mains lost, confirming for %d s", CONFIG_MAINS_CONFIRM_S);
+            break;
+
+        case MAINS_EVENT_GLITCH:
+            ESP_LOGI(TAG, "mains back after %lld ms", (now_us - lost_us) / 1000);
+            break;
+
+        case MAINS_EVENT_CRANK:
+        {
+            int64_t on_us = crank();
+            if (fsm.attempt > 1)
+            {
+                notify("Cranking the generator again, attempt %d/%d", fsm.attempt, config->attempts);
+                break;
+            }
+            // an older switch on means the relay was already busy
+            if (on_us < lost_us)
+            {
+                notify("Mains failure, the generator relay is busy, attempt 1/%d", config->attempts);
+                break;
+            }
+            last_delay_us = on_us - lost_us;
+            int64_t over_us = last_delay_us - config->confirm_ms * 1000LL;
+            latency_hist_record(&crank_delay, over_us > 0 ? over_us : 0);
+            notify(
+                "Mains failure, cranking the generator, attempt 1/%d. Detection to crank %lld ms (%lu s window + %lld ms)",
+                config->attempts,
+                last_delay_us / 1000,
+                (unsigned long)config->confirm_ms / 1000,
+                over_us / 1000);
+            break;
+        }
+
+        case MAINS_EVENT_NOT_STARTED:
+            notify(
+                "Warning: the generator did not start, attempt %d/%d. Next one in %d s",
+                fsm.attempt,
+                config->attempts,
+                CONFIG_MAINS_COOLDOWN_S);
+            break;
+
+        case MAINS_EVENT_RUNNING:
+            if (config->feedback)
+                notify("Generator is running, %lld s after the mains failure", out_s);
+            else
+                notify("Generator cranked %lld s after the mains failure, no running input to confirm it", out_s);
+            break;
+
+        case MAINS_EVENT_STOPPED:
+            notify("Warning: the generator stopped, the mains is still off. Cranking again in %d s", CONFIG_MAINS_COOLDOWN_S);
+            break;
+
+        case MAINS_EVENT_LOCKOUT:
+            notify("ALARM: the generator did not start after %d attempts, it needs a manual start", config->attempts);
+            journal_log(JOURNAL_NOTE, "no start after %d attempts", config->attempts);
+            break;
+
+        case MAINS_EVENT_REMIND:
+            notify("ALARM: no mains and no generator for %lld min", out_s / 60);
+            break;
+
+        case MAINS_EVENT_RESTORED:
+            notify("Mains restored after %lld min %lld s", out_s / 60, out_s % 60);
+            journal_log(JOURNAL_MAINS_BACK, "after %lld s", out_s);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void mains_task(void * pv)
+{
+    task = xTaskGetCurrentTaskHandle();
+    init_input();
+    init_running();
+
+    while (true)
+    {
+        uint32_t now = now_ms();
+        bool mains = read_mains();
+        bool running = read_running();
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        mains_event_t event = mains_fsm_step(&fsm, now, mains, running);
+        uint32_t wait_ms = mains_fsm_timeout(&fsm, now);
+        xSemaphoreGive(lock);
+
+        // the next transition may be due already
+        if (event != MAINS_EVENT_NONE)
+        {
+            handle_event(event, esp_timer_get_time());
+            continue;
+        }
+
+        if (wait_ms > CONFIG_MAINS_SAMPLE_MS)
+            wait_ms = CONFIG_MAINS_SAMPLE_MS;
+        ulTaskNotifyTake(pdTRUE, (wait_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+    }
+}
+
+bool mains_busy(void)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool busy = fsm.state != MAINS_STATE_PRESENT;
+    xSemaphoreGive(lock);
+    return busy;
+}
+
+int mains_format(char * buf, size_t size)
+{
+    int pos = 0;
+    char line[64];
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    pos += snprintf(
+        buf + pos,
+        size - pos,
+        "state: %s, attempt %d/%d\noutages: %lu, glitches: %lu\n",
+        mains_state_name(fsm.state),
+        fsm.attempt,
+        fsm.config.attempts,
+        (unsigned long)fsm.outages,
+        (unsigned long)fsm.glitches);
+    if (fsm.state != MAINS_STATE_PRESENT && pos < (int)size)
+        pos += snprintf(buf + pos, size - pos, "off for %lld s\n", (esp_timer_get_time() - lost_us) / 1000000);
+    xSemaphoreGive(lock);
+
+#if CONFIG_MAINS_INPUT_ADC
+    if (pos < (int)size)
+        pos += snprintf(buf + pos, size - pos, "adc: %d (on %d, off %d)\n", last_raw, level.on, level.off);
+#endif
+    if (crank_delay.total && pos < (int)size)
+    {
+        latency_hist_format(&crank_delay, line, sizeof(line));
+        pos += snprintf(
+            buf + pos,
+            size - pos,
+            "detection to crank: last %lld ms, over the window: %s\n",
+            last_delay_us / 1000,
+            line);
+    }
+    return pos;
+}
+
+void mains_init(void)
+{
+    mains_config_t config = {
+        .confirm_ms = CONFIG_MAINS_CONFIRM_S * 1000,
+        .check_ms = CONFIG_MAINS_CHECK_S * 1000,
+        .cooldown_ms = CONFIG_MAINS_COOLDOWN_S * 1000,
+        .restore_ms = CONFIG_MAINS_RESTORE_S * 1000,
+        .remind_ms = CONFIG_MAINS_REMIND_MIN * 60 * 1000,
+        .attempts = CONFIG_MAINS_ATTEMPTS,
+        .feedback = CONFIG_MAINS_RUNNING_GPIO >= 0,
+    };
+
+    if (CONFIG_MAINS_CHANNEL[0] && !control_channel_exists(CONFIG_MAINS_CHANNEL))
+        ESP_LOGE(TAG, "no channel %s, nothing will be cranked", CONFIG_MAINS_CHANNEL);
+
+    lock = xSemaphoreCreateMutex();
+    configASSERT(lock);
+    mains_fsm_init(&fsm, &config, now_ms());
+
+    TaskHandle_t handle = NULL;
+    xTaskCreatePinnedToCore(&mains_task, "mains", 3072, NULL, TASK_PRIO_MAINS, &handle, TASK_CORE_CONTROL);
+    metrics_register_task(handle);
+}
+
+#else
+
+void mains_init(void)
+{
+}
+
+bool mains_busy(void)
+{
+    return false;
+}
+
+int mains_format(char * buf, size_t size)
+{
+    return snprintf(buf, size, "mains monitor is off\n");
+}
+
+#endif
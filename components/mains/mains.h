@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Watch the mains present input and crank the generator when it fails.
+ * Call after init_gpio, it installs the gpio isr service, and after the
+ * bot is up. Does nothing unless CONFIG_MAINS_MONITOR is set. */
+void mains_init(void);
+
+/* True while an outage is handled, from the first loss of the mains until
+ * it is back for good. */
+bool mains_busy(void);
+
+/* Input, state, outage counters and the detection to crank latency.
+ * Returns the length. */
+int mains_format(char * buf, size_t size);
@@ -0,0 +1,194 @@
+#include <string.h>
+
+#include "mains_fsm.h"
+
+static const char * state_names[] = {
+    [MAINS_STATE_PRESENT] = "present",
+    [MAINS_STATE_CONFIRMING] = "confirming",
+    [MAINS_STATE_CRANKING] = "cranking",
+    [MAINS_STATE_COOLDOWN] = "cooldown",
+    [MAINS_STATE_RUNNING] = "running",
+    [MAINS_STATE_LOCKOUT] = "lockout",
+};
+
+static void enter(mains_fsm_t * fsm, mains_state_t state, uint32_t now_ms)
+{
+    fsm->state = state;
+    fsm->since_ms = now_ms;
+}
+
+static bool elapsed(const mains_fsm_t * fsm, uint32_t now_ms, uint32_t span)
+{
+    return now_ms - fsm->since_ms >= span;
+}
+
+static mains_event_t crank(mains_fsm_t * fsm, uint32_t now_ms)
+{
+    fsm->attempt++;
+    enter(fsm, MAINS_STATE_CRANKING, now_ms);
+    return MAINS_EVENT_CRANK;
+}
+
+static mains_event_t mains_back(mains_fsm_t * fsm, uint32_t now_ms)
+{
+    switch (fsm->state)
+    {
+        case MAINS_STATE_PRESENT:
+            return MAINS_EVENT_NONE;
+
+        case MAINS_STATE_CONFIRMING:
+            fsm->glitches++;
+            enter(fsm, MAINS_STATE_PRESENT, now_ms);
+            return MAINS_EVENT_GLITCH;
+
+        default:
+            // no cranking while it looks back, it may only be a flicker
+            if (!fsm->back)
+            {
+                fsm->back = true;
+                fsm->back_ms = now_ms;
+            }
+            if (now_ms - fsm->back_ms < fsm->config.restore_ms)
+                return MAINS_EVENT_NONE;
+            fsm->back = false;
+            enter(fsm, MAINS_STATE_PRESENT, now_ms);
+            return MAINS_EVENT_RESTORED;
+    }
+}
+
+void mains_fsm_init(mains_fsm_t * fsm, const mains_config_t * config, uint32_t now_ms)
+{
+    memset(fsm, 0, sizeof(mains_fsm_t));
+    fsm->config = *config;
+    enter(fsm, MAINS_STATE_PRESENT, now_ms);
+}
+
+mains_event_t mains_fsm_step(mains_fsm_t * fsm, uint32_t now_ms, bool mains, bool running)
+{
+    const mains_config_t * config = &fsm->config;
+
+    if (mains)
+        return mains_back(fsm, now_ms);
+    fsm->back = false;
+
+    if (!config->feedback)
+        running = false;
+
+    switch (fsm->state)
+    {
+        case MAINS_STATE_PRESENT:
+            fsm->lost_ms = now_ms;
+            fsm->attempt = 0;
+            enter(fsm, MAINS_STATE_CONFIRMING, now_ms);
+            return MAINS_EVENT_LOST;
+
+        case MAINS_STATE_CONFIRMING:
+            if (!elapsed(fsm, now_ms, config->confirm_ms))
+                return MAINS_EVENT_NONE;
+            fsm->outages++;
+            // started by hand within the window
+            if (running)
+            {
+                enter(fsm, MAINS_STATE_RUNNING, now_ms);
+                return MAINS_EVENT_RUNNING;
+            }
+            return crank(fsm, now_ms);
+
+        case MAINS_STATE_CRANKING:
+            if (running || (!config->feedback && elapsed(fsm, now_ms, config->check_ms)))
+            {
+                enter(fsm, MAINS_STATE_RUNNING, now_ms);
+                return MAINS_EVENT_RUNNING;
+            }
+            if (!elapsed(fsm, now_ms, config->check_ms))
+                return MAINS_EVENT_NONE;
+            if (fsm->attempt >= config->attempts)
+            {
+                enter(fsm, MAINS_STATE_LOCKOUT, now_ms);
+                return MAINS_EVENT_LOCKOUT;
+            }
+            enter(fsm, MAINS_STATE_COOLDOWN, now_ms);
+            return MAINS_EVENT_NOT_STARTED;
+
+        case MAINS_STATE_COOLDOWN:
+            if (running)
+            {
+                enter(fsm, MAINS_STATE_RUNNING, now_ms);
+                return MAINS_EVENT_RUNNING;
+            }
+            if (!elapsed(fsm, now_ms, config->cooldown_ms))
+                return MAINS_EVENT_NONE;
+            return crank(fsm, now_ms);
+
+        case MAINS_STATE_RUNNING:
+            if (running || !config->feedback)
+                return MAINS_EVENT_NONE;
+            // a fresh set of attempts after the cooldown
+            fsm->attempt = 0;
+            enter(fsm, MAINS_STATE_COOLDOWN, now_ms);
+            return MAINS_EVENT_STOPPED;
+
+        case MAINS_STATE_LOCKOUT:
+            // started by hand
+            if (running)
+            {
+                enter(fsm, MAINS_STATE_RUNNING, now_ms);
+                return MAINS_EVENT_RUNNING;
+            }
+            if (config->remind_ms == 0 || !elapsed(fsm, now_ms, config->remind_ms))
+                return MAINS_EVENT_NONE;
+            fsm->since_ms = now_ms;
+            return MAINS_EVENT_REMIND;
+    }
+    return MAINS_EVENT_NONE;
+}
+
+uint32_t mains_fsm_timeout(const mains_fsm_t * fsm, uint32_t now_ms)
+{
+    const mains_config_t * config = &fsm->config;
+    uint32_t since = fsm->since_ms;
+    uint32_t span;
+
+    if (fsm->back)
+    {
+        since = fsm->back_ms;
+        span = config->restore_ms;
+    }
+    else
+    {
+        switch (fsm->state)
+        {
+            case MAINS_STATE_CONFIRMING:
+                span = config->confirm_ms;
+                break;
+            case MAINS_STATE_CRANKING:
+                span = config->check_ms;
+                break;
+            case MAINS_STATE_COOLDOWN:
+                span = config->cooldown_ms;
+                break;
+            case MAINS_STATE_LOCKOUT:
+                if (config->remind_ms == 0)
+                    return UINT32_MAX;
+                span = config->remind_ms;
+                break;
+            default:
+                return UINT32_MAX;
+        }
+    }
+
+    uint32_t spent = now_ms - since;
+    return spent >= span ? 0 : span - spent;
+}
+
+const char * mains_state_name(mains_state_t state)
+{
+    return state < sizeof(state_names) / sizeof(*state_names) ? state_names[state] : "?";
+}
+
+bool mains_level_update(mains_level_t * level, int value)
+{
+    if (level->present ? value < level->off : value >= level->on)
+        level->present = !level->present;
+    return level->present;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Mains failure state machine, no IDF in here so the host simulator can
+ * drive it. The owner samples the inputs and calls mains_fsm_step, times
+ * are milliseconds of a free running clock, wrap around is fine. */
+
+typedef enum
+{
+    MAINS_STATE_PRESENT,
+    MAINS_STATE_CONFIRMING,
+    MAINS_STATE_CRANKING,
+    MAINS_STATE_COOLDOWN,
+    MAINS_STATE_RUNNING,
+    MAINS_STATE_LOCKOUT,
+} mains_state_t;
+
+typedef enum
+{
+    MAINS_EVENT_NONE,
+    MAINS_EVENT_LOST,        // the mains went away, the confirmation window starts
+    MAINS_EVENT_GLITCH,      // it came back within the window
+    MAINS_EVENT_CRANK,       // crank now, attempt tells which one
+    MAINS_EVENT_NOT_STARTED, // nothing running after a crank, cooling down
+    MAINS_EVENT_RUNNING,
+    MAINS_EVENT_STOPPED, // the generator stopped while the mains is still off
+    MAINS_EVENT_LOCKOUT, // out of attempts
+    MAINS_EVENT_REMIND,  // still locked out
+    MAINS_EVENT_RESTORED,
+} mains_event_t;
+
+typedef struct
+{
+    uint32_t confirm_ms;
+    // a crank fails if nothing runs that long after it
+    uint32_t check_ms;
+    uint32_t cooldown_ms;
+    // the mains has to stay back that long to end the outage
+    uint32_t restore_ms;
+    // 0 for no reminders in the lockout
+    uint32_t remind_ms;
+    int attempts;
+    // without a running input a crank is taken as a success after check_ms
+    bool feedback;
+} mains_config_t;
+
+typedef struct
+{
+    mains_config_t config;
+    mains_state_t state;
+    uint32_t since_ms;
+    uint32_t lost_ms;
+    uint32_t back_ms;
+    bool back;
+    int attempt;
+    uint32_t outages;
+    uint32_t glitches;
+} mains_fsm_t;
+
+void mains_fsm_init(mains_fsm_t * fsm, const mains_config_t * config, uint32_t now_ms);
+
+/* Feed the inputs sampled at now_ms. At most one event per call, step
+ * again right away after an event, the next one may already be due. */
+mains_event_t mains_fsm_step(mains_fsm_t * fsm, uint32_t now_ms, bool mains, bool running);
+
+/* Milliseconds until a step can do something without an input change,
+ * UINT32_MAX if only an input change can. */
+uint32_t mains_fsm_timeout(const mains_fsm_t * fsm, uint32_t now_ms);
+
+const char * mains_state_name(mains_state_t state);
+
+/* Two thresholds for an analog input, so noise around one does not chatter. */
+typedef struct
+{
+    int on;
+    int off;
+    bool present;
+} mains_level_t;
+
+bool mains_level_update(mains_level_t * level, int value);
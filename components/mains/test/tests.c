@@ -0,0 +1,462 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mains_fsm.h"
+
+// ----------------------------------------------------- Test "framework": ---
+
+#define done() return 0
+#define fail() return __LINE__
+static int checkqty = 0;
+#define check(x) \
+    do \
+    { \
+        ++checkqty; \
+        if (!(x)) \
+            fail(); \
+    } while (0)
+
+struct test
+{
+    int (*func)(void);
+    char const * name;
+};
+
+static int test_suit(struct test const * tests, int numtests)
+{
+    printf("%s", "\n\nTests:\n");
+    int failed = 0;
+    for (int i = 0; i < numtests; ++i)
+    {
+        printf(" %02d%s%-25s ", i, ": ", tests[i].name);
+        int linerr = tests[i].func();
+        if (0 == linerr)
+            printf("%s", "OK\n");
+        else
+        {
+            printf("%s%d\n", "Failed, line: ", linerr);
+            ++failed;
+        }
+    }
+    printf("\n%s%d\n", "Total checks: ", checkqty);
+    printf("%s[ %d / %d ]\r\n\n\n", "Tests PASS: ", numtests - failed, numtests);
+    return failed;
+}
+
+// ------------------------------------------------- Waveform simulator: ---
+
+/* The mains input is a list of edges, the generator answers the cranks:
+ * it runs start_ms after the crank that catches and may stop later on.
+ * The loop samples at a fixed period or, with sample_ms 0, wakes up on
+ * input edges and the state machine timeouts like the device task. */
+
+#define MAX_EDGES 64
+#define MAX_EVENTS 64
+
+typedef struct
+{
+    uint32_t at;
+    bool present;
+} edge_t;
+
+typedef struct
+{
+    mains_event_t event;
+    uint32_t at;
+    int attempt;
+} entry_t;
+
+typedef struct
+{
+    mains_fsm_t fsm;
+
+    edge_t edges[MAX_EDGES];
+    int edges_count;
+
+    // generator
+    int starts_on; // the attempt that catches, 0 for never
+    uint32_t start_ms;
+    uint32_t stops_at; // 0 for never
+    int cranks;
+    uint32_t running_at; // 0 while not running
+
+    // analog input, raw counts with noise instead of the edges as they are
+    bool analog;
+    mains_level_t level;
+    int noise;
+
+    entry_t events[MAX_EVENTS];
+    int events_count;
+    int steps;
+    uint32_t now;
+} sim_t;
+
+static const mains_config_t defaults = {
+    .confirm_ms = 30000,
+    .check_ms = 20000,
+    .cooldown_ms = 60000,
+    .restore_ms = 10000,
+    .remind_ms = 30 * 60000,
+    .attempts = 3,
+    .feedback = true,
+};
+
+static void sim_init(sim_t * sim, const mains_config_t * config)
+{
+    memset(sim, 0, sizeof(sim_t));
+    mains_fsm_init(&sim->fsm, config, 0);
+    sim->start_ms = 3000;
+    sim->level.on = 2000;
+    sim->level.off = 1200;
+    sim->level.present = true;
+}
+
+static void sim_edge(sim_t * sim, uint32_t at, bool present)
+{
+    sim->edges[sim->edges_count].at = at;
+    sim->edges[sim->edges_count].present = present;
+    sim->edges_count++;
+}
+
+/* Dropouts of off_ms every period_ms, a flickering grid. */
+static void sim_flicker(sim_t * sim, uint32_t from, int count, uint32_t off_ms, uint32_t period_ms)
+{
+    for (int i = 0; i < count; i++)
+    {
+        sim_edge(sim, from + i * period_ms, false);
+        sim_edge(sim, from + i * period_ms + off_ms, true);
+    }
+}
+
+static bool mains_at(const sim_t * sim, uint32_t t)
+{
+    bool present = true;
+    for (int i = 0; i < sim->edges_count && sim->edges[i].at <= t; i++)
+        present = sim->edges[i].present;
+    return present;
+}
+
+static bool running_at(const sim_t * sim, uint32_t t)
+{
+    if (sim->running_at == 0 || t < sim->running_at)
+        return false;
+    return sim->stops_at == 0 || t < sim->stops_at;
+}
+
+/* Rectified and smoothed sensor: a level around 2900 or 300, plus noise. */
+static bool sample_mains(sim_t * sim, uint32_t t)
+{
+    if (!sim->analog)
+        return mains_at(sim, t);
+
+    int raw = (mains_at(sim, t) ? 2900 : 300) + (sim->noise ? rand() % (2 * sim->noise + 1) - sim->noise : 0);
+    return mains_level_update(&sim->level, raw);
+}
+
+/* Earliest input change after t. */
+static uint32_t next_change(const sim_t * sim, uint32_t t)
+{
+    uint32_t next = UINT32_MAX;
+
+    for (int i = 0; i < sim->edges_count; i++)
+    {
+        if (sim->edges[i].at > t && sim->edges[i].at < next)
+            next = sim->edges[i].at;
+    }
+    if (sim->running_at > t && sim->running_at < next)
+        next = sim->running_at;
+    if (sim->stops_at > t && sim->stops_at < next)
+        next = sim->stops_at;
+    return next;
+}
+
+static void sim_run(sim_t * sim, uint32_t until, uint32_t sample_ms)
+{
+    uint32_t t = sim->now;
+
+    while (t <= until)
+    {
+        mains_event_t event = mains_fsm_step(&sim->fsm, t, sample_mains(sim, t), running_at(sim, t));
+        sim->steps++;
+
+        if (event != MAINS_EVENT_NONE)
+        {
+            if (sim->events_count < MAX_EVENTS)
+            {
+                entry_t * entry = &sim->events[sim->events_count++];
+                entry->event = event;
+                entry->at = t;
+                entry->attempt = sim->fsm.attempt;
+            }
+            if (event == MAINS_EVENT_CRANK && !running_at(sim, t))
+            {
+                sim->cranks++;
+                if (sim->starts_on && sim->cranks >= sim->starts_on)
+                {
+                    sim->running_at = t + sim->start_ms;
+                    // restarted after it stopped
+                    if (sim->stops_at <= t)
+                        sim->stops_at = 0;
+                }
+            }
+            // step again at the same time, like the device
+            continue;
+        }
+
+        if (sample_ms)
+            t += sample_ms;
+        else
+        {
+            uint32_t wait = mains_fsm_timeout(&sim->fsm, t);
+            uint32_t change = next_change(sim, t);
+            uint32_t next = wait == UINT32_MAX ? UINT32_MAX : t + wait;
+            if (change < next)
+                next = change;
+            if (next == UINT32_MAX || next > until)
+                break;
+            t = next;
+        }
+    }
+    sim->now = t;
+}
+
+static int count_events(const sim_t * sim, mains_event_t event)
+{
+    int count = 0;
+    for (int i = 0; i < sim->events_count; i++)
+        count += sim->events[i].event == event;
+    return count;
+}
+
+static const entry_t * find_event(const sim_t * sim, mains_event_t event, int nth)
+{
+    for (int i = 0; i < sim->events_count; i++)
+    {
+        if (sim->events[i].event == event && nth-- == 0)
+            return &sim->events[i];
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------- Unit tests: ---
+
+static int outage(void)
+{
+    static sim_t sim;
+    const entry_t * e;
+
+    sim_init(&sim, &defaults);
+    sim.starts_on = 1;
+    sim_edge(&sim, 1000, false);
+    sim_edge(&sim, 600000, true);
+    sim_run(&sim, 700000, 10);
+
+    check(sim.events_count == 4);
+    check(sim.events[0].event == MAINS_EVENT_LOST && sim.events[0].at == 1000);
+    e = &sim.events[1];
+    check(e->event == MAINS_EVENT_CRANK && e->attempt == 1);
+    // detection to crank is the window, the rest is the sampling
+    check(e->at - sim.fsm.lost_ms == defaults.confirm_ms);
+    check(sim.events[2].event == MAINS_EVENT_RUNNING && sim.events[2].at == e->at + sim.start_ms);
+    check(sim.events[3].event == MAINS_EVENT_RESTORED && sim.events[3].at == 600000 + defaults.restore_ms);
+    check(sim.fsm.state == MAINS_STATE_PRESENT);
+    check(sim.fsm.outages == 1 && sim.fsm.glitches == 0);
+    done();
+}
+
+static int flicker(void)
+{
+    static sim_t sim;
+
+    // 200 ms dropouts every 5 s for a minute, then a 29 s one
+    sim_init(&sim, &defaults);
+    sim.starts_on = 1;
+    sim_flicker(&sim, 1000, 12, 200, 5000);
+    sim_flicker(&sim, 100000, 1, 29000, 1);
+    sim_run(&sim, 200000, 10);
+
+    check(count_events(&sim, MAINS_EVENT_LOST) == 13);
+    check(count_events(&sim, MAINS_EVENT_GLITCH) == 13);
+    check(count_events(&sim, MAINS_EVENT_CRANK) == 0);
+    check(sim.fsm.glitches == 13 && sim.fsm.outages == 0);
+    done();
+}
+
+static int retries(void)
+{
+    static sim_t sim;
+    const entry_t * e;
+
+    // never starts
+    sim_init(&sim, &defaults);
+    sim_edge(&sim, 0, false);
+    sim_run(&sim, 2 * 3600 * 1000, 100);
+
+    check(count_events(&sim, MAINS_EVENT_CRANK) == 3);
+    check(count_events(&sim, MAINS_EVENT_NOT_STARTED) == 2);
+    check(count_events(&sim, MAINS_EVENT_LOCKOUT) == 1);
+    for (int i = 1; i < 3; i++)
+    {
+        const entry_t * prev = find_event(&sim, MAINS_EVENT_CRANK, i - 1);
+        e = find_event(&sim, MAINS_EVENT_CRANK, i);
+        check(e->attempt == i + 1);
+        check(e->at - prev->at == defaults.check_ms + defaults.cooldown_ms);
+    }
+    e = find_event(&sim, MAINS_EVENT_LOCKOUT, 0);
+    check(e->at == find_event(&sim, MAINS_EVENT_CRANK, 2)->at + defaults.check_ms);
+    // the alarm is repeated every 30 min
+    check(count_events(&sim, MAINS_EVENT_REMIND) == (int)((2 * 3600 * 1000 - e->at) / defaults.remind_ms));
+    check(find_event(&sim, MAINS_EVENT_REMIND, 0)->at == e->at + defaults.remind_ms);
+
+    // catches on the second crank
+    sim_init(&sim, &defaults);
+    sim.starts_on = 2;
+    sim_edge(&sim, 0, false);
+    sim_run(&sim, 3600 * 1000, 100);
+    check(count_events(&sim, MAINS_EVENT_CRANK) == 2);
+    check(count_events(&sim, MAINS_EVENT_LOCKOUT) == 0);
+    e = find_event(&sim, MAINS_EVENT_RUNNING, 0);
+    check(e && e->attempt == 2);
+    check(sim.fsm.state == MAINS_STATE_RUNNING);
+
+    // started by hand in the lockout
+    sim_init(&sim, &defaults);
+    sim_edge(&sim, 0, false);
+    sim_run(&sim, 3600 * 1000, 100);
+    sim.running_at = 3600 * 1000 + 500;
+    sim.events_count = 0;
+    sim_run(&sim, 3700 * 1000, 100);
+    check(sim.events_count == 1 && sim.events[0].event == MAINS_EVENT_RUNNING);
+    done();
+}
+
+static int restored(void)
+{
+    static sim_t sim;
+
+    // back in the cooldown: no more cranks
+    sim_init(&sim, &defaults);
+    sim_edge(&sim, 0, false);
+    sim_edge(&sim, 60000, true);
+    sim_run(&sim, 600000, 100);
+    check(count_events(&sim, MAINS_EVENT_CRANK) == 1);
+    check(find_event(&sim, MAINS_EVENT_RESTORED, 0)->at == 60000 + defaults.restore_ms);
+    check(sim.fsm.state == MAINS_STATE_PRESENT);
+
+    // a 5 s return does not end the outage, the retry only waits for it
+    sim_init(&sim, &defaults);
+    sim_edge(&sim, 0, false);
+    sim_edge(&sim, 100000, true);
+    sim_edge(&sim, 105000, false);
+    sim_run(&sim, 300000, 100);
+    check(count_events(&sim, MAINS_EVENT_RESTORED) == 0);
+    check(count_events(&sim, MAINS_EVENT_CRANK) == 3);
+    check(find_event(&sim, MAINS_EVENT_CRANK, 1)->at == 110000);
+    done();
+}
+
+static int stopped(void)
+{
+    static sim_t sim;
+
+    // runs for ten minutes and dies, the next crank catches again
+    sim_init(&sim, &defaults);
+    sim.starts_on = 1;
+    sim_edge(&sim, 0, false);
+    sim.stops_at = 630000;
+    sim_run(&sim, 700000, 100);
+    check(count_events(&sim, MAINS_EVENT_STOPPED) == 1);
+    check(find_event(&sim, MAINS_EVENT_STOPPED, 0)->at == 630000);
+    check(count_events(&sim, MAINS_EVENT_CRANK) == 2);
+    check(find_event(&sim, MAINS_EVENT_CRANK, 1)->at == 630000 + defaults.cooldown_ms);
+    check(find_event(&sim, MAINS_EVENT_CRANK, 1)->attempt == 1);
+
+    // no running input: one crank, taken as done
+    mains_config_t config = defaults;
+    config.feedback = false;
+    sim_init(&sim, &config);
+    sim_edge(&sim, 0, false);
+    sim_run(&sim, 3600 * 1000, 100);
+    check(count_events(&sim, MAINS_EVENT_CRANK) == 1);
+    check(find_event(&sim, MAINS_EVENT_RUNNING, 0)->at == defaults.confirm_ms + defaults.check_ms);
+    check(sim.events_count == 3);
+    done();
+}
+
+static int analog(void)
+{
+    static sim_t sim;
+
+    // noise of +-700 crosses a single threshold all the time, not the pair
+    srand(7);
+    sim_init(&sim, &defaults);
+    sim.analog = true;
+    sim.noise = 700;
+    sim.starts_on = 1;
+    sim_edge(&sim, 20000, false);
+    sim_edge(&sim, 300000, true);
+    sim_run(&sim, 400000, 10);
+    check(count_events(&sim, MAINS_EVENT_GLITCH) == 0);
+    check(count_events(&sim, MAINS_EVENT_LOST) == 1);
+    check(find_event(&sim, MAINS_EVENT_LOST, 0)->at == 20000);
+    check(count_events(&sim, MAINS_EVENT_CRANK) == 1);
+    check(count_events(&sim, MAINS_EVENT_RESTORED) == 1);
+
+    mains_level_t level = {.on = 2000, .off = 1200};
+    check(!mains_level_update(&level, 1999));
+    check(mains_level_update(&level, 2000));
+    check(mains_level_update(&level, 1200));
+    check(!mains_level_update(&level, 1199));
+    done();
+}
+
+static int tickless(void)
+{
+    static sim_t sim;
+    static sim_t sampled;
+
+    // woken by edges and timeouts only: the crank is exactly one window late
+    sim_init(&sim, &defaults);
+    sim.starts_on = 2;
+    sim_flicker(&sim, 1000, 3, 500, 2000);
+    sim_edge(&sim, 12345, false);
+    sim_edge(&sim, 900000, true);
+    sim_run(&sim, 4 * 3600 * 1000, 0);
+
+    check(find_event(&sim, MAINS_EVENT_CRANK, 0)->at == 12345 + defaults.confirm_ms);
+    check(find_event(&sim, MAINS_EVENT_RESTORED, 0)->at == 900000 + defaults.restore_ms);
+    check(count_events(&sim, MAINS_EVENT_GLITCH) == 3);
+    // a handful of wakeups for hours of simulated time
+    check(sim.steps < 40);
+
+    // same story sampled every 100 ms ends the same way
+    sim_init(&sampled, &defaults);
+    sampled.starts_on = 2;
+    memcpy(sampled.edges, sim.edges, sizeof(sim.edges));
+    sampled.edges_count = sim.edges_count;
+    sim_run(&sampled, 4 * 3600 * 1000, 100);
+    check(sampled.events_count == sim.events_count);
+    for (int i = 0; i < sim.events_count; i++)
+    {
+        check(sampled.events[i].event == sim.events[i].event);
+        check(sampled.events[i].at - sim.events[i].at < 100);
+    }
+    check(sampled.steps > 1000 * sim.steps);
+    done();
+}
+
+int main(void)
+{
+    static struct test const tests[] = {
+        {outage, "Outage"},
+        {flicker, "Flicker"},
+        {retries, "Retries and lockout"},
+        {restored, "Restored"},
+        {stopped, "Generator stopped"},
+        {analog, "Analog input"},
+        {tickless, "Edge driven loop"},
+    };
+    return test_suit(tests, sizeof tests / sizeof *tests);
+}
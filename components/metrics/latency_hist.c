@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include "latency_hist.h"
+
+// bot.c keeps 7 phases for each method, the size adds up
+_Static_assert(sizeof(latency_hist_t) == 216, "the size in latency_hist.h is out of date");
+
+static int bucket_index(uint32_t us)
+{
+    if (us < LATENCY_SUB_BUCKETS)
+        return us;
+
+    int msb = 31 - __builtin_clz(us);
+    if (msb >= LATENCY_MAX_BITS)
+        return LATENCY_BUCKETS - 1;
+
+    int shift = msb - LATENCY_SUB_BITS;
+    return (msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + ((us >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+/* The largest value that falls into the bucket. */
+static uint32_t bucket_upper_bound(int index)
+{
+    if (index < LATENCY_SUB_BUCKETS)
+        return index;
+
+    int msb = index / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+    int shift = msb - LATENCY_SUB_BITS;
+    uint32_t sub = index % LATENCY_SUB_BUCKETS;
+    return (((uint32_t)LATENCY_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void latency_hist_record(latency_hist_t * hist, uint32_t us)
+{
+    int index = bucket_index(us);
+    if (hist->counts[index] < UINT16_MAX)
+        hist->counts[index]++;
+    hist->total++;
+    if (us > hist->max_us)
+        hist->max_us = us;
+}
+
+uint32_t latency_hist_percentile(const latency_hist_t * hist, int percentile)
+{
+    uint32_t counted = 0;
+    uint64_t wanted = ((uint64_t)hist->total * percentile + 99) / 100;
+
+    if (hist->total == 0)
+        return 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        counted += hist->counts[i];
+        if (counted >= wanted)
+        {
+            uint32_t bound = bucket_upper_bound(i);
+            return bound < hist->max_us ? bound : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
+
+int latency_hist_format(const latency_hist_t * hist, char * buf, size_t size)
+{
+    if (hist->total == 0)
+        return snprintf(buf, size, "no data");
+
+    return snprintf(
+        buf,
+        size,
+        "n=%lu p50=%lu p90=%lu p99=%lu max=%lu ms",
+        (unsigned long)hist->total,
+        (unsigned long)latency_hist_percentile(hist, 50) / 1000,
+        (unsigned long)latency_hist_percentile(hist, 90) / 1000,
+        (unsigned long)latency_hist_percentile(hist, 99) / 1000,
+        (unsigned long)hist->max_us / 1000);
+}
+
+void latency_hist_dump(const latency_hist_t * hist, const char * name)
+{
+    printf("latency %s: %lu samples, max %lu us\n", name, (unsigned long)hist->total, (unsigned long)hist->max_us);
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        if (hist->counts[i] != 0)
+            printf("  <= %10lu us: %u\n", (unsigned long)bucket_upper_bound(i), hist->counts[i]);
+    }
+}
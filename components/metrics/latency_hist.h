@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fixed memory log-linear histogram of latencies in microseconds.
+ * Every power of two is split into 2^LATENCY_SUB_BITS linear buckets,
+ * so a recorded value is off by at most 1/2^LATENCY_SUB_BITS of itself.
+ * Values from 0 up to 2^LATENCY_MAX_BITS us (~134 s) are tracked, larger
+ * ones go into the last bucket. One histogram is 104 16 bit counts plus
+ * the total and the max, 216 bytes. */
+
+#define LATENCY_SUB_BITS 2
+#define LATENCY_MAX_BITS 27
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct
+{
+    uint16_t counts[LATENCY_BUCKETS]; // saturating
+    uint32_t total;
+    uint32_t max_us;
+} latency_hist_t;
+
+void latency_hist_record(latency_hist_t * hist, uint32_t us);
+
+/* Upper bound of the bucket holding the given percentile, 0 if empty. */
+uint32_t latency_hist_percentile(const latency_hist_t * hist, int percentile);
+
+/* One line summary: count, p50, p90, p99 and max in milliseconds. */
+int latency_hist_format(const latency_hist_t * hist, char * buf, size_t size);
+
+/* Print every non empty bucket to the console. */
+void latency_hist_dump(const latency_hist_t * hist, const char * name);
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_METRICS_HTTP_SERVER
+#    include "esp_http_server.h"
+#endif
+
+#include "metrics.h"
+
+#define CPU_LOAD_UNKNOWN 0xff
+// run time stats are only collected while the system has no more tasks than that
+#define METRICS_MAX_SYSTEM_TASKS 24
+
+static const char * TAG = "metrics";
+
+typedef struct
+{
+    uint32_t uptime_s;
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    uint32_t largest_block;
+    uint16_t stack_free[METRICS_MAX_TASKS];
+    uint8_t cpu_load[portNUM_PROCESSORS];
+} metrics_sample_t;
+
+static metrics_sample_t ring[CONFIG_METRICS_RING_SIZE];
+static int ring_next = 0;
+static int ring_count = 0;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t tasks[METRICS_MAX_TASKS];
+static int tasks_count = 0;
+
+// the latest sensor batch and when it came, under ring_lock
+static metrics_reading_t readings[METRICS_MAX_SENSORS];
+static int readings_count = 0;
+static uint32_t readings_at_s = 0;
+
+// cost of taking a sample, microseconds
+static uint32_t sample_last_us = 0;
+static uint32_t sample_max_us = 0;
+
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static TaskStatus_t system_state[METRICS_MAX_SYSTEM_TASKS];
+static uint32_t last_total_time = 0;
+static uint32_t last_idle_time[portNUM_PROCESSORS];
+
+static void sample_cpu_load(metrics_sample_t * sample)
+{
+    uint32_t total_time;
+    UBaseType_t count = uxTaskGetSystemState(system_state, METRICS_MAX_SYSTEM_TASKS, &total_time);
+    if (count == 0 || total_time == last_total_time)
+        return;
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        TaskHandle_t idle = xTaskGetIdleTaskHandleForCPU(core);
+        for (UBaseType_t i = 0; i < count; i++)
+        {
+            if (system_state[i].xHandle != idle)
+                continue;
+
+            uint32_t idle_delta = system_state[i].ulRunTimeCounter - last_idle_time[core];
+            uint32_t total_delta = total_time - last_total_time;
+            // the first sample has no previous one to compare with
+            if (last_total_time != 0 && idle_delta <= total_delta)
+                sample->cpu_load[core] = 100 - (uint64_t)idle_delta * 100 / total_delta;
+            last_idle_time[core] = system_state[i].ulRunTimeCounter;
+            break;
+        }
+    }
+    last_total_time = total_time;
+}
+#endif
+
+static void take_sample(void * arg)
+{
+    int64_t start = esp_timer_get_time();
+    metrics_sample_t sample;
+
+    sample.uptime_s = start / 1000000;
+    sample.free_heap = esp_get_free_heap_size();
+    sample.min_free_heap = esp_get_minimum_free_heap_size();
+    sample.largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    for (int i = 0; i < METRICS_MAX_TASKS; i++)
+        sample.stack_free[i] = i < tasks_count ? uxTaskGetStackHighWaterMark(tasks[i]) : 0;
+
+    memset(sample.cpu_load, CPU_LOAD_UNKNOWN, sizeof(sample.cpu_load));
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    sample_cpu_load(&sample);
+#endif
+
+    portENTER_CRITICAL(&ring_lock);
+    ring[ring_next] = sample;
+    ring_next = (ring_next + 1) % CONFIG_METRICS_RING_SIZE;
+    if (ring_count < CONFIG_METRICS_RING_SIZE)
+        ring_count++;
+    portEXIT_CRITICAL(&ring_lock);
+
+    sample_last_us = esp_timer_get_time() - start;
+    if (sample_last_us > sample_max_us)
+        sample_max_us = sample_last_us;
+}
+
+void metrics_register_task(TaskHandle_t task)
+{
+    if (task == NULL)
+        return;
+
+    if (tasks_count >= METRICS_MAX_TASKS)
+    {
+        ESP_LOGW(TAG, "too many tasks to watch, skipping %s", pcTaskGetName(task));
+        return;
+    }
+    tasks[tasks_count++] = task;
+}
+
+void metrics_record_sensors(const metrics_reading_t * batch, int count)
+{
+    if (count > METRICS_MAX_SENSORS)
+        count = METRICS_MAX_SENSORS;
+
+    portENTER_CRITICAL(&ring_lock);
+    memcpy(readings, batch, count * sizeof(metrics_reading_t));
+    readings_count = count;
+    readings_at_s = esp_timer_get_time() / 1000000;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+/* One line with the latest sensor batch, empty without sensors. */
+static int format_readings(char * buf, size_t size)
+{
+    metrics_reading_t batch[METRICS_MAX_SENSORS];
+    uint32_t at_s;
+    int count;
+    int pos = 0;
+
+    portENTER_CRITICAL(&ring_lock);
+    count = readings_count;
+    at_s = readings_at_s;
+    memcpy(batch, readings, sizeof(batch));
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (count == 0)
+        return 0;
+
+    pos += snprintf(buf + pos, size - pos, "\nsensors at %lu s:", (unsigned long)at_s);
+    for (int i = 0; i < count && pos < (int)size; i++)
+    {
+        if (batch[i].valid)
+            pos += snprintf(buf + pos, size - pos, " %s %.1f %s", batch[i].name, batch[i].value, batch[i].unit);
+        else
+            pos += snprintf(buf + pos, size - pos, " %s -", batch[i].name);
+    }
+    return pos;
+}
+
+int metrics_format(char * buf, size_t size)
+{
+    metrics_sample_t last;
+    uint32_t ring_min_heap = UINT32_MAX;
+    uint32_t ring_min_block = UINT32_MAX;
+    int count;
+
+    portENTER_CRITICAL(&ring_lock);
+    count = ring_count;
+    last = ring[(ring_next + CONFIG_METRICS_RING_SIZE - 1) % CONFIG_METRICS_RING_SIZE];
+    for (int i = 0; i < ring_count; i++)
+    {
+        if (ring[i].free_heap < ring_min_heap)
+            ring_min_heap = ring[i].free_heap;
+        if (ring[i].largest_block < ring_min_block)
+            ring_min_block = ring[i].largest_block;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (count == 0)
+        return snprintf(buf, size, "no samples yet");
+
+    int pos = snprintf(
+        buf,
+        size,
+        "uptime %lu s\nheap free %lu, min ever %lu, largest block %lu\n",
+        (unsigned long)last.uptime_s,
+        (unsigned long)last.free_heap,
+        (unsigned long)last.min_free_heap,
+        (unsigned long)last.largest_block);
+
+    for (int i = 0; i < tasks_count && pos < (int)size; i++)
+        pos += snprintf(buf + pos, size - pos, "stack free %s: %u\n", pcTaskGetName(tasks[i]), last.stack_free[i]);
+
+    for (int core = 0; core < portNUM_PROCESSORS && pos < (int)size; core++)
+    {
+        if (last.cpu_load[core] == CPU_LOAD_UNKNOWN)
+            continue;
+        pos += snprintf(buf + pos, size - pos, "cpu%d load %u%%\n", core, last.cpu_load[core]);
+    }
+
+    if (pos < (int)size)
+        pos += snprintf(
+            buf + pos,
+            size - pos,
+            "last %d samples: heap min %lu, largest block min %lu\nsampling took %lu us, max %lu us",
+            count,
+            (unsigned long)ring_min_heap,
+            (unsigned long)ring_min_block,
+            (unsigned long)sample_last_us,
+            (unsigned long)sample_max_us);
+    if (pos < (int)size)
+        pos += format_readings(buf + pos, size - pos);
+
+    return pos < (int)size ? pos : (int)size - 1;
+}
+
+#ifdef CONFIG_METRICS_HTTP_SERVER
+static esp_err_t metrics_get_handler(httpd_req_t * req)
+{
+    char buf[768];
+    int len = metrics_format(buf, sizeof(buf));
+
+    httpd_resp_set_type(req, "text/plain");
+    return httpd_resp_send(req, buf, len);
+}
+
+static void start_http_server(void)
+{
+    httpd_handle_t server = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_METRICS_HTTP_PORT;
+
+    if (httpd_start(&server, &config) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "could not start http server");
+        return;
+    }
+
+    httpd_uri_t metrics_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_get_handler,
+    };
+    httpd_register_uri_handler(server, &metrics_uri);
+}
+#endif
+
+void metrics_init(void)
+{
+    esp_timer_handle_t timer;
+    esp_timer_create_args_t args = {
+        .callback = take_sample,
+        .name = "metrics",
+    };
+
+    ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer, CONFIG_METRICS_PERIOD_S * 1000000ULL));
+    take_sample(NULL);
+
+#ifdef CONFIG_METRICS_HTTP_SERVER
+    start_http_server();
+#endif
+}
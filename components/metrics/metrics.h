@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define METRICS_MAX_TASKS 8
+#define METRICS_MAX_SENSORS 4
+
+typedef struct
+{
+    const char * name;
+    const char * unit;
+    float value;
+    bool valid;
+} metrics_reading_t;
+
+void metrics_init(void);
+
+/* Watch the stack high water mark of a task. */
+void metrics_register_task(TaskHandle_t task);
+
+/* Keep the latest batch of sensor readings, the names and units must be
+ * static. Shown with the samples. */
+void metrics_record_sensors(const metrics_reading_t * readings, int count);
+
+/* Print the latest sample and the extremes over the ring, returns the length. */
+int metrics_format(char * buf, size_t size);
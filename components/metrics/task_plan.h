@@ -0,0 +1,30 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+/* Where every task of the firmware runs. The wifi driver, lwip and the
+ * esp_timer task are on core 0, so is everything that talks to the network.
+ * Core 1 is left to what switches relays: a TLS handshake keeps its core
+ * busy for a second or more and must not sit between a button press and
+ * the relay. */
+#ifdef CONFIG_FREERTOS_UNICORE
+#    define TASK_CORE_NET 0
+#    define TASK_CORE_CONTROL 0
+#else
+#    define TASK_CORE_NET 0
+#    define TASK_CORE_CONTROL 1
+#endif
+
+// core 1, the button handler first, it has the tightest deadline
+#define TASK_PRIO_BUTTONS 10
+#define TASK_PRIO_MAINS 8
+#define TASK_PRIO_SCHEDULER 7
+
+// core 0, below lwip (18), esp_timer (22) and wifi (23)
+#define TASK_PRIO_BOT 5
+#define TASK_PRIO_HEALTH 4
+#define TASK_PRIO_OTA 3
+#define TASK_PRIO_SENSORS 2
+// flash erases stall the cache, everything else goes first
+#define TASK_PRIO_JOURNAL 1
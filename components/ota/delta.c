@@ -0,0 +1,243 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rom/miniz.h"
+
+#include "delta.h"
+
+#define DELTA_WINDOW (1 << DELTA_WINDOW_BITS)
+#define DELTA_CONTROL_SIZE 12
+#define DELTA_SOURCE_CHUNK 512
+
+typedef enum
+{
+    STATE_HEADER,
+    STATE_CONTROL,
+    STATE_DIFF,
+    STATE_EXTRA,
+} delta_state_t;
+
+struct delta_s
+{
+    delta_io_t io;
+    delta_state_t state;
+    uint8_t flags;
+    uint32_t target_size;
+    uint32_t source_size;
+    uint32_t written;
+    int64_t source_pos;
+    uint32_t diff_left;
+    uint32_t extra_left;
+    int32_t seek;
+
+    // header and control records may be split between reads
+    uint8_t head[DELTA_HEADER_SIZE];
+    size_t head_len;
+    uint8_t source_buf[DELTA_SOURCE_CHUNK];
+
+    // the rom inflater writes into a ring as big as the deflate window
+    tinfl_decompressor inflator;
+    tinfl_status inflate_status;
+    uint8_t window[DELTA_WINDOW];
+    size_t window_pos;
+};
+
+static uint32_t read_u32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static esp_err_t parse_header(delta_t * delta)
+{
+    const uint8_t * head = delta->head;
+
+    if (memcmp(head, DELTA_MAGIC, 4) != 0)
+        return ESP_ERR_INVALID_ARG;
+
+    delta->flags = head[4];
+    delta->target_size = read_u32(head + 8);
+    delta->source_size = read_u32(head + 12);
+    if (delta->flags & ~DELTA_FLAG_DEFLATE)
+        return ESP_ERR_NOT_SUPPORTED;
+    if (delta->source_size > delta->io.source_size)
+        return ESP_ERR_INVALID_SIZE;
+    // the patch was made for another image
+    if (memcmp(head + 16, delta->io.source_sha256, 32) != 0)
+        return ESP_ERR_INVALID_VERSION;
+    return ESP_OK;
+}
+
+static esp_err_t parse_control(delta_t * delta)
+{
+    delta->diff_left = read_u32(delta->head);
+    delta->extra_left = read_u32(delta->head + 4);
+    delta->seek = (int32_t)read_u32(delta->head + 8);
+
+    if ((uint64_t)delta->written + delta->diff_left + delta->extra_left > delta->target_size)
+        return ESP_ERR_INVALID_SIZE;
+    if (delta->source_pos < 0 || delta->source_pos + delta->diff_left > delta->source_size)
+        return ESP_ERR_INVALID_SIZE;
+    return ESP_OK;
+}
+
+/* Run the records through, data is the uncompressed record stream. */
+static esp_err_t apply_records(delta_t * delta, const uint8_t * data, size_t len)
+{
+    esp_err_t err = ESP_OK;
+
+    while (len > 0 && err == ESP_OK)
+    {
+        size_t n;
+
+        switch (delta->state)
+        {
+            case STATE_CONTROL:
+                n = DELTA_CONTROL_SIZE - delta->head_len;
+                if (n > len)
+                    n = len;
+                memcpy(delta->head + delta->head_len, data, n);
+                delta->head_len += n;
+                if (delta->head_len == DELTA_CONTROL_SIZE)
+                {
+                    delta->head_len = 0;
+                    delta->state = STATE_DIFF;
+                    err = parse_control(delta);
+                }
+                break;
+
+            case STATE_DIFF:
+                if (delta->diff_left == 0)
+                {
+                    delta->state = STATE_EXTRA;
+                    continue;
+                }
+                n = delta->diff_left < DELTA_SOURCE_CHUNK ? delta->diff_left : DELTA_SOURCE_CHUNK;
+                if (n > len)
+                    n = len;
+                err = delta->io.read_source(delta->io.ctx, delta->source_pos, delta->source_buf, n);
+                if (err != ESP_OK)
+                    break;
+                for (size_t i = 0; i < n; i++)
+                    delta->source_buf[i] += data[i];
+                err = delta->io.write_target(delta->io.ctx, delta->source_buf, n);
+                delta->source_pos += n;
+                delta->diff_left -= n;
+                delta->written += n;
+                break;
+
+            case STATE_EXTRA:
+                if (delta->extra_left == 0)
+                {
+                    delta->source_pos += delta->seek;
+                    delta->state = STATE_CONTROL;
+                    continue;
+                }
+                n = delta->extra_left < len ? delta->extra_left : len;
+                err = delta->io.write_target(delta->io.ctx, data, n);
+                delta->extra_left -= n;
+                delta->written += n;
+                break;
+
+            default:
+                return ESP_ERR_INVALID_STATE;
+        }
+        data += n;
+        len -= n;
+    }
+    return err;
+}
+
+static esp_err_t inflate_records(delta_t * delta, const uint8_t * data, size_t len)
+{
+    while (true)
+    {
+        size_t in_bytes = len;
+        size_t out_bytes = DELTA_WINDOW - delta->window_pos;
+        tinfl_status status = tinfl_decompress(
+            &delta->inflator,
+            data,
+            &in_bytes,
+            delta->window,
+            delta->window + delta->window_pos,
+            &out_bytes,
+            TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_bytes;
+        len -= in_bytes;
+        delta->inflate_status = status;
+
+        if (status < TINFL_STATUS_DONE)
+            return ESP_ERR_INVALID_RESPONSE;
+
+        esp_err_t err = apply_records(delta, delta->window + delta->window_pos, out_bytes);
+        if (err != ESP_OK)
+            return err;
+        delta->window_pos = (delta->window_pos + out_bytes) & (DELTA_WINDOW - 1);
+
+        if (status == TINFL_STATUS_DONE)
+            return len == 0 ? ESP_OK : ESP_ERR_INVALID_SIZE;
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT && len == 0)
+            return ESP_OK;
+    }
+}
+
+delta_t * delta_begin(const delta_io_t * io)
+{
+    delta_t * delta = calloc(1, sizeof(delta_t));
+    if (delta == NULL)
+        return NULL;
+
+    delta->io = *io;
+    delta->state = STATE_HEADER;
+    tinfl_init(&delta->inflator);
+    delta->inflate_status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    return delta;
+}
+
+esp_err_t delta_feed(delta_t * delta, const uint8_t * data, size_t len)
+{
+    if (delta->state == STATE_HEADER)
+    {
+        size_t n = DELTA_HEADER_SIZE - delta->head_len;
+        if (n > len)
+            n = len;
+        memcpy(delta->head + delta->head_len, data, n);
+        delta->head_len += n;
+        data += n;
+        len -= n;
+        if (delta->head_len < DELTA_HEADER_SIZE)
+            return ESP_OK;
+
+        esp_err_t err = parse_header(delta);
+        if (err != ESP_OK)
+            return err;
+        delta->head_len = 0;
+        delta->state = STATE_CONTROL;
+    }
+
+    if (len == 0)
+        return ESP_OK;
+    if (delta->flags & DELTA_FLAG_DEFLATE)
+        return inflate_records(delta, data, len);
+    return apply_records(delta, data, len);
+}
+
+esp_err_t delta_end(delta_t * delta)
+{
+    if (delta->state == STATE_HEADER || delta->written != delta->target_size)
+        return ESP_ERR_INVALID_SIZE;
+    if (delta->diff_left || delta->extra_left)
+        return ESP_ERR_INVALID_SIZE;
+    if ((delta->flags & DELTA_FLAG_DEFLATE) && delta->inflate_status != TINFL_STATUS_DONE)
+        return ESP_ERR_INVALID_SIZE;
+    return ESP_OK;
+}
+
+size_t delta_written(const delta_t * delta)
+{
+    return delta->written;
+}
+
+void delta_free(delta_t * delta)
+{
+    free(delta);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Streaming patcher for delta updates made by tools/mkdelta.py.
+ *
+ * A patch is a 48 byte header followed by bsdiff style records, the records
+ * may be raw deflated with a 4K window:
+ *
+ *   "RDP1", u8 flags, 3 reserved, u32 target size, u32 source size,
+ *   32 bytes of the source app_elf_sha256
+ *   { u32 diff len, u32 extra len, i32 seek, diff bytes, extra bytes } ...
+ *
+ * diff bytes are added to the source image at the current source offset,
+ * extra bytes are copied as is, then the source offset moves by seek.
+ * All integers are little endian. The source is the running partition, the
+ * target goes to esp_ota_write as it is produced. Both are reached through
+ * delta_io_t, so the patcher itself runs on the host too. */
+
+#define DELTA_MAGIC "RDP1"
+#define DELTA_HEADER_SIZE 48
+#define DELTA_FLAG_DEFLATE 0x01
+#define DELTA_WINDOW_BITS 12
+
+typedef struct delta_s delta_t;
+
+typedef struct
+{
+    void * ctx;
+    esp_err_t (*read_source)(void * ctx, size_t offset, uint8_t * buf, size_t len);
+    esp_err_t (*write_target)(void * ctx, const uint8_t * data, size_t len);
+    // app_elf_sha256 of the source, a patch made for another image is refused
+    const uint8_t * source_sha256;
+    size_t source_size;
+} delta_io_t;
+
+delta_t * delta_begin(const delta_io_t * io);
+
+/* Feed the next patch bytes as they arrive, in pieces of any size. */
+esp_err_t delta_feed(delta_t * delta, const uint8_t * data, size_t len);
+
+/* Check that the whole target has been produced. */
+esp_err_t delta_end(delta_t * delta);
+
+size_t delta_written(const delta_t * delta);
+
+void delta_free(delta_t * delta);
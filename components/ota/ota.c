@@ -0,0 +1,360 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_app_desc.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "delta.h"
+#include "journal.h"
+#include "ota.h"
+#include "resume.h"
+#include "task_plan.h"
+
+#define OTA_HTTP_TIMEOUT_MS 10000
+#define OTA_REPORT_SIZE 160
+#define OTA_PROGRESS_STEP (256 * 1024)
+
+static const char * TAG = "ota";
+
+// the only CA the update server may be signed by, see ota_server_ca.pem
+extern const char ota_server_ca_start[] asm("_binary_ota_server_ca_pem_start");
+extern const char ota_server_ca_end[] asm("_binary_ota_server_ca_pem_end");
+
+typedef struct
+{
+    char * url;
+    ota_report_t report;
+    esp_ota_handle_t handle;
+    const esp_partition_t * running;
+} ota_job_t;
+
+static volatile bool ota_running = false;
+static volatile bool pending_verify = false;
+static esp_timer_handle_t confirm_timer;
+
+static void report(ota_job_t * job, const char * fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void report(ota_job_t * job, const char * fmt, ...)
+{
+    char text[OTA_REPORT_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    ESP_LOGI(TAG, "%s", text);
+    if (job->report)
+        job->report(text);
+}
+
+static esp_err_t read_running(void * ctx, size_t offset, uint8_t * buf, size_t len)
+{
+    ota_job_t * job = ctx;
+    return esp_partition_read(job->running, offset, buf, len);
+}
+
+static esp_err_t write_update(void * ctx, const uint8_t * data, size_t len)
+{
+    ota_job_t * job = ctx;
+    return esp_ota_write(job->handle, data, len);
+}
+
+/* Request the rest of the image, resume.c tells from where and what to
+ * throw away of the answer. */
+static esp_err_t open_rest(esp_http_client_handle_t client, resume_t * resume)
+{
+    char range[32];
+
+    if (resume_range(resume, range, sizeof(range)))
+        esp_http_client_set_header(client, "Range", range);
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK)
+        return err;
+
+    int64_t length = esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+    err = resume_response(resume, status, length);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "unexpected status %d", status);
+        esp_http_client_close(client);
+    }
+    else if (resume->skip > 0)
+        ESP_LOGW(TAG, "server ignores ranges, skipping %d bytes", resume->skip);
+    else if (resume->resumed_at > 0)
+        ESP_LOGI(TAG, "resuming at %d", resume->resumed_at);
+    return err;
+}
+
+static void ota_task(void * pv)
+{
+    ota_job_t * job = pv;
+    esp_ota_handle_t handle = 0;
+    esp_http_client_handle_t client = NULL;
+    char * chunk = NULL;
+    delta_t * delta = NULL;
+    size_t free_before = esp_get_free_heap_size();
+    size_t free_min = free_before;
+
+    const esp_partition_t * partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL)
+    {
+        report(job, "update failed: no ota partition");
+        goto out;
+    }
+
+    // sequential writes erase the partition sector by sector as data arrives
+    esp_err_t err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle);
+    if (err != ESP_OK)
+    {
+        report(job, "update failed: %s", esp_err_to_name(err));
+        goto out;
+    }
+
+    chunk = malloc(CONFIG_OTA_CHUNK_SIZE);
+    esp_http_client_config_t config = {
+        .url = job->url,
+        .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+        .keep_alive_enable = true,
+        .cert_pem = ota_server_ca_start,
+        // a redirect could lead off the pinned server to plain http
+        .disable_auto_redirect = true,
+    };
+    client = esp_http_client_init(&config);
+    if (chunk == NULL || client == NULL)
+    {
+        report(job, "update failed: out of memory");
+        esp_ota_abort(handle);
+        goto out;
+    }
+
+    report(job, "downloading into %s", partition->label);
+
+    resume_t resume;
+    int written = 0;
+    int next_progress = OTA_PROGRESS_STEP;
+    bool complete = false;
+    int64_t started = esp_timer_get_time();
+
+    resume_init(&resume, CONFIG_OTA_RESUME_ATTEMPTS);
+    while (!complete)
+    {
+        err = open_rest(client, &resume);
+        while (err == ESP_OK)
+        {
+            int len = esp_http_client_read(client, chunk, CONFIG_OTA_CHUNK_SIZE);
+            if (len < 0)
+            {
+                err = ESP_FAIL;
+                break;
+            }
+            if (len == 0)
+            {
+                if (esp_http_client_is_complete_data_received(client))
+                    complete = true;
+                else
+                    err = ESP_ERR_TIMEOUT;
+                break;
+            }
+
+            int drop = resume_drop(&resume, len);
+            if (len == drop)
+                continue;
+
+            const uint8_t * data = (uint8_t *)chunk + drop;
+            len -= drop;
+
+            // a patch against the running image instead of a full one
+            if (resume.received == 0 && len >= 4 && memcmp(data, DELTA_MAGIC, 4) == 0)
+            {
+                job->handle = handle;
+                job->running = esp_ota_get_running_partition();
+                delta_io_t io = {
+                    .ctx = job,
+                    .read_source = read_running,
+                    .write_target = write_update,
+                    .source_sha256 = esp_app_get_description()->app_elf_sha256,
+                    .source_size = job->running->size,
+                };
+                delta = delta_begin(&io);
+                if (delta == NULL)
+                    err = ESP_ERR_NO_MEM;
+                else
+                    ESP_LOGI(TAG, "the image is a patch against %s", job->running->label);
+            }
+
+            if (err == ESP_OK)
+                err = delta ? delta_feed(delta, data, len) : esp_ota_write(handle, data, len);
+            if (err != ESP_OK)
+            {
+                // a bad image does not get better on retry
+                if (err == ESP_ERR_INVALID_VERSION)
+                    report(job, "update failed: the patch was made for another image");
+                else
+                    report(job, "update failed: %s at %d", esp_err_to_name(err), resume.received);
+                esp_http_client_close(client);
+                esp_ota_abort(handle);
+                goto out;
+            }
+            resume_advance(&resume, len);
+            written = delta ? (int)delta_written(delta) : resume.received;
+
+            size_t free_now = esp_get_free_heap_size();
+            if (free_now < free_min)
+                free_min = free_now;
+
+            if (resume.received >= next_progress)
+            {
+                ESP_LOGI(TAG, "%d of %d bytes, %d written", resume.received, resume.total, written);
+                next_progress += OTA_PROGRESS_STEP;
+            }
+        }
+        esp_http_client_close(client);
+
+        if (complete)
+            break;
+
+        int delay_ms;
+        if (!resume_interrupted(&resume, &delay_ms))
+        {
+            report(job, "update failed: %s after %d bytes", esp_err_to_name(err), resume.received);
+            esp_ota_abort(handle);
+            goto out;
+        }
+        ESP_LOGW(TAG, "download interrupted at %d: %s", resume.received, esp_err_to_name(err));
+        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+    }
+
+    int64_t elapsed_us = esp_timer_get_time() - started;
+
+    // esp_ota_end checks the image header and its sha256
+    err = delta ? delta_end(delta) : ESP_OK;
+    if (err == ESP_OK)
+        err = esp_ota_end(handle);
+    else
+        esp_ota_abort(handle);
+    if (err == ESP_OK)
+        err = esp_ota_set_boot_partition(partition);
+    if (err != ESP_OK)
+    {
+        report(job, "update failed: %s", esp_err_to_name(err));
+        goto out;
+    }
+
+    report(
+        job,
+        "update done: %d bytes%s for a %d byte image in %lld ms, %lld KB/s, %d interruptions, peak ram %u bytes. Rebooting",
+        resume.received,
+        delta ? " of patch" : "",
+        written,
+        elapsed_us / 1000,
+        elapsed_us > 0 ? (int64_t)resume.received * 1000000 / 1024 / elapsed_us : 0,
+        resume.interruptions,
+        (unsigned)(free_before - free_min));
+    journal_log(JOURNAL_NOTE, "ota %s %d bytes into %s", delta ? "delta" : "full", resume.received, partition->label);
+
+    esp_http_client_cleanup(client);
+    delta_free(delta);
+    free(chunk);
+    free(job->url);
+    free(job);
+
+    // let the report go out first, the journal is flushed on restart
+    vTaskDelay(pdMS_TO_TICKS(5000));
+    esp_restart();
+
+out:
+    if (client)
+        esp_http_client_cleanup(client);
+    delta_free(delta);
+    free(chunk);
+    free(job->url);
+    free(job);
+    ota_running = false;
+    vTaskDelete(NULL);
+}
+
+static bool ca_pinned(void)
+{
+    return strstr(ota_server_ca_start, "-----BEGIN CERTIFICATE-----") != NULL;
+}
+
+esp_err_t ota_start(const char * url, ota_report_t report)
+{
+    if (strncmp(url, "https://", 8) != 0)
+        return ESP_ERR_INVALID_ARG;
+    if (!ca_pinned())
+        return ESP_ERR_NOT_SUPPORTED;
+    if (ota_running)
+        return ESP_ERR_INVALID_STATE;
+
+    ota_job_t * job = malloc(sizeof(ota_job_t));
+    if (job == NULL)
+        return ESP_ERR_NO_MEM;
+
+    job->url = strdup(url);
+    job->report = report;
+    if (job->url == NULL)
+    {
+        free(job);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ota_running = true;
+    if (xTaskCreatePinnedToCore(&ota_task, "ota", 8192, job, TASK_PRIO_OTA, NULL, TASK_CORE_NET) != pdPASS)
+    {
+        ota_running = false;
+        free(job->url);
+        free(job);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static void confirm_timeout_callback(void * arg)
+{
+    ESP_LOGE(TAG, "new image did not reach the api, rolling back");
+    journal_log(JOURNAL_NOTE, "ota rollback: not confirmed");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+void ota_init(void)
+{
+    const esp_partition_t * running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+
+    if (esp_ota_get_state_partition(running, &state) != ESP_OK || state != ESP_OTA_IMG_PENDING_VERIFY)
+        return;
+
+    ESP_LOGW(TAG, "first boot of the image in %s, waiting for confirmation", running->label);
+    pending_verify = true;
+
+    esp_timer_create_args_t args = {
+        .callback = confirm_timeout_callback,
+        .name = "ota confirm",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &confirm_timer));
+    ESP_ERROR_CHECK(esp_timer_start_once(confirm_timer, CONFIG_OTA_CONFIRM_TIMEOUT_S * 1000000ULL));
+}
+
+void ota_mark_valid(void)
+{
+    if (!pending_verify)
+        return;
+    pending_verify = false;
+
+    esp_timer_stop(confirm_timer);
+    esp_ota_mark_app_valid_cancel_rollback();
+    journal_log(JOURNAL_NOTE, "ota image confirmed");
+    ESP_LOGI(TAG, "image confirmed");
+}
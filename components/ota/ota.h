@@ -0,0 +1,23 @@
+#pragma once
+
+#include "esp_err.h"
+
+/* Firmware update into the spare ota partition. The image is streamed
+ * straight to flash, an interrupted download continues from the last
+ * written byte. */
+
+typedef void (*ota_report_t)(char * text);
+
+/* Check whether this is the first boot of a new image and arm the rollback
+ * timer if it is. */
+void ota_init(void);
+
+/* Start downloading url in the background, report gets the outcome.
+ * Reboots into the new image when it is complete and valid. Only https urls
+ * of a server signed by the CA in ota_server_ca.pem are accepted, returns
+ * ESP_ERR_INVALID_ARG for any other url and ESP_ERR_NOT_SUPPORTED when the
+ * firmware was built without a CA. */
+esp_err_t ota_start(const char * url, ota_report_t report);
+
+/* The running image works, cancel the rollback. */
+void ota_mark_valid(void);
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "resume.h"
+
+void resume_init(resume_t * resume, int max_attempts)
+{
+    memset(resume, 0, sizeof(resume_t));
+    resume->max_attempts = max_attempts;
+    resume->total = -1;
+}
+
+bool resume_range(resume_t * resume, char * buf, size_t size)
+{
+    resume->resumed_at = resume->received;
+    resume->skip = 0;
+    if (resume->received == 0)
+        return false;
+    snprintf(buf, size, "bytes=%d-", resume->received);
+    return true;
+}
+
+esp_err_t resume_response(resume_t * resume, int status, int64_t length)
+{
+    if (status == 206 && resume->resumed_at > 0)
+        return ESP_OK;
+    if (status != 200)
+        return ESP_ERR_INVALID_RESPONSE;
+
+    // the whole image again, from the start
+    resume->skip = resume->resumed_at;
+    resume->total = length;
+    return ESP_OK;
+}
+
+int resume_drop(resume_t * resume, int len)
+{
+    int drop = resume->skip < len ? resume->skip : len;
+    resume->skip -= drop;
+    return drop;
+}
+
+void resume_advance(resume_t * resume, int len)
+{
+    resume->received += len;
+}
+
+bool resume_interrupted(resume_t * resume, int * delay_ms)
+{
+    resume->interruptions++;
+    // only interruptions without any progress count against the limit
+    if (resume->received > resume->resumed_at)
+        resume->attempts = 0;
+    if (++resume->attempts > resume->max_attempts)
+        return false;
+    *delay_ms = 2000 * resume->attempts;
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Bookkeeping of a download that continues after interruptions, no IDF in
+ * here. Every request after the first asks for the rest of the image with a
+ * Range header. A server that ignores it sends the whole image again and
+ * the part that was already received is thrown away. The download is given
+ * up after max_attempts interruptions in a row without any progress. */
+
+typedef struct
+{
+    int max_attempts;
+    // bytes of the image received and kept
+    int received;
+    // from the first full response, -1 until then
+    int total;
+    // received when the current request went out
+    int resumed_at;
+    // bytes of the current response to throw away
+    int skip;
+    // interruptions in a row without progress
+    int attempts;
+    int interruptions;
+} resume_t;
+
+void resume_init(resume_t * resume, int max_attempts);
+
+/* The Range header of the next request. Returns false if it needs none. */
+bool resume_range(resume_t * resume, char * buf, size_t size);
+
+/* The status and Content-Length of the response. Returns
+ * ESP_ERR_INVALID_RESPONSE if it cannot be used. */
+esp_err_t resume_response(resume_t * resume, int status, int64_t length);
+
+/* How many of the len bytes that just arrived are thrown away. */
+int resume_drop(resume_t * resume, int len);
+
+/* len more bytes of the image were written. */
+void resume_advance(resume_t * resume, int len);
+
+/* The response broke off. Returns false if the download is given up,
+ * otherwise *delay_ms is how long to wait before the next request. */
+bool resume_interrupted(resume_t * resume, int * delay_ms);
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+/* The part of the rom inflater delta.c uses, on top of zlib. Like tinfl it
+ * writes into a ring: out_start is the ring, out_next where to continue,
+ * and the ring ends right after out_next + out_bytes. The ring size must be
+ * a power of two and the stream must not reach back further than the ring,
+ * zlib is opened with that window so it fails where tinfl would corrupt. */
+
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+
+typedef enum
+{
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+typedef struct
+{
+    z_stream z;
+    int opened;
+    size_t ring_size;
+} tinfl_decompressor;
+
+// how often the output went around the ring, defined by the tests
+extern int tinfl_ring_wraps;
+
+#define tinfl_init(r) \
+    do \
+    { \
+        (r)->opened = 0; \
+    } while (0)
+
+static inline tinfl_status tinfl_decompress(
+    tinfl_decompressor * r,
+    const uint8_t * in,
+    size_t * in_bytes,
+    uint8_t * out_start,
+    uint8_t * out_next,
+    size_t * out_bytes,
+    const uint32_t flags)
+{
+    size_t ring_size = (out_next - out_start) + *out_bytes;
+    if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0)
+        return TINFL_STATUS_BAD_PARAM;
+
+    if (!r->opened)
+    {
+        int bits = 0;
+        while ((1u << bits) < ring_size)
+            bits++;
+        memset(&r->z, 0, sizeof(r->z));
+        if (inflateInit2(&r->z, -bits) != Z_OK)
+            return TINFL_STATUS_FAILED;
+        r->opened = 1;
+        r->ring_size = ring_size;
+    }
+    if (ring_size != r->ring_size)
+        return TINFL_STATUS_BAD_PARAM;
+
+    r->z.next_in = (uint8_t *)in;
+    r->z.avail_in = *in_bytes;
+    r->z.next_out = out_next;
+    r->z.avail_out = *out_bytes;
+    int ret = inflate(&r->z, Z_NO_FLUSH);
+    *in_bytes -= r->z.avail_in;
+    *out_bytes -= r->z.avail_out;
+    if (*out_bytes > 0 && out_next + *out_bytes == out_start + ring_size)
+        tinfl_ring_wraps++;
+
+    if (ret == Z_STREAM_END)
+    {
+        inflateEnd(&r->z);
+        r->opened = 0;
+        return TINFL_STATUS_DONE;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+        inflateEnd(&r->z);
+        r->opened = 0;
+        return TINFL_STATUS_FAILED;
+    }
+    if (r->z.avail_out == 0)
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    return TINFL_STATUS_NEEDS_MORE_INPUT;
+}
@@ -0,0 +1,525 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "delta.h"
+#include "resume.h"
+
+// ----------------------------------------------------- Test "framework": ---
+
+#define done() return 0
+#define fail() return __LINE__
+static int checkqty = 0;
+#define check(x) \
+    do \
+    { \
+        ++checkqty; \
+        if (!(x)) \
+            fail(); \
+    } while (0)
+
+struct test
+{
+    int (*func)(void);
+    char const * name;
+};
+
+static int test_suit(struct test const * tests, int numtests)
+{
+    printf("%s", "\n\nTests:\n");
+    int failed = 0;
+    for (int i = 0; i < numtests; ++i)
+    {
+        printf(" %02d%s%-25s ", i, ": ", tests[i].name);
+        int linerr = tests[i].func();
+        if (0 == linerr)
+            printf("%s", "OK\n");
+        else
+        {
+            printf("%s%d\n", "Failed, line: ", linerr);
+            ++failed;
+        }
+    }
+    printf("\n%s%d\n", "Total checks: ", checkqty);
+    printf("%s[ %d / %d ]\r\n\n\n", "Tests PASS: ", numtests - failed, numtests);
+    return failed;
+}
+
+// ---------------------------------------------------------- The images: ---
+
+/* Two app images made up here, the patches between them are made by
+ * tools/mkdelta.py like for a real update. The new image moves code
+ * around, changes bytes here and there and adds new code, the things a
+ * rebuild does. */
+
+#define MKDELTA "python3 ../../../tools/mkdelta.py"
+#define OLD_SIZE (160 * 1024)
+#define NEW_MAX (OLD_SIZE + 8 * 1024)
+#define APP_DESC_OFFSET 32
+#define ELF_SHA256_OFFSET (APP_DESC_OFFSET + 144)
+
+int tinfl_ring_wraps = 0;
+
+static uint8_t old_image[OLD_SIZE];
+static uint8_t new_image[NEW_MAX];
+static size_t new_size;
+
+static uint32_t random_state = 12345;
+
+static uint8_t random_byte(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void append_random(size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        new_image[new_size++] = random_byte();
+}
+
+static void append_old(size_t from, size_t len)
+{
+    memcpy(new_image + new_size, old_image + from, len);
+    new_size += len;
+}
+
+static void make_images(void)
+{
+    for (size_t i = 0; i < OLD_SIZE; i++)
+        old_image[i] = random_byte();
+    old_image[0] = 0xE9;
+    // app descriptor magic, mkdelta.py checks it
+    old_image[APP_DESC_OFFSET + 0] = 0x32;
+    old_image[APP_DESC_OFFSET + 1] = 0x54;
+    old_image[APP_DESC_OFFSET + 2] = 0xCD;
+    old_image[APP_DESC_OFFSET + 3] = 0xAB;
+
+    new_size = 0;
+    append_old(0, ELF_SHA256_OFFSET);
+    append_random(32);
+    append_old(ELF_SHA256_OFFSET + 32, 30000 - ELF_SHA256_OFFSET - 32);
+    // new code
+    append_random(700);
+    // changed addresses, an approximate match
+    size_t changed = new_size;
+    append_old(30000, 40000);
+    for (size_t i = changed; i < new_size; i += 997)
+        new_image[i] += 3;
+    // removed code
+    append_old(71200, 78800);
+    // a moved function
+    append_old(10000, 2000);
+    append_old(150000, OLD_SIZE - 150000);
+    append_random(3000);
+}
+
+static bool write_file(const char * path, const uint8_t * data, size_t len)
+{
+    FILE * f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+    bool ok = fwrite(data, 1, len, f) == len;
+    return fclose(f) == 0 && ok;
+}
+
+static uint8_t * read_file(const char * path, size_t * len)
+{
+    FILE * f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t * data = malloc(*len);
+    if (data && fread(data, 1, *len, f) != *len)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static uint8_t * make_patch(const char * options, size_t * len)
+{
+    char command[160];
+
+    if (!write_file("old.bin", old_image, OLD_SIZE) || !write_file("new.bin", new_image, new_size))
+        return NULL;
+    snprintf(command, sizeof(command), MKDELTA " diff %s old.bin new.bin patch.rdp > /dev/null", options);
+    if (system(command) != 0)
+        return NULL;
+    return read_file("patch.rdp", len);
+}
+
+// ---------------------------------------------------------- The patcher: ---
+
+static uint8_t target[NEW_MAX];
+static size_t target_len;
+
+static esp_err_t read_source(void * ctx, size_t offset, uint8_t * buf, size_t len)
+{
+    if (offset + len > OLD_SIZE)
+        return ESP_ERR_INVALID_ARG;
+    memcpy(buf, old_image + offset, len);
+    return ESP_OK;
+}
+
+static esp_err_t write_target(void * ctx, const uint8_t * data, size_t len)
+{
+    if (target_len + len > NEW_MAX)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(target + target_len, data, len);
+    target_len += len;
+    return ESP_OK;
+}
+
+/* Run a patch through like ota.c does, in pieces of chunk bytes. */
+static esp_err_t apply(const uint8_t * patch, size_t len, size_t chunk, const uint8_t * sha256)
+{
+    delta_io_t io = {
+        .read_source = read_source,
+        .write_target = write_target,
+        .source_sha256 = sha256 ? sha256 : old_image + ELF_SHA256_OFFSET,
+        .source_size = OLD_SIZE,
+    };
+    delta_t * delta = delta_begin(&io);
+    if (delta == NULL)
+        return ESP_ERR_NO_MEM;
+
+    target_len = 0;
+    esp_err_t err = ESP_OK;
+    for (size_t pos = 0; pos < len && err == ESP_OK; pos += chunk)
+        err = delta_feed(delta, patch + pos, len - pos < chunk ? len - pos : chunk);
+    if (err == ESP_OK)
+        err = delta_end(delta);
+    if (err == ESP_OK && delta_written(delta) != target_len)
+        err = ESP_FAIL;
+    delta_free(delta);
+    return err;
+}
+
+static bool target_is_new(void)
+{
+    return target_len == new_size && memcmp(target, new_image, new_size) == 0;
+}
+
+// ---------------------------------------------------------------- Tests: ---
+
+static const size_t chunks[] = {1, 13, 4096, 1 << 30};
+
+static int raw_patch(void)
+{
+    size_t len;
+    uint8_t * patch = make_patch("--raw", &len);
+    check(patch != NULL);
+    check(memcmp(patch, DELTA_MAGIC, 4) == 0);
+    check(patch[4] == 0);
+
+    for (int i = 0; i < sizeof chunks / sizeof *chunks; i++)
+    {
+        check(apply(patch, len, chunks[i], NULL) == ESP_OK);
+        check(target_is_new());
+    }
+    free(patch);
+    done();
+}
+
+static int deflated_patch(void)
+{
+    size_t len;
+    uint8_t * patch = make_patch("", &len);
+    check(patch != NULL);
+    check(patch[4] == DELTA_FLAG_DEFLATE);
+    // mostly zeros and the new code, much smaller than the image
+    check(len < new_size / 10);
+
+    for (int i = 0; i < sizeof chunks / sizeof *chunks; i++)
+    {
+        tinfl_ring_wraps = 0;
+        check(apply(patch, len, chunks[i], NULL) == ESP_OK);
+        check(target_is_new());
+        // the records are far longer than the 4K ring, it went around many times
+        check(tinfl_ring_wraps >= (int)(new_size >> DELTA_WINDOW_BITS) - 1);
+    }
+    free(patch);
+    done();
+}
+
+static int other_source(void)
+{
+    size_t len;
+    uint8_t * patch = make_patch("", &len);
+    check(patch != NULL);
+
+    uint8_t sha256[32];
+    memcpy(sha256, old_image + ELF_SHA256_OFFSET, 32);
+    sha256[31] ^= 1;
+    check(apply(patch, len, 4096, sha256) == ESP_ERR_INVALID_VERSION);
+    check(target_len == 0);
+    free(patch);
+    done();
+}
+
+static int truncated(void)
+{
+    size_t len;
+    uint8_t * patch = make_patch("", &len);
+    check(patch != NULL);
+
+    check(apply(patch, len - 100, 4096, NULL) == ESP_ERR_INVALID_SIZE);
+    check(apply(patch, DELTA_HEADER_SIZE - 1, 4096, NULL) == ESP_ERR_INVALID_SIZE);
+    check(apply(patch, DELTA_HEADER_SIZE, 4096, NULL) == ESP_ERR_INVALID_SIZE);
+    free(patch);
+
+    patch = make_patch("--raw", &len);
+    check(patch != NULL);
+    check(apply(patch, len - 1, 4096, NULL) == ESP_ERR_INVALID_SIZE);
+    free(patch);
+    done();
+}
+
+static void put_u32(uint8_t * p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = value >> (8 * i);
+}
+
+static int bad_records(void)
+{
+    uint8_t patch[DELTA_HEADER_SIZE + 12] = DELTA_MAGIC;
+    put_u32(patch + 8, 100);
+    put_u32(patch + 12, OLD_SIZE);
+    memcpy(patch + 16, old_image + ELF_SHA256_OFFSET, 32);
+
+    // more diff bytes than the target has
+    put_u32(patch + DELTA_HEADER_SIZE, 101);
+    check(apply(patch, sizeof patch, 4096, NULL) == ESP_ERR_INVALID_SIZE);
+
+    // diff bytes past the end of the source
+    put_u32(patch + 8, NEW_MAX);
+    put_u32(patch + 12, 50);
+    put_u32(patch + DELTA_HEADER_SIZE, 51);
+    check(apply(patch, sizeof patch, 4096, NULL) == ESP_ERR_INVALID_SIZE);
+
+    // a source bigger than the partition
+    put_u32(patch + 12, OLD_SIZE + 1);
+    check(apply(patch, sizeof patch, 4096, NULL) == ESP_ERR_INVALID_SIZE);
+
+    // a format this firmware does not know
+    put_u32(patch + 12, OLD_SIZE);
+    patch[4] = 0x80;
+    check(apply(patch, sizeof patch, 4096, NULL) == ESP_ERR_NOT_SUPPORTED);
+
+    patch[0] = 'X';
+    check(apply(patch, sizeof patch, 4096, NULL) == ESP_ERR_INVALID_ARG);
+    done();
+}
+
+static int garbage_stream(void)
+{
+    size_t len;
+    uint8_t * patch = make_patch("", &len);
+    check(patch != NULL);
+
+    // an invalid block type right at the start of the deflate stream
+    patch[DELTA_HEADER_SIZE] |= 0x06;
+    check(apply(patch, len, 4096, NULL) == ESP_ERR_INVALID_RESPONSE);
+    free(patch);
+    done();
+}
+
+// ------------------------------------------------------------- Resuming: ---
+
+/* A made up server for new_image, it cuts every response after cut bytes,
+ * answers the range or ignores it, and can answer with a status of its
+ * own. The download loop is the one of ota_task. */
+
+typedef struct
+{
+    bool ranges;
+    int cut;
+    // cut only this many responses, the rest go through
+    int cuts;
+    int status;
+    int requests;
+    int waited_ms;
+} server_t;
+
+static uint8_t received_image[NEW_MAX];
+
+static int serve(server_t * server, const char * range, int * status, int64_t * length)
+{
+    int from = 0;
+
+    server->requests++;
+    if (server->status)
+    {
+        *status = server->status;
+        *length = 0;
+        return 0;
+    }
+    if (range && server->ranges)
+    {
+        if (sscanf(range, "bytes=%d-", &from) != 1)
+            return -1;
+        *status = 206;
+        *length = new_size - from;
+    }
+    else
+    {
+        *status = 200;
+        *length = new_size;
+    }
+    return from;
+}
+
+static esp_err_t download(server_t * server, resume_t * resume, int max_attempts)
+{
+    resume_init(resume, max_attempts);
+    for (;;)
+    {
+        char range[32];
+        int status;
+        int64_t length;
+        bool ranged = resume_range(resume, range, sizeof(range));
+        int from = serve(server, ranged ? range : NULL, &status, &length);
+        if (from < 0)
+            return ESP_FAIL;
+
+        esp_err_t err = resume_response(resume, status, length);
+        if (err == ESP_OK)
+        {
+            int end = new_size;
+            if (server->cuts > 0)
+            {
+                server->cuts--;
+                end = from + server->cut < end ? from + server->cut : end;
+            }
+            // the body arrives in odd chunks like from the socket
+            for (int pos = from; pos < end;)
+            {
+                int len = end - pos < 1500 ? end - pos : 1500;
+                int drop = resume_drop(resume, len);
+                memcpy(received_image + resume->received, new_image + pos + drop, len - drop);
+                resume_advance(resume, len - drop);
+                pos += len;
+            }
+            if (end == new_size)
+                return ESP_OK;
+        }
+
+        int delay_ms;
+        if (!resume_interrupted(resume, &delay_ms))
+            return err == ESP_OK ? ESP_ERR_TIMEOUT : err;
+        server->waited_ms += delay_ms;
+    }
+}
+
+static int resumed_ranges(void)
+{
+    server_t server = {.ranges = true, .cut = 10000, .cuts = 1000};
+    resume_t resume;
+
+    memset(received_image, 0, sizeof(received_image));
+    check(download(&server, &resume, 5) == ESP_OK);
+    check(resume.received == new_size);
+    check(memcmp(received_image, new_image, new_size) == 0);
+    check(resume.total == new_size);
+    check(server.requests == (new_size + 9999) / 10000);
+    check(resume.interruptions == server.requests - 1);
+    // every interruption made progress, no backoff beyond the first step
+    check(server.waited_ms == 2000 * resume.interruptions);
+
+    // a cut right before the end
+    server = (server_t){.ranges = true, .cut = new_size - 1, .cuts = 1};
+    check(download(&server, &resume, 5) == ESP_OK);
+    check(memcmp(received_image, new_image, new_size) == 0);
+    check(server.requests == 2);
+
+    char range[32];
+    resume_init(&resume, 5);
+    check(!resume_range(&resume, range, sizeof(range)));
+    resume_advance(&resume, 12345);
+    check(resume_range(&resume, range, sizeof(range)));
+    check(strcmp(range, "bytes=12345-") == 0);
+    done();
+}
+
+static int ignored_ranges(void)
+{
+    server_t server = {.ranges = false, .cut = 50000, .cuts = 3};
+    resume_t resume;
+
+    memset(received_image, 0, sizeof(received_image));
+    check(download(&server, &resume, 5) == ESP_OK);
+    check(resume.received == new_size);
+    check(memcmp(received_image, new_image, new_size) == 0);
+    check(server.requests == 4);
+    check(resume.skip == 0);
+
+    // cuts shorter than what was received, the prefix is thrown away every time
+    server = (server_t){.ranges = false, .cut = 30000, .cuts = 100};
+    memset(received_image, 0, sizeof(received_image));
+    check(download(&server, &resume, 3) == ESP_ERR_TIMEOUT);
+    check(resume.received == 30000);
+    check(memcmp(received_image, new_image, 30000) == 0);
+    // one that made progress, then two without, the third one without gives up
+    check(server.requests == 4);
+    check(resume.interruptions == 4);
+    check(server.waited_ms == 2000 * (1 + 2 + 3));
+    done();
+}
+
+static int bad_status(void)
+{
+    server_t server = {.status = 404};
+    resume_t resume;
+
+    check(download(&server, &resume, 2) == ESP_ERR_INVALID_RESPONSE);
+    check(server.requests == 3);
+    check(resume.received == 0);
+
+    // a 206 to a request without a range is not the image
+    resume_init(&resume, 2);
+    check(resume_response(&resume, 206, 100) == ESP_ERR_INVALID_RESPONSE);
+    check(resume_response(&resume, 416, 0) == ESP_ERR_INVALID_RESPONSE);
+    check(resume_response(&resume, 200, 100) == ESP_OK);
+    check(resume.total == 100);
+    check(resume.skip == 0);
+
+    // a 206 after an interruption is, and leaves the total alone
+    resume_advance(&resume, 40);
+    char range[32];
+    check(resume_range(&resume, range, sizeof(range)));
+    check(resume_response(&resume, 206, 60) == ESP_OK);
+    check(resume.total == 100);
+    check(resume.skip == 0);
+    done();
+}
+
+int main(void)
+{
+    make_images();
+
+    static struct test const tests[] = {
+        {raw_patch, "Raw patch"},
+        {deflated_patch, "Deflated patch"},
+        {other_source, "Patch for another image"},
+        {truncated, "Truncated patch"},
+        {bad_records, "Bad records"},
+        {garbage_stream, "Garbage stream"},
+        {resumed_ranges, "Resumed ranges"},
+        {ignored_ranges, "Ignored ranges"},
+        {bad_status, "Bad status"},
+    };
+    int failed = test_suit(tests, sizeof tests / sizeof *tests);
+    remove("old.bin");
+    remove("new.bin");
+    remove("patch.rdp");
+    return failed;
+}
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cron.h"
+
+// a few years of month and day steps
+#define CRON_MAX_STEPS 5000
+
+static const struct
+{
+    const char * name;
+    const char * spec;
+} shortcuts[] = {
+    {"@hourly", "0 * * * *"},
+    {"@daily", "0 0 * * *"},
+    {"@weekly", "0 0 * * 0"},
+    {"@monthly", "0 0 1 * *"},
+};
+
+static bool parse_number(const char ** p, int * value)
+{
+    char * end;
+    long v = strtol(*p, &end, 10);
+    if (end == *p || v < 0 || v > 59)
+        return false;
+    *p = end;
+    *value = v;
+    return true;
+}
+
+static bool parse_field(const char ** p, int min, int max, uint64_t * bits, bool * any)
+{
+    *bits = 0;
+    *any = false;
+
+    while (**p == ' ')
+        (*p)++;
+
+    while (true)
+    {
+        int lo, hi, step = 1;
+        bool star = false;
+
+        if (**p == '*')
+        {
+            lo = min;
+            hi = max;
+            star = true;
+            (*p)++;
+        }
+        else
+        {
+            if (!parse_number(p, &lo))
+                return false;
+            hi = lo;
+            if (**p == '-')
+            {
+                (*p)++;
+                if (!parse_number(p, &hi))
+                    return false;
+            }
+        }
+
+        if (**p == '/')
+        {
+            (*p)++;
+            if (!parse_number(p, &step) || step == 0)
+                return false;
+            // "5/15" means from 5 on
+            if (!star && hi == lo)
+                hi = max;
+        }
+
+        if (lo < min || hi > max || lo > hi)
+            return false;
+        for (int v = lo; v <= hi; v += step)
+            *bits |= 1ULL << v;
+        if (star && step == 1)
+            *any = true;
+
+        if (**p != ',')
+            break;
+        (*p)++;
+    }
+    return **p == ' ' || **p == '\0';
+}
+
+bool cron_parse(cron_t * cron, const char * spec, const char ** end)
+{
+    uint64_t bits;
+    bool any;
+    const char * p = spec;
+
+    while (*p == ' ')
+        p++;
+
+    for (size_t i = 0; i < sizeof(shortcuts) / sizeof(shortcuts[0]); i++)
+    {
+        size_t len = strlen(shortcuts[i].name);
+        if (strncmp(p, shortcuts[i].name, len) == 0 && (p[len] == ' ' || p[len] == '\0'))
+        {
+            if (end)
+                *end = p + len;
+            return cron_parse(cron, shortcuts[i].spec, NULL);
+        }
+    }
+
+    memset(cron, 0, sizeof(cron_t));
+    if (!parse_field(&p, 0, 59, &cron->minutes, &any))
+        return false;
+    if (!parse_field(&p, 0, 23, &bits, &any))
+        return false;
+    cron->hours = bits;
+    if (!parse_field(&p, 1, 31, &bits, &cron->any_day))
+        return false;
+    cron->days = bits;
+    if (!parse_field(&p, 1, 12, &bits, &any))
+        return false;
+    cron->months = bits;
+    if (!parse_field(&p, 0, 7, &bits, &cron->any_weekday))
+        return false;
+    // 7 is another sunday
+    cron->weekdays = (bits | (bits >> 7)) & 0x7f;
+
+    if (end)
+        *end = p;
+    return true;
+}
+
+static bool day_matches(const cron_t * cron, const struct tm * tm)
+{
+    bool day = cron->days & (1UL << tm->tm_mday);
+    bool weekday = cron->weekdays & (1 << tm->tm_wday);
+
+    if (cron->any_day && cron->any_weekday)
+        return true;
+    if (cron->any_day)
+        return weekday;
+    if (cron->any_weekday)
+        return day;
+    return day || weekday;
+}
+
+static time_t normalize(struct tm * tm)
+{
+    tm->tm_isdst = -1;
+    time_t t = mktime(tm);
+    localtime_r(&t, tm);
+    return t;
+}
+
+time_t cron_next(const cron_t * cron, time_t after)
+{
+    struct tm tm;
+    time_t t = after - after % 60 + 60;
+
+    localtime_r(&t, &tm);
+    tm.tm_sec = 0;
+
+    // skip whole months, days and hours that cannot match
+    for (int i = 0; i < CRON_MAX_STEPS; i++)
+    {
+        if (!(cron->months & (1 << (tm.tm_mon + 1))))
+        {
+            tm.tm_mon++;
+            tm.tm_mday = 1;
+            tm.tm_hour = 0;
+            tm.tm_min = 0;
+        }
+        else if (!day_matches(cron, &tm))
+        {
+            tm.tm_mday++;
+            tm.tm_hour = 0;
+            tm.tm_min = 0;
+        }
+        else if (!(cron->hours & (1UL << tm.tm_hour)))
+        {
+            tm.tm_hour++;
+            tm.tm_min = 0;
+        }
+        else if (!(cron->minutes & (1ULL << tm.tm_min)))
+        {
+            tm.tm_min++;
+        }
+        else
+        {
+            return normalize(&tm);
+        }
+        normalize(&tm);
+    }
+    return -1;
+}
+
+void cron_plan(const cron_t * cron, time_t last_run, time_t now, time_t grace, cron_plan_t * plan)
+{
+    memset(plan, 0, sizeof(cron_plan_t));
+    plan->next = cron_next(cron, now);
+
+    time_t due = cron_next(cron, last_run);
+    if (due < 0 || due > now)
+        return;
+    plan->missed = due;
+
+    // only the recent part matters for the catch up, do not walk years of minutes
+    time_t from = now - grace > last_run ? now - grace - 1 : last_run;
+    due = cron_next(cron, from);
+    plan->catch_up = due >= 0 && due <= now;
+}
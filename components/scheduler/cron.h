@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Cron expressions: "minute hour day-of-month month day-of-week".
+ * A field is *, a number, a range a-b, any of them with /step, or a comma
+ * list of those. Sunday is 0 or 7. When both day fields are restricted a
+ * day matching either one counts, like in vixie cron. @hourly, @daily,
+ * @weekly and @monthly stand for the usual expressions.
+ * Times are local, see the TZ variable. */
+
+typedef struct
+{
+    uint64_t minutes;
+    uint32_t hours;
+    uint32_t days;
+    uint16_t months;
+    uint8_t weekdays;
+    bool any_day;
+    bool any_weekday;
+} cron_t;
+
+typedef struct
+{
+    time_t next;
+    // the first due time between the last run and now, 0 if none
+    time_t missed;
+    // one of the missed runs is recent enough to do it now
+    bool catch_up;
+} cron_plan_t;
+
+/* Parse the expression at the start of spec. end is set past it. */
+bool cron_parse(cron_t * cron, const char * spec, const char ** end);
+
+/* The first matching minute after the given time, -1 if there is none
+ * within a few years. */
+time_t cron_next(const cron_t * cron, time_t after);
+
+/* Decide what to do after a gap, for example a reboot or a clock jump:
+ * runs due in (last_run, now] are missed, the ones not older than
+ * grace seconds are worth catching up. */
+void cron_plan(const cron_t * cron, time_t last_run, time_t now, time_t grace, cron_plan_t * plan);
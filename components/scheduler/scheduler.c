@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "bot.h"
+#include "control.h"
+#include "cron.h"
+#include "journal.h"
+#include "latency_hist.h"
+#include "scheduler.h"
+#include "task_plan.h"
+
+#define NVS_NAMESPACE "scheduler"
+#define NVS_KEY "rules"
+#define CHANNEL_NAME_LEN 16
+// anything earlier means the clock has not been set yet
+#define TIME_VALID_AFTER 1700000000
+#define REPLAN (-1)
+
+static const char * TAG = "scheduler";
+
+typedef struct
+{
+    char spec[SCHEDULER_SPEC_LEN];
+    int64_t last_run;
+} stored_rule_t;
+
+typedef struct
+{
+    stored_rule_t stored;
+    cron_t cron;
+    char channel[CHANNEL_NAME_LEN];
+    time_t next;
+    // esp_timer time the wheel timer was armed for
+    int64_t due_us;
+    // a fresh number on every rearm, stale wakeups in the queue are dropped
+    uint32_t generation;
+    wheel_timer_t timer;
+} rule_t;
+
+typedef struct
+{
+    int index;
+    uint32_t generation;
+    int64_t fired_us;
+} due_t;
+
+static rule_t rules[SCHEDULER_MAX_RULES];
+static int rules_count = 0;
+static bool time_valid = false;
+static latency_hist_t jitter;
+/* Only ever counts up. Rules move in the array when one is removed, a
+ * number of their own could then match a wakeup queued for the rule that
+ * was in the slot before. */
+static uint32_t generations = 0;
+
+/* Wheel callbacks run under the control lock, so they only queue the
+ * wakeup. The task takes this lock first and control's second, the bot
+ * commands do the same. NULL until the rules are loaded, the bot starts
+ * taking commands before that. */
+static SemaphoreHandle_t lock;
+static QueueHandle_t due_q;
+
+static bool parse_rule(rule_t * rule, const char * spec)
+{
+    const char * end;
+
+    if (strlen(spec) >= SCHEDULER_SPEC_LEN || !cron_parse(&rule->cron, spec, &end))
+        return false;
+
+    while (*end == ' ')
+        end++;
+    size_t len = strcspn(end, " ");
+    if (len >= CHANNEL_NAME_LEN || end[len] != '\0')
+        return false;
+    memcpy(rule->channel, end, len);
+    rule->channel[len] = '\0';
+    if (len && !control_channel_exists(rule->channel))
+        return false;
+
+    strcpy(rule->stored.spec, spec);
+    return true;
+}
+
+static void save_rules(void)
+{
+    stored_rule_t stored[SCHEDULER_MAX_RULES];
+    nvs_handle_t nvs;
+
+    for (int i = 0; i < rules_count; i++)
+        stored[i] = rules[i].stored;
+
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(nvs, NVS_KEY, stored, rules_count * sizeof(stored_rule_t));
+        if (err == ESP_OK)
+            err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "failed to save the rules: %s", esp_err_to_name(err));
+}
+
+static void load_rules(void)
+{
+    stored_rule_t stored[SCHEDULER_MAX_RULES];
+    size_t size = sizeof(stored);
+    nvs_handle_t nvs;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+        return;
+    esp_err_t err = nvs_get_blob(nvs, NVS_KEY, stored, &size);
+    nvs_close(nvs);
+    if (err != ESP_OK)
+        return;
+
+    for (size_t i = 0; i < size / sizeof(stored_rule_t); i++)
+    {
+        rule_t * rule = &rules[rules_count];
+        stored[i].spec[SCHEDULER_SPEC_LEN - 1] = '\0';
+        if (!parse_rule(rule, stored[i].spec))
+        {
+            ESP_LOGW(TAG, "dropping bad rule \"%s\"", stored[i].spec);
+            continue;
+        }
+        rule->stored.last_run = stored[i].last_run;
+        rules_count++;
+    }
+    ESP_LOGI(TAG, "%d rules loaded", rules_count);
+}
+
+static int64_t wall_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void rule_timer_callback(void * arg)
+{
+    rule_t * rule = arg;
+    due_t due = {
+        .index = rule - rules,
+        .generation = rule->generation,
+        .fired_us = esp_timer_get_time(),
+    };
+    xQueueSend(due_q, &due, 0);
+}
+
+/* Put the rule on the wheel for its first run after the given time. */
+static void arm_rule(rule_t * rule, time_t after)
+{
+    rule->generation = ++generations;
+    rule->next = cron_next(&rule->cron, after);
+    if (rule->next < 0)
+    {
+        control_timer_stop(&rule->timer);
+        return;
+    }
+
+    int64_t delay_ms = rule->next * 1000LL - wall_ms();
+    if (delay_ms < 0)
+        delay_ms = 0;
+    rule->due_us = esp_timer_get_time() + delay_ms * 1000;
+    control_timer_start(&rule->timer, delay_ms);
+}
+
+static void trigger(rule_t * rule, const char * why)
+{
+    char text[96];
+
+    snprintf(text, sizeof(text), "%s run: %s", why, rule->stored.spec);
+    sendMessageToAdmin(text);
+    journal_log(JOURNAL_NOTE, "%s %.40s", why, rule->stored.spec);
+
+    if (rule->channel[0] == '\0')
+        open_relay();
+    else
+        open_channel(rule->channel);
+}
+
+static void run_rule(rule_t * rule, const due_t * due)
+{
+    int64_t late_us = due->fired_us - rule->due_us;
+    latency_hist_record(&jitter, late_us > 0 ? late_us : 0);
+
+    trigger(rule, "Scheduled");
+    rule->stored.last_run = rule->next;
+    save_rules();
+
+    // the wall clock may be a bit behind the wheel, never run the same minute twice
+    time_t now = time(NULL);
+    arm_rule(rule, now > rule->next ? now : rule->next);
+}
+
+/* After a boot or a clock update: look for runs missed in between and
+ * put every rule on the wheel again. */
+static void replan(void)
+{
+    time_t now = time(NULL);
+    bool changed = false;
+
+    if (now < TIME_VALID_AFTER)
+        return;
+    if (!time_valid)
+        ESP_LOGI(TAG, "time is set, planning %d rules", rules_count);
+    time_valid = true;
+
+    for (int i = 0; i < rules_count; i++)
+    {
+        rule_t * rule = &rules[i];
+        cron_plan_t plan;
+
+        // added before the clock was set, nothing was missed
+        if (rule->stored.last_run == 0)
+        {
+            rule->stored.last_run = now;
+            changed = true;
+        }
+
+        cron_plan(&rule->cron, rule->stored.last_run, now, CONFIG_SCHEDULER_CATCHUP_MIN * 60, &plan);
+        if (plan.catch_up)
+        {
+            trigger(rule, "Missed, catching up");
+        }
+        else if (plan.missed)
+        {
+            char text[128];
+            struct tm tm;
+            char when[20];
+
+            localtime_r(&plan.missed, &tm);
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+            snprintf(text, sizeof(text), "Missed run at %s: %s", when, rule->stored.spec);
+            sendMessageToAdmin(text);
+            journal_log(JOURNAL_NOTE, "missed %.40s", rule->stored.spec);
+        }
+        if (plan.missed)
+        {
+            rule->stored.last_run = now;
+            changed = true;
+        }
+        arm_rule(rule, now);
+    }
+
+    if (changed)
+        save_rules();
+}
+
+static void scheduler_task(void * pv)
+{
+    due_t due;
+
+    while (true)
+    {
+        if (!xQueueReceive(due_q, &due, portMAX_DELAY))
+            continue;
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (due.index == REPLAN)
+            replan();
+        else if (due.index < rules_count && rules[due.index].generation == due.generation)
+            run_rule(&rules[due.index], &due);
+        xSemaphoreGive(lock);
+    }
+}
+
+static void time_sync_callback(struct timeval * tv)
+{
+    due_t due = {.index = REPLAN};
+    xQueueSend(due_q, &due, 0);
+}
+
+esp_err_t scheduler_add(const char * spec)
+{
+    esp_err_t err = ESP_OK;
+
+    if (lock == NULL)
+        return ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (rules_count == SCHEDULER_MAX_RULES)
+        err = ESP_ERR_NO_MEM;
+    else
+    {
+        rule_t * rule = &rules[rules_count];
+        memset(rule, 0, sizeof(rule_t));
+        if (!parse_rule(rule, spec))
+            err = ESP_ERR_INVALID_ARG;
+        else
+        {
+            wheel_timer_init(&rule->timer, rule_timer_callback, rule);
+            rules_count++;
+            if (time_valid)
+            {
+                rule->stored.last_run = time(NULL);
+                arm_rule(rule, rule->stored.last_run);
+            }
+            save_rules();
+        }
+    }
+    xSemaphoreGive(lock);
+    return err;
+}
+
+esp_err_t scheduler_remove(int number)
+{
+    if (lock == NULL)
+        return ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (number < 1 || number > rules_count)
+    {
+        xSemaphoreGive(lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // the wheel links point into the array, take them all off before moving
+    for (int i = 0; i < rules_count; i++)
+        control_timer_stop(&rules[i].timer);
+    memmove(&rules[number - 1], &rules[number], (rules_count - number) * sizeof(rule_t));
+    rules_count--;
+    for (int i = 0; i < rules_count; i++)
+    {
+        wheel_timer_init(&rules[i].timer, rule_timer_callback, &rules[i]);
+        if (time_valid)
+            arm_rule(&rules[i], time(NULL));
+    }
+    save_rules();
+
+    xSemaphoreGive(lock);
+    return ESP_OK;
+}
+
+int scheduler_format(char * buf, size_t size)
+{
+    int pos = 0;
+    char when[20];
+    struct tm tm;
+
+    if (lock == NULL)
+        return snprintf(buf, size, "scheduler is starting\n");
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (!time_valid)
+        pos += snprintf(buf + pos, size - pos, "waiting for time sync\n");
+
+    for (int i = 0; i < rules_count && pos < (int)size; i++)
+    {
+        rule_t * rule = &rules[i];
+        if (time_valid && rule->next > 0)
+        {
+            localtime_r(&rule->next, &tm);
+            strftime(when, sizeof(when), "%a %m-%d %H:%M", &tm);
+        }
+        else
+            strcpy(when, "-");
+        pos += snprintf(buf + pos, size - pos, "%d: %s, next %s\n", i + 1, rule->stored.spec, when);
+    }
+    if (rules_count == 0 && pos < (int)size)
+        pos += snprintf(buf + pos, size - pos, "no rules\n");
+    if (jitter.total && pos < (int)size)
+    {
+        char line[64];
+        latency_hist_format(&jitter, line, sizeof(line));
+        pos += snprintf(buf + pos, size - pos, "wakeup delay: %s\n", line);
+    }
+    xSemaphoreGive(lock);
+    return pos;
+}
+
+void scheduler_init(void)
+{
+    SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+    due_q = xQueueCreate(SCHEDULER_MAX_RULES + 2, sizeof(due_t));
+    configASSERT(mutex && due_q);
+
+    load_rules();
+    for (int i = 0; i < rules_count; i++)
+        wheel_timer_init(&rules[i].timer, rule_timer_callback, &rules[i]);
+    // commands work from here on
+    lock = mutex;
+
+    xTaskCreatePinnedToCore(&scheduler_task, "scheduler", 4096, NULL, TASK_PRIO_SCHEDULER, NULL, TASK_CORE_CONTROL);
+
+    setenv("TZ", CONFIG_SCHEDULER_TZ, 1);
+    tzset();
+    esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    esp_sntp_setservername(0, CONFIG_SCHEDULER_NTP_SERVER);
+    sntp_set_time_sync_notification_cb(time_sync_callback);
+    esp_sntp_init();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+
+/* Exercise runs on a cron schedule. A rule is a cron expression followed by
+ * an optional channel name, "0 10 * * 6 starter". Rules are kept in NVS
+ * with the time of their last run, so runs missed while the device was
+ * off are found after the next boot. Time comes from SNTP. */
+
+#define SCHEDULER_MAX_RULES 8
+#define SCHEDULER_SPEC_LEN 64
+
+void scheduler_init(void);
+
+/* Both return ESP_ERR_INVALID_STATE before scheduler_init is done. */
+esp_err_t scheduler_add(const char * spec);
+
+/* Remove the rule by its number in the list, starting with 1. */
+esp_err_t scheduler_remove(int number);
+
+/* The rules with their next and last runs. Returns the length. */
+int scheduler_format(char * buf, size_t size);
@@ -0,0 +1,329 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cron.h"
+#include "timer_wheel.h"
+
+// ----------------------------------------------------- Test "framework": ---
+
+#define done() return 0
+#define fail() return __LINE__
+static int checkqty = 0;
+#define check(x) \
+    do \
+    { \
+        ++checkqty; \
+        if (!(x)) \
+            fail(); \
+    } while (0)
+
+struct test
+{
+    int (*func)(void);
+    char const * name;
+};
+
+static int test_suit(struct test const * tests, int numtests)
+{
+    printf("%s", "\n\nTests:\n");
+    int failed = 0;
+    for (int i = 0; i < numtests; ++i)
+    {
+        printf(" %02d%s%-25s ", i, ": ", tests[i].name);
+        int linerr = tests[i].func();
+        if (0 == linerr)
+            printf("%s", "OK\n");
+        else
+        {
+            printf("%s%d\n", "Failed, line: ", linerr);
+            ++failed;
+        }
+    }
+    printf("\n%s%d\n", "Total checks: ", checkqty);
+    printf("%s[ %d / %d ]\r\n\n\n", "Tests PASS: ", numtests - failed, numtests);
+    return failed;
+}
+
+// ---------------------------------------------------------------- Helpers: ---
+
+static time_t at(int year, int month, int day, int hour, int minute)
+{
+    struct tm tm = {
+        .tm_year = year - 1900,
+        .tm_mon = month - 1,
+        .tm_mday = day,
+        .tm_hour = hour,
+        .tm_min = minute,
+        .tm_isdst = -1,
+    };
+    return mktime(&tm);
+}
+
+static time_t next_of(const char * spec, time_t after)
+{
+    cron_t cron;
+    if (!cron_parse(&cron, spec, NULL))
+        return -2;
+    return cron_next(&cron, after);
+}
+
+// ----------------------------------------------------------- Unit tests: ---
+
+static int parse(void)
+{
+    cron_t cron;
+    const char * end;
+
+    check(cron_parse(&cron, "0 10 * * 6 starter", &end));
+    check(strcmp(end, " starter") == 0);
+    check(cron.minutes == 1);
+    check(cron.hours == 1 << 10);
+    check(cron.any_day && !cron.any_weekday);
+    check(cron.weekdays == 1 << 6);
+
+    check(cron_parse(&cron, "*/15 8-18/2 1,15 * 0,7", &end));
+    check(*end == '\0');
+    check(cron.minutes == (1ULL | 1ULL << 15 | 1ULL << 30 | 1ULL << 45));
+    check(cron.hours == (1 << 8 | 1 << 10 | 1 << 12 | 1 << 14 | 1 << 16 | 1 << 18));
+    check(cron.days == (1 << 1 | 1 << 15));
+    check(cron.weekdays == 1);
+
+    check(cron_parse(&cron, "@weekly reserve", &end));
+    check(strcmp(end, " reserve") == 0);
+    check(cron.weekdays == 1 && cron.hours == 1);
+
+    check(!cron_parse(&cron, "60 * * * *", NULL));
+    check(!cron_parse(&cron, "* 24 * * *", NULL));
+    check(!cron_parse(&cron, "* * 0 * *", NULL));
+    check(!cron_parse(&cron, "* * * 13 *", NULL));
+    check(!cron_parse(&cron, "* * * *", NULL));
+    check(!cron_parse(&cron, "5-1 * * * *", NULL));
+    check(!cron_parse(&cron, "*/0 * * * *", NULL));
+    check(!cron_parse(&cron, "1x * * * *", NULL));
+    done();
+}
+
+static int next(void)
+{
+    // 2024-01-01 is a monday
+    time_t monday = at(2024, 1, 1, 0, 0);
+
+    check(next_of("0 10 * * 6", monday) == at(2024, 1, 6, 10, 0));
+    check(next_of("0 10 * * 6", at(2024, 1, 6, 10, 0)) == at(2024, 1, 13, 10, 0));
+    check(next_of("*/15 * * * *", monday + 1) == monday + 15 * 60);
+    check(next_of("30 23 31 * *", monday) == at(2024, 1, 31, 23, 30));
+    check(next_of("30 23 31 * *", at(2024, 2, 1, 0, 0)) == at(2024, 3, 31, 23, 30));
+    check(next_of("0 0 29 2 *", monday) == at(2024, 2, 29, 0, 0));
+    check(next_of("0 0 29 2 *", at(2024, 3, 1, 0, 0)) == at(2028, 2, 29, 0, 0));
+    // the 13th or any friday
+    check(next_of("0 0 13 * 5", monday) == at(2024, 1, 5, 0, 0));
+    check(next_of("0 0 13 * 5", at(2024, 1, 12, 1, 0)) == at(2024, 1, 13, 0, 0));
+    check(next_of("@monthly", at(2024, 12, 5, 0, 0)) == at(2025, 1, 1, 0, 0));
+    // never
+    check(next_of("0 0 31 4 *", monday) == -1);
+    done();
+}
+
+static int missed(void)
+{
+    cron_t cron;
+    cron_plan_t plan;
+    time_t grace = 2 * 3600;
+    check(cron_parse(&cron, "0 10 * * 6", NULL));
+
+    // rebooted an hour after a run was due
+    cron_plan(&cron, at(2024, 1, 1, 0, 0), at(2024, 1, 6, 11, 0), grace, &plan);
+    check(plan.missed == at(2024, 1, 6, 10, 0));
+    check(plan.catch_up);
+    check(plan.next == at(2024, 1, 13, 10, 0));
+
+    // off for the whole day, too late to crank
+    cron_plan(&cron, at(2024, 1, 1, 0, 0), at(2024, 1, 6, 23, 0), grace, &plan);
+    check(plan.missed == at(2024, 1, 6, 10, 0));
+    check(!plan.catch_up);
+
+    // off for weeks, the recent one is still caught up once
+    cron_plan(&cron, at(2024, 1, 1, 0, 0), at(2024, 1, 27, 10, 30), grace, &plan);
+    check(plan.missed == at(2024, 1, 6, 10, 0));
+    check(plan.catch_up);
+    check(plan.next == at(2024, 2, 3, 10, 0));
+
+    // back right before the run
+    cron_plan(&cron, at(2024, 1, 1, 0, 0), at(2024, 1, 6, 9, 59), grace, &plan);
+    check(plan.missed == 0);
+    check(!plan.catch_up);
+    check(plan.next == at(2024, 1, 6, 10, 0));
+
+    // the run was done, nothing is missed
+    cron_plan(&cron, at(2024, 1, 6, 10, 0), at(2024, 1, 6, 10, 30), grace, &plan);
+    check(plan.missed == 0);
+
+    // every minute rules across a year do not walk all the minutes
+    check(cron_parse(&cron, "* * * * *", NULL));
+    cron_plan(&cron, at(2023, 1, 1, 0, 0), at(2024, 1, 1, 0, 0), grace, &plan);
+    check(plan.missed == at(2023, 1, 1, 0, 1));
+    check(plan.catch_up);
+    done();
+}
+
+// -------------------------------------- Scheduler on a simulated clock: ---
+
+#define TICK_MS 100
+#define RULES 3
+
+static timer_wheel_t wheel;
+static time_t epoch; // wall time of tick 0
+static int64_t wake_late_ms; // how late the os timer calls back
+static int fired;
+static int64_t worst_jitter_ms;
+
+typedef struct
+{
+    cron_t cron;
+    time_t next;
+    time_t last_run;
+    int runs;
+    wheel_timer_t timer;
+} sim_rule_t;
+
+static sim_rule_t sim_rules[RULES];
+static const char * sim_specs[RULES] = {"0 10 * * 6", "*/7 * * * *", "30 3 1 * *"};
+
+static int64_t now_ms(void)
+{
+    return (int64_t)wheel.now * TICK_MS + wake_late_ms;
+}
+
+static void sim_arm(sim_rule_t * rule, time_t after)
+{
+    rule->next = cron_next(&rule->cron, after);
+    int64_t delay_ms = (int64_t)(rule->next - epoch) * 1000 - now_ms();
+    wheel_add(&wheel, &rule->timer, delay_ms > 0 ? (delay_ms + TICK_MS - 1) / TICK_MS : 0);
+}
+
+static void sim_callback(void * arg)
+{
+    sim_rule_t * rule = arg;
+    int64_t jitter = now_ms() - (int64_t)(rule->next - epoch) * 1000;
+    if (jitter < 0)
+        jitter = -jitter;
+    if (jitter > worst_jitter_ms)
+        worst_jitter_ms = jitter;
+
+    fired++;
+    rule->runs++;
+    rule->last_run = rule->next;
+    sim_arm(rule, rule->next);
+}
+
+static void sim_boot(time_t wall, time_t grace, int * caught_up)
+{
+    wheel_init(&wheel);
+    epoch = wall;
+    for (int i = 0; i < RULES; i++)
+    {
+        sim_rule_t * rule = &sim_rules[i];
+        cron_plan_t plan;
+
+        wheel_timer_init(&rule->timer, sim_callback, rule);
+        cron_plan(&rule->cron, rule->last_run, wall, grace, &plan);
+        if (plan.catch_up)
+        {
+            (*caught_up)++;
+            rule->runs++;
+        }
+        if (plan.missed)
+            rule->last_run = wall;
+        sim_arm(rule, wall);
+    }
+}
+
+static int wakeups;
+
+static void sim_run_until(time_t wall)
+{
+    uint64_t end = (uint64_t)(wall - epoch) * 1000 / TICK_MS;
+    while (true)
+    {
+        uint64_t next = wheel_next_expiry(&wheel);
+        if (next > end)
+            break;
+        wakeups++;
+        wake_late_ms = rand() % 20;
+        wheel_advance_to(&wheel, next);
+        wake_late_ms = 0;
+    }
+    wheel_advance_to(&wheel, end);
+}
+
+static int simulated(void)
+{
+    int caught_up = 0;
+    time_t start = at(2024, 1, 1, 0, 0);
+
+    srand(3);
+    memset(sim_rules, 0, sizeof(sim_rules));
+    for (int i = 0; i < RULES; i++)
+    {
+        check(cron_parse(&sim_rules[i].cron, sim_specs[i], NULL));
+        sim_rules[i].last_run = start;
+    }
+
+    // two weeks of uptime
+    wakeups = fired = 0;
+    worst_jitter_ms = 0;
+    sim_boot(start, 7200, &caught_up);
+    sim_run_until(at(2024, 1, 14, 0, 0));
+    check(sim_rules[0].runs == 2);
+    // */7 restarts every hour: 0, 7 ... 56
+    check(sim_rules[1].runs == 13 * 24 * 9);
+    check(sim_rules[2].runs == 1);
+    // tickless: the wheel only woke up for the runs
+    check(wakeups <= fired);
+    // rounding up to a tick plus the late callback
+    check(worst_jitter_ms < TICK_MS + 20);
+    check(caught_up == 0);
+
+    // power cut on saturday 9:00, back at 11:00: the exercise run is caught up
+    time_t down = at(2024, 1, 20, 9, 0);
+    sim_run_until(down);
+    int weekly = sim_rules[0].runs;
+    sim_boot(at(2024, 1, 20, 11, 0), 7200, &caught_up);
+    check(caught_up == 2);
+    check(sim_rules[0].runs == weekly + 1);
+    check(sim_rules[0].next == at(2024, 1, 27, 10, 0));
+
+    // down over the 1st of the month and saturday morning: reported, not cranked
+    sim_run_until(at(2024, 1, 31, 12, 0));
+    int monthly = sim_rules[2].runs;
+    caught_up = 0;
+    sim_boot(at(2024, 2, 3, 13, 0), 7200, &caught_up);
+    check(sim_rules[2].runs == monthly);
+    check(sim_rules[2].last_run == at(2024, 2, 3, 13, 0));
+    check(sim_rules[2].next == at(2024, 3, 1, 3, 30));
+    // only the every 7 minutes one
+    check(caught_up == 1);
+
+    // and the runs go on
+    sim_run_until(at(2024, 3, 2, 0, 0));
+    check(sim_rules[2].runs == monthly + 1);
+    check(worst_jitter_ms < TICK_MS + 20);
+    done();
+}
+
+int main(void)
+{
+    setenv("TZ", "UTC0", 1);
+    tzset();
+
+    static struct test const tests[] = {
+        {parse, "Parse"},
+        {next, "Next run"},
+        {missed, "Missed runs"},
+        {simulated, "Simulated clock"},
+    };
+    return test_suit(tests, sizeof tests / sizeof *tests);
+}
@@ -0,0 +1,85 @@
+#include "esp_attr.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+
+#include "onewire.h"
+
+static portMUX_TYPE slot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void onewire_init(onewire_t * bus, gpio_num_t pin)
+{
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << pin,
+        .mode = GPIO_MODE_INPUT_OUTPUT_OD,
+    };
+
+    bus->pin = pin;
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+    gpio_set_level(pin, 1);
+}
+
+bool onewire_reset(onewire_t * bus)
+{
+    // a longer low is still a reset, no need to keep interrupts off
+    gpio_set_level(bus->pin, 0);
+    esp_rom_delay_us(480);
+
+    portENTER_CRITICAL(&slot_lock);
+    gpio_set_level(bus->pin, 1);
+    esp_rom_delay_us(70);
+    bool present = gpio_get_level(bus->pin) == 0;
+    portEXIT_CRITICAL(&slot_lock);
+
+    esp_rom_delay_us(410);
+    return present;
+}
+
+static void write_bit(onewire_t * bus, int bit)
+{
+    portENTER_CRITICAL(&slot_lock);
+    gpio_set_level(bus->pin, 0);
+    esp_rom_delay_us(bit ? 6 : 60);
+    gpio_set_level(bus->pin, 1);
+    esp_rom_delay_us(bit ? 64 : 10);
+    portEXIT_CRITICAL(&slot_lock);
+}
+
+static int read_bit(onewire_t * bus)
+{
+    portENTER_CRITICAL(&slot_lock);
+    gpio_set_level(bus->pin, 0);
+    esp_rom_delay_us(6);
+    gpio_set_level(bus->pin, 1);
+    esp_rom_delay_us(9);
+    int bit = gpio_get_level(bus->pin);
+    esp_rom_delay_us(55);
+    portEXIT_CRITICAL(&slot_lock);
+    return bit;
+}
+
+void onewire_write(onewire_t * bus, uint8_t byte)
+{
+    for (int i = 0; i < 8; i++)
+        write_bit(bus, (byte >> i) & 1);
+}
+
+uint8_t onewire_read(onewire_t * bus)
+{
+    uint8_t byte = 0;
+    for (int i = 0; i < 8; i++)
+        byte |= read_bit(bus) << i;
+    return byte;
+}
+
+uint8_t onewire_crc8(const uint8_t * data, size_t len)
+{
+    uint8_t crc = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+    return crc;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/gpio.h"
+
+/* Bit-banged 1-Wire master on an open drain pin with an external pull-up.
+ * Every time slot runs in a critical section, about 70 us each, the reset
+ * pulse does not. */
+
+typedef struct
+{
+    gpio_num_t pin;
+} onewire_t;
+
+void onewire_init(onewire_t * bus, gpio_num_t pin);
+
+/* True if a device answered with a presence pulse. */
+bool onewire_reset(onewire_t * bus);
+
+void onewire_write(onewire_t * bus, uint8_t byte);
+uint8_t onewire_read(onewire_t * bus);
+
+/* Dallas/Maxim CRC-8, 0 over data with its crc byte at the end. */
+uint8_t onewire_crc8(const uint8_t * data, size_t len);
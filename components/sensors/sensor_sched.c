@@ -0,0 +1,145 @@
+#include <stddef.h>
+#include "sensor_sched.h"
+
+static bool is_due(const sensor_t * sensor, uint32_t now_ms)
+{
+    return (int32_t)(sensor->due_ms - now_ms) <= 0;
+}
+
+static uint32_t all_sensors(const sensor_sched_t * sched)
+{
+    return sched->count >= 32 ? UINT32_MAX : (1u << sched->count) - 1;
+}
+
+void sensor_sched_init(sensor_sched_t * sched, sensor_t * sensors, int count, uint64_t (*now_us)(void), uint32_t now_ms)
+{
+    sched->sensors = sensors;
+    sched->count = count < SENSOR_SCHED_MAX ? count : SENSOR_SCHED_MAX;
+    sched->now_us = now_us;
+    sched->since_ms = now_ms;
+    sched->pending = all_sensors(sched);
+    sched->batches = 0;
+
+    for (int i = 0; i < sched->count; i++)
+    {
+        sensor_t * sensor = &sensors[i];
+        sensor->phase = SENSOR_IDLE;
+        sensor->due_ms = now_ms;
+        sensor->valid = false;
+        sensor->samples = 0;
+        sensor->errors = 0;
+        sensor->latency_ms = 0;
+        sensor->latency_max_ms = 0;
+        sensor->bus_us = 0;
+    }
+}
+
+/* A read frees a conversion slot and makes a value fresh, it goes first. */
+static sensor_t * next_due(sensor_sched_t * sched, uint32_t now_ms, int * index)
+{
+    sensor_t * best = NULL;
+
+    for (int i = 0; i < sched->count; i++)
+    {
+        sensor_t * sensor = &sched->sensors[i];
+        if (!is_due(sensor, now_ms))
+            continue;
+        if (best != NULL)
+        {
+            if (best->phase == SENSOR_CONVERTING && sensor->phase != SENSOR_CONVERTING)
+                continue;
+            if (best->phase == sensor->phase && (int32_t)(sensor->due_ms - best->due_ms) >= 0)
+                continue;
+        }
+        best = sensor;
+        *index = i;
+    }
+    return best;
+}
+
+static bool complete(sensor_sched_t * sched, int index)
+{
+    sched->pending &= ~(1u << index);
+    if (sched->pending != 0)
+        return false;
+
+    sched->pending = all_sensors(sched);
+    sched->batches++;
+    return true;
+}
+
+bool sensor_sched_step(sensor_sched_t * sched, uint32_t now_ms)
+{
+    int index = 0;
+    sensor_t * sensor = next_due(sched, now_ms, &index);
+    if (sensor == NULL)
+        return false;
+
+    uint64_t start_us = sched->now_us();
+    if (sensor->phase == SENSOR_IDLE)
+    {
+        bool ok = sensor->ops->start(sensor);
+        sensor->bus_us += sched->now_us() - start_us;
+        if (ok)
+        {
+            sensor->phase = SENSOR_CONVERTING;
+            sensor->started_ms = now_ms;
+            sensor->due_ms = now_ms + sensor->conversion_ms;
+            return false;
+        }
+
+        sensor->errors++;
+        sensor->valid = false;
+        sensor->due_ms = now_ms + sensor->period_ms;
+        return complete(sched, index);
+    }
+
+    float value;
+    bool ok = sensor->ops->read(sensor, &value);
+    uint32_t read_us = sched->now_us() - start_us;
+    sensor->bus_us += read_us;
+    sensor->phase = SENSOR_IDLE;
+    if (ok)
+    {
+        sensor->value = value;
+        sensor->valid = true;
+        sensor->samples++;
+        sensor->latency_ms = now_ms - sensor->started_ms + read_us / 1000;
+        if (sensor->latency_ms > sensor->latency_max_ms)
+            sensor->latency_max_ms = sensor->latency_ms;
+    }
+    else
+    {
+        sensor->errors++;
+        sensor->valid = false;
+    }
+
+    // periods count from the starts, a late read does not shift the next one
+    sensor->due_ms = sensor->started_ms + sensor->period_ms;
+    if (is_due(sensor, now_ms))
+        sensor->due_ms = now_ms;
+    return complete(sched, index);
+}
+
+uint32_t sensor_sched_timeout(const sensor_sched_t * sched, uint32_t now_ms)
+{
+    uint32_t timeout = UINT32_MAX;
+
+    for (int i = 0; i < sched->count; i++)
+    {
+        const sensor_t * sensor = &sched->sensors[i];
+        if (is_due(sensor, now_ms))
+            return 0;
+        if (sensor->due_ms - now_ms < timeout)
+            timeout = sensor->due_ms - now_ms;
+    }
+    return timeout;
+}
+
+uint32_t sensor_bus_us_per_s(const sensor_sched_t * sched, const sensor_t * sensor, uint32_t now_ms)
+{
+    uint32_t elapsed_ms = now_ms - sched->since_ms;
+    if (elapsed_ms == 0)
+        return 0;
+    return sensor->bus_us * 1000 / elapsed_ms;
+}
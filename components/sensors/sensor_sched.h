@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Sensor sampling without waiting for conversions, no IDF in here so the
+ * host tests can drive it with simulated devices. A reading has two bus
+ * transactions: start the conversion and, conversion_ms later, read the
+ * value. Conversions of all sensors run at the same time, the bus is only
+ * busy for the transactions. Times are milliseconds of a free running
+ * clock, wrap around is fine. */
+
+typedef struct sensor sensor_t;
+
+typedef struct
+{
+    // false on a bus error, the reading is skipped
+    bool (*start)(sensor_t * sensor);
+    // false on a bus or crc error
+    bool (*read)(sensor_t * sensor, float * value);
+} sensor_ops_t;
+
+typedef enum
+{
+    SENSOR_IDLE,
+    SENSOR_CONVERTING,
+} sensor_phase_t;
+
+struct sensor
+{
+    const char * name;
+    const char * unit;
+    const sensor_ops_t * ops;
+    // driver state
+    void * dev;
+    uint32_t conversion_ms;
+    uint32_t period_ms;
+
+    sensor_phase_t phase;
+    uint32_t started_ms;
+    uint32_t due_ms;
+    float value;
+    bool valid;
+    uint32_t samples;
+    uint32_t errors;
+    // conversion start to value, the last one and the largest
+    uint32_t latency_ms;
+    uint32_t latency_max_ms;
+    // time spent in this sensor's transactions
+    uint64_t bus_us;
+};
+
+#define SENSOR_SCHED_MAX 32
+
+typedef struct
+{
+    sensor_t * sensors;
+    int count;
+    // the bus time clock, finer than now_ms
+    uint64_t (*now_us)(void);
+    uint32_t since_ms;
+    // sensors not read yet in the current batch, one bit each
+    uint32_t pending;
+    uint32_t batches;
+} sensor_sched_t;
+
+/* All sensors start their first conversion right away. */
+void sensor_sched_init(sensor_sched_t * sched, sensor_t * sensors, int count, uint64_t (*now_us)(void), uint32_t now_ms);
+
+/* Run the one transaction that is due first, if any, reads before starts.
+ * Returns true when that completed a batch: every sensor was read or
+ * failed once since the last batch. Step again right away while
+ * sensor_sched_timeout is 0. */
+bool sensor_sched_step(sensor_sched_t * sched, uint32_t now_ms);
+
+/* Milliseconds until the next transaction is due. */
+uint32_t sensor_sched_timeout(const sensor_sched_t * sched, uint32_t now_ms);
+
+/* Bus time the sensor took since init, microseconds per second. */
+uint32_t sensor_bus_us_per_s(const sensor_sched_t * sched, const sensor_t * sensor, uint32_t now_ms);
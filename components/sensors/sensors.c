@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+
+#include "sensors.h"
+
+#if CONFIG_SENSORS
+
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#if CONFIG_SENSORS_FUEL
+#    include "driver/i2c.h"
+#endif
+
+#include "metrics.h"
+#include "onewire.h"
+#include "sensor_sched.h"
+#include "task_plan.h"
+
+#define SENSORS_MAX 3
+// 12 bit resolution, the power-on default
+#define DS18B20_CONVERSION_MS 760
+#define DS18B20_SKIP_ROM 0xCC
+#define DS18B20_CONVERT 0x44
+#define DS18B20_READ_SCRATCHPAD 0xBE
+// single shot at 128 samples/s takes 7.8 ms
+#define ADS1115_CONVERSION_MS 9
+#define ADS1115_I2C_PORT I2C_NUM_0
+#define ADS1115_TIMEOUT_MS 10
+
+static const char * TAG = "sensors";
+
+// NULL until sensors_init is done, sensors_count is not final before that
+static SemaphoreHandle_t lock;
+static sensor_sched_t sched;
+static sensor_t sensors[SENSORS_MAX];
+static int sensors_count;
+
+static uint64_t now_us(void)
+{
+    return esp_timer_get_time();
+}
+
+static uint32_t now_ms(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+/* Alone on its pin, so skip rom addresses it. */
+static bool ds18b20_start(sensor_t * sensor)
+{
+    onewire_t * bus = sensor->dev;
+    if (!onewire_reset(bus))
+        return false;
+    onewire_write(bus, DS18B20_SKIP_ROM);
+    onewire_write(bus, DS18B20_CONVERT);
+    return true;
+}
+
+static bool ds18b20_read(sensor_t * sensor, float * value)
+{
+    onewire_t * bus = sensor->dev;
+    uint8_t scratchpad[9];
+
+    if (!onewire_reset(bus))
+        return false;
+    onewire_write(bus, DS18B20_SKIP_ROM);
+    onewire_write(bus, DS18B20_READ_SCRATCHPAD);
+    for (size_t i = 0; i < sizeof(scratchpad); i++)
+        scratchpad[i] = onewire_read(bus);
+
+    // a line stuck low reads all zeros and passes the crc, the low bits of
+    // the config register are always set
+    if (onewire_crc8(scratchpad, sizeof(scratchpad)) != 0 || (scratchpad[4] & 0x1F) != 0x1F)
+        return false;
+    *value = (int16_t)(scratchpad[1] << 8 | scratchpad[0]) / 16.0f;
+    return true;
+}
+
+static const sensor_ops_t ds18b20_ops = {.start = ds18b20_start, .read = ds18b20_read};
+
+#if CONFIG_SENSORS_FUEL
+/* Single shot on one input against ground, +-4.096 V, comparator off. */
+static const uint16_t ads1115_config = 0x8000 | (4 + CONFIG_SENSORS_FUEL_CHANNEL) << 12 | 1 << 9 | 1 << 8 | 4 << 5 | 0x03;
+
+static bool ads1115_start(sensor_t * sensor)
+{
+    uint8_t cmd[3] = {0x01, ads1115_config >> 8, ads1115_config & 0xFF};
+    return i2c_master_write_to_device(
+               ADS1115_I2C_PORT, CONFIG_SENSORS_ADS1115_ADDRESS, cmd, sizeof(cmd), pdMS_TO_TICKS(ADS1115_TIMEOUT_MS))
+        == ESP_OK;
+}
+
+/* The sender voltage as percent between empty and full. */
+static bool ads1115_read(sensor_t * sensor, float * value)
+{
+    uint8_t reg = 0x00;
+    uint8_t data[2];
+
+    if (i2c_master_write_read_device(
+            ADS1115_I2C_PORT,
+            CONFIG_SENSORS_ADS1115_ADDRESS,
+            &reg,
+            1,
+            data,
+            sizeof(data),
+            pdMS_TO_TICKS(ADS1115_TIMEOUT_MS))
+        != ESP_OK)
+        return false;
+
+    float mv = (int16_t)(data[0] << 8 | data[1]) * 0.125f;
+    float percent = (mv - CONFIG_SENSORS_FUEL_EMPTY_MV) * 100.0f / (CONFIG_SENSORS_FUEL_FULL_MV - CONFIG_SENSORS_FUEL_EMPTY_MV);
+    *value = percent < 0 ? 0 : percent > 100 ? 100 : percent;
+    return true;
+}
+
+static const sensor_ops_t ads1115_ops = {.start = ads1115_start, .read = ads1115_read};
+
+static void init_i2c(void)
+{
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = CONFIG_SENSORS_I2C_SDA_GPIO,
+        .scl_io_num = CONFIG_SENSORS_I2C_SCL_GPIO,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = 100000,
+    };
+
+    ESP_ERROR_CHECK(i2c_param_config(ADS1115_I2C_PORT, &conf));
+    ESP_ERROR_CHECK(i2c_driver_install(ADS1115_I2C_PORT, I2C_MODE_MASTER, 0, 0, 0));
+}
+#endif
+
+static void add_sensor(const char * name, const char * unit, const sensor_ops_t * ops, void * dev, uint32_t conversion_ms)
+{
+    sensor_t * sensor = &sensors[sensors_count++];
+    sensor->name = name;
+    sensor->unit = unit;
+    sensor->ops = ops;
+    sensor->dev = dev;
+    sensor->conversion_ms = conversion_ms;
+    sensor->period_ms = CONFIG_SENSORS_PERIOD_S * 1000;
+}
+
+/* One batch for the telemetry, every sensor read once. */
+static void publish(void)
+{
+    metrics_reading_t readings[SENSORS_MAX];
+
+    for (int i = 0; i < sensors_count; i++)
+    {
+        readings[i].name = sensors[i].name;
+        readings[i].unit = sensors[i].unit;
+        readings[i].value = sensors[i].value;
+        readings[i].valid = sensors[i].valid;
+    }
+    metrics_record_sensors(readings, sensors_count);
+}
+
+static void sensors_task(void * pv)
+{
+    while (true)
+    {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        bool batch = sensor_sched_step(&sched, now_ms());
+        if (batch)
+            publish();
+        uint32_t wait_ms = sensor_sched_timeout(&sched, now_ms());
+        xSemaphoreGive(lock);
+
+        // the next transaction may be due already
+        if (wait_ms > 0)
+            vTaskDelay((wait_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+    }
+}
+
+int sensors_format(char * buf, size_t size)
+{
+    int pos = 0;
+
+    if (lock == NULL)
+        return snprintf(buf, size, "sensors are starting\n");
+    if (sensors_count == 0)
+        return snprintf(buf, size, "no sensors set up\n");
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t now = now_ms();
+    for (int i = 0; i < sensors_count && pos < (int)size; i++)
+    {
+        const sensor_t * sensor = &sensors[i];
+        if (sensor->valid)
+            pos += snprintf(buf + pos, size - pos, "%s: %.1f %s", sensor->name, sensor->value, sensor->unit);
+        else
+            pos += snprintf(buf + pos, size - pos, "%s: no reading", sensor->name);
+        if (pos < (int)size)
+            pos += snprintf(
+                buf + pos,
+                size - pos,
+                "\n  latency %lu ms, max %lu ms, bus %lu us/s, %lu samples, %lu errors\n",
+                (unsigned long)sensor->latency_ms,
+                (unsigned long)sensor->latency_max_ms,
+                (unsigned long)sensor_bus_us_per_s(&sched, sensor, now),
+                (unsigned long)sensor->samples,
+                (unsigned long)sensor->errors);
+    }
+    xSemaphoreGive(lock);
+    return pos;
+}
+
+void sensors_init(void)
+{
+#if CONFIG_SENSORS_COOLANT_GPIO >= 0
+    static onewire_t coolant_bus;
+    onewire_init(&coolant_bus, CONFIG_SENSORS_COOLANT_GPIO);
+    add_sensor("coolant", "C", &ds18b20_ops, &coolant_bus, DS18B20_CONVERSION_MS);
+#endif
+#if CONFIG_SENSORS_ENCLOSURE_GPIO >= 0
+    static onewire_t enclosure_bus;
+    onewire_init(&enclosure_bus, CONFIG_SENSORS_ENCLOSURE_GPIO);
+    add_sensor("enclosure", "C", &ds18b20_ops, &enclosure_bus, DS18B20_CONVERSION_MS);
+#endif
+#if CONFIG_SENSORS_FUEL
+    init_i2c();
+    add_sensor("fuel", "%", &ads1115_ops, NULL, ADS1115_CONVERSION_MS);
+#endif
+
+    SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+    configASSERT(mutex);
+    if (sensors_count == 0)
+    {
+        ESP_LOGW(TAG, "no sensors set up");
+        lock = mutex;
+        return;
+    }
+
+    sensor_sched_init(&sched, sensors, sensors_count, now_us, now_ms());
+    lock = mutex;
+
+    // bit-banged slots keep interrupts off for 70 us, not on the control core
+    TaskHandle_t handle = NULL;
+    xTaskCreatePinnedToCore(&sensors_task, "sensors", 3072, NULL, TASK_PRIO_SENSORS, &handle, TASK_CORE_NET);
+    metrics_register_task(handle);
+}
+
+#else
+
+void sensors_init(void)
+{
+}
+
+int sensors_format(char * buf, size_t size)
+{
+    return snprintf(buf, size, "sensors are off\n");
+}
+
+#endif
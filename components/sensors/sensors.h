@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Sample the coolant and enclosure temperatures and the fuel level on the
+ * sensors set up in menuconfig. Every batch goes to the metrics. Call after
+ * metrics_init. Does nothing unless CONFIG_SENSORS is set. */
+void sensors_init(void);
+
+/* The latest value of every sensor with its sampling latency and bus time.
+ * Returns the length. */
+int sensors_format(char * buf, size_t size);
@@ -0,0 +1,311 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sensor_sched.h"
+
+// ----------------------------------------------------- Test "framework": ---
+
+#define done() return 0
+#define fail() return __LINE__
+static int checkqty = 0;
+#define check(x) \
+    do \
+    { \
+        ++checkqty; \
+        if (!(x)) \
+            fail(); \
+    } while (0)
+
+struct test
+{
+    int (*func)(void);
+    char const * name;
+};
+
+static int test_suit(struct test const * tests, int numtests)
+{
+    printf("%s", "\n\nTests:\n");
+    int failed = 0;
+    for (int i = 0; i < numtests; ++i)
+    {
+        printf(" %02d%s%-25s ", i, ": ", tests[i].name);
+        int linerr = tests[i].func();
+        if (0 == linerr)
+            printf("%s", "OK\n");
+        else
+        {
+            printf("%s%d\n", "Failed, line: ", linerr);
+            ++failed;
+        }
+    }
+    printf("\n%s%d\n", "Total checks: ", checkqty);
+    printf("%s[ %d / %d ]\r\n\n\n", "Tests PASS: ", numtests - failed, numtests);
+    return failed;
+}
+
+// ---------------------------------------------------- Bus simulator: ---
+
+/* Devices on a simulated bus. A transaction moves the clock forward by its
+ * bus time, like the blocking drivers on the device. A device remembers
+ * reads that came before its conversion was done. */
+
+typedef struct
+{
+    uint32_t start_us;
+    uint32_t read_us;
+    uint32_t conversion_ms;
+    float value;
+    bool fail_start;
+    bool fail_read;
+
+    bool converting;
+    uint32_t started_at;
+    uint32_t read_at;
+    int starts;
+    int reads;
+    int early_reads;
+} sim_dev_t;
+
+static uint64_t clock_us;
+
+static uint64_t sim_now_us(void)
+{
+    return clock_us;
+}
+
+static uint32_t sim_now_ms(void)
+{
+    return clock_us / 1000;
+}
+
+static bool sim_start(sensor_t * sensor)
+{
+    sim_dev_t * dev = sensor->dev;
+    clock_us += dev->start_us;
+    dev->starts++;
+    if (dev->fail_start)
+        return false;
+    dev->converting = true;
+    dev->started_at = sim_now_ms();
+    return true;
+}
+
+static bool sim_read(sensor_t * sensor, float * value)
+{
+    sim_dev_t * dev = sensor->dev;
+    if (!dev->converting || sim_now_ms() - dev->started_at < dev->conversion_ms)
+        dev->early_reads++;
+    clock_us += dev->read_us;
+    dev->reads++;
+    dev->read_at = sim_now_ms();
+    dev->converting = false;
+    if (dev->fail_read)
+        return false;
+    *value = dev->value;
+    return true;
+}
+
+static const sensor_ops_t sim_ops = {.start = sim_start, .read = sim_read};
+
+// a DS18B20 at 12 bits, 1-Wire reset and two bytes, reset and nine bytes back
+static const sim_dev_t ds18b20 = {.start_us = 1300, .read_us = 6500, .conversion_ms = 750, .value = 82.5f};
+// an ADS1115 at 128 samples/s on 100 kHz I2C
+static const sim_dev_t ads1115 = {.start_us = 400, .read_us = 500, .conversion_ms = 8, .value = 1650.0f};
+
+typedef struct
+{
+    sensor_sched_t sched;
+    sensor_t sensors[3];
+    sim_dev_t devs[3];
+    int batches;
+    // longest a single step kept the task busy
+    uint32_t longest_step_us;
+} sim_t;
+
+static void sim_init(sim_t * sim, uint64_t start_us, uint32_t period_ms)
+{
+    static const char * names[3] = {"coolant", "enclosure", "fuel"};
+
+    memset(sim, 0, sizeof(sim_t));
+    sim->devs[0] = ds18b20;
+    sim->devs[1] = ds18b20;
+    sim->devs[1].value = 31.0f;
+    sim->devs[2] = ads1115;
+    for (int i = 0; i < 3; i++)
+    {
+        sim->sensors[i].name = names[i];
+        sim->sensors[i].ops = &sim_ops;
+        sim->sensors[i].dev = &sim->devs[i];
+        // a little margin over the datasheet time
+        sim->sensors[i].conversion_ms = sim->devs[i].conversion_ms + (i < 2 ? 10 : 1);
+        sim->sensors[i].period_ms = period_ms;
+    }
+    clock_us = start_us;
+    sensor_sched_init(&sim->sched, sim->sensors, 3, sim_now_us, sim_now_ms());
+}
+
+/* Step like the sensor task: run what is due, then sleep until the next
+ * transaction. */
+static void sim_run(sim_t * sim, uint32_t duration_ms)
+{
+    uint64_t end_us = clock_us + duration_ms * 1000ULL;
+
+    while (clock_us < end_us)
+    {
+        uint64_t before = clock_us;
+        if (sensor_sched_step(&sim->sched, sim_now_ms()))
+            sim->batches++;
+        if (clock_us - before > sim->longest_step_us)
+            sim->longest_step_us = clock_us - before;
+
+        uint32_t wait_ms = sensor_sched_timeout(&sim->sched, sim_now_ms());
+        if (wait_ms > 0)
+            // wakes up on the next tick, the ms clock has to reach the due time
+            clock_us = (clock_us / 1000 + wait_ms) * 1000;
+    }
+}
+
+// ----------------------------------------------------------- Unit tests: ---
+
+static int interleave(void)
+{
+    sim_t sim;
+    sim_init(&sim, 0, 10000);
+    check(sensor_sched_timeout(&sim.sched, 0) == 0);
+
+    sim_run(&sim, 1000);
+    check(sim.batches == 1);
+    for (int i = 0; i < 3; i++)
+    {
+        check(sim.sensors[i].valid);
+        check(sim.sensors[i].value == sim.devs[i].value);
+        check(sim.devs[i].early_reads == 0);
+        check(sim.devs[i].starts == 1);
+    }
+
+    // both conversions run at the same time, the second starts right after the first
+    check(sim.devs[1].started_at - sim.devs[0].started_at <= 2);
+    // the fuel level is in long before the temperatures
+    check(sim.devs[2].read_at < 20);
+    check(sim.sensors[2].latency_ms < 20);
+    check(sim.sensors[0].latency_ms >= 760 && sim.sensors[0].latency_ms < 780);
+    check(sim.sensors[1].latency_ms >= 760 && sim.sensors[1].latency_ms < 780);
+    // nothing waited for a conversion, the longest step is one transaction
+    check(sim.longest_step_us == ds18b20.read_us);
+    done();
+}
+
+static int period(void)
+{
+    sim_t sim;
+    sim_init(&sim, 0, 10000);
+
+    sim_run(&sim, 60000);
+    check(sim.batches == 6);
+    check(sim.sched.batches == 6);
+    for (int i = 0; i < 3; i++)
+    {
+        check(sim.sensors[i].samples == 6);
+        check(sim.devs[i].early_reads == 0);
+        // the last start is on the period, reads did not make it drift
+        check(sim.devs[i].started_at >= 50000 && sim.devs[i].started_at < 50010);
+    }
+    done();
+}
+
+static int errors(void)
+{
+    sim_t sim;
+    sim_init(&sim, 0, 5000);
+    sim.devs[0].fail_start = true;
+    sim.devs[2].fail_read = true;
+
+    sim_run(&sim, 1000);
+    // failed sensors still close the batch
+    check(sim.batches == 1);
+    check(!sim.sensors[0].valid);
+    check(sim.sensors[0].errors == 1);
+    check(sim.devs[0].reads == 0);
+    check(sim.sensors[1].valid);
+    check(!sim.sensors[2].valid);
+    check(sim.sensors[2].errors == 1);
+    check(sim.sensors[2].samples == 0);
+
+    // and are tried again next period
+    sim.devs[0].fail_start = false;
+    sim.devs[2].fail_read = false;
+    sim_run(&sim, 5000);
+    check(sim.batches == 2);
+    for (int i = 0; i < 3; i++)
+        check(sim.sensors[i].valid);
+    check(sim.sensors[0].errors == 1);
+    done();
+}
+
+static int utilization(void)
+{
+    sim_t sim;
+    sim_init(&sim, 0, 10000);
+
+    sim_run(&sim, 60000);
+    uint32_t now = sim_now_ms();
+    // six readings of 1.3 + 6.5 ms in a minute
+    check(sim.sensors[0].bus_us == 6 * (ds18b20.start_us + ds18b20.read_us));
+    uint32_t coolant = sensor_bus_us_per_s(&sim.sched, &sim.sensors[0], now);
+    check(coolant >= 770 && coolant <= 780);
+    uint32_t fuel = sensor_bus_us_per_s(&sim.sched, &sim.sensors[2], now);
+    check(fuel >= 85 && fuel <= 90);
+    check(sensor_bus_us_per_s(&sim.sched, &sim.sensors[0], sim.sched.since_ms) == 0);
+    done();
+}
+
+static int late(void)
+{
+    sim_t sim;
+    sim_init(&sim, 0, 1000);
+
+    // the task was held up for 3 s, every sensor catches up once, no burst
+    sim_run(&sim, 500);
+    clock_us += 3000 * 1000;
+    int before = sim.devs[0].starts;
+    sim_run(&sim, 100);
+    check(sim.devs[0].starts == before + 1);
+    check(sim.sensors[0].latency_max_ms > 3000);
+    check(sim.devs[0].early_reads == 0);
+
+    sim_run(&sim, 3000);
+    check(sim.sensors[0].latency_ms < 780);
+    done();
+}
+
+static int wraparound(void)
+{
+    sim_t sim;
+    // the ms clock wraps 2 s in
+    sim_init(&sim, (UINT32_MAX - 2000ULL) * 1000, 1000);
+
+    sim_run(&sim, 10000);
+    check(sim.batches == 10);
+    for (int i = 0; i < 3; i++)
+    {
+        check(sim.sensors[i].samples == 10);
+        check(sim.devs[i].early_reads == 0);
+        check(sim.sensors[i].latency_max_ms < 780);
+    }
+    done();
+}
+
+int main(void)
+{
+    static struct test const tests[] = {
+        {interleave, "Interleaved conversions"},
+        {period, "Period"},
+        {errors, "Bus errors"},
+        {utilization, "Bus utilization"},
+        {late, "Late task"},
+        {wraparound, "Clock wrap around"},
+    };
+    return test_suit(tests, sizeof tests / sizeof *tests);
+}
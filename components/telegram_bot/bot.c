@@ -1,13 +1,18 @@
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "esp_attr.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_random.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_tls.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/portmacro.h"
 #include "freertos/projdefs.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "nvs_flash.h"
 #include "sdkconfig.h"
@@ -19,21 +24,77 @@
 #include "bot.h"
 #include "control.h"
 #include "esp_http_client.h"
+#include "health.h"
+#include "http_response.h"
+#include "journal.h"
+#include "latency_hist.h"
+#include "mains.h"
+#include "metrics.h"
+#include "ota.h"
+#include "outbox.h"
+#include "ratelimit.h"
+#include "retry.h"
+#include "scheduler.h"
+#include "sensors.h"
+#include "task_plan.h"
 #include "tiny-json.h"
 
 #define MAX_HTTP_RECV_BUFFER 512
-#define MAX_HTTP_OUTPUT_BUFFER 2048
+#define MAX_HTTP_OUTPUT_BUFFER CONFIG_TELEGRAM_BOT_RESPONSE_BUFFER_SIZE
 
 #define TELEGRAM_BOT_API_KEY CONFIG_TELEGRAM_BOT_API_KEY
 #define TELEGRAM_BOT_ADMIN_ID CONFIG_TELEGRAM_BOT_ADMIN_ID
+#define TELEGRAM_BOT_POLL_TIMEOUT CONFIG_TELEGRAM_BOT_POLL_TIMEOUT
+
+#ifdef CONFIG_MBEDTLS_ASYMMETRIC_CONTENT_LEN
+#    define TLS_RECORD_BUFFERS (CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN + CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN)
+#else
+#    define TLS_RECORD_BUFFERS (2 * CONFIG_MBEDTLS_SSL_MAX_CONTENT_LEN)
+#endif
+
+/* Rough heap cost of one kept-alive connection to the API: mbedTLS record
+ * buffers, ssl context with the peer certificate chain, http client rx/tx
+ * buffers and our own response buffer. */
+#define TLS_SESSION_OVERHEAD (10 * 1024)
+#define HTTP_CLIENT_BUFFERS (2 * 512)
+#define BOT_CONNECTION_COST (TLS_RECORD_BUFFERS + TLS_SESSION_OVERHEAD + HTTP_CLIENT_BUFFERS + MAX_HTTP_OUTPUT_BUFFER)
+
+// telegram does not accept longer messages
+#define MESSAGE_MAX_LEN 4096
+// messages that did not fit into the queue are merged here
+#define PENDING_TEXT_SIZE 512
+// anything earlier means the clock has not been set yet
+#define TIME_VALID_AFTER 1700000000
 
 static const char * TAG = "BOT";
 
 // global variables
 static QueueHandle_t queries_q = NULL;
 static int bot_update_id = 0;
+// lowered to 1 while a batch does not fit the response buffer, see retry.h
+static int updates_limit = RETRY_UPDATES_LIMIT;
+static volatile bool poll_in_flight = false;
+// a query worker request between perform and its return, read by the latency probe
+static volatile bool query_in_flight = false;
+
+static ratelimit_t ratelimit;
+// the worker takes tokens, /netstats reads them from the poll task
+static SemaphoreHandle_t ratelimit_lock = NULL;
+static SemaphoreHandle_t pending_lock = NULL;
+static char pending_text[PENDING_TEXT_SIZE];
+static int pending_len = 0;
 static int64_t config_bot_admin_id = 0;
 
+/* Messages that could not go out while the api was unreachable. RTC memory
+ * keeps them over a reset, they are flushed in batches once a request goes
+ * through again. */
+static RTC_NOINIT_ATTR outbox_t outbox;
+static SemaphoreHandle_t outbox_lock = NULL;
+// set by a request that did not reach the api, cleared by one that did
+static volatile bool api_down = false;
+// bumped by the connectivity watchdog, every worker drops its connection once
+static volatile uint32_t reset_generation = 0;
+
 extern const char api_telegram_org_root_cert_start[] asm("_binary_api_telegram_org_root_cert_pem_start");
 extern const char api_telegram_org_root_cert_end[] asm("_binary_api_telegram_org_root_cert_pem_end");
 
@@ -44,75 +105,308 @@ typedef enum
     DELETE_WEBHOOK
 } TelegramMethod_t;
 
+#define TELEGRAM_METHODS_COUNT (DELETE_WEBHOOK + 1)
+
+static const char * method_names[TELEGRAM_METHODS_COUNT] = {
+    [SEND_MESSAGE] = "sendMessage",
+    [GET_UPDATES] = "getUpdates",
+    [DELETE_WEBHOOK] = "deleteWebhook",
+};
+
+#define METHOD_PATH(name) "/bot" TELEGRAM_BOT_API_KEY "/" name
+
+/* Request paths put together at compile time. The client keeps what it was
+ * last set up with, so a run of queries of one method does not parse the
+ * url or touch the header list again, see apply_template. */
+typedef struct
+{
+    const char * path;
+} request_template_t;
+
+static const request_template_t request_templates[TELEGRAM_METHODS_COUNT] = {
+    [SEND_MESSAGE] = {.path = METHOD_PATH("sendMessage")},
+    [GET_UPDATES] = {.path = METHOD_PATH("getUpdates")},
+    [DELETE_WEBHOOK] = {.path = METHOD_PATH("deleteWebhook")},
+};
+
 typedef struct
 {
     TelegramMethod_t method;
     char * post_data;
+    // sendMessage only, post_data is built from them right before sending
+    int64_t chat_id;
+    char * text;
+    int64_t queued_at;
+    // sent so far, retries included
+    int attempts;
+    // a flush of the outbox, released when delivered
+    bool from_outbox;
+    outbox_batch_t batch;
 } Query_t;
 
-
-#define JSON_POOL_ARRAY_SIZE 32
-
-struct json_pool_array;
-typedef struct json_pool_array
-{
-    json_t * mem;
-    struct json_pool_array * prev;
-} pool_array_t;
+/* How hard each method is tried, see retry.h. */
+static const retry_policy_t retry_policies[TELEGRAM_METHODS_COUNT] = {
+    [SEND_MESSAGE] = {.max_attempts = 8, .base_delay_ms = 500, .max_delay_ms = 60000},
+    // polled again anyway, the delays are used between failed long polls
+    [GET_UPDATES] = {.max_attempts = 1, .base_delay_ms = 1000, .max_delay_ms = 60000},
+    [DELETE_WEBHOOK] = {.max_attempts = 3, .base_delay_ms = 1000, .max_delay_ms = 10000},
+};
 
 typedef struct
 {
-    pool_array_t * array;
-    unsigned int nextFree;
-    jsonPool_t pool;
-} pool_t;
+    uint32_t requests;
+    uint32_t retries;
+    uint32_t throttled;
+    uint32_t drops;
+} method_stats_t;
+
+static method_stats_t method_stats[TELEGRAM_METHODS_COUNT];
+/* method_stats and the histograms are written by both workers and by the
+ * tasks calling make_query, /netstats and /latency read them. */
+static SemaphoreHandle_t stats_lock = NULL;
 
-static json_t * pool_alloc(jsonPool_t * pool)
+/* esp_http_client resolves, connects and does the TLS handshake in one
+ * step, so DNS, TCP and TLS are only seen together as the connect phase. */
+typedef enum
 {
-    pool_t * spool = json_containerOf(pool, pool_t, pool);
-    if (spool->nextFree >= JSON_POOL_ARRAY_SIZE)
-    {
-        pool_array_t * curarray = spool->array;
-        spool->array = malloc(sizeof(pool_array_t));
-        spool->array->mem = calloc(JSON_POOL_ARRAY_SIZE, sizeof(json_t));
-        spool->array->prev = curarray;
-        spool->nextFree = 0;
-    }
+    PHASE_PREPARE,
+    PHASE_CONNECT,
+    PHASE_SEND,
+    PHASE_FIRST_BYTE,
+    PHASE_BODY,
+    PHASE_PARSE,
+    PHASE_TOTAL,
+    PHASES_COUNT
+} request_phase_t;
 
-    return &spool->array->mem[spool->nextFree++];
-}
+static const char * phase_names[PHASES_COUNT] = {
+    [PHASE_PREPARE] = "prepare",
+    [PHASE_CONNECT] = "connect",
+    [PHASE_SEND] = "send",
+    [PHASE_FIRST_BYTE] = "first byte",
+    [PHASE_BODY] = "body",
+    [PHASE_PARSE] = "parse",
+    [PHASE_TOTAL] = "total",
+};
+
+static latency_hist_t latency[TELEGRAM_METHODS_COUNT][PHASES_COUNT];
 
-static json_t * pool_init(jsonPool_t * pool)
+/* Queued to delivered of sendMessage, by how updates were polled while it
+ * went out, so the two connection setups can be compared. */
+typedef enum
 {
-    pool_t * spool = json_containerOf(pool, pool_t, pool);
-    spool->nextFree = JSON_POOL_ARRAY_SIZE;
-    spool->array = NULL;
+    DELIVERY_SHARED,
+    DELIVERY_POLL_IDLE,
+    DELIVERY_POLL_OPEN,
+    DELIVERY_MODES
+} delivery_mode_t;
+
+static const char * delivery_names[DELIVERY_MODES] = {
+    [DELIVERY_SHARED] = "shared connection",
+    [DELIVERY_POLL_IDLE] = "own poll connection, no poll open",
+    [DELIVERY_POLL_OPEN] = "own poll connection, poll open",
+};
+
+static latency_hist_t delivery[DELIVERY_MODES];
+static bool dual_connection = false;
 
-    return pool_alloc(pool);
+static void count_stat(uint32_t * counter)
+{
+    xSemaphoreTake(stats_lock, portMAX_DELAY);
+    (*counter)++;
+    xSemaphoreGive(stats_lock);
 }
 
-static void pool_free(pool_t * spool)
+/* Formatting and dumping take a while, they work on a copy. */
+static void copy_hist(const latency_hist_t * hist, latency_hist_t * copy)
 {
-    pool_array_t * item = spool->array;
-    while (item != NULL)
-    {
-        pool_array_t * prev = item->prev;
-        free(item->mem);
-        free(item);
-        item = prev;
-    }
+    xSemaphoreTake(stats_lock, portMAX_DELAY);
+    *copy = *hist;
+    xSemaphoreGive(stats_lock);
 }
 
-void process_bot_command(const char * cmd, int len)
+
+/* args is the message text after the command, without leading spaces. */
+void process_bot_command(const char * cmd, int len, const char * args)
 {
     if (strncmp(cmd, "/status", len) == 0)
         sendMessageToAdmin("Working");
     else if (strncmp(cmd, "/state", len) == 0)
-        sendMessageToAdmin("Not implemented");
+    {
+        char buf[256];
+        control_format_state(buf, sizeof(buf));
+        sendMessageToAdmin(buf);
+    }
     else if (strncmp(cmd, "/starter_on", len) == 0)
     {
         open_relay();
     }
+    else if (strncmp(cmd, "/on", len) == 0)
+    {
+        if (*args == '\0')
+            open_relay();
+        else if (!open_channel(args))
+            sendMessageToAdmin("unknown channel, see /state");
+    }
+    else if (strncmp(cmd, "/metrics", len) == 0)
+    {
+        char buf[512];
+        metrics_format(buf, sizeof(buf));
+        sendMessageToAdmin(buf);
+    }
+    else if (strncmp(cmd, "/latency", len) == 0)
+    {
+        char buf[1024];
+        int pos = 0;
+        latency_hist_t hist;
+        for (int method = 0; method < TELEGRAM_METHODS_COUNT && pos < (int)sizeof(buf); method++)
+        {
+            copy_hist(&latency[method][PHASE_TOTAL], &hist);
+            if (hist.total == 0)
+                continue;
+
+            pos += snprintf(buf + pos, sizeof(buf) - pos, "%s\n", method_names[method]);
+            for (int phase = 0; phase < PHASES_COUNT && pos < (int)sizeof(buf); phase++)
+            {
+                char line[64];
+                copy_hist(&latency[method][phase], &hist);
+                latency_hist_format(&hist, line, sizeof(line));
+                pos += snprintf(buf + pos, sizeof(buf) - pos, "  %s: %s\n", phase_names[phase], line);
+
+                // the full buckets go to the serial console
+                char name[40];
+                snprintf(name, sizeof(name), "%s %s", method_names[method], phase_names[phase]);
+                latency_hist_dump(&hist, name);
+            }
+        }
+        for (int mode = 0; mode < DELIVERY_MODES && pos < (int)sizeof(buf); mode++)
+        {
+            copy_hist(&delivery[mode], &hist);
+            if (hist.total == 0)
+                continue;
+
+            char line[64];
+            latency_hist_format(&hist, line, sizeof(line));
+            pos += snprintf(buf + pos, sizeof(buf) - pos, "delivery, %s: %s\n", delivery_names[mode], line);
+            latency_hist_dump(&hist, delivery_names[mode]);
+        }
+        if (pos < (int)sizeof(buf))
+            pos += control_format_latency(buf + pos, sizeof(buf) - pos);
+        sendMessageToAdmin(pos ? buf : "no requests yet");
+    }
+    else if (strncmp(cmd, "/history", len) == 0)
+    {
+        char buf[1024];
+        int pos = journal_format_history(buf, sizeof(buf), 10);
+        if (pos < (int)sizeof(buf) - 1)
+            journal_format_stats(buf + pos, sizeof(buf) - pos);
+        sendMessageToAdmin(buf);
+    }
+    else if (strncmp(cmd, "/netstats", len) == 0)
+    {
+        char buf[384];
+        int pos = 0;
+        method_stats_t stats_copy[TELEGRAM_METHODS_COUNT];
+        xSemaphoreTake(stats_lock, portMAX_DELAY);
+        memcpy(stats_copy, method_stats, sizeof(stats_copy));
+        xSemaphoreGive(stats_lock);
+        for (int i = 0; i < TELEGRAM_METHODS_COUNT && pos < (int)sizeof(buf); i++)
+        {
+            method_stats_t * stats = &stats_copy[i];
+            pos += snprintf(
+                buf + pos,
+                sizeof(buf) - pos,
+                "%s: %lu req, %lu retries, %lu throttled, %lu dropped; ",
+                method_names[i],
+                (unsigned long)stats->requests,
+                (unsigned long)stats->retries,
+                (unsigned long)stats->throttled,
+                (unsigned long)stats->drops);
+        }
+        if (pos < (int)sizeof(buf))
+            pos += snprintf(
+                buf + pos,
+                sizeof(buf) - pos,
+                "outbox: %d held, %u dropped; ",
+                outbox.count,
+                outbox.dropped);
+        if (pos < (int)sizeof(buf))
+        {
+            xSemaphoreTake(ratelimit_lock, portMAX_DELAY);
+            snprintf(
+                buf + pos,
+                sizeof(buf) - pos,
+                "limiter: %d chat tokens, %lu waits, %lu merged",
+                ratelimit_chat_tokens(&ratelimit, config_bot_admin_id, esp_timer_get_time() / 1000),
+                (unsigned long)ratelimit.waits,
+                (unsigned long)ratelimit.merged);
+            xSemaphoreGive(ratelimit_lock);
+        }
+        sendMessageToAdmin(buf);
+    }
+    else if (strncmp(cmd, "/schedule", len) == 0)
+    {
+        if (strncmp(args, "add ", 4) == 0)
+        {
+            esp_err_t err = scheduler_add(args + 4);
+            if (err == ESP_OK)
+                sendMessageToAdmin("added");
+            else if (err == ESP_ERR_NO_MEM)
+                sendMessageToAdmin("too many rules");
+            else if (err == ESP_ERR_INVALID_STATE)
+                sendMessageToAdmin("scheduler is starting, try again");
+            else
+                sendMessageToAdmin("bad rule, expected: minute hour day month weekday [channel]");
+        }
+        else if (strncmp(args, "del ", 4) == 0)
+        {
+            esp_err_t err = scheduler_remove(atoi(args + 4));
+            if (err == ESP_OK)
+                sendMessageToAdmin("removed");
+            else if (err == ESP_ERR_INVALID_STATE)
+                sendMessageToAdmin("scheduler is starting, try again");
+            else
+                sendMessageToAdmin("no such rule");
+        }
+        else
+        {
+            char buf[640];
+            scheduler_format(buf, sizeof(buf));
+            sendMessageToAdmin(buf);
+        }
+    }
+    else if (strncmp(cmd, "/mains", len) == 0)
+    {
+        char buf[320];
+        mains_format(buf, sizeof(buf));
+        sendMessageToAdmin(buf);
+    }
+    else if (strncmp(cmd, "/sensors", len) == 0)
+    {
+        char buf[384];
+        sensors_format(buf, sizeof(buf));
+        sendMessageToAdmin(buf);
+    }
+    else if (strncmp(cmd, "/health", len) == 0)
+    {
+        char buf[320];
+        health_format(buf, sizeof(buf));
+        sendMessageToAdmin(buf);
+    }
+    else if (strncmp(cmd, "/ota", len) == 0)
+    {
+        esp_err_t err = *args == '\0' ? ESP_ERR_INVALID_ARG : ota_start(args, sendMessageToAdmin);
+        if (err == ESP_ERR_INVALID_ARG)
+            sendMessageToAdmin("usage: /ota https://<host>/<image>");
+        else if (err == ESP_ERR_NOT_SUPPORTED)
+            sendMessageToAdmin("no update server CA in this firmware");
+        else if (err == ESP_ERR_INVALID_STATE)
+            sendMessageToAdmin("update is already running");
+        else if (err != ESP_OK)
+            sendMessageToAdmin("update not started: out of memory");
+        else
+            sendMessageToAdmin("update started");
+    }
     else
     {
         sendMessageToAdmin("Not implemented");
@@ -120,52 +414,64 @@ void process_bot_command(const char * cmd, int len)
     }
 }
 
-BaseType_t process_api_response(char * resp)
+/* Commands are copied out of the response, longer messages are ignored. */
+#define COMMAND_TEXT_SIZE 256
+
+/* The response is parsed read-only, it stays intact for the log. */
+BaseType_t process_api_response(const char * resp, int len, int * retry_after)
 {
     BaseType_t res = pdPASS;
-    pool_t spool = {.pool = {.init = pool_init, .alloc = pool_alloc}, .array = NULL};
-    json_t const * json = json_createWithPool(resp, &spool.pool);
+    // count first, then one block of the exact size
+    unsigned int json_qty = jsonv_count(resp, len);
+    jsonv_t * json_mem = malloc(json_qty * sizeof(jsonv_t));
+    if (json_mem == NULL)
+    {
+        ESP_LOGE(TAG, "no memory for %u json properties", json_qty);
+        return pdFAIL;
+    }
+
+    jsonv_t const * json = jsonv_create(resp, len, json_mem, json_qty);
     if (json == NULL)
     {
         res = pdFAIL;
-        ESP_LOGE(TAG, "could not parse json response");
+        ESP_LOGE(TAG, "could not parse json response: %.*s", len, resp);
         goto cleanup;
     }
 
-    json_t const * ok_prop = json_getProperty(json, "ok");
+    jsonv_t const * ok_prop = jsonv_getProperty(json, "ok");
     if (ok_prop == NULL)
     {
         ESP_LOGI(TAG, "got invalid response with no 'ok' field");
         goto cleanup;
     }
 
-    bool is_ok = json_getBoolean(ok_prop);
+    bool is_ok = jsonv_getBoolean(ok_prop);
     if (is_ok)
     {
-        json_t const * result_prop = json_getProperty(json, "result");
-        if (result_prop && json_getType(result_prop) == JSON_ARRAY)
+        jsonv_t const * result_prop = jsonv_getProperty(json, "result");
+        if (result_prop && jsonv_getType(result_prop) == JSON_ARRAY)
         {
-            json_t const * item = json_getChild(result_prop);
+            jsonv_t const * item = jsonv_getChild(result_prop);
             while (item != NULL)
             {
-                json_t const * update_id_prop = json_getProperty(item, "update_id");
+                jsonv_t const * update_id_prop = jsonv_getProperty(item, "update_id");
                 if (update_id_prop != NULL)
                 {
                     // we got an update object
-                    int update_id = json_getInteger(update_id_prop);
+                    int update_id = jsonv_getInteger(update_id_prop);
                     if (update_id > bot_update_id)
                     {
                         bot_update_id = update_id;
                         ESP_LOGI(TAG, "new update offset %d", bot_update_id);
                     }
 
-                    json_t const * message_prop = json_getProperty(item, "message");
+                    jsonv_t const * message_prop = jsonv_getProperty(item, "message");
                     if (message_prop)
                     {
                         // we got an update object with message object
-                        json_t const * from_prop = json_getProperty(message_prop, "from");
-                        json_t const * from_id_prop = json_getProperty(from_prop, "id");
-                        int sender_id = json_getInteger(from_id_prop);
+                        jsonv_t const * from_prop = jsonv_getProperty(message_prop, "from");
+                        jsonv_t const * from_id_prop = from_prop ? jsonv_getProperty(from_prop, "id") : NULL;
+                        int64_t sender_id = from_id_prop ? jsonv_getInteger(from_id_prop) : 0;
 
                         if (sender_id != config_bot_admin_id)
                         {
@@ -173,22 +479,42 @@ BaseType_t process_api_response(char * resp)
                             goto skip;
                         }
 
-                        const char * text = json_getPropertyValue(message_prop, "text");
-                        json_t const * entities_prop = json_getProperty(message_prop, "entities");
+                        jsonv_t const * text_prop = jsonv_getProperty(message_prop, "text");
+                        jsonv_t const * entities_prop = jsonv_getProperty(message_prop, "entities");
 
-                        if (entities_prop && json_getType(entities_prop) == JSON_ARRAY)
+                        if (text_prop && entities_prop && jsonv_getType(entities_prop) == JSON_ARRAY)
                         {
-                            json_t const * entity_item = json_getChild(entities_prop);
+                            // unescaped only for messages with commands
+                            char text[COMMAND_TEXT_SIZE];
+                            int text_len = -1;
+                            jsonv_t const * entity_item = jsonv_getChild(entities_prop);
                             while (entity_item != NULL)
                             {
-                                int entity_offset = json_getInteger(json_getProperty(entity_item, "offset"));
-                                int entity_len = json_getInteger(json_getProperty(entity_item, "length"));
-                                const char * entity_type = json_getPropertyValue(entity_item, "type");
+                                jsonv_t const * offset_prop = jsonv_getProperty(entity_item, "offset");
+                                jsonv_t const * length_prop = jsonv_getProperty(entity_item, "length");
+                                jsonv_t const * type_prop = jsonv_getProperty(entity_item, "type");
 
-                                if (strcmp(entity_type, "bot_command") == 0)
-                                    process_bot_command(text + entity_offset, entity_len);
+                                if (offset_prop && length_prop && type_prop && jsonv_isText(type_prop, "bot_command"))
+                                {
+                                    if (text_len < 0)
+                                        text_len = jsonv_getText(text_prop, text, sizeof(text));
+                                    int entity_offset = jsonv_getInteger(offset_prop);
+                                    int entity_len = jsonv_getInteger(length_prop);
 
-                                entity_item = json_getSibling(entity_item);
+                                    if (text_len < 0)
+                                        ESP_LOGI(TAG, "skipping the command: the message is too long");
+                                    else if (entity_offset < 0 || entity_len < 0 || entity_offset + entity_len > text_len)
+                                        ESP_LOGI(TAG, "skipping the command: it is out of the text");
+                                    else
+                                    {
+                                        const char * args = text + entity_offset + entity_len;
+                                        while (*args == ' ')
+                                            args++;
+                                        process_bot_command(text + entity_offset, entity_len, args);
+                                    }
+                                }
+
+                                entity_item = jsonv_getSibling(entity_item);
                             }
                         }
                         else
@@ -196,23 +522,51 @@ BaseType_t process_api_response(char * resp)
                     }
                 }
             skip:
-                item = json_getSibling(item);
+                item = jsonv_getSibling(item);
             }
         }
     }
+    else
+    {
+        jsonv_t const * description_prop = jsonv_getProperty(json, "description");
+        if (description_prop && jsonv_getType(description_prop) == JSON_TEXT)
+        {
+            jsonSpan_t description = jsonv_getValue(description_prop);
+            ESP_LOGE(TAG, "api error: %.*s", (int)description.len, description.ptr);
+        }
+        else
+            ESP_LOGE(TAG, "api error: no description");
+
+        if (retry_after)
+            *retry_after = retry_after_of(json);
+    }
 
 cleanup:
-    pool_free(&spool);
+    free(json_mem);
 
     return res;
 }
 
-bool make_query(TelegramMethod_t method, char * post_data, bool wait)
+static Query_t * new_query(TelegramMethod_t method)
 {
-    Query_t * query = malloc(sizeof(Query_t));
-    query->method = method;
-    query->post_data = post_data;
+    Query_t * query = calloc(1, sizeof(Query_t));
+    if (query)
+    {
+        query->method = method;
+        query->queued_at = esp_timer_get_time();
+    }
+    return query;
+}
+
+static void free_query(Query_t * query)
+{
+    free(query->post_data);
+    free(query->text);
+    free(query);
+}
 
+static bool enqueue_query(Query_t * query, bool wait)
+{
     BaseType_t res;
 
 again:
@@ -224,75 +578,183 @@ again:
         goto again;
     }
 
-    if (res != pdPASS)
+    return res == pdPASS;
+}
+
+bool make_query(TelegramMethod_t method, char * post_data, bool wait)
+{
+    Query_t * query = new_query(method);
+    if (query == NULL)
+    {
+        free(post_data);
+        return false;
+    }
+    query->post_data = post_data;
+
+    if (!enqueue_query(query, wait))
     {
-        free(query);
+        count_stat(&method_stats[method].drops);
+        free_query(query);
         return false;
     }
 
     return true;
 }
 
+/* The pending text and the sending task both merge, the counter is the limiter's. */
+static void count_merged(void)
+{
+    xSemaphoreTake(ratelimit_lock, portMAX_DELAY);
+    ratelimit.merged++;
+    xSemaphoreGive(ratelimit_lock);
+}
+
+/* Append a message to the pending text, it goes out as one message as soon as the queue drains. */
+static void add_pending_text(const char * text)
+{
+    bool cut = false;
+
+    xSemaphoreTake(pending_lock, portMAX_DELAY);
+    int left = PENDING_TEXT_SIZE - pending_len;
+    int len = snprintf(pending_text + pending_len, left, "%s%s", pending_len ? "\n" : "", text);
+    if (len >= left)
+    {
+        // keep what fits, mark the cut
+        pending_len = PENDING_TEXT_SIZE - 1;
+        memcpy(pending_text + PENDING_TEXT_SIZE - 4, "...", 4);
+        cut = true;
+    }
+    else
+        pending_len += len;
+    xSemaphoreGive(pending_lock);
+    if (cut)
+        count_merged();
+}
+
+static Query_t * take_pending_text(void)
+{
+    Query_t * query = NULL;
+
+    xSemaphoreTake(pending_lock, portMAX_DELAY);
+    if (pending_len > 0)
+    {
+        query = new_query(SEND_MESSAGE);
+        if (query)
+        {
+            query->chat_id = config_bot_admin_id;
+            query->text = strdup(pending_text);
+            pending_len = 0;
+        }
+    }
+    xSemaphoreGive(pending_lock);
+
+    return query;
+}
+
+/* Hold a message for later, stamped with the time it was queued at. */
+static void store_in_outbox(const char * text, int64_t queued_at)
+{
+    time_t now = time(NULL);
+    int64_t age_s = (esp_timer_get_time() - queued_at) / 1000000;
+    bool wall = now > TIME_VALID_AFTER;
+
+    xSemaphoreTake(outbox_lock, portMAX_DELAY);
+    outbox_put(&outbox, text, wall ? now - age_s : queued_at / 1000000, wall);
+    xSemaphoreGive(outbox_lock);
+}
+
+/* The oldest held messages as one query, once the api is back. */
+static Query_t * take_outbox_batch(void)
+{
+    Query_t * query = NULL;
+
+    if (api_down)
+        return NULL;
+
+    xSemaphoreTake(outbox_lock, portMAX_DELAY);
+    if (outbox.count > 0)
+    {
+        query = new_query(SEND_MESSAGE);
+        if (query)
+            query->text = malloc(MESSAGE_MAX_LEN);
+        if (query && query->text)
+        {
+            query->chat_id = config_bot_admin_id;
+            query->from_outbox = true;
+            outbox_batch(&outbox, query->text, MESSAGE_MAX_LEN, &query->batch);
+        }
+    }
+    xSemaphoreGive(outbox_lock);
+
+    if (query && query->text == NULL)
+    {
+        free_query(query);
+        query = NULL;
+    }
+    return query;
+}
+
+static void record_latency(TelegramMethod_t method, http_response_t * resp)
+{
+    latency_hist_t * hist = latency[method];
+    int64_t sent_from = resp->connected_at ? resp->connected_at : resp->started_at;
+    int64_t total_us = esp_timer_get_time() - resp->started_at;
+
+    xSemaphoreTake(stats_lock, portMAX_DELAY);
+    // a phase is skipped if its event did not come
+    if (resp->prepare_us)
+        latency_hist_record(&hist[PHASE_PREPARE], resp->prepare_us);
+    if (resp->connected_at)
+        latency_hist_record(&hist[PHASE_CONNECT], resp->connected_at - resp->started_at);
+    if (resp->sent_at)
+        latency_hist_record(&hist[PHASE_SEND], resp->sent_at - sent_from);
+    if (resp->sent_at && resp->first_byte_at)
+        latency_hist_record(&hist[PHASE_FIRST_BYTE], resp->first_byte_at - resp->sent_at);
+    if (resp->first_byte_at && resp->finished_at)
+        latency_hist_record(&hist[PHASE_BODY], resp->finished_at - resp->first_byte_at);
+    if (resp->finished_at)
+        latency_hist_record(&hist[PHASE_PARSE], resp->parse_us);
+    latency_hist_record(&hist[PHASE_TOTAL], total_us);
+    xSemaphoreGive(stats_lock);
+}
+
 esp_err_t _http_event_handler(esp_http_client_event_t * evt)
 {
-    static char * output_buffer; // Buffer to store response of http request from event handler
-    static int output_len; // Stores number of bytes read
+    http_response_t * resp = evt->user_data;
     switch (evt->event_id)
     {
         case HTTP_EVENT_ERROR:
             ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
+            http_response_reset(resp);
             break;
         case HTTP_EVENT_ON_CONNECTED:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+            resp->connected_at = esp_timer_get_time();
             break;
         case HTTP_EVENT_HEADER_SENT:
             ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
+            resp->sent_at = esp_timer_get_time();
             break;
         case HTTP_EVENT_ON_HEADER:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            if (resp->first_byte_at == 0)
+                resp->first_byte_at = esp_timer_get_time();
             break;
         case HTTP_EVENT_ON_DATA:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            /*
-             *  Check for chunked encoding is added as the URL for chunked encoding used in this example returns binary data.
-             *  However, event handler can also be used in case chunked encoding is used.
-             */
-            if (!esp_http_client_is_chunked_response(evt->client))
-            {
-                // If user_data buffer is configured, copy the response into the buffer
-                if (evt->user_data)
-                {
-                    memcpy((char *)evt->user_data + output_len, evt->data, evt->data_len);
-                }
-                else
-                {
-                    if (output_buffer == NULL)
-                    {
-                        output_buffer = (char *)malloc(esp_http_client_get_content_length(evt->client) + 1);
-                        output_len = 0;
-                        if (output_buffer == NULL)
-                        {
-                            ESP_LOGE(TAG, "Failed to allocate memory for output buffer");
-                            return ESP_FAIL;
-                        }
-                    }
-                    memcpy(output_buffer + output_len, evt->data, evt->data_len);
-                }
-                output_len += evt->data_len;
-            }
-
+            if (!resp->overflow && !http_response_append(resp, evt->data, evt->data_len))
+                ESP_LOGE(TAG, "response does not fit into %d bytes, dropping it", resp->capacity);
             break;
         case HTTP_EVENT_ON_FINISH:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-            if (output_buffer != NULL)
+            resp->finished_at = esp_timer_get_time();
+            if (!resp->overflow && resp->len > 0)
             {
-                output_buffer[output_len] = '\0';
-                ESP_LOGI(TAG, "%s", output_buffer);
-                process_api_response(output_buffer);
-                free(output_buffer);
-                output_buffer = NULL;
+                ESP_LOGI(TAG, "%.*s", resp->len, resp->buf);
+                process_api_response(resp->buf, resp->len, &resp->retry_after);
+                resp->parse_us = esp_timer_get_time() - resp->finished_at;
             }
-            output_len = 0;
+            // kept until the next http_response_start, query_result reads retry_after
             break;
         case HTTP_EVENT_DISCONNECTED: {
             ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
@@ -304,16 +766,12 @@ esp_err_t _http_event_handler(esp_http_client_event_t * evt)
                 ESP_LOGI(TAG, "Last esp error code: 0x%x", err);
                 ESP_LOGI(TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
             }
-            if (output_buffer != NULL)
-            {
-                free(output_buffer);
-                output_buffer = NULL;
-            }
-            output_len = 0;
+            http_response_reset(resp);
             break;
         }
         case HTTP_EVENT_REDIRECT:
             ESP_LOGD(TAG, "HTTP_EVENT_REDIRECT");
+            resp->redirected = true;
             esp_http_client_set_header(evt->client, "From", "user@example.com");
             esp_http_client_set_header(evt->client, "Accept", "text/html");
             break;
@@ -321,94 +779,432 @@ esp_err_t _http_event_handler(esp_http_client_event_t * evt)
     return ESP_OK;
 }
 
-static void queryMakerTask(void * queue)
+/* Create a client for api.telegram.org with its own response buffer. */
+static esp_http_client_handle_t bot_client_init(http_response_t * resp, int timeout_ms, bool is_async)
 {
+    http_response_init(resp, malloc(MAX_HTTP_OUTPUT_BUFFER), MAX_HTTP_OUTPUT_BUFFER);
+    if (resp->buf == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate memory for output buffer");
+        return NULL;
+    }
+
     esp_http_client_config_t config = {
         .host = "api.telegram.org",
         .path = "/",
         .transport_type = HTTP_TRANSPORT_OVER_SSL,
         .cert_pem = api_telegram_org_root_cert_start,
-        .timeout_ms = 5000,
+        .timeout_ms = timeout_ms,
         .event_handler = _http_event_handler,
-        .is_async = true,
+        .user_data = resp,
+        .is_async = is_async,
         .keep_alive_enable = true,
     };
     esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        free(resp->buf);
+        resp->buf = NULL;
+    }
+    return client;
+}
 
-    char query_buf[100];
+static void bot_client_cleanup(esp_http_client_handle_t client, http_response_t * resp)
+{
+    esp_http_client_cleanup(client);
+    free(resp->buf);
+    resp->buf = NULL;
+}
 
-    Query_t * query;
+/* getUpdates answered with more than the buffer holds. Fails the query, the
+ * next poll asks for less or skips the update that never fits. */
+static query_result_t oversized_updates(const http_response_t * resp)
+{
+    int64_t last_id = bot_update_id;
 
-    while (true)
+    updates_limit = retry_oversized_updates(updates_limit, resp, &last_id);
+    if (last_id == bot_update_id)
     {
-        BaseType_t res;
+        ESP_LOGW(TAG, "updates do not fit into %d bytes, asking for %d at a time", resp->capacity, updates_limit);
+        return QUERY_FAILED;
+    }
 
-        query = NULL;
-        res = xQueueReceive(queries_q, &query, (TickType_t)10000);
-        if (res == errQUEUE_EMPTY)
-            continue;
+    ESP_LOGW(TAG, "update %lld does not fit into %d bytes, skipping it", last_id, resp->capacity);
+    journal_log(JOURNAL_NOTE, "skipped update %lld", last_id);
+    bot_update_id = last_id;
+    sendMessageToAdmin("A message was too long to read and was skipped");
+    return QUERY_FAILED;
+}
+
+/* Decide what to do with a query after esp_http_client_perform returned.
+ * delay_ms is set to the server requested delay when it asked for one. */
+static query_result_t query_result(
+    esp_http_client_handle_t client, http_response_t * resp, TelegramMethod_t method, esp_err_t err, int * delay_ms)
+{
+    static bool api_reachable = false;
+
+    *delay_ms = 0;
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error perform http request %s", esp_err_to_name(err));
+        if (api_reachable)
+            journal_log(JOURNAL_NET_DOWN, "api unreachable: %s", esp_err_to_name(err));
+        api_reachable = false;
+        api_down = true;
+        health_report(false);
+        return QUERY_RETRY;
+    }
+
+    if (!api_reachable)
+        journal_log(JOURNAL_NET_UP, "api reachable");
+    api_reachable = true;
+    api_down = false;
+    // any answer is a round trip, the link works
+    health_report(true);
+
+    int status = esp_http_client_get_status_code(client);
+    ESP_LOGI(TAG, "HTTPS Status = %d, content_length = %lld", status, esp_http_client_get_content_length(client));
+
+    if (status == 429)
+    {
+        *delay_ms = resp->retry_after * 1000;
+        ESP_LOGW(TAG, "flood control, retry after %d s", resp->retry_after);
+    }
+
+    query_result_t result = retry_classify(status);
+    if (result == QUERY_DONE && method == GET_UPDATES)
+    {
+        if (resp->overflow)
+            return oversized_updates(resp);
+        updates_limit = RETRY_UPDATES_LIMIT;
+    }
+    // the api answered, so a freshly updated image is good to keep
+    if (result == QUERY_DONE)
+        ota_mark_valid();
+    return result;
+}
 
-        char * method;
-        switch (query->method)
+/* Build the sendMessage body, escaping the text for json. */
+static char * message_post_data(int64_t chat_id, const char * text)
+{
+    const char * format = "{\"chat_id\": %lld, \"text\": \"%s\"}";
+    char * escaped = malloc(strlen(text) * 2 + 1);
+    if (escaped == NULL)
+        return NULL;
+
+    char * out = escaped;
+    for (const char * c = text; *c; c++)
+    {
+        switch (*c)
         {
-            case SEND_MESSAGE:
-                method = "sendMessage";
-                break;
-            case GET_UPDATES:
-                method = "getUpdates";
+            case '"':
+            case '\\':
+                *out++ = '\\';
+                *out++ = *c;
                 break;
-            case DELETE_WEBHOOK:
-                method = "deleteWebhook";
+            case '\n':
+                *out++ = '\\';
+                *out++ = 'n';
                 break;
             default:
-                ESP_LOGI(TAG, "got unknown method for telegram bot");
-                goto cleanup;
+                // other control characters are not allowed in json strings
+                *out++ = (unsigned char)*c < ' ' ? ' ' : *c;
         }
+    }
+    *out = '\0';
 
-        strcpy(query_buf, "/bot" TELEGRAM_BOT_API_KEY "/");
-        strcpy(query_buf + strlen(query_buf), method);
-        ESP_LOGI(TAG, "making query to url = %s, url len = %zu", query_buf, strlen(query_buf));
+    char * msg = malloc(strlen(format) + strlen(escaped) + 24);
+    if (msg)
+        sprintf(msg, format, chat_id, escaped);
+    free(escaped);
 
-        esp_err_t err;
+    return msg;
+}
+
+/* Merge the messages waiting right behind the query for the same chat into
+ * it, so a burst goes out as one message instead of being throttled one by one. */
+static void merge_queued_messages(Query_t * query)
+{
+    Query_t * next;
+
+    while (xQueuePeek(queries_q, &next, 0) == pdPASS)
+    {
+        if (next->method != SEND_MESSAGE || next->post_data != NULL || next->chat_id != query->chat_id)
+            break;
+
+        size_t len = strlen(query->text);
+        size_t next_len = strlen(next->text);
+        if (len + next_len + 1 >= MESSAGE_MAX_LEN)
+            break;
+
+        char * text = realloc(query->text, len + next_len + 2);
+        if (text == NULL)
+            break;
+
+        xQueueReceive(queries_q, &next, 0);
+        text[len] = '\n';
+        memcpy(text + len + 1, next->text, next_len + 1);
+        query->text = text;
+        free_query(next);
+        count_merged();
+    }
+}
+
+/* Block until the limiter lets the message go, merging what queues up meanwhile. */
+static void wait_for_send_slot(Query_t * query)
+{
+    int64_t wait_ms;
+
+    while (true)
+    {
+        xSemaphoreTake(ratelimit_lock, portMAX_DELAY);
+        wait_ms = ratelimit_acquire(&ratelimit, query->chat_id, esp_timer_get_time() / 1000);
+        xSemaphoreGive(ratelimit_lock);
+        if (wait_ms == 0)
+            break;
+
+        ESP_LOGI(TAG, "rate limited, waiting %lld ms", wait_ms);
+        merge_queued_messages(query);
+        vTaskDelay(pdMS_TO_TICKS(wait_ms) + 1);
+    }
+}
+
+/* What a client was last set up with. */
+typedef struct
+{
+    const char * path;
+    bool content_type;
+} client_setup_t;
+
+/* Point the client at the method and attach the body, the url and the
+ * headers are only touched when they differ from the last query. */
+static void apply_template(esp_http_client_handle_t client, client_setup_t * setup, TelegramMethod_t method, const char * post_data)
+{
+    const char * path = request_templates[method].path;
+    bool content_type = post_data != NULL;
+
+#if CONFIG_TELEGRAM_BOT_REBUILD_REQUESTS
+    // the old way, every query builds the url and sets the headers again
+    char url[100];
+    snprintf(url, sizeof(url), "/bot" TELEGRAM_BOT_API_KEY "/%s", method_names[method]);
+    path = url;
+    setup->path = NULL;
+    setup->content_type = !content_type;
+#endif
+
+    if (setup->path != path)
+    {
         esp_http_client_set_method(client, HTTP_METHOD_POST);
-        esp_http_client_set_url(client, query_buf);
+        esp_http_client_set_url(client, path);
+        setup->path = path;
+    }
+    if (setup->content_type != content_type)
+    {
+        if (content_type)
+            esp_http_client_set_header(client, "Content-Type", "application/json");
+        else
+            esp_http_client_delete_header(client, "Content-Type");
+        setup->content_type = content_type;
+    }
+    esp_http_client_set_post_field(client, post_data, post_data ? strlen(post_data) : 0);
+}
 
-        if (query->post_data != NULL)
+void bot_reset_connections(void)
+{
+    reset_generation++;
+}
+
+bool bot_request_in_flight(void)
+{
+    return query_in_flight;
+}
+
+/* Close the connection if the watchdog asked for it, the next request
+ * opens a fresh one. */
+static void check_reset(esp_http_client_handle_t client, uint32_t * seen)
+{
+    if (*seen == reset_generation)
+        return;
+    *seen = reset_generation;
+    ESP_LOGW(TAG, "resetting the api connection");
+    esp_http_client_close(client);
+}
+
+static int64_t now_ms(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+static void queryMakerTask(void * queue)
+{
+    http_response_t resp;
+    esp_http_client_handle_t client = bot_client_init(&resp, 5000, false);
+    if (client == NULL)
+    {
+        ESP_LOGE(TAG, "could not create http client");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    client_setup_t setup = {0};
+    Query_t * query;
+    uint32_t seen_reset = reset_generation;
+    // failed queries wait here for their next attempt, the others go on meanwhile
+    retry_list_t retries;
+    // an outbox flush is in the retry list, its messages must not go into another batch
+    bool flush_waiting = false;
+
+    retry_list_init(&retries);
+
+    while (true)
+    {
+        BaseType_t res;
+
+        // a retry is older than anything else, then the held messages
+        query = retry_list_take_due(&retries, now_ms());
+        if (query && query->from_outbox)
+            flush_waiting = false;
+        if (query == NULL && !flush_waiting)
+            query = take_outbox_batch();
+        if (query == NULL && uxQueueMessagesWaiting(queries_q) == 0)
+            query = take_pending_text();
+        if (query == NULL)
         {
-            esp_http_client_set_header(client, "Content-Type", "application/json");
-            esp_http_client_set_post_field(client, query->post_data, strlen(query->post_data));
+            // look at the outbox again soon, a long poll may bring the api back
+            TickType_t wait = outbox.count ? pdMS_TO_TICKS(1000) : (TickType_t)10000;
+            int64_t retry_ms = retry_list_wait_ms(&retries, now_ms());
+            if (retry_ms >= 0 && pdMS_TO_TICKS(retry_ms) + 1 < wait)
+                wait = pdMS_TO_TICKS(retry_ms) + 1;
+            res = xQueueReceive(queries_q, &query, wait);
+            if (res == errQUEUE_EMPTY)
+                continue;
         }
-        else
+
+        if (query->from_outbox && api_down)
         {
-            esp_http_client_delete_header(client, "Content-Type");
-            esp_http_client_set_post_field(client, NULL, 0);
+            // its messages are still held, the next flush takes them
+            ESP_LOGI(TAG, "api unreachable, flush of %d held messages postponed", query->batch.count);
+            goto cleanup;
+        }
+
+        // no point in retrying it now, it goes out with the next flush
+        if (query->method == SEND_MESSAGE && api_down && query->text)
+        {
+            store_in_outbox(query->text, query->queued_at);
+            goto cleanup;
+        }
+
+        if (query->method >= TELEGRAM_METHODS_COUNT)
+        {
+            ESP_LOGI(TAG, "got unknown method for telegram bot");
+            goto cleanup;
+        }
+
+        int64_t prepare_from = esp_timer_get_time();
+        if (query->method == SEND_MESSAGE && query->post_data == NULL)
+        {
+            wait_for_send_slot(query);
+            prepare_from = esp_timer_get_time();
+            query->post_data = message_post_data(query->chat_id, query->text);
+            if (query->post_data == NULL)
+            {
+                ESP_LOGE(TAG, "could not allocate message");
+                goto cleanup;
+            }
         }
 
-        do
-            err = esp_http_client_perform(client);
-        while (err == ESP_ERR_HTTP_EAGAIN);
+        ESP_LOGD(TAG, "making %s query", method_names[query->method]);
+
+        esp_err_t err;
+        apply_template(client, &setup, query->method, query->post_data);
+        int64_t prepare_us = esp_timer_get_time() - prepare_from;
+
+        const retry_policy_t * policy = &retry_policies[query->method];
+        method_stats_t * stats = &method_stats[query->method];
+        query_result_t result;
+        int delay_ms;
 
+        // the client is blocking, perform returns when the request is done or timed out
+        query->attempts++;
+        http_response_start(&resp, esp_timer_get_time());
+        if (query->attempts == 1)
+            resp.prepare_us = prepare_us;
+        count_stat(&stats->requests);
+        check_reset(client, &seen_reset);
+        query_in_flight = true;
+        // a long poll was open when the request went out
+        bool poll_open = poll_in_flight;
+        err = esp_http_client_perform(client);
+        query_in_flight = false;
+        // the client followed a redirect and holds another url now
+        if (resp.redirected)
+            setup.path = NULL;
+        result = query_result(client, &resp, query->method, err, &delay_ms);
         if (err == ESP_OK)
-            ESP_LOGI(
-                TAG,
-                "HTTPS Status = %d, content_length = %lld",
-                esp_http_client_get_status_code(client),
-                esp_http_client_get_content_length(client));
-        else
-            ESP_LOGE(TAG, "Error perform http request %s", esp_err_to_name(err));
+            record_latency(query->method, &resp);
 
-    cleanup:
-        if (query)
+        // store and forward instead of retrying against a dead link
+        if (result == QUERY_RETRY && query->attempts < policy->max_attempts && !(query->method == SEND_MESSAGE && api_down))
         {
-            if (query->post_data != NULL)
-                free(query->post_data);
+            if (delay_ms > 0)
+                count_stat(&stats->throttled);
+            delay_ms = retry_delay_ms(policy, query->attempts, delay_ms / 1000, esp_random());
 
-            free(query);
+            if (retry_list_add(&retries, query, now_ms() + delay_ms))
+            {
+                count_stat(&stats->retries);
+                flush_waiting = flush_waiting || query->from_outbox;
+                ESP_LOGW(
+                    TAG,
+                    "%s attempt %d failed, retrying in %d ms",
+                    method_names[query->method],
+                    query->attempts,
+                    delay_ms);
+                continue;
+            }
+            ESP_LOGW(TAG, "too many queries waiting for a retry");
         }
+
+        if (query->from_outbox)
+        {
+            // a retry may deliver it later, a rejected batch never will
+            if (result != QUERY_RETRY)
+            {
+                xSemaphoreTake(outbox_lock, portMAX_DELAY);
+                outbox_release(&outbox, &query->batch);
+                xSemaphoreGive(outbox_lock);
+            }
+            if (result == QUERY_FAILED)
+                count_stat(&stats->drops);
+            ESP_LOGI(TAG, "flush of %d held messages: %s", query->batch.count, result == QUERY_DONE ? "done" : "failed");
+        }
+        else if (result != QUERY_DONE && query->method == SEND_MESSAGE && api_down && query->text)
+        {
+            ESP_LOGW(TAG, "api unreachable, holding the message");
+            store_in_outbox(query->text, query->queued_at);
+        }
+        else if (result != QUERY_DONE)
+        {
+            count_stat(&stats->drops);
+            ESP_LOGE(TAG, "dropping %s query", method_names[query->method]);
+        }
+        else if (query->method == SEND_MESSAGE)
+        {
+            int64_t delivered_us = esp_timer_get_time() - query->queued_at;
+            delivery_mode_t mode = !dual_connection ? DELIVERY_SHARED : poll_open ? DELIVERY_POLL_OPEN : DELIVERY_POLL_IDLE;
+            xSemaphoreTake(stats_lock, portMAX_DELAY);
+            latency_hist_record(&delivery[mode], delivered_us);
+            xSemaphoreGive(stats_lock);
+            ESP_LOGI(TAG, "message delivered in %lld ms, %s", delivered_us / 1000, delivery_names[mode]);
+        }
+
+    cleanup:
+        if (query)
+            free_query(query);
     }
 
     // unreachable, just in case we will make graceful ending
-    esp_http_client_cleanup(client);
+    bot_client_cleanup(client, &resp);
     vTaskDelete(NULL);
 }
 
@@ -418,26 +1214,59 @@ void init_query_queue()
     if (queries_q == NULL)
         ESP_LOGE(TAG, "could not create message queue");
 
-    xTaskCreate(&queryMakerTask, "make queries", 8192 * 3, queries_q, 5, NULL);
+    pending_lock = xSemaphoreCreateMutex();
+    outbox_lock = xSemaphoreCreateMutex();
+    ratelimit_lock = xSemaphoreCreateMutex();
+    stats_lock = xSemaphoreCreateMutex();
+    outbox_attach(&outbox);
+    if (outbox.count)
+        ESP_LOGI(TAG, "%d messages held from before the reset", outbox.count);
+    ratelimit_init(
+        &ratelimit,
+        CONFIG_TELEGRAM_BOT_GLOBAL_RATE * 60,
+        CONFIG_TELEGRAM_BOT_GLOBAL_RATE,
+        CONFIG_TELEGRAM_BOT_CHAT_RATE,
+        CONFIG_TELEGRAM_BOT_CHAT_BURST,
+        esp_timer_get_time() / 1000);
+
+    TaskHandle_t task = NULL;
+    xTaskCreatePinnedToCore(&queryMakerTask, "make queries", 8192 * 3, queries_q, TASK_PRIO_BOT, &task, TASK_CORE_NET);
+    metrics_register_task(task);
 }
 
 
 void sendMessageToAdmin(char * text)
 {
-    const char * format = "{\"chat_id\": " TELEGRAM_BOT_ADMIN_ID ", \"text\": \"%s\"}";
-    char * msg = malloc(strlen(format) + strlen(text) + 10);
-    sprintf(msg, format, text);
+    // straight to the outbox, the queue would only hand it over there
+    if (api_down && outbox_lock)
+    {
+        store_in_outbox(text, esp_timer_get_time());
+        return;
+    }
+
+    Query_t * query = new_query(SEND_MESSAGE);
+    if (query)
+    {
+        query->chat_id = config_bot_admin_id;
+        query->text = strdup(text);
+    }
 
-    make_query(SEND_MESSAGE, msg, false);
+    if (query == NULL || query->text == NULL || !enqueue_query(query, false))
+    {
+        // never drop an alert because the queue is busy, it goes out merged later
+        if (query)
+            free_query(query);
+        add_pending_text(text);
+    }
 }
 
 static void readUpdatesTask(void * pv)
 {
     while (true)
     {
-        const char * format = "{\"allowed_updates\": [\"message\"], \"offset\": %d}";
-        char * msg = malloc(strlen(format) + 10);
-        sprintf(msg, format, bot_update_id + 1);
+        const char * format = "{\"allowed_updates\": [\"message\"], \"offset\": %d, \"limit\": %d}";
+        char * msg = malloc(strlen(format) + 20);
+        sprintf(msg, format, bot_update_id + 1, updates_limit);
         make_query(GET_UPDATES, msg, false);
 
         // sleep for 60s
@@ -447,11 +1276,112 @@ static void readUpdatesTask(void * pv)
     vTaskDelete(NULL);
 }
 
+/* Long polling over a dedicated connection, so a pending getUpdates never
+ * holds back the messages going through queryMakerTask. */
+static void pollUpdatesTask(void * pv)
+{
+    http_response_t resp;
+    // the server holds the request for up to the poll timeout, leave some slack on top
+    esp_http_client_handle_t client = bot_client_init(&resp, (TELEGRAM_BOT_POLL_TIMEOUT + 10) * 1000, false);
+    if (client == NULL)
+    {
+        ESP_LOGE(TAG, "could not create http client for polling");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    esp_http_client_set_method(client, HTTP_METHOD_POST);
+    esp_http_client_set_url(client, request_templates[GET_UPDATES].path);
+    esp_http_client_set_header(client, "Content-Type", "application/json");
+
+    const char * format = "{\"allowed_updates\": [\"message\"], \"offset\": %d, \"limit\": %d, \"timeout\": %d}";
+    char body[120];
+    int failures = 0;
+    uint32_t seen_reset = reset_generation;
+
+    while (true)
+    {
+        snprintf(body, sizeof(body), format, bot_update_id + 1, updates_limit, TELEGRAM_BOT_POLL_TIMEOUT);
+        esp_http_client_set_post_field(client, body, strlen(body));
+
+        http_response_start(&resp, esp_timer_get_time());
+        check_reset(client, &seen_reset);
+        poll_in_flight = true;
+        count_stat(&method_stats[GET_UPDATES].requests);
+        esp_err_t err = esp_http_client_perform(client);
+        poll_in_flight = false;
+        if (err == ESP_OK)
+            record_latency(GET_UPDATES, &resp);
+
+        int delay_ms;
+        if (query_result(client, &resp, GET_UPDATES, err, &delay_ms) == QUERY_DONE)
+        {
+            failures = 0;
+            continue;
+        }
+
+        // do not hammer the server while the link is down
+        failures++;
+        if (delay_ms > 0)
+            count_stat(&method_stats[GET_UPDATES].throttled);
+        else
+            delay_ms = retry_backoff_ms(&retry_policies[GET_UPDATES], failures, esp_random());
+
+        count_stat(&method_stats[GET_UPDATES].retries);
+        ESP_LOGW(TAG, "long poll failed, next one in %d ms", delay_ms);
+        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+    }
+
+    bot_client_cleanup(client, &resp);
+    vTaskDelete(NULL);
+}
+
+/* Both workers keep their own TLS session open, check that it fits. */
+static bool dual_connection_fits(void)
+{
+    const size_t budget = CONFIG_TELEGRAM_BOT_TLS_BUDGET_KB * 1024;
+    const size_t needed = 2 * BOT_CONNECTION_COST;
+    const size_t free_heap = esp_get_free_heap_size();
+
+    ESP_LOGI(TAG, "connection cost %d bytes, budget %zu, free heap %zu", BOT_CONNECTION_COST, budget, free_heap);
+    if (needed > budget || needed > free_heap)
+    {
+        ESP_LOGW(TAG, "two connections do not fit, falling back to shared one with short polling");
+        return false;
+    }
+
+    return true;
+}
+
 void initTelegramBot(void)
 {
     config_bot_admin_id = strtoll(CONFIG_TELEGRAM_BOT_ADMIN_ID, (char **)NULL, 10);
 
     init_query_queue();
     // make_query(DELETE_WEBHOOK, NULL, true);
-    xTaskCreate(&readUpdatesTask, "readUpdates", 8192, NULL, 5, NULL);
+    TaskHandle_t task = NULL;
+#if CONFIG_TELEGRAM_BOT_SINGLE_CONNECTION
+    ESP_LOGW(TAG, "single connection forced by the config");
+#else
+    dual_connection = dual_connection_fits();
+#endif
+    if (dual_connection)
+        xTaskCreatePinnedToCore(&pollUpdatesTask, "pollUpdates", 8192 * 2, NULL, TASK_PRIO_BOT, &task, TASK_CORE_NET);
+    else
+        xTaskCreatePinnedToCore(&readUpdatesTask, "readUpdates", 8192, NULL, TASK_PRIO_BOT, &task, TASK_CORE_NET);
+    metrics_register_task(task);
+}
+
+#ifdef CONFIG_BENCH_ON_DEVICE
+/* Updates from others than the admin are parsed and walked, but cause no
+ * replies, the query queue is not there in the benchmark firmware. */
+void bot_bench_response(const char * resp, int len)
+{
+    process_api_response(resp, len, NULL);
 }
+
+void bot_bench_format(const char * text)
+{
+    free(message_post_data(config_bot_admin_id, text));
+}
+#endif
@@ -1,4 +1,19 @@
 #pragma once
 
+#include <stdbool.h>
+
 void sendMessageToAdmin(char *text);
 void initTelegramBot(void);
+
+/* Close the api connections before the next request, the watchdog's first step. */
+void bot_reset_connections(void);
+
+/* True while a request other than the long poll is being sent or answered. */
+bool bot_request_in_flight(void);
+
+#include "sdkconfig.h"
+#ifdef CONFIG_BENCH_ON_DEVICE
+/* Entry points for components/bench, nothing is sent. */
+void bot_bench_response(const char * resp, int len);
+void bot_bench_format(const char * text);
+#endif
@@ -0,0 +1,80 @@
+#include <string.h>
+#include "http_response.h"
+
+void http_response_init(http_response_t * resp, char * buf, int capacity)
+{
+    memset(resp, 0, sizeof(http_response_t));
+    resp->buf = buf;
+    resp->capacity = buf ? capacity : 0;
+}
+
+void http_response_reset(http_response_t * resp)
+{
+    resp->len = 0;
+    resp->overflow = false;
+}
+
+void http_response_start(http_response_t * resp, int64_t now_us)
+{
+    http_response_reset(resp);
+    resp->retry_after = 0;
+    resp->redirected = false;
+    resp->prepare_us = 0;
+    resp->started_at = now_us;
+    resp->connected_at = 0;
+    resp->sent_at = 0;
+    resp->first_byte_at = 0;
+    resp->finished_at = 0;
+    resp->parse_us = 0;
+}
+
+bool http_response_append(http_response_t * resp, const char * data, int len)
+{
+    if (resp->overflow)
+        return false;
+
+    if (len < 0 || resp->len + len > resp->capacity)
+    {
+        resp->overflow = true;
+        return false;
+    }
+    memcpy(resp->buf + resp->len, data, len);
+    resp->len += len;
+    return true;
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+bool http_response_find_integer(const http_response_t * resp, const char * key, int64_t * value)
+{
+    const int key_len = strlen(key);
+
+    for (int i = 0; i + key_len + 2 <= resp->len; i++)
+    {
+        const char * p = resp->buf + i;
+        if (p[0] != '"' || memcmp(p + 1, key, key_len) != 0 || p[key_len + 1] != '"')
+            continue;
+
+        int pos = i + key_len + 2;
+        while (pos < resp->len && (resp->buf[pos] == ' ' || resp->buf[pos] == ':'))
+            pos++;
+        bool negative = pos < resp->len && resp->buf[pos] == '-';
+        if (negative)
+            pos++;
+        if (pos == resp->len || !is_digit(resp->buf[pos]))
+            return false;
+
+        int64_t number = 0;
+        while (pos < resp->len && is_digit(resp->buf[pos]))
+            number = number * 10 + (resp->buf[pos++] - '0');
+        // the rest of the number may be in the part that did not fit
+        if (pos == resp->len)
+            return false;
+        *value = negative ? -number : number;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Response state of one http client, passed to the event handler as user_data.
+ * The buffer is allocated once together with the client, so every connection
+ * owns its own storage and nothing is shared between requests. No IDF in
+ * here, the times are passed in. */
+typedef struct
+{
+    char * buf;
+    int capacity;
+    int len;
+    bool overflow;
+    int retry_after; // seconds, from a 429 response
+    bool redirected;
+
+    // url, headers and body set up, measured by the caller
+    int64_t prepare_us;
+    // esp_timer_get_time of the request phases, connected_at is 0 when a kept-alive connection was reused
+    int64_t started_at;
+    int64_t connected_at;
+    int64_t sent_at;
+    int64_t first_byte_at;
+    int64_t finished_at;
+    int64_t parse_us;
+} http_response_t;
+
+/* Take over a buffer of capacity bytes, the response starts empty. */
+void http_response_init(http_response_t * resp, char * buf, int capacity);
+
+/* Drop the body received so far. */
+void http_response_reset(http_response_t * resp);
+
+/* Prepare for a new request, called right before esp_http_client_perform.
+ * Nothing else clears the request state, so retry_after and the times of
+ * the last request stay readable after perform returned. */
+void http_response_start(http_response_t * resp, int64_t now_us);
+
+/* Add a chunk of the body. Once a chunk does not fit the response is marked
+ * as overflowed and the rest of the body is ignored, returns false then. */
+bool http_response_append(http_response_t * resp, const char * data, int len);
+
+/* The first integer value of "key" in the body received so far, also after
+ * an overflow. False if there is none or the number is cut off by the end
+ * of the kept data. */
+bool http_response_find_integer(const http_response_t * resp, const char * key, int64_t * value);
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "outbox.h"
+
+#define OUTBOX_MAGIC 0x584f424fUL
+// u16 text length, u32 seconds, u8 flags
+#define RECORD_HEADER 7
+#define FLAG_WALL 0x80
+#define BOOT_MASK 0x7f
+
+_Static_assert(OUTBOX_SIZE >= RECORD_HEADER + OUTBOX_MAX_TEXT, "the outbox must hold the longest record");
+_Static_assert(OUTBOX_SIZE <= UINT16_MAX, "offsets are 16 bit");
+
+typedef struct
+{
+    uint16_t len;
+    uint32_t seconds;
+    uint8_t flags;
+} record_t;
+
+static void ring_write(outbox_t * box, size_t pos, const void * src, size_t n)
+{
+    pos %= OUTBOX_SIZE;
+    size_t first = OUTBOX_SIZE - pos < n ? OUTBOX_SIZE - pos : n;
+    memcpy(box->data + pos, src, first);
+    memcpy(box->data, (const uint8_t *)src + first, n - first);
+}
+
+static void ring_read(const outbox_t * box, size_t pos, void * dst, size_t n)
+{
+    pos %= OUTBOX_SIZE;
+    size_t first = OUTBOX_SIZE - pos < n ? OUTBOX_SIZE - pos : n;
+    memcpy(dst, box->data + pos, first);
+    memcpy((uint8_t *)dst + first, box->data, n - first);
+}
+
+static void read_record(const outbox_t * box, size_t pos, record_t * rec)
+{
+    uint8_t head[RECORD_HEADER];
+
+    ring_read(box, pos, head, RECORD_HEADER);
+    rec->len = head[0] | (head[1] << 8);
+    rec->seconds = head[2] | (head[3] << 8) | (head[4] << 16) | ((uint32_t)head[5] << 24);
+    rec->flags = head[6];
+}
+
+/* Take the oldest record off. */
+static void pop(outbox_t * box)
+{
+    record_t rec;
+
+    read_record(box, box->head, &rec);
+    box->head = (box->head + RECORD_HEADER + rec.len) % OUTBOX_SIZE;
+    box->used -= RECORD_HEADER + rec.len;
+    box->count--;
+    box->first++;
+}
+
+/* The memory held garbage after a power on, walk the records to be sure. */
+static bool valid(const outbox_t * box)
+{
+    size_t pos = box->head;
+    size_t left = box->used;
+
+    if (box->magic != OUTBOX_MAGIC || box->head >= OUTBOX_SIZE || box->used > OUTBOX_SIZE)
+        return false;
+
+    for (int i = 0; i < box->count; i++)
+    {
+        record_t rec;
+        if (left < RECORD_HEADER)
+            return false;
+        read_record(box, pos, &rec);
+        if (rec.len > OUTBOX_MAX_TEXT || RECORD_HEADER + rec.len > left)
+            return false;
+        pos += RECORD_HEADER + rec.len;
+        left -= RECORD_HEADER + rec.len;
+    }
+    return left == 0;
+}
+
+void outbox_attach(outbox_t * box)
+{
+    if (!valid(box))
+    {
+        memset(box, 0, sizeof(outbox_t));
+        box->magic = OUTBOX_MAGIC;
+    }
+    box->boot++;
+}
+
+void outbox_put(outbox_t * box, const char * text, uint32_t seconds, bool wall)
+{
+    size_t len = strlen(text);
+    if (len > OUTBOX_MAX_TEXT)
+        len = OUTBOX_MAX_TEXT;
+
+    while (OUTBOX_SIZE - box->used < RECORD_HEADER + len)
+    {
+        pop(box);
+        if (box->dropped < UINT16_MAX)
+            box->dropped++;
+    }
+
+    uint8_t head[RECORD_HEADER] = {
+        len & 0xff,
+        len >> 8,
+        seconds & 0xff,
+        (seconds >> 8) & 0xff,
+        (seconds >> 16) & 0xff,
+        seconds >> 24,
+        (wall ? FLAG_WALL : 0) | (box->boot & BOOT_MASK),
+    };
+    size_t tail = box->head + box->used;
+    ring_write(box, tail, head, RECORD_HEADER);
+    ring_write(box, tail + RECORD_HEADER, text, len);
+    box->used += RECORD_HEADER + len;
+    box->count++;
+}
+
+static void format_stamp(const outbox_t * box, const record_t * rec, char * buf, size_t size)
+{
+    if (rec->flags & FLAG_WALL)
+    {
+        time_t t = rec->seconds;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(buf, size, "%m-%d %H:%M:%S", &tm);
+    }
+    else if ((rec->flags & BOOT_MASK) == (box->boot & BOOT_MASK))
+        snprintf(buf, size, "uptime %lus", (unsigned long)rec->seconds);
+    else
+        snprintf(buf, size, "earlier boot, uptime %lus", (unsigned long)rec->seconds);
+}
+
+void outbox_batch(const outbox_t * box, char * buf, size_t size, outbox_batch_t * batch)
+{
+    size_t pos = box->head;
+    int len;
+
+    batch->count = 0;
+    batch->end = box->first;
+    batch->dropped = box->dropped;
+
+    if (box->dropped)
+        len = snprintf(buf, size, "While offline (%u older messages did not fit):", box->dropped);
+    else
+        len = snprintf(buf, size, "While offline:");
+    if (len < 0 || (size_t)len >= size)
+        return;
+
+    for (int i = 0; i < box->count; i++)
+    {
+        record_t rec;
+        char stamp[40];
+
+        read_record(box, pos, &rec);
+        format_stamp(box, &rec, stamp, sizeof(stamp));
+
+        // "\n[stamp] text" and the terminating zero
+        size_t prefix = strlen(stamp) + 4;
+        size_t left = size - len;
+        size_t text_len = rec.len;
+        if (prefix + text_len + 1 > left)
+        {
+            if (i > 0 || prefix + 1 >= left)
+                break;
+            text_len = left - prefix - 1;
+        }
+
+        len += sprintf(buf + len, "\n[%s] ", stamp);
+        ring_read(box, pos + RECORD_HEADER, buf + len, text_len);
+        len += text_len;
+        buf[len] = '\0';
+
+        pos += RECORD_HEADER + rec.len;
+        batch->count++;
+        batch->end++;
+    }
+}
+
+void outbox_release(outbox_t * box, const outbox_batch_t * batch)
+{
+    while (box->count && (int32_t)(batch->end - box->first) > 0)
+        pop(box);
+    box->dropped -= batch->dropped < box->dropped ? batch->dropped : box->dropped;
+}
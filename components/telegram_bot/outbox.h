@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Store-and-forward ring of notifications that could not be sent. It is
+ * meant to live in memory that survives a reset, so the owner attaches to
+ * it at boot: valid contents are kept, anything else is cleared. Records
+ * have a variable length and may wrap around the end of the ring, the
+ * oldest ones are dropped to make room. No locking and no clock in here. */
+
+#ifndef OUTBOX_SIZE
+#    define OUTBOX_SIZE 2048
+#endif
+
+// longer texts are cut, one alert must not push out all the others
+#define OUTBOX_MAX_TEXT 512
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t boot; // bumped on every attach
+    uint32_t first; // sequence number of the oldest record
+    uint16_t head; // offset of the oldest record
+    uint16_t used;
+    uint16_t count;
+    uint16_t dropped; // evicted and not reported yet
+    uint8_t data[OUTBOX_SIZE];
+} outbox_t;
+
+/* What went into a batch, to release it once it is delivered. */
+typedef struct
+{
+    uint32_t end;
+    uint16_t dropped;
+    int count;
+} outbox_batch_t;
+
+void outbox_attach(outbox_t * box);
+
+/* seconds is the wall clock if wall is set, otherwise the uptime. */
+void outbox_put(outbox_t * box, const char * text, uint32_t seconds, bool wall);
+
+/* Write the oldest records into buf as one message: a header line and a
+ * line per record with its time. At least one record goes in if any is
+ * held, cut to fit. Nothing is removed. */
+void outbox_batch(const outbox_t * box, char * buf, size_t size, outbox_batch_t * batch);
+
+/* Remove what the batch held, records evicted meanwhile are skipped. */
+void outbox_release(outbox_t * box, const outbox_batch_t * batch);
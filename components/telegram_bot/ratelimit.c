@@ -0,0 +1,111 @@
+#include "ratelimit.h"
+
+static void token_bucket_refill(token_bucket_t * bucket, int64_t now_ms)
+{
+    if (now_ms <= bucket->last_ms)
+        return;
+
+    bucket->tokens += (now_ms - bucket->last_ms) * bucket->per_minute;
+    if (bucket->tokens > bucket->capacity)
+        bucket->tokens = bucket->capacity;
+    bucket->last_ms = now_ms;
+}
+
+void token_bucket_init(token_bucket_t * bucket, int per_minute, int burst, int64_t now_ms)
+{
+    bucket->capacity = (int64_t)burst * TOKEN_UNIT;
+    bucket->tokens = bucket->capacity;
+    bucket->per_minute = per_minute;
+    bucket->last_ms = now_ms;
+}
+
+int64_t token_bucket_wait_ms(token_bucket_t * bucket, int64_t now_ms)
+{
+    token_bucket_refill(bucket, now_ms);
+    if (bucket->tokens >= TOKEN_UNIT)
+        return 0;
+
+    // round up, a token must be complete when the caller comes back
+    return (TOKEN_UNIT - bucket->tokens + bucket->per_minute - 1) / bucket->per_minute;
+}
+
+bool token_bucket_take(token_bucket_t * bucket, int64_t now_ms)
+{
+    if (token_bucket_wait_ms(bucket, now_ms) > 0)
+        return false;
+
+    bucket->tokens -= TOKEN_UNIT;
+    return true;
+}
+
+void ratelimit_init(ratelimit_t * rl, int global_per_minute, int global_burst, int chat_per_minute, int chat_burst, int64_t now_ms)
+{
+    token_bucket_init(&rl->global, global_per_minute, global_burst, now_ms);
+    for (int i = 0; i < RATELIMIT_CHATS; i++)
+    {
+        rl->chats[i].chat_id = 0;
+        rl->chats[i].used_ms = 0;
+    }
+    rl->chat_per_minute = chat_per_minute;
+    rl->chat_burst = chat_burst;
+    rl->waits = 0;
+    rl->merged = 0;
+}
+
+/* Find the bucket of a chat, reusing the least recently used slot for a new one. */
+static token_bucket_t * chat_bucket(ratelimit_t * rl, int64_t chat_id, int64_t now_ms)
+{
+    int lru = 0;
+    for (int i = 0; i < RATELIMIT_CHATS; i++)
+    {
+        if (rl->chats[i].chat_id == chat_id)
+        {
+            rl->chats[i].used_ms = now_ms;
+            return &rl->chats[i].bucket;
+        }
+        if (rl->chats[i].used_ms < rl->chats[lru].used_ms)
+            lru = i;
+    }
+
+    rl->chats[lru].chat_id = chat_id;
+    rl->chats[lru].used_ms = now_ms;
+    token_bucket_init(&rl->chats[lru].bucket, rl->chat_per_minute, rl->chat_burst, now_ms);
+    return &rl->chats[lru].bucket;
+}
+
+int64_t ratelimit_acquire(ratelimit_t * rl, int64_t chat_id, int64_t now_ms)
+{
+    token_bucket_t * chat = chat_bucket(rl, chat_id, now_ms);
+    int64_t chat_wait = token_bucket_wait_ms(chat, now_ms);
+    int64_t global_wait = token_bucket_wait_ms(&rl->global, now_ms);
+    int64_t wait = chat_wait > global_wait ? chat_wait : global_wait;
+
+    if (wait > 0)
+    {
+        rl->waits++;
+        return wait;
+    }
+
+    token_bucket_take(chat, now_ms);
+    token_bucket_take(&rl->global, now_ms);
+    return 0;
+}
+
+int ratelimit_chat_tokens(const ratelimit_t * rl, int64_t chat_id, int64_t now_ms)
+{
+    for (int i = 0; i < RATELIMIT_CHATS; i++)
+    {
+        if (rl->chats[i].chat_id != chat_id)
+            continue;
+
+        // what token_bucket_refill would make of it
+        const token_bucket_t * chat = &rl->chats[i].bucket;
+        int64_t tokens = chat->tokens;
+        if (now_ms > chat->last_ms)
+            tokens += (now_ms - chat->last_ms) * chat->per_minute;
+        if (tokens > chat->capacity)
+            tokens = chat->capacity;
+        return tokens / TOKEN_UNIT;
+    }
+    return rl->chat_burst;
+}
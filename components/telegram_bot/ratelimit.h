@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Token buckets for outbound messages. Time is passed in by the caller in
+ * milliseconds, nothing here reads a clock. */
+
+// one token, refill rate is counted in tokens per minute per millisecond
+#define TOKEN_UNIT 60000
+
+typedef struct
+{
+    int64_t tokens;
+    int64_t capacity;
+    int32_t per_minute;
+    int64_t last_ms;
+} token_bucket_t;
+
+#define RATELIMIT_CHATS 4
+
+typedef struct
+{
+    token_bucket_t global;
+    struct
+    {
+        int64_t chat_id;
+        token_bucket_t bucket;
+        int64_t used_ms;
+    } chats[RATELIMIT_CHATS];
+    int32_t chat_per_minute;
+    int32_t chat_burst;
+    uint32_t waits;
+    uint32_t merged;
+} ratelimit_t;
+
+void token_bucket_init(token_bucket_t * bucket, int per_minute, int burst, int64_t now_ms);
+int64_t token_bucket_wait_ms(token_bucket_t * bucket, int64_t now_ms);
+bool token_bucket_take(token_bucket_t * bucket, int64_t now_ms);
+
+void ratelimit_init(ratelimit_t * rl, int global_per_minute, int global_burst, int chat_per_minute, int chat_burst, int64_t now_ms);
+
+/* Take a token from both the chat and the global bucket.
+ * Returns 0 if the message can be sent now, otherwise how many milliseconds
+ * to wait before asking again. Nothing is taken in that case. */
+int64_t ratelimit_acquire(ratelimit_t * rl, int64_t chat_id, int64_t now_ms);
+
+/* Tokens left for the chat, in whole messages. Read only, nothing is
+ * refilled or evicted, a chat without a bucket has its full burst. */
+int ratelimit_chat_tokens(const ratelimit_t * rl, int64_t chat_id, int64_t now_ms);
@@ -0,0 +1,108 @@
+#include <stddef.h>
+#include "retry.h"
+
+query_result_t retry_classify(int status)
+{
+    if (status == 429 || status >= 500)
+        return QUERY_RETRY;
+    if (status >= 400)
+        return QUERY_FAILED;
+    return QUERY_DONE;
+}
+
+int retry_backoff_ms(const retry_policy_t * policy, int attempt, uint32_t random)
+{
+    int delay = policy->base_delay_ms;
+    for (int i = 1; i < attempt && delay < policy->max_delay_ms; i++)
+        delay *= 2;
+
+    if (delay > policy->max_delay_ms)
+        delay = policy->max_delay_ms;
+
+    // keep at least a half of the delay, randomize the rest
+    return delay / 2 + random % (delay / 2 + 1);
+}
+
+int retry_delay_ms(const retry_policy_t * policy, int attempt, int retry_after_s, uint32_t random)
+{
+    if (retry_after_s > 0)
+        return retry_after_s * 1000;
+    return retry_backoff_ms(policy, attempt, random);
+}
+
+int retry_after_of(jsonv_t const * json)
+{
+    jsonv_t const * params_prop = jsonv_getProperty(json, "parameters");
+    jsonv_t const * retry_prop = params_prop ? jsonv_getProperty(params_prop, "retry_after") : NULL;
+    if (retry_prop == NULL || jsonv_getType(retry_prop) != JSON_INTEGER)
+        return 0;
+
+    int64_t seconds = jsonv_getInteger(retry_prop);
+    // anything over an hour is not worth waiting for in the worker
+    if (seconds < 0)
+        return 0;
+    return seconds > 3600 ? 3600 : (int)seconds;
+}
+
+int retry_oversized_updates(int limit, const http_response_t * resp, int64_t * last_id)
+{
+    int64_t update_id;
+
+    if (limit > 1)
+        return 1;
+    // the answer starts with the update, its id is in the part that was kept
+    if (http_response_find_integer(resp, "update_id", &update_id) && update_id > *last_id)
+        *last_id = update_id;
+    return 1;
+}
+
+void retry_list_init(retry_list_t * list)
+{
+    list->count = 0;
+}
+
+bool retry_list_add(retry_list_t * list, void * item, int64_t not_before_ms)
+{
+    if (list->count == RETRY_LIST_SIZE)
+        return false;
+
+    list->entries[list->count].item = item;
+    list->entries[list->count].not_before_ms = not_before_ms;
+    list->count++;
+    return true;
+}
+
+static int first_due(const retry_list_t * list)
+{
+    int first = -1;
+    for (int i = 0; i < list->count; i++)
+    {
+        if (first < 0 || list->entries[i].not_before_ms < list->entries[first].not_before_ms)
+            first = i;
+    }
+    return first;
+}
+
+void * retry_list_take_due(retry_list_t * list, int64_t now_ms)
+{
+    int first = first_due(list);
+    if (first < 0 || list->entries[first].not_before_ms > now_ms)
+        return NULL;
+
+    void * item = list->entries[first].item;
+    // keep the order of the rest, equal times go out in the order they came
+    for (int i = first + 1; i < list->count; i++)
+        list->entries[i - 1] = list->entries[i];
+    list->count--;
+    return item;
+}
+
+int64_t retry_list_wait_ms(const retry_list_t * list, int64_t now_ms)
+{
+    int first = first_due(list);
+    if (first < 0)
+        return -1;
+    if (list->entries[first].not_before_ms <= now_ms)
+        return 0;
+    return list->entries[first].not_before_ms - now_ms;
+}
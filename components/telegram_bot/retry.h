@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "http_response.h"
+#include "tiny-json.h"
+
+/* When and how often a failed api request is tried again, and the list of
+ * requests waiting for their next attempt. The worker keeps sending other
+ * requests meanwhile. No clock and no random source in here, the caller
+ * passes them in. */
+
+/* How hard we try before a query is dropped. The delay before attempt n is
+ * base_delay_ms * 2^(n-1) capped by max_delay_ms, with jitter on top. */
+typedef struct
+{
+    int max_attempts;
+    int base_delay_ms;
+    int max_delay_ms;
+} retry_policy_t;
+
+typedef enum
+{
+    QUERY_DONE,
+    QUERY_RETRY,
+    QUERY_FAILED,
+} query_result_t;
+
+/* What the http status of an answer means for the query. Flood control and
+ * server errors are retried, other client errors never succeed. */
+query_result_t retry_classify(int status);
+
+/* Exponential backoff with jitter, so devices that lost the link together
+ * do not come back in lockstep. attempt is the number of failed attempts
+ * so far, random any 32 bit random number. */
+int retry_backoff_ms(const retry_policy_t * policy, int attempt, uint32_t random);
+
+/* The delay before the next attempt: what the server asked for with
+ * retry_after if it did, the backoff otherwise. */
+int retry_delay_ms(const retry_policy_t * policy, int attempt, int retry_after_s, uint32_t random);
+
+/* parameters.retry_after of an api error response, 0 if there is none. */
+int retry_after_of(jsonv_t const * json);
+
+/* How many updates one getUpdates asks for. */
+#define RETRY_UPDATES_LIMIT 10
+
+/* A getUpdates answer did not fit the response buffer, so none of its
+ * updates can be read and the offset did not move. The batch is asked for
+ * again one update at a time. If a single update does not fit either it is
+ * skipped: *last_id is moved to its update_id, the next poll asks for the
+ * ones after it. Returns the limit for the next getUpdates. */
+int retry_oversized_updates(int limit, const http_response_t * resp, int64_t * last_id);
+
+#define RETRY_LIST_SIZE 8
+
+typedef struct
+{
+    struct
+    {
+        void * item;
+        int64_t not_before_ms;
+    } entries[RETRY_LIST_SIZE];
+    int count;
+} retry_list_t;
+
+void retry_list_init(retry_list_t * list);
+
+/* Park the item until not_before_ms. Returns false if the list is full. */
+bool retry_list_add(retry_list_t * list, void * item, int64_t not_before_ms);
+
+/* Take off the item that is due first, NULL if none is due yet. */
+void * retry_list_take_due(retry_list_t * list, int64_t now_ms);
+
+/* Milliseconds until the first item is due, 0 if one is due, -1 if empty. */
+int64_t retry_list_wait_ms(const retry_list_t * list, int64_t now_ms);
@@ -0,0 +1,807 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "http_response.h"
+#include "outbox.h"
+#include "ratelimit.h"
+#include "retry.h"
+
+// ----------------------------------------------------- Test "framework": ---
+
+#define done() return 0
+#define fail() return __LINE__
+static int checkqty = 0;
+#define check(x) \
+    do \
+    { \
+        ++checkqty; \
+        if (!(x)) \
+            fail(); \
+    } while (0)
+
+struct test
+{
+    int (*func)(void);
+    char const * name;
+};
+
+static int test_suit(struct test const * tests, int numtests)
+{
+    printf("%s", "\n\nTests:\n");
+    int failed = 0;
+    for (int i = 0; i < numtests; ++i)
+    {
+        printf(" %02d%s%-25s ", i, ": ", tests[i].name);
+        int linerr = tests[i].func();
+        if (0 == linerr)
+            printf("%s", "OK\n");
+        else
+        {
+            printf("%s%d\n", "Failed, line: ", linerr);
+            ++failed;
+        }
+    }
+    printf("\n%s%d\n", "Total checks: ", checkqty);
+    printf("%s[ %d / %d ]\r\n\n\n", "Tests PASS: ", numtests - failed, numtests);
+    return failed;
+}
+
+// ---------------------------------------------------------------- Helpers: ---
+
+#define MESSAGE_MAX_LEN 4096
+
+static outbox_t box;
+static char message[MESSAGE_MAX_LEN];
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ----------------------------------------------------------- Unit tests: ---
+
+static int basic(void)
+{
+    outbox_batch_t batch;
+
+    memset(&box, 0xa5, sizeof(box));
+    outbox_attach(&box);
+    check(box.count == 0 && box.used == 0);
+
+    // 2024-01-06 10:00:05 UTC
+    outbox_put(&box, "Turning on the starter in few seconds", 1704535205, true);
+    outbox_put(&box, "The starter turned off", 42, false);
+    check(box.count == 2);
+
+    outbox_batch(&box, message, sizeof(message), &batch);
+    check(batch.count == 2);
+    check(strcmp(
+              message,
+              "While offline:\n"
+              "[01-06 10:00:05] Turning on the starter in few seconds\n"
+              "[uptime 42s] The starter turned off")
+          == 0);
+
+    // a reset in between: kept, the uptime is from an earlier boot now
+    outbox_attach(&box);
+    check(box.count == 2);
+    outbox_batch(&box, message, sizeof(message), &batch);
+    check(strstr(message, "[earlier boot, uptime 42s] The starter turned off"));
+
+    outbox_release(&box, &batch);
+    check(box.count == 0 && box.used == 0);
+    done();
+}
+
+static int eviction(void)
+{
+    outbox_batch_t batch;
+    char text[64];
+
+    memset(&box, 0, sizeof(box));
+    outbox_attach(&box);
+
+    // far more than fits, the newest survive in order
+    for (int i = 0; i < 500; i++)
+    {
+        snprintf(text, sizeof(text), "message %d", i);
+        outbox_put(&box, text, i, false);
+    }
+    check(box.dropped + box.count == 500);
+    check(box.used <= OUTBOX_SIZE);
+    check(box.first == box.dropped);
+
+    outbox_batch(&box, message, sizeof(message), &batch);
+    check(batch.count == box.count);
+    check(strstr(message, "older messages did not fit"));
+    snprintf(text, sizeof(text), "] message %d\n", box.dropped);
+    check(strstr(message, text));
+    check(strstr(message, "] message 499") && strstr(message, "] message 499")[13] == '\0');
+
+    // the batch is in flight while more come and push out some of it
+    for (int i = 0; i < 10; i++)
+        outbox_put(&box, "late one", 500 + i, false);
+    int evicted = box.dropped - batch.dropped;
+    check(evicted > 0);
+    outbox_release(&box, &batch);
+    check(box.count == 10);
+    check(box.dropped == evicted);
+
+    // a long text is cut, it does not push out everything
+    memset(message, 'x', 1000);
+    message[1000] = '\0';
+    outbox_put(&box, message, 0, false);
+    check(box.count == 11);
+    done();
+}
+
+static int corrupted(void)
+{
+    memset(&box, 0, sizeof(box));
+    outbox_attach(&box);
+    outbox_put(&box, "one", 1, false);
+    outbox_put(&box, "two", 2, false);
+
+    // random contents after a power on
+    srand(5);
+    for (int round = 0; round < 100; round++)
+    {
+        uint8_t * p = (uint8_t *)&box;
+        for (size_t i = 0; i < sizeof(box); i++)
+            p[i] = rand();
+        outbox_attach(&box);
+        check(box.count == 0 && box.used == 0);
+    }
+
+    // a valid header with a broken record
+    outbox_put(&box, "one", 1, false);
+    box.data[box.head] = 0xff;
+    outbox_attach(&box);
+    check(box.count == 0);
+
+    // a count that does not match the bytes
+    outbox_put(&box, "one", 1, false);
+    box.count = 2;
+    outbox_attach(&box);
+    check(box.count == 0);
+    done();
+}
+
+/* Three days of alerts over a link that drops out now and then. The worker
+ * sends right away while the link is up, holds what fails and flushes it
+ * in batches as soon as a request goes through again. */
+static int outages(void)
+{
+    outbox_batch_t batch;
+    char text[64];
+    int sent = 0, delivered = 0, lost = 0, expected = 0;
+    int flushes = 0, flush_requests = 0, worst_flush = 0;
+    bool up = true;
+
+    memset(&box, 0, sizeof(box));
+    outbox_attach(&box);
+    srand(11);
+
+    for (int minute = 0; minute < 3 * 24 * 60; minute++)
+    {
+        // outages of a few minutes to a couple of hours
+        bool was_up = up;
+        if (up && rand() % 100 == 0)
+            up = false;
+        else if (!up && rand() % 30 == 0)
+            up = true;
+        // and a night without the link, more than the outbox holds
+        if (minute >= 2000 && minute < 2600)
+            up = false;
+
+        if (up && !was_up && box.count)
+        {
+            int requests = 0;
+            flushes++;
+            while (box.count)
+            {
+                outbox_batch(&box, message, sizeof(message), &batch);
+                check(batch.count > 0);
+                check(strlen(message) < MESSAGE_MAX_LEN - 1);
+                strcat(message, "\n");
+
+                // delivered in order, the records evicted before are only counted
+                lost += batch.dropped;
+                expected += batch.dropped;
+                for (int i = 0; i < batch.count; i++)
+                {
+                    snprintf(text, sizeof(text), "] alert %d\n", expected++);
+                    check(strstr(message, text));
+                }
+                delivered += batch.count;
+                outbox_release(&box, &batch);
+                requests++;
+            }
+            flush_requests += requests;
+            if (requests > worst_flush)
+                worst_flush = requests;
+        }
+
+        // a burst of alerts now and then
+        int alerts = rand() % 10 == 0 ? 1 + rand() % 6 : 0;
+        for (int i = 0; i < alerts; i++)
+        {
+            snprintf(text, sizeof(text), "alert %d", sent++);
+            if (up && box.count == 0)
+            {
+                expected++;
+                delivered++;
+            }
+            else
+                outbox_put(&box, text, minute * 60, true);
+        }
+    }
+
+    // whatever is left goes out at the end
+    lost += box.dropped;
+    delivered += box.count;
+    check(delivered + lost == sent);
+    printf("\n    %d alerts, %d flushes in %d requests, %d lost\n", sent, flushes, flush_requests, lost);
+    check(flushes > 5);
+    check(lost > 0);
+    // bursts of a few messages each, not one request per alert
+    check(flush_requests <= flushes * 2);
+    check(worst_flush <= 2);
+    done();
+}
+
+static int flush_time(void)
+{
+    outbox_batch_t batch;
+    char text[128];
+    int requests = 0;
+    int64_t worst_us = 0;
+
+    memset(&box, 0, sizeof(box));
+    outbox_attach(&box);
+    for (int i = 0; i < 200; i++)
+    {
+        snprintf(text, sizeof(text), "The starter turned off, channel %d, attempt %d of 3", i % 4, i % 3 + 1);
+        outbox_put(&box, text, 1704535205 + i, true);
+    }
+
+    int64_t start = now_us();
+    while (box.count)
+    {
+        int64_t from = now_us();
+        outbox_batch(&box, message, sizeof(message), &batch);
+        outbox_release(&box, &batch);
+        if (now_us() - from > worst_us)
+            worst_us = now_us() - from;
+        requests++;
+    }
+    int64_t total_us = now_us() - start;
+
+    printf("\n    full outbox: %d requests, %lld us to batch, worst %lld us\n", requests, (long long)total_us, (long long)worst_us);
+    // 2 KB of alerts fit into one or two messages
+    check(requests <= 2);
+    // the formatting is noise next to a request
+    check(total_us < 20000);
+    done();
+}
+
+/* The sending and the polling client each own a response, their chunks
+ * come in interleaved and must not end up in the other one. */
+static int responses(void)
+{
+    static char send_buf[64], poll_buf[64];
+    http_response_t send, poll;
+
+    http_response_init(&send, send_buf, sizeof(send_buf));
+    http_response_init(&poll, poll_buf, sizeof(poll_buf));
+    http_response_start(&send, 1000);
+    http_response_start(&poll, 1000);
+
+    check(http_response_append(&send, "{\"ok\":", 6));
+    check(http_response_append(&poll, "{\"ok\":true,", 11));
+    check(http_response_append(&send, "true}", 5));
+    check(http_response_append(&poll, "\"result\":[]}", 12));
+    check(send.len == 11 && memcmp(send.buf, "{\"ok\":true}", 11) == 0);
+    check(poll.len == 23 && memcmp(poll.buf, "{\"ok\":true,\"result\":[]}", 23) == 0);
+
+    // exactly full still fits
+    http_response_start(&send, 2000);
+    memset(message, 'x', sizeof(send_buf));
+    check(http_response_append(&send, message, sizeof(send_buf) - 1));
+    check(http_response_append(&send, message, 1));
+    check(send.len == sizeof(send_buf) && !send.overflow);
+
+    // one byte more and the rest of the body is dropped, even what would fit
+    check(!http_response_append(&send, "y", 1));
+    check(send.overflow);
+    check(!http_response_append(&send, "", 0));
+    check(send.len == sizeof(send_buf));
+    // the other client does not notice
+    check(!poll.overflow && poll.len == 23);
+
+    // a chunk larger than the whole buffer
+    http_response_start(&poll, 3000);
+    check(!http_response_append(&poll, message, sizeof(poll_buf) + 1));
+    check(poll.overflow && poll.len == 0);
+
+    // an error halfway through a body: reset keeps the request state
+    http_response_start(&send, 4000);
+    send.retry_after = 3;
+    send.connected_at = 4100;
+    check(http_response_append(&send, "{\"partial", 9));
+    http_response_reset(&send);
+    check(send.len == 0 && !send.overflow);
+    check(send.retry_after == 3 && send.connected_at == 4100 && send.started_at == 4000);
+
+    // reused for the next request after an overflow, nothing is left over
+    send.redirected = true;
+    http_response_start(&send, 5000);
+    check(send.len == 0 && !send.overflow);
+    check(send.retry_after == 0 && !send.redirected && send.connected_at == 0 && send.started_at == 5000);
+    check(http_response_append(&send, "{}", 2));
+    check(send.len == 2 && send.buf == send_buf && send.capacity == sizeof(send_buf));
+
+    // a failed allocation leaves a response that takes nothing
+    http_response_init(&send, NULL, 512);
+    http_response_start(&send, 6000);
+    check(!http_response_append(&send, "{}", 2));
+    check(http_response_append(&send, "", 0) == false);
+    done();
+}
+
+static const retry_policy_t send_policy = {.max_attempts = 8, .base_delay_ms = 500, .max_delay_ms = 60000};
+
+/* getUpdates answers that do not fit the buffer, on a fake server. */
+#define FAKE_FIRST_ID 100
+#define FAKE_UPDATES 20
+
+static int fake_text_len(int64_t id)
+{
+    if (id == 105)
+        return 4096; // one message as long as telegram allows, it never fits
+    return id >= 110 ? 400 : 50; // ten of these do not fit together
+}
+
+/* The answer to getUpdates with offset and limit, fed in 512 byte chunks
+ * like the http client does. Returns the last id sent. */
+static int64_t fake_get_updates(http_response_t * resp, int64_t offset, int limit)
+{
+    static char body[16 * 1024];
+    int len = sprintf(body, "{\"ok\":true,\"result\":[");
+    int64_t last = 0;
+
+    for (int64_t id = offset; id < FAKE_FIRST_ID + FAKE_UPDATES && limit > 0; id++, limit--)
+    {
+        len += sprintf(body + len, "%s{\"update_id\":%lld,\"message\":{\"text\":\"", last ? "," : "", (long long)id);
+        memset(body + len, 'x', fake_text_len(id));
+        len += fake_text_len(id);
+        len += sprintf(body + len, "\"}}");
+        last = id;
+    }
+    len += sprintf(body + len, "]}");
+
+    for (int pos = 0; pos < len; pos += 512)
+        http_response_append(resp, body + pos, len - pos < 512 ? len - pos : 512);
+    return last;
+}
+
+static int oversized(void)
+{
+    static char buf[4096];
+    http_response_t resp;
+    int delivered[FAKE_UPDATES] = {0};
+    int64_t last_id = FAKE_FIRST_ID - 1;
+    int limit = RETRY_UPDATES_LIMIT;
+    int polls = 0;
+
+    http_response_init(&resp, buf, sizeof(buf));
+    while (last_id < FAKE_FIRST_ID + FAKE_UPDATES - 1 && polls < 100)
+    {
+        polls++;
+        http_response_start(&resp, polls);
+        int64_t sent = fake_get_updates(&resp, last_id + 1, limit);
+        if (resp.overflow)
+        {
+            limit = retry_oversized_updates(limit, &resp, &last_id);
+            continue;
+        }
+        // what process_api_response does with the ids
+        for (int64_t id = last_id + 1; id <= sent; id++)
+            delivered[id - FAKE_FIRST_ID]++;
+        last_id = sent;
+        limit = RETRY_UPDATES_LIMIT;
+    }
+
+    // everything but the long one arrived once, and the loop did not spin
+    for (int i = 0; i < FAKE_UPDATES; i++)
+        check(delivered[i] == (i == 5 ? 0 : 1));
+    check(last_id == FAKE_FIRST_ID + FAKE_UPDATES - 1);
+    check(polls < 30);
+    done();
+}
+
+static int find_integer(void)
+{
+    static char buf[32];
+    http_response_t resp;
+    int64_t value = 7;
+
+    http_response_init(&resp, buf, sizeof(buf));
+    http_response_start(&resp, 0);
+    const char * head = "{\"a\": -12, \"update_id\":3456";
+    check(http_response_append(&resp, head, strlen(head)));
+    check(http_response_find_integer(&resp, "a", &value) && value == -12);
+    // the digits run into the end of what was kept, more may follow
+    check(!http_response_find_integer(&resp, "update_id", &value));
+    check(http_response_append(&resp, "7}", 2));
+    check(http_response_find_integer(&resp, "update_id", &value) && value == 34567);
+    check(!http_response_find_integer(&resp, "update", &value));
+    check(!http_response_find_integer(&resp, "b", &value));
+    check(value == 34567);
+
+    // still readable after the rest of the body was dropped
+    check(!http_response_append(&resp, "{\"more\": 1}", 11));
+    check(resp.overflow);
+    check(http_response_find_integer(&resp, "update_id", &value) && value == 34567);
+    done();
+}
+
+static int backoff(void)
+{
+    // at least half of the delay, at most all of it
+    check(retry_backoff_ms(&send_policy, 1, 0) == 250);
+    check(retry_backoff_ms(&send_policy, 1, 250) == 500);
+    check(retry_backoff_ms(&send_policy, 1, UINT32_MAX) >= 250);
+    check(retry_backoff_ms(&send_policy, 1, UINT32_MAX) <= 500);
+
+    // doubles with every failure
+    for (int attempt = 1; attempt <= 7; attempt++)
+    {
+        int delay = 500 << (attempt - 1);
+        check(retry_backoff_ms(&send_policy, attempt, 0) == delay / 2);
+        check(retry_backoff_ms(&send_policy, attempt, delay / 2) == delay);
+    }
+    // up to the cap, and no overflow far beyond it
+    check(retry_backoff_ms(&send_policy, 8, 30000) == 60000);
+    check(retry_backoff_ms(&send_policy, 1000, 30000) == 60000);
+    check(retry_backoff_ms(&send_policy, 1000, 0) == 30000);
+
+    // the jitter spreads devices that failed together
+    srand(3);
+    int low = 0, high = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        int delay = retry_backoff_ms(&send_policy, 3, rand());
+        check(delay >= 1000 && delay <= 2000);
+        low += delay < 1500;
+        high += delay >= 1500;
+    }
+    check(low > 400 && high > 400);
+
+    // the whole policy gives up within a bounded time
+    int worst = 0;
+    for (int attempt = 1; attempt < send_policy.max_attempts; attempt++)
+        worst += retry_backoff_ms(&send_policy, attempt, UINT32_MAX);
+    check(worst <= 500 + 1000 + 2000 + 4000 + 8000 + 16000 + 32000);
+
+    check(retry_classify(200) == QUERY_DONE);
+    check(retry_classify(400) == QUERY_FAILED);
+    check(retry_classify(403) == QUERY_FAILED);
+    check(retry_classify(429) == QUERY_RETRY);
+    check(retry_classify(500) == QUERY_RETRY);
+    check(retry_classify(502) == QUERY_RETRY);
+    done();
+}
+
+static int parse_retry_after(const char * text)
+{
+    static char resp[256];
+    jsonv_t mem[32];
+
+    strcpy(resp, text);
+    jsonv_t const * json = jsonv_create(resp, strlen(resp), mem, 32);
+    return json ? retry_after_of(json) : -1;
+}
+
+static int retry_after(void)
+{
+    check(parse_retry_after(
+              "{\"ok\":false,\"error_code\":429,\"description\":\"Too Many Requests: retry after 7\","
+              "\"parameters\":{\"retry_after\":7}}")
+          == 7);
+    check(parse_retry_after("{\"ok\":false,\"error_code\":400,\"description\":\"Bad Request\"}") == 0);
+    check(parse_retry_after("{\"ok\":false,\"parameters\":{\"migrate_to_chat_id\":-100}}") == 0);
+    check(parse_retry_after("{\"ok\":false,\"parameters\":{\"retry_after\":\"7\"}}") == 0);
+    check(parse_retry_after("{\"ok\":false,\"parameters\":{\"retry_after\":-5}}") == 0);
+    check(parse_retry_after("{\"ok\":false,\"parameters\":{\"retry_after\":86400}}") == 3600);
+
+    // the server's delay wins over the backoff, whatever the attempt
+    check(retry_delay_ms(&send_policy, 1, 7, 0) == 7000);
+    check(retry_delay_ms(&send_policy, 6, 2, UINT32_MAX) == 2000);
+    check(retry_delay_ms(&send_policy, 2, 0, 0) == 500);
+    done();
+}
+
+/* A send worker like queryMakerTask on a simulated clock, against a server
+ * that fails some requests. Every request takes 200 ms. */
+typedef struct
+{
+    int id;
+    int attempts;
+    // the server answers these attempts with the status, 200 after them
+    int fail_first;
+    int fail_status;
+    int retry_after;
+    int64_t queued_ms;
+    int64_t delivered_ms;
+    bool dropped;
+} sim_query_t;
+
+static int64_t sim_ms;
+
+static void sim_worker(sim_query_t * queries, int count)
+{
+    retry_list_t retries;
+    int next = 0;
+
+    retry_list_init(&retries);
+    while (true)
+    {
+        sim_query_t * query = retry_list_take_due(&retries, sim_ms);
+        if (query == NULL && next < count && queries[next].queued_ms <= sim_ms)
+            query = &queries[next++];
+        if (query == NULL)
+        {
+            // sleep until a retry is due or the next query comes
+            int64_t wait = retry_list_wait_ms(&retries, sim_ms);
+            if (next < count && (wait < 0 || queries[next].queued_ms - sim_ms < wait))
+                wait = queries[next].queued_ms - sim_ms;
+            if (wait < 0)
+                break;
+            sim_ms += wait;
+            continue;
+        }
+
+        query->attempts++;
+        sim_ms += 200;
+        int status = query->attempts <= query->fail_first ? query->fail_status : 200;
+        query_result_t result = retry_classify(status);
+        if (result == QUERY_DONE)
+            query->delivered_ms = sim_ms;
+        else if (result == QUERY_RETRY && query->attempts < send_policy.max_attempts)
+        {
+            int delay = retry_delay_ms(&send_policy, query->attempts, status == 429 ? query->retry_after : 0, rand());
+            if (retry_list_add(&retries, query, sim_ms + delay))
+                continue;
+            query->dropped = true;
+        }
+        else
+            query->dropped = true;
+    }
+}
+
+static int retries(void)
+{
+    sim_query_t queries[6] = {
+        // a server error for a while, then it goes through
+        {.id = 0, .fail_first = 3, .fail_status = 500, .queued_ms = 0},
+        // flood control with an explicit delay
+        {.id = 1, .fail_first = 1, .fail_status = 429, .retry_after = 5, .queued_ms = 100},
+        // healthy ones queued right behind them
+        {.id = 2, .queued_ms = 150},
+        {.id = 3, .queued_ms = 200},
+        // rejected, not retried
+        {.id = 4, .fail_first = 8, .fail_status = 400, .queued_ms = 250},
+        // never succeeds
+        {.id = 5, .fail_first = 100, .fail_status = 503, .queued_ms = 300},
+    };
+
+    srand(9);
+    sim_ms = 0;
+    sim_worker(queries, 6);
+
+    // the healthy ones did not wait for the failing ones
+    check(queries[2].delivered_ms > 0 && queries[2].delivered_ms <= 1000);
+    check(queries[3].delivered_ms > 0 && queries[3].delivered_ms <= 1000);
+
+    // the 500 went through after three backoffs of 250-500, 500-1000 and 1000-2000 ms
+    check(queries[0].attempts == 4);
+    check(queries[0].delivered_ms >= 200 + 250 + 500 + 1000);
+    check(queries[0].delivered_ms <= 3500 + 6 * 200);
+
+    // the 429 waited what the server asked for, not the backoff
+    check(queries[1].attempts == 2);
+    check(queries[1].delivered_ms >= 100 + 200 + 5000);
+    check(queries[1].delivered_ms <= 100 + 200 + 5000 + 6 * 200);
+
+    check(queries[4].attempts == 1 && queries[4].dropped);
+    check(queries[5].attempts == send_policy.max_attempts && queries[5].dropped);
+    done();
+}
+
+static int retry_list(void)
+{
+    retry_list_t list;
+    int items[RETRY_LIST_SIZE + 1];
+
+    retry_list_init(&list);
+    check(retry_list_wait_ms(&list, 0) == -1);
+    check(retry_list_take_due(&list, 1000000) == NULL);
+
+    check(retry_list_add(&list, &items[0], 300));
+    check(retry_list_add(&list, &items[1], 100));
+    check(retry_list_add(&list, &items[2], 100));
+    check(retry_list_wait_ms(&list, 40) == 60);
+    check(retry_list_take_due(&list, 99) == NULL);
+
+    // the earliest first, equal times in the order they came
+    check(retry_list_take_due(&list, 500) == &items[1]);
+    check(retry_list_take_due(&list, 500) == &items[2]);
+    check(retry_list_wait_ms(&list, 500) == 0);
+    check(retry_list_take_due(&list, 500) == &items[0]);
+    check(list.count == 0);
+
+    // full, the caller has to give up on the query
+    for (int i = 0; i < RETRY_LIST_SIZE; i++)
+        check(retry_list_add(&list, &items[i], i));
+    check(!retry_list_add(&list, &items[RETRY_LIST_SIZE], 0));
+    check(retry_list_take_due(&list, 0) == &items[0]);
+    check(retry_list_add(&list, &items[RETRY_LIST_SIZE], 0));
+    done();
+}
+
+// ------------------------------------------------------ Rate limiter: ---
+
+static int refill(void)
+{
+    token_bucket_t bucket;
+
+    // 20 a minute is one every 3 s, 3 back to back
+    token_bucket_init(&bucket, 20, 3, 1000);
+    for (int i = 0; i < 3; i++)
+        check(token_bucket_take(&bucket, 1000));
+    check(!token_bucket_take(&bucket, 1000));
+    check(token_bucket_wait_ms(&bucket, 1000) == 3000);
+    check(token_bucket_wait_ms(&bucket, 2500) == 1500);
+    check(!token_bucket_take(&bucket, 3999));
+    check(token_bucket_take(&bucket, 4000));
+
+    // a long pause fills it up to the burst, not beyond
+    check(token_bucket_wait_ms(&bucket, 1000000) == 0);
+    for (int i = 0; i < 3; i++)
+        check(token_bucket_take(&bucket, 1000000));
+    check(!token_bucket_take(&bucket, 1000000));
+
+    // a clock going backwards changes nothing
+    check(!token_bucket_take(&bucket, 500));
+    check(token_bucket_wait_ms(&bucket, 1003000) == 0);
+
+    // a rate that does not divide a minute rounds the wait up
+    token_bucket_init(&bucket, 7, 1, 0);
+    check(token_bucket_take(&bucket, 0));
+    int64_t wait = token_bucket_wait_ms(&bucket, 0);
+    check(wait == 8572);
+    check(!token_bucket_take(&bucket, wait - 1));
+    check(token_bucket_take(&bucket, wait));
+    done();
+}
+
+static int burst(void)
+{
+    ratelimit_t rl;
+
+    ratelimit_init(&rl, 30 * 60, 30, 20, 3, 0);
+    for (int i = 0; i < 3; i++)
+        check(ratelimit_acquire(&rl, 42, 0) == 0);
+    check(ratelimit_chat_tokens(&rl, 42, 0) == 0);
+    check(ratelimit_acquire(&rl, 42, 0) == 3000);
+    // a refused message takes nothing, asking again gives the same answer
+    check(ratelimit_acquire(&rl, 42, 0) == 3000);
+    check(rl.waits == 2);
+    check(ratelimit_acquire(&rl, 42, 3000) == 0);
+
+    // a burst of alerts over 10 minutes, one every 100 ms: the burst and one every 3 s
+    int sent = 3 + 1;
+    for (int64_t now = 3100; now < 600000; now += 100)
+        sent += ratelimit_acquire(&rl, 42, now) == 0;
+    check(sent == 3 + 599999 / 3000);
+    done();
+}
+
+static int global_cap(void)
+{
+    ratelimit_t rl;
+
+    // one a second overall, two back to back, chats alone could send far more
+    ratelimit_init(&rl, 60, 2, 600, 5, 0);
+    check(ratelimit_acquire(&rl, 1, 0) == 0);
+    check(ratelimit_acquire(&rl, 2, 0) == 0);
+    check(ratelimit_acquire(&rl, 3, 0) == 1000);
+    // the chat bucket was not charged for the refused message
+    check(ratelimit_chat_tokens(&rl, 3, 0) == 5);
+    check(ratelimit_acquire(&rl, 3, 1000) == 0);
+    check(ratelimit_chat_tokens(&rl, 3, 1000) == 4);
+
+    // many chats over the next minute never beat the global rate
+    int sent = 0;
+    for (int64_t now = 1010; now <= 61000; now += 10)
+        sent += ratelimit_acquire(&rl, 10 + now % 7, now) == 0;
+    check(sent == 60);
+    done();
+}
+
+static int lru(void)
+{
+    ratelimit_t rl;
+
+    ratelimit_init(&rl, 30 * 60, 30, 20, 3, 0);
+    for (int chat = 1; chat <= RATELIMIT_CHATS; chat++)
+        check(ratelimit_acquire(&rl, chat, chat) == 0);
+    // chat 1 is out of tokens and was used last
+    check(ratelimit_acquire(&rl, 1, 10) == 0);
+    check(ratelimit_acquire(&rl, 1, 11) == 0);
+    check(ratelimit_acquire(&rl, 1, 12) > 0);
+
+    // a new chat takes the slot of the least recently used one, chat 2
+    check(ratelimit_acquire(&rl, 100, 20) == 0);
+    check(ratelimit_chat_tokens(&rl, 100, 20) == 2);
+    // chat 1 keeps its empty bucket, it is not reset by the eviction
+    check(ratelimit_acquire(&rl, 1, 21) > 0);
+    // chat 2 starts over with a full burst
+    check(ratelimit_chat_tokens(&rl, 2, 22) == 3);
+    check(ratelimit_acquire(&rl, 2, 22) == 0);
+    check(ratelimit_chat_tokens(&rl, 2, 22) == 2);
+    // and pushed out chat 3 meanwhile
+    check(ratelimit_chat_tokens(&rl, 3, 22) == 3);
+    done();
+}
+
+static int peek(void)
+{
+    ratelimit_t rl, before;
+
+    ratelimit_init(&rl, 30 * 60, 30, 20, 3, 0);
+    for (int chat = 1; chat <= RATELIMIT_CHATS; chat++)
+        check(ratelimit_acquire(&rl, chat, chat) == 0);
+    memcpy(&before, &rl, sizeof(rl));
+
+    // reading refills on paper only, and never evicts a chat
+    check(ratelimit_chat_tokens(&rl, 1, 1) == 2);
+    check(ratelimit_chat_tokens(&rl, 1, 3001) == 3);
+    check(ratelimit_chat_tokens(&rl, 1, 1000000) == 3);
+    check(ratelimit_chat_tokens(&rl, 999, 5000) == 3);
+    check(memcmp(&before, &rl, sizeof(rl)) == 0);
+    done();
+}
+
+int main(void)
+{
+    setenv("TZ", "UTC0", 1);
+    tzset();
+
+    static struct test const tests[] = {
+        {basic, "Put and batch"},
+        {eviction, "Eviction"},
+        {corrupted, "Attach to garbage"},
+        {outages, "Outages and recovery"},
+        {flush_time, "Flush time"},
+        {responses, "Response buffers"},
+        {find_integer, "Integers in a cut body"},
+        {oversized, "Oversized updates"},
+        {backoff, "Backoff"},
+        {retry_after, "Retry after"},
+        {retries, "Retries do not block"},
+        {retry_list, "Retry list"},
+        {refill, "Token refill"},
+        {burst, "Chat burst and rate"},
+        {global_cap, "Global cap"},
+        {lru, "Chats LRU"},
+        {peek, "Read only tokens"},
+    };
+    return test_suit(tests, sizeof tests / sizeof *tests);
+}
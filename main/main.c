@@ -8,6 +8,7 @@
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
@@ -17,7 +18,15 @@
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
+#include "bench.h"
 #include "bot.h"
+#include "health.h"
+#include "journal.h"
+#include "mains.h"
+#include "metrics.h"
+#include "ota.h"
+#include "scheduler.h"
+#include "sensors.h"
 
 /* The examples use WiFi configuration that you can set via project configuration menu
    If you'd rather not, just change the below entries to strings with
@@ -57,7 +66,14 @@ static EventGroupHandle_t s_wifi_event_group;
 static const char * TAG = "wifi station";
 
 static int s_retry_num = 0;
+// reconnects after the first retries, the link must come back by itself
+static esp_timer_handle_t s_reconnect_timer;
+#define RECONNECT_MAX_MS 60000
 
+static void reconnect(void * arg)
+{
+    esp_wifi_connect();
+}
 
 static void event_handler(void * arg, esp_event_base_t event_base, int32_t event_id, void * event_data)
 {
@@ -70,13 +86,21 @@ static void event_handler(void * arg, esp_event_base_t event_base, int32_t event
         if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY)
         {
             esp_wifi_connect();
-            s_retry_num++;
             ESP_LOGI(TAG, "retry to connect to the AP");
         }
         else
         {
+            // let the boot go on, but never give up on the AP
             xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+            int shift = s_retry_num - EXAMPLE_ESP_MAXIMUM_RETRY;
+            int delay_ms = shift < 6 ? 1000 << shift : RECONNECT_MAX_MS;
+            if (delay_ms > RECONNECT_MAX_MS)
+                delay_ms = RECONNECT_MAX_MS;
+            esp_timer_stop(s_reconnect_timer);
+            esp_timer_start_once(s_reconnect_timer, delay_ms * 1000LL);
+            ESP_LOGI(TAG, "retry to connect to the AP in %d ms", delay_ms);
         }
+        s_retry_num++;
         ESP_LOGI(TAG, "connect to the AP fail");
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
@@ -92,6 +116,12 @@ void wifi_init_sta(void)
 {
     s_wifi_event_group = xEventGroupCreate();
 
+    const esp_timer_create_args_t reconnect_args = {
+        .callback = &reconnect,
+        .name = "wifi reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconnect_args, &s_reconnect_timer));
+
     ESP_ERROR_CHECK(esp_netif_init());
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -155,6 +185,15 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+#ifdef CONFIG_BENCH_ON_DEVICE
+    // the benchmark firmware, the controller is not started
+    bench_run();
+    return;
+#endif
+
+    journal_init();
+    ota_init();
+
     ESP_LOGI(TAG, "GPIO CONTROL INIT");
 	init_gpio();
 
@@ -165,6 +204,11 @@ void app_main(void)
     ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
     wifi_init_sta();
 
+    metrics_init();
     initTelegramBot();
 	sendMessageToAdmin("Starter controller has initialized");
+    scheduler_init();
+    mains_init();
+    health_init();
+    sensors_init();
 }
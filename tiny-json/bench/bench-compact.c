@@ -0,0 +1,110 @@
+
+/*
+
+<https://github.com/rafagafe/tiny-json>
+
+  Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+  SPDX-License-Identifier: MIT
+  Copyright (c) 2016-2018 Rafa Garcia <rafagarcia77@gmail.com>.
+
+  Permission is hereby  granted, free of charge, to any  person obtaining a copy
+  of this software and associated  documentation files (the "Software"), to deal
+  in the Software  without restriction, including without  limitation the rights
+  to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+  copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+  IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+  FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+  AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+  LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+*/
+
+/*
+ * The compact layout against json_t: bytes per property, properties per KB
+ * of memory, DOM bytes per KB of input and parse time of a getUpdates
+ * answer. The makefile builds it for the host and, if gcc can, for a 32-bit
+ * target, which has the pointer size of the ESP32.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../tiny-json.h"
+
+enum { UPDATES = 20, ROUNDS = 20000, CAPACITY = 512 };
+
+static json_t pool[CAPACITY];
+static jsonc_t cpool[CAPACITY];
+static char input[UPDATES * 400];
+static char buf[sizeof input];
+
+static double now_ns( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* A getUpdates answer with a batch of command messages. */
+static size_t make_input( void ) {
+    size_t len = sprintf( input, "%s", "{\"ok\":true,\"result\":[" );
+    for( int i = 0; i < UPDATES; ++i )
+        len += sprintf( input + len,
+                        "%s{\"update_id\":%d,\"message\":{\"message_id\":%d,"
+                        "\"from\":{\"id\":123456789,\"is_bot\":false,\"first_name\":\"Admin\",\"language_code\":\"en\"},"
+                        "\"chat\":{\"id\":123456789,\"first_name\":\"Admin\",\"type\":\"private\"},"
+                        "\"date\":%d,\"text\":\"/on gen%d\","
+                        "\"entities\":[{\"offset\":0,\"length\":3,\"type\":\"bot_command\"}]}}",
+                        i ? "," : "", 500000 + i, 1000 + i, 1704535205 + i, i % 4 );
+    len += sprintf( input + len, "%s", "]}" );
+    return len;
+}
+
+int main( void ) {
+    size_t const len = make_input();
+    jsoncDoc_t doc;
+
+    memcpy( buf, input, len + 1 );
+    if ( !jsonc_create( &doc, buf, cpool, CAPACITY ) ) {
+        puts( "parse failed" );
+        return EXIT_FAILURE;
+    }
+    // both layouts need the same number of properties
+    memcpy( buf, input, len + 1 );
+    bool const same = json_create( buf, pool, doc.used ) != NULL;
+    memcpy( buf, input, len + 1 );
+    bool const fewer = json_create( buf, pool, doc.used - 1 ) != NULL;
+
+    double json_ns = 0, jsonc_ns = 0;
+    for( int r = 0; r < ROUNDS; ++r ) {
+        memcpy( buf, input, len + 1 );
+        double t0 = now_ns();
+        json_create( buf, pool, CAPACITY );
+        double t1 = now_ns();
+        memcpy( buf, input, len + 1 );
+        double t2 = now_ns();
+        jsonc_create( &doc, buf, cpool, CAPACITY );
+        double t3 = now_ns();
+        json_ns += t1 - t0;
+        jsonc_ns += t3 - t2;
+    }
+    json_ns /= ROUNDS;
+    jsonc_ns /= ROUNDS;
+
+    double const kb = len / 1024.0;
+    printf( "  %zu-bit pointers, %zu bytes, %u properties\n", sizeof( void* ) * 8, len, doc.used );
+    printf( "  json_t  %2zu bytes, %4zu per KB, %6.0f DOM bytes per KB of input, parse %7.0f ns\n",
+            sizeof( json_t ), 1024 / sizeof( json_t ), doc.used * sizeof( json_t ) / kb, json_ns );
+    printf( "  jsonc_t %2zu bytes, %4zu per KB, %6.0f DOM bytes per KB of input, parse %7.0f ns\n",
+            sizeof( jsonc_t ), 1024 / sizeof( jsonc_t ), doc.used * sizeof( jsonc_t ) / kb, jsonc_ns );
+    return same && !fewer ? EXIT_SUCCESS : EXIT_FAILURE;
+}
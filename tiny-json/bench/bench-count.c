@@ -0,0 +1,156 @@
+
+/*
+
+<https://github.com/rafagafe/tiny-json>
+
+  Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+  SPDX-License-Identifier: MIT
+  Copyright (c) 2016-2018 Rafa Garcia <rafagarcia77@gmail.com>.
+
+  Permission is hereby  granted, free of charge, to any  person obtaining a copy
+  of this software and associated  documentation files (the "Software"), to deal
+  in the Software  without restriction, including without  limitation the rights
+  to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+  copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+  IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+  FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+  AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+  LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+*/
+
+/*
+ * Sizing the property array: the 32 property chunks of bot.c, allocated as
+ * the parser asks for them, against json_count() and one allocation of the
+ * exact length. For a getUpdates answer of one update and one of a batch.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../tiny-json.h"
+
+enum { ROUNDS = 20000, CHUNK = 32 };
+
+static char input[20 * 400];
+static char buf[sizeof input];
+static size_t len;
+static unsigned long allocs;
+
+static double now_ns( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* A getUpdates answer with a batch of command messages. */
+static void make_input( int updates ) {
+    len = sprintf( input, "%s", "{\"ok\":true,\"result\":[" );
+    for( int i = 0; i < updates; ++i )
+        len += sprintf( input + len,
+                        "%s{\"update_id\":%d,\"message\":{\"message_id\":%d,"
+                        "\"from\":{\"id\":123456789,\"is_bot\":false,\"first_name\":\"Admin\",\"language_code\":\"en\"},"
+                        "\"chat\":{\"id\":123456789,\"first_name\":\"Admin\",\"type\":\"private\"},"
+                        "\"date\":%d,\"text\":\"/on gen%d\","
+                        "\"entities\":[{\"offset\":0,\"length\":3,\"type\":\"bot_command\"}]}}",
+                        i ? "," : "", 500000 + i, 1000 + i, 1704535205 + i, i % 4 );
+    len += sprintf( input + len, "%s", "]}" );
+}
+
+// ------------------------------------------------ The pool of bot.c: ---
+
+typedef struct chunk_s {
+    json_t* mem;
+    struct chunk_s* prev;
+} chunk_t;
+
+typedef struct {
+    chunk_t* chunk;
+    unsigned int nextFree;
+    jsonPool_t pool;
+} chunkPool_t;
+
+static json_t* chunkAlloc( jsonPool_t* pool ) {
+    chunkPool_t* spool = json_containerOf( pool, chunkPool_t, pool );
+    if ( spool->nextFree >= CHUNK ) {
+        chunk_t* prev = spool->chunk;
+        spool->chunk = malloc( sizeof( chunk_t ) );
+        spool->chunk->mem = calloc( CHUNK, sizeof( json_t ) );
+        spool->chunk->prev = prev;
+        spool->nextFree = 0;
+        allocs += 2;
+    }
+    return &spool->chunk->mem[spool->nextFree++];
+}
+
+static json_t* chunkInit( jsonPool_t* pool ) {
+    chunkPool_t* spool = json_containerOf( pool, chunkPool_t, pool );
+    spool->nextFree = CHUNK;
+    spool->chunk = NULL;
+    return chunkAlloc( pool );
+}
+
+static int chunked( void ) {
+    chunkPool_t spool = { .pool = { .init = chunkInit, .alloc = chunkAlloc } };
+    json_t const* json = json_createWithPool( buf, &spool.pool );
+    int const ok = json != NULL;
+    while( spool.chunk ) {
+        chunk_t* prev = spool.chunk->prev;
+        free( spool.chunk->mem );
+        free( spool.chunk );
+        spool.chunk = prev;
+    }
+    return ok;
+}
+
+// ---------------------------------------------------- Counted first: ---
+
+static int counted( void ) {
+    unsigned int const qty = json_count( buf );
+    json_t* mem = malloc( qty * sizeof( json_t ) );
+    ++allocs;
+    int const ok = json_create( buf, mem, qty ) != NULL;
+    free( mem );
+    return ok;
+}
+
+static int count_only( void ) {
+    return json_count( buf ) > 1;
+}
+
+static void measure( char const* name, int (*func)( void ) ) {
+    double ns = 0;
+    unsigned long a = allocs;
+    for( int r = 0; r < ROUNDS; ++r ) {
+        memcpy( buf, input, len + 1 );
+        double t0 = now_ns();
+        if ( !func() ) {
+            printf( "  %s failed\n", name );
+            exit( EXIT_FAILURE );
+        }
+        ns += now_ns() - t0;
+    }
+    printf( "    %-28s %8.0f ns %5.1f allocs\n", name, ns / ROUNDS, (double)( allocs - a ) / ROUNDS );
+}
+
+int main( void ) {
+    static int const updates[] = { 1, 20 };
+    for( unsigned int i = 0; i < sizeof updates / sizeof *updates; ++i ) {
+        make_input( updates[i] );
+        printf( "  %d updates, %zu bytes, %u properties\n", updates[i], len, json_count( input ) );
+        measure( "chunks of 32, calloc", chunked );
+        measure( "json_count, one malloc", counted );
+        measure( "json_count alone", count_only );
+    }
+    return EXIT_SUCCESS;
+}
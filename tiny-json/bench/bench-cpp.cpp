@@ -0,0 +1,215 @@
+
+/*
+
+<https://github.com/rafagafe/tiny-json>
+
+  Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+  SPDX-License-Identifier: MIT
+  Copyright (c) 2016-2018 Rafa Garcia <rafagarcia77@gmail.com>.
+
+  Permission is hereby  granted, free of charge, to any  person obtaining a copy
+  of this software and associated  documentation files (the "Software"), to deal
+  in the Software  without restriction, including without  limitation the rights
+  to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+  copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+  IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+  FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+  AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+  LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+*/
+
+/*
+ * The parser class of example-03-cpp.cpp against tiny-json.hpp: heap
+ * allocations and time per parse of a getUpdates answer, and the time of
+ * property lookups by name and by compile time key.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <new>
+#include <string>
+#include "../tiny-json.hpp"
+
+using namespace tinyjson::literals;
+
+// ------------------------------------------------- Allocation counting: ---
+
+static std::size_t allocs = 0;
+static std::size_t alloc_bytes = 0;
+
+void* operator new( std::size_t size ) {
+    ++allocs;
+    alloc_bytes += size;
+    void* p = std::malloc( size ? size : 1 );
+    if ( !p ) throw std::bad_alloc{};
+    return p;
+}
+void* operator new[]( std::size_t size ) { return operator new( size ); }
+void operator delete( void* p ) noexcept { std::free( p ); }
+void operator delete[]( void* p ) noexcept { std::free( p ); }
+void operator delete( void* p, std::size_t ) noexcept { std::free( p ); }
+void operator delete[]( void* p, std::size_t ) noexcept { std::free( p ); }
+
+// ------------------------------------------- The class of example-03-cpp: ---
+
+class jsonParser : jsonPool_t
+{
+  static json_t* alloc_fn( jsonPool_t* pool )
+  {
+    const auto list_pool = (jsonParser*)pool;
+    list_pool->_list.emplace_back();
+    return &list_pool->_list.back();
+  }
+
+  std::list<json_t> _list{};
+  std::string _str{};
+  json_t const* _root{};
+
+public:
+  jsonParser() : jsonPool_t{ &alloc_fn, &alloc_fn } {}
+  jsonParser( const char* str )
+    : jsonPool_t{ &alloc_fn, &alloc_fn }
+    , _str{ str }
+  {
+    _root = json_createWithPool( _str.data(), this );
+  }
+  jsonParser( const jsonParser& ) = delete;
+  jsonParser( jsonParser&& ) = delete;
+  jsonParser& operator=( const jsonParser& ) = delete;
+  jsonParser& operator=( jsonParser&& ) = delete;
+
+  void parse( const char* str )
+  {
+    _str = str;
+    _list.clear();
+    _root = json_createWithPool( _str.data(), this );
+  }
+
+  json_t const* root() const { return _root; }
+};
+
+// ------------------------------------------------------------- Helpers: ---
+
+enum { UPDATES = 20, ROUNDS = 20000, CAPACITY = 512 };
+
+/* A getUpdates answer with a batch of command messages. */
+static std::string make_updates( void ) {
+    std::string str = "{\"ok\":true,\"result\":[";
+    char item[512];
+    for( int i = 0; i < UPDATES; ++i ) {
+        snprintf( item, sizeof item,
+                  "%s{\"update_id\":%d,\"message\":{\"message_id\":%d,"
+                  "\"from\":{\"id\":123456789,\"is_bot\":false,\"first_name\":\"Admin\",\"language_code\":\"en\"},"
+                  "\"chat\":{\"id\":123456789,\"first_name\":\"Admin\",\"type\":\"private\"},"
+                  "\"date\":%d,\"text\":\"/on gen%d\","
+                  "\"entities\":[{\"offset\":0,\"length\":3,\"type\":\"bot_command\"}]}}",
+                  i ? "," : "", 500000 + i, 1000 + i, 1704535205 + i, i % 4 );
+        str += item;
+    }
+    str += "]}";
+    return str;
+}
+
+/* What the bot reads from each update, summed up to compare the parsers. */
+static long long visit( json_t const* root ) {
+    long long sum = 0;
+    json_t const* result = json_getProperty( root, "result" );
+    for( json_t const* u = json_getChild( result ); u; u = json_getSibling( u ) ) {
+        json_t const* message = json_getProperty( u, "message" );
+        sum += json_getInteger( json_getProperty( u, "update_id" ) );
+        sum += json_getInteger( json_getProperty( json_getProperty( message, "chat" ), "id" ) );
+        sum += strlen( json_getPropertyValue( message, "text" ) );
+    }
+    return sum;
+}
+
+static long long visit( tinyjson::value root ) {
+    long long sum = 0;
+    for( tinyjson::value u : root["result"_key] ) {
+        tinyjson::value message = u["message"_key];
+        sum += u["update_id"_key].get_or<long long>( 0 );
+        sum += message["chat"_key]["id"_key].get_or<long long>( 0 );
+        sum += message["text"_key].text().size();
+    }
+    return sum;
+}
+
+struct result {
+    double ns;
+    double allocs;
+    double bytes;
+    long long check;
+};
+
+template <typename F>
+static result measure( F&& parse ) {
+    long long check = 0;
+    check += parse(); // warm up, buffers reach their size
+    std::size_t a = allocs, b = alloc_bytes;
+    auto start = std::chrono::steady_clock::now();
+    for( int i = 0; i < ROUNDS; ++i )
+        check += parse();
+    auto ns = std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count();
+    return result{ ns / ROUNDS, double( allocs - a ) / ROUNDS, double( alloc_bytes - b ) / ROUNDS, check / ( ROUNDS + 1 ) };
+}
+
+static void print( char const* name, result const& r ) {
+    printf( "  %-30s %9.0f ns %8.1f allocs %9.0f bytes\n", name, r.ns, r.allocs, r.bytes );
+}
+
+// ---------------------------------------------------------------- Main: ---
+
+int main( void ) {
+    std::string const input = make_updates();
+    std::string buf;
+    buf.reserve( input.size() + 1 );
+
+    printf( "\n%d updates, %zu bytes per parse, %d rounds\n\n", UPDATES, input.size(), ROUNDS );
+
+    jsonParser example;
+    result list = measure( [&] {
+        example.parse( input.c_str() );
+        return visit( example.root() );
+    } );
+    print( "example-03 std::list parser", list );
+
+    static tinyjson::document<CAPACITY> doc;
+    result inline_arena = measure( [&] {
+        buf.assign( input );
+        return visit( doc.parse( buf ) );
+    } );
+    print( "tinyjson::document<512>", inline_arena );
+
+    result heap_arena = measure( [&] {
+        buf.assign( input );
+        tinyjson::dynamic_document ddoc{ CAPACITY };
+        return visit( ddoc.parse( buf ) );
+    } );
+    print( "tinyjson::dynamic_document", heap_arena );
+
+    // lookups alone, on a parsed document
+    buf.assign( input );
+    doc.parse( buf );
+    result by_name = measure( [&] { return visit( doc.root().get() ); } );
+    print( "lookups by name (strcmp)", by_name );
+    result by_key = measure( [&] { return visit( doc.root() ); } );
+    print( "lookups by _key (hash)", by_key );
+
+    bool same = list.check == inline_arena.check && list.check == heap_arena.check
+             && list.check == by_name.check && list.check == by_key.check;
+    printf( "\n  results %s, %.1fx faster than the list parser, %.0f allocations less per parse\n\n",
+            same ? "match" : "DIFFER", list.ns / inline_arena.ns, list.allocs - inline_arena.allocs );
+    return same && inline_arena.allocs == 0 && heap_arena.allocs <= 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,155 @@
+
+/*
+
+<https://github.com/rafagafe/tiny-json>
+
+  Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+  SPDX-License-Identifier: MIT
+  Copyright (c) 2016-2018 Rafa Garcia <rafagarcia77@gmail.com>.
+
+  Permission is hereby  granted, free of charge, to any  person obtaining a copy
+  of this software and associated  documentation files (the "Software"), to deal
+  in the Software  without restriction, including without  limitation the rights
+  to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+  copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+  IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+  FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+  AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+  LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+*/
+
+/*
+ * Throughput of json_streamNext() on an NDJSON stream of several MB: a
+ * recorded file given as the argument or generated getUpdates answers and
+ * journal events. Against splitting the lines first and calling
+ * json_create() for each.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../tiny-json.h"
+
+enum { LINES = 20000, ROUNDS = 10, CAPACITY = 4096 };
+
+static json_t pool[CAPACITY];
+
+static double now_ns( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* getUpdates answers of 1 to 4 updates and journal events, one per line. */
+static char* make_input( size_t* len ) {
+    size_t const size = LINES * 1600;
+    char* str = malloc( size );
+    if ( !str ) return 0;
+    size_t n = 0;
+    for( int i = 0; i < LINES; ++i ) {
+        if ( i % 3 == 2 ) {
+            n += sprintf( str + n, "{\"t\":%d,\"event\":\"relay\",\"gen\":%d,\"on\":%s,\"text\":\"gen%d switched\"}\n",
+                          1704535205 + i, i % 4, i % 2 ? "true" : "false", i % 4 );
+            continue;
+        }
+        n += sprintf( str + n, "%s", "{\"ok\":true,\"result\":[" );
+        for( int u = 0; u <= i % 4; ++u )
+            n += sprintf( str + n,
+                          "%s{\"update_id\":%d,\"message\":{\"message_id\":%d,"
+                          "\"from\":{\"id\":123456789,\"is_bot\":false,\"first_name\":\"Admin\",\"language_code\":\"en\"},"
+                          "\"chat\":{\"id\":123456789,\"first_name\":\"Admin\",\"type\":\"private\"},"
+                          "\"date\":%d,\"text\":\"/on gen%d\","
+                          "\"entities\":[{\"offset\":0,\"length\":3,\"type\":\"bot_command\"}]}}",
+                          u ? "," : "", 500000 + i, 1000 + i, 1704535205 + i, u );
+        n += sprintf( str + n, "%s", "]}\n" );
+    }
+    *len = n;
+    return str;
+}
+
+static char* read_file( char const* name, size_t* len ) {
+    FILE* file = fopen( name, "rb" );
+    if ( !file ) return 0;
+    fseek( file, 0, SEEK_END );
+    long const size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+    char* str = size >= 0 ? malloc( (size_t)size + 1 ) : 0;
+    if ( str && fread( str, 1, (size_t)size, file ) == (size_t)size ) {
+        str[size] = '\0';
+        *len = (size_t)size;
+    }
+    else {
+        free( str );
+        str = 0;
+    }
+    fclose( file );
+    return str;
+}
+
+static unsigned long by_stream( char* buf ) {
+    jsonStream_t stream;
+    unsigned long docs = 0;
+    json_streamInit( &stream, buf );
+    while( json_streamNext( &stream, pool, CAPACITY ) ) ++docs;
+    return stream.error ? 0 : docs;
+}
+
+static unsigned long by_lines( char* buf ) {
+    unsigned long docs = 0;
+    for( char* line = buf; *line; ) {
+        char* eol = strchr( line, '\n' );
+        if ( eol ) *eol = '\0';
+        if ( line[strspn( line, " \r\t" )] ) {
+            if ( !json_create( line, pool, CAPACITY ) ) return 0;
+            ++docs;
+        }
+        if ( !eol ) break;
+        line = eol + 1;
+    }
+    return docs;
+}
+
+static double measure( char const* name, unsigned long (*func)( char* ), char const* input, char* buf, size_t len ) {
+    double ns = 0;
+    unsigned long docs = 0;
+    for( int r = 0; r < ROUNDS; ++r ) {
+        memcpy( buf, input, len + 1 );
+        double t0 = now_ns();
+        docs = func( buf );
+        ns += now_ns() - t0;
+        if ( !docs ) {
+            printf( "  %s: parse failed\n", name );
+            exit( EXIT_FAILURE );
+        }
+    }
+    ns /= ROUNDS;
+    printf( "    %-24s %lu documents, %7.1f MB/s, %8.0f documents/s\n", name, docs, len / ns * 1e3, docs / ns * 1e9 );
+    return ns;
+}
+
+int main( int argc, char* argv[] ) {
+    size_t len = 0;
+    char* input = argc > 1 ? read_file( argv[1], &len ) : make_input( &len );
+    char* buf = input ? malloc( len + 1 ) : 0;
+    if ( !buf ) {
+        puts( "no input" );
+        return EXIT_FAILURE;
+    }
+    printf( "  %s, %.1f MB\n", argc > 1 ? argv[1] : "generated", len / 1e6 );
+    measure( "json_streamNext", by_stream, input, buf, len );
+    measure( "lines + json_create", by_lines, input, buf, len );
+    free( buf );
+    free( input );
+    return EXIT_SUCCESS;
+}
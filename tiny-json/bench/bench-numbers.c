@@ -0,0 +1,109 @@
+
+/*
+
+<https://github.com/rafagafe/tiny-json>
+
+  Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+  SPDX-License-Identifier: MIT
+  Copyright (c) 2016-2018 Rafa Garcia <rafagarcia77@gmail.com>.
+
+  Permission is hereby  granted, free of charge, to any  person obtaining a copy
+  of this software and associated  documentation files (the "Software"), to deal
+  in the Software  without restriction, including without  limitation the rights
+  to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+  copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+  IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+  FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+  AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+  LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+*/
+
+/*
+ * A number heavy document, entities with ids, offsets and lengths, parsed
+ * and read. The makefile builds it with and without JSON_NUMBER_CACHE.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../tiny-json.h"
+
+enum { ITEMS = 200, FIELDS = 6, ROUNDS = 2000, READS = 4 };
+
+static json_t pool[1 + 1 + ITEMS * ( FIELDS + 1 )];
+static char input[ITEMS * 160];
+static char buf[sizeof input];
+
+static double now_ns( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void make_input( void ) {
+    size_t len = 0;
+    len += sprintf( input + len, "%s", "{\"entities\":[" );
+    for( int i = 0; i < ITEMS; ++i )
+        len += sprintf( input + len, "%s{\"update_id\":%d,\"id\":%lld,\"offset\":%d,\"length\":%d,\"date\":%d,\"load\":%d.%03d}",
+                        i ? "," : "", 500000 + i, 1234567890123LL + i * 7919, i * 3 % 97, 1 + i % 17, 1704535205 + i, i % 10, i * 37 % 1000 );
+    sprintf( input + len, "%s", "]}" );
+}
+
+static json_t const* parse( void ) {
+    memcpy( buf, input, sizeof input );
+    return json_create( buf, pool, sizeof pool / sizeof *pool );
+}
+
+/* What bot.c does per update and per entity. */
+static long long read_all( json_t const* json ) {
+    long long sum = 0;
+    json_t const* entities = json_getProperty( json, "entities" );
+    for( json_t const* item = json_getChild( entities ); item; item = json_getSibling( item ) )
+        for( json_t const* field = json_getChild( item ); field; field = json_getSibling( field ) )
+            sum += json_getType( field ) == JSON_INTEGER ? json_getInteger( field ) : (long long)json_getReal( field );
+    return sum;
+}
+
+int main( void ) {
+    make_input();
+    if ( !parse() ) {
+        puts( "parse failed" );
+        return EXIT_FAILURE;
+    }
+
+    double parse_ns = 0, read_ns = 0;
+    long long sum = 0;
+    for( int r = 0; r < ROUNDS; ++r ) {
+        double t0 = now_ns();
+        json_t const* json = parse();
+        double t1 = now_ns();
+        for( int i = 0; i < READS; ++i )
+            sum += read_all( json );
+        double t2 = now_ns();
+        parse_ns += t1 - t0;
+        read_ns += t2 - t1;
+    }
+
+    int const numbers = ITEMS * FIELDS;
+    parse_ns /= ROUNDS;
+    read_ns /= ROUNDS * READS;
+#ifdef JSON_NUMBER_CACHE
+    char const* mode = "cached";
+#else
+    char const* mode = "strtoll";
+#endif
+    printf( "  %-8s %zu bytes, %d numbers: parse %7.0f ns, read all %7.0f ns (%5.1f ns each), parse and read once %7.0f ns, sum %lld\n",
+            mode, strlen( input ), numbers, parse_ns, read_ns, read_ns / numbers, parse_ns + read_ns, sum / ROUNDS / READS );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,306 @@
+
+/*
+
+<https://github.com/rafagafe/tiny-json>
+
+  Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+  SPDX-License-Identifier: MIT
+  Copyright (c) 2016-2018 Rafa Garcia <rafagarcia77@gmail.com>.
+
+  Permission is hereby  granted, free of charge, to any  person obtaining a copy
+  of this software and associated  documentation files (the "Software"), to deal
+  in the Software  without restriction, including without  limitation the rights
+  to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+  copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+  IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+  FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+  AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+  LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+*/
+
+/*
+ * The benchmark suite: every file of the corpus with every parser. One
+ * line of json per file and parser on the standard output, so runs can be
+ * kept and compared. Each parse is timed along with a fixed loop over its
+ * input, "relative" is the time of the parse over the time of the loop, so
+ * it moves less than the times with the load and the clock of the machine.
+ * With --baseline the relative time of each pair is checked against an
+ * earlier run and the exit code is 1 if any is slower by more than
+ * --threshold percent.
+ *
+ *   bench-suite.exe [--baseline file] [--threshold percent] file...
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../tiny-json.h"
+
+enum { BATCHES = 15, BATCH_NS = 10000000, BASELINE_LINES = 256 };
+
+static double now_ns( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static char* read_file( char const* name, size_t* len ) {
+    FILE* file = fopen( name, "rb" );
+    if ( !file ) return 0;
+    fseek( file, 0, SEEK_END );
+    long const size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+    char* str = size >= 0 ? malloc( (size_t)size + 1 ) : 0;
+    if ( str && fread( str, 1, (size_t)size, file ) == (size_t)size ) {
+        str[size] = '\0';
+        *len = (size_t)size;
+    }
+    else {
+        free( str );
+        str = 0;
+    }
+    fclose( file );
+    return str;
+}
+
+// ------------------------------------------------------------- Parsers: ---
+
+/* The input of a parse, the property arrays are sized once per file. */
+struct input {
+    char const* str;
+    size_t len;
+    char* buf;
+    unsigned int nodes;
+    json_t* mem;
+    jsonc_t* cmem;
+    jsonv_t* vmem;
+};
+
+/* A static pool that counts what it hands out. */
+typedef struct {
+    json_t* mem;
+    unsigned int qty;
+    unsigned int used;
+    jsonPool_t pool;
+} countingPool_t;
+
+static json_t* countingAlloc( jsonPool_t* pool ) {
+    countingPool_t* spool = json_containerOf( pool, countingPool_t, pool );
+    return spool->used < spool->qty ? spool->mem + spool->used++ : 0;
+}
+
+static json_t* countingInit( jsonPool_t* pool ) {
+    json_containerOf( pool, countingPool_t, pool )->used = 0;
+    return countingAlloc( pool );
+}
+
+struct result {
+    int ok;
+    unsigned int allocs;
+    unsigned int heap;
+};
+
+static struct result in_place( struct input* in ) {
+    countingPool_t spool = { in->mem, in->nodes, 0, { countingInit, countingAlloc } };
+    struct result r = { json_createWithPool( in->buf, &spool.pool ) != 0, spool.used, 0 };
+    return r;
+}
+
+/* What bot.c did before the read-only parse: count, one block, parse. */
+static struct result counted( struct input* in ) {
+    unsigned int const qty = json_count( in->buf );
+    json_t* mem = malloc( qty * sizeof( json_t ) );
+    struct result r = { mem && json_create( in->buf, mem, qty ), qty, 1 };
+    free( mem );
+    return r;
+}
+
+static struct result compact( struct input* in ) {
+    jsoncDoc_t doc;
+    struct result r = { jsonc_create( &doc, in->buf, in->cmem, in->nodes ) != 0, doc.used, 0 };
+    return r;
+}
+
+static struct result read_only( struct input* in ) {
+    struct result r = { jsonv_create( in->str, in->len, in->vmem, in->nodes ) != 0, in->nodes, 0 };
+    return r;
+}
+
+static struct parser {
+    char const* name;
+    struct result (*parse)( struct input* in );
+    size_t node_size;
+    int modifies;
+} const parsers[] = {
+    { "json_create",          in_place,  sizeof( json_t ),  1 },
+    { "json_count+malloc",    counted,   sizeof( json_t ),  1 },
+    { "jsonc_create",         compact,   sizeof( jsonc_t ), 1 },
+    { "jsonv_create",         read_only, sizeof( jsonv_t ), 0 },
+};
+
+// ------------------------------------------------------------ Baseline: ---
+
+struct baseline {
+    char file[64];
+    char parser[32];
+    double relative;
+};
+
+static struct baseline baseline[BASELINE_LINES];
+static unsigned int baseline_qty = 0;
+
+/* The lines of an earlier run, read with the stream parser. */
+static int read_baseline( char const* name ) {
+    size_t len;
+    char* str = read_file( name, &len );
+    if ( !str ) return 0;
+    json_t pool[32];
+    jsonStream_t stream;
+    json_t const* json;
+    json_streamInit( &stream, str );
+    while( baseline_qty < BASELINE_LINES && ( json = json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) ) ) {
+        char const* file = json_getPropertyValue( json, "file" );
+        char const* parser = json_getPropertyValue( json, "parser" );
+        json_t const* relative = json_getProperty( json, "relative" );
+        if ( !file || !parser || !relative ) continue;
+        struct baseline* b = baseline + baseline_qty++;
+        snprintf( b->file, sizeof b->file, "%s", file );
+        snprintf( b->parser, sizeof b->parser, "%s", parser );
+        b->relative = json_getReal( relative );
+    }
+    int const ok = !stream.error;
+    free( str );
+    return ok;
+}
+
+static struct baseline const* find_baseline( char const* file, char const* parser ) {
+    for( unsigned int i = 0; i < baseline_qty; ++i )
+        if ( !strcmp( baseline[i].file, file ) && !strcmp( baseline[i].parser, parser ) )
+            return baseline + i;
+    return 0;
+}
+
+// ---------------------------------------------------------------- Main: ---
+
+/* A fixed amount of work per byte of the input, timed along with each
+   parse so the parse can be compared with it: a slower or busier machine
+   slows both down. */
+static unsigned long reference( char const* str, size_t len ) {
+    unsigned long sum = 0;
+    for( size_t i = 0; i < len; ++i )
+        sum = sum * 31 + (unsigned char)str[i];
+    return sum;
+}
+
+static int compare( void const* a, void const* b ) {
+    double const x = *(double const*)a, y = *(double const*)b;
+    return ( x > y ) - ( x < y );
+}
+
+/* The medians of some batches of parses: ns per parse and the time of the
+   parse over the time of the reference. */
+static double measure( struct parser const* parser, struct input* in, struct result* r, double* relative ) {
+    double ns[BATCHES], ratio[BATCHES];
+    unsigned long rounds = 1;
+    volatile unsigned long sink = 0;
+    for( int batch = 0; batch <= BATCHES; ++batch ) {
+        double parse_ns = 0, ref_ns = 0;
+        for( unsigned long i = 0; i < rounds; ++i ) {
+            if ( parser->modifies ) memcpy( in->buf, in->str, in->len + 1 );
+            double const t0 = now_ns();
+            *r = parser->parse( in );
+            double const t1 = now_ns();
+            sink += reference( in->str, in->len );
+            double const t2 = now_ns();
+            if ( !r->ok ) return -1;
+            parse_ns += t1 - t0;
+            ref_ns += t2 - t1;
+        }
+        // the first batch sets the rounds for the rest
+        if ( batch == 0 ) {
+            rounds = (unsigned long)( BATCH_NS / ( parse_ns + ref_ns + 1 ) ) + 1;
+            continue;
+        }
+        ns[batch - 1] = parse_ns / rounds;
+        ratio[batch - 1] = parse_ns / ref_ns;
+    }
+    qsort( ns, BATCHES, sizeof *ns, compare );
+    qsort( ratio, BATCHES, sizeof *ratio, compare );
+    *relative = ratio[BATCHES / 2];
+    return ns[BATCHES / 2];
+}
+
+int main( int argc, char* argv[] ) {
+    char const* baseline_name = 0;
+    double threshold = 20;
+    int regressions = 0;
+    int arg = 1;
+    for( ; arg < argc - 1 && argv[arg][0] == '-'; arg += 2 ) {
+        if ( !strcmp( argv[arg], "--baseline" ) ) baseline_name = argv[arg + 1];
+        else if ( !strcmp( argv[arg], "--threshold" ) ) threshold = atof( argv[arg + 1] );
+        else break;
+    }
+    if ( arg >= argc ) {
+        fprintf( stderr, "usage: %s [--baseline file] [--threshold percent] file...\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+    if ( baseline_name && !read_baseline( baseline_name ) ) {
+        fprintf( stderr, "could not read the baseline %s\n", baseline_name );
+        return EXIT_FAILURE;
+    }
+
+    for( ; arg < argc; ++arg ) {
+        struct input in;
+        in.str = read_file( argv[arg], &in.len );
+        if ( !in.str ) {
+            fprintf( stderr, "could not read %s\n", argv[arg] );
+            return EXIT_FAILURE;
+        }
+        char const* file = strrchr( argv[arg], '/' );
+        file = file ? file + 1 : argv[arg];
+        in.nodes = json_count( in.str );
+        in.buf = malloc( in.len + 1 );
+        in.mem = malloc( in.nodes * sizeof( json_t ) );
+        in.cmem = malloc( in.nodes * sizeof( jsonc_t ) );
+        in.vmem = malloc( in.nodes * sizeof( jsonv_t ) );
+        if ( !in.buf || !in.mem || !in.cmem || !in.vmem ) return EXIT_FAILURE;
+
+        for( unsigned int p = 0; p < sizeof parsers / sizeof *parsers; ++p ) {
+            struct parser const* parser = parsers + p;
+            struct result r;
+            double relative;
+            double const ns = measure( parser, &in, &r, &relative );
+            if ( ns < 0 ) {
+                fprintf( stderr, "%s: %s failed\n", file, parser->name );
+                return EXIT_FAILURE;
+            }
+            printf( "{\"file\":\"%s\",\"parser\":\"%s\",\"bytes\":%zu,\"nodes\":%u,\"mb_s\":%.1f,"
+                    "\"ns_per_node\":%.2f,\"relative\":%.4f,\"allocs\":%u,\"heap_allocs\":%u,\"peak_pool_bytes\":%zu}\n",
+                    file, parser->name, in.len, in.nodes, in.len / ns * 1e3, ns / in.nodes,
+                    relative, r.allocs, r.heap, r.allocs * parser->node_size );
+            struct baseline const* b = find_baseline( file, parser->name );
+            if ( b && relative > b->relative * ( 1 + threshold / 100 ) ) {
+                fprintf( stderr, "regression: %s %s %.4f of the reference, baseline %.4f\n",
+                         file, parser->name, relative, b->relative );
+                ++regressions;
+            }
+        }
+        free( in.vmem );
+        free( in.cmem );
+        free( in.mem );
+        free( in.buf );
+        free( (char*)in.str );
+    }
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+
+/*
+
+<https://github.com/rafagafe/tiny-json>
+
+  Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+  SPDX-License-Identifier: MIT
+  Copyright (c) 2016-2018 Rafa Garcia <rafagarcia77@gmail.com>.
+
+  Permission is hereby  granted, free of charge, to any  person obtaining a copy
+  of this software and associated  documentation files (the "Software"), to deal
+  in the Software  without restriction, including without  limitation the rights
+  to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+  copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+  IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+  FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+  AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+  LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+*/
+
+/*
+ * Keeping the input of a parse: a copy of it and json_create() against
+ * jsonv_create(), which leaves the input as it is, each with the reads of
+ * bot.c. The texts of the read-only parse are unescaped as they are read.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../tiny-json.h"
+
+enum { UPDATES = 20, ROUNDS = 20000, CAPACITY = 512 };
+
+static json_t pool[CAPACITY];
+static jsonv_t vpool[CAPACITY];
+static char input[UPDATES * 400];
+static char copy[sizeof input];
+static size_t len;
+
+static double now_ns( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* A getUpdates answer with a batch of command messages. */
+static void make_input( void ) {
+    len = sprintf( input, "%s", "{\"ok\":true,\"result\":[" );
+    for( int i = 0; i < UPDATES; ++i )
+        len += sprintf( input + len,
+                        "%s{\"update_id\":%d,\"message\":{\"message_id\":%d,"
+                        "\"from\":{\"id\":123456789,\"is_bot\":false,\"first_name\":\"Admin\",\"language_code\":\"en\"},"
+                        "\"chat\":{\"id\":123456789,\"first_name\":\"Admin\",\"type\":\"private\"},"
+                        "\"date\":%d,\"text\":\"/on gen%d\","
+                        "\"entities\":[{\"offset\":0,\"length\":3,\"type\":\"bot_command\"}]}}",
+                        i ? "," : "", 500000 + i, 1000 + i, 1704535205 + i, i % 4 );
+    len += sprintf( input + len, "%s", "]}" );
+}
+
+/* What process_api_response() reads. */
+static long long read_json( json_t const* root ) {
+    long long sum = 0;
+    json_t const* result = json_getProperty( root, "result" );
+    for( json_t const* u = json_getChild( result ); u; u = json_getSibling( u ) ) {
+        json_t const* message = json_getProperty( u, "message" );
+        sum += json_getInteger( json_getProperty( u, "update_id" ) );
+        sum += json_getInteger( json_getProperty( json_getProperty( message, "from" ), "id" ) );
+        json_t const* entity = json_getChild( json_getProperty( message, "entities" ) );
+        if ( !strcmp( json_getPropertyValue( entity, "type" ), "bot_command" ) )
+            sum += strlen( json_getPropertyValue( message, "text" ) );
+    }
+    return sum;
+}
+
+static long long read_view( jsonv_t const* root ) {
+    long long sum = 0;
+    char text[256];
+    jsonv_t const* result = jsonv_getProperty( root, "result" );
+    for( jsonv_t const* u = jsonv_getChild( result ); u; u = jsonv_getSibling( u ) ) {
+        jsonv_t const* message = jsonv_getProperty( u, "message" );
+        sum += jsonv_getInteger( jsonv_getProperty( u, "update_id" ) );
+        sum += jsonv_getInteger( jsonv_getProperty( jsonv_getProperty( message, "from" ), "id" ) );
+        jsonv_t const* entity = jsonv_getChild( jsonv_getProperty( message, "entities" ) );
+        if ( jsonv_isText( jsonv_getProperty( entity, "type" ), "bot_command" ) )
+            sum += jsonv_getText( jsonv_getProperty( message, "text" ), text, sizeof text );
+    }
+    return sum;
+}
+
+int main( void ) {
+    make_input();
+    double copy_ns = 0, parse_ns = 0, read_ns = 0, view_ns = 0, view_read_ns = 0;
+    long long sum = 0, vsum = 0;
+    for( int r = 0; r < ROUNDS; ++r ) {
+        double t0 = now_ns();
+        memcpy( copy, input, len + 1 );
+        double t1 = now_ns();
+        json_t const* json = json_create( copy, pool, CAPACITY );
+        double t2 = now_ns();
+        sum += read_json( json );
+        double t3 = now_ns();
+        jsonv_t const* jsonv = jsonv_create( input, len, vpool, CAPACITY );
+        double t4 = now_ns();
+        vsum += read_view( jsonv );
+        double t5 = now_ns();
+        copy_ns += t1 - t0;
+        parse_ns += t2 - t1;
+        read_ns += t3 - t2;
+        view_ns += t4 - t3;
+        view_read_ns += t5 - t4;
+    }
+    printf( "  %d updates, %zu bytes, %u properties\n", UPDATES, len, json_count( input ) );
+    printf( "    copy + json_create   %6.0f + %6.0f ns, read %5.0f ns, total %6.0f ns, %2zu bytes per property + %zu bytes of copy\n",
+            copy_ns / ROUNDS, parse_ns / ROUNDS, read_ns / ROUNDS, ( copy_ns + parse_ns + read_ns ) / ROUNDS, sizeof( json_t ), len + 1 );
+    printf( "    jsonv_create                  %6.0f ns, read %5.0f ns, total %6.0f ns, %2zu bytes per property\n",
+            view_ns / ROUNDS, view_read_ns / ROUNDS, ( view_ns + view_read_ns ) / ROUNDS, sizeof( jsonv_t ) );
+    return sum == vsum ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,193 @@
+
+/*
+
+<https://github.com/rafagafe/tiny-json>
+
+  Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+  SPDX-License-Identifier: MIT
+  Copyright (c) 2016-2018 Rafa Garcia <rafagarcia77@gmail.com>.
+
+  Permission is hereby  granted, free of charge, to any  person obtaining a copy
+  of this software and associated  documentation files (the "Software"), to deal
+  in the Software  without restriction, including without  limitation the rights
+  to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+  copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+  IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+  FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+  AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+  LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "../tiny-json.hpp"
+
+using namespace tinyjson::literals;
+
+// ----------------------------------------------------- Test "framework": ---
+
+#define done() return 0
+#define fail() return __LINE__
+static int checkqty = 0;
+#define check( x ) do { ++checkqty; if (!(x)) fail(); } while ( 0 )
+
+struct test {
+    int(*func)(void);
+    char const* name;
+};
+
+static int test_suit( struct test const* tests, int numtests ) {
+    printf( "%s", "\n\nTests:\n" );
+    int failed = 0;
+    for( int i = 0; i < numtests; ++i ) {
+        printf( " %02d%s%-25s ", i, ": ", tests[i].name );
+        int linerr = tests[i].func();
+        if ( 0 == linerr )
+            printf( "%s", "OK\n" );
+        else {
+            printf( "%s%d\n", "Failed, line: ", linerr );
+            ++failed;
+        }
+    }
+    printf( "\n%s%d\n", "Total checks: ", checkqty );
+    printf( "%s[ %d / %d ]\r\n\n\n", "Tests PASS: ", numtests - failed, numtests );
+    return failed;
+}
+
+
+
+// ----------------------------------------------------------- Unit tests: ---
+
+static char update[] =
+    "{\"ok\":true,\"result\":[{\"update_id\":500123,"
+    "\"message\":{\"message_id\":77,\"from\":{\"id\":123456789,\"is_bot\":false},"
+    "\"chat\":{\"id\":-1001234567890,\"type\":\"group\"},\"date\":1704535205,"
+    "\"text\":\"/on gen2\",\"entities\":[{\"offset\":0,\"length\":3,\"type\":\"bot_command\"}]}}],"
+    "\"load\":-0.25}";
+
+static int typed( void ) {
+    std::string str = update;
+    tinyjson::document<32> doc{ str };
+    tinyjson::value root = doc.root();
+    check( root.is_object() );
+
+    check( root["ok"_key].get<bool>() == true );
+    check( !root["ok"_key].get<int>() );
+
+    tinyjson::value message = root["result"_key][0]["message"_key];
+    check( message.is_object() );
+    check( message["message_id"_key].get<int>() == 77 );
+    check( message["chat"_key]["id"_key].get<std::int64_t>() == -1001234567890LL );
+    // does not fit
+    check( !message["chat"_key]["id"_key].get<std::int32_t>() );
+    check( !message["chat"_key]["id"_key].get<std::uint64_t>() );
+    check( message["date"_key].get<std::uint32_t>() == 1704535205u );
+    check( message["text"_key].get<std::string_view>() == "/on gen2" );
+    check( !std::strcmp( *message["text"_key].get<char const*>(), "/on gen2" ) );
+    check( root["load"_key].get<double>() == -0.25 );
+    check( message["date"_key].get<double>() == 1704535205.0 );
+
+    // a missing step anywhere gives a null handle at the end
+    check( !root["result"_key][3]["message"_key]["chat"_key] );
+    check( root["nothing"_key]["id"_key].get_or<int>( -1 ) == -1 );
+    check( message["chat"_key]["type"_key].text() == "group" );
+    check( message["from"_key].name() == "from" );
+
+    // runtime keys work the same
+    std::string name = "message_id";
+    check( message[tinyjson::key{ name }].get<int>() == 77 );
+    done();
+}
+
+static int iteration( void ) {
+    char str[] = "{\"a\":[1,2,3,4],\"b\":{\"x\":1,\"y\":2},\"c\":[]}";
+    tinyjson::document<16> doc;
+    tinyjson::value root = doc.parse( str );
+    check( root );
+    check( doc.size() == 10 );
+
+    long sum = 0;
+    for( tinyjson::value item : root["a"_key] )
+        sum += item.get_or<long>( 0 );
+    check( sum == 10 );
+    check( root["a"_key].size() == 4 );
+    check( root["c"_key].size() == 0 );
+    check( root["c"_key].begin() == root["c"_key].end() );
+
+    std::string names;
+    for( tinyjson::value property : root["b"_key] )
+        names += property.name();
+    check( names == "xy" );
+
+    // primitives have no children
+    check( root["a"_key][0].size() == 0 );
+    done();
+}
+
+static int hashing( void ) {
+    static_assert( "update_id"_key.hash == tinyjson::hash( "update_id" ), "compile time" );
+    constexpr tinyjson::key k = "chat";
+    static_assert( k.name.size() == 4, "compile time" );
+
+    // names that collide must still be told apart: a prefix and a longer name
+    char str[] = "{\"id\":1,\"idx\":2,\"i\":3}";
+    tinyjson::document<4> doc{ str };
+    check( doc.root()["id"_key].get<int>() == 1 );
+    check( doc.root()["idx"_key].get<int>() == 2 );
+    check( doc.root()["i"_key].get<int>() == 3 );
+    check( !doc.root()["ix"_key] );
+
+    // a handle without an arena looks up by name only
+    tinyjson::value plain{ doc.root().get(), nullptr };
+    check( plain["idx"_key].get<int>() == 2 );
+    done();
+}
+
+static int storage( void ) {
+    {
+        char str[] = "{\"a\":[1,2,3,4,5,6,7,8]}";
+        tinyjson::document<4> doc{ str };
+        check( !doc.root() );
+        check( doc.exhausted() );
+    }
+    {
+        char str[] = "{\"a\":[1,2,}";
+        tinyjson::document<16> doc{ str };
+        check( !doc.root() );
+        check( !doc.exhausted() );
+    }
+    {
+        std::string str = update;
+        tinyjson::dynamic_document doc{ 32 };
+        check( doc.capacity() == 32 );
+        check( doc.parse( str ) );
+        check( doc.root()["result"_key][0]["update_id"_key].get<int>() == 500123 );
+
+        // parse again into the same arena
+        char again[] = "[true,false]";
+        check( doc.parse( again ) );
+        check( doc.size() == 3 );
+        check( doc.root()[1].get<bool>() == false );
+    }
+    done();
+}
+
+int main( void ) {
+    static struct test const tests[] = {
+        { typed,     "Typed access"     },
+        { iteration, "Range for"        },
+        { hashing,   "Keys"             },
+        { storage,   "Arena storage"    },
+    };
+    return test_suit( tests, sizeof tests / sizeof *tests );
+}
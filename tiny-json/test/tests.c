@@ -363,6 +363,320 @@ int badformat( void ) {
     done();
 }
 
+/* The same results with and without JSON_NUMBER_CACHE. */
+static int numbers( void ) {
+    json_t pool[20];
+    unsigned const qty = sizeof pool / sizeof *pool;
+
+    char str[] = "{\"ints\":[0,-0,7,-7,1000000007,-4294967296,"
+                     "999999999999999999,1000000000000000000,"
+                     "9223372036854775806,-9223372036854775807],"
+                 "\"reals\":[2.5,-0.125,1e3,-2E-2]}";
+    json_t const* json = json_create( str, pool, qty );
+    check( json );
+
+    static int64_t const ints[] = {
+        0, 0, 7, -7, 1000000007, -4294967296LL,
+        999999999999999999LL, 1000000000000000000LL,
+        INT64_MAX - 1, -INT64_MAX
+    };
+    int i = 0;
+    for( json_t const* item = json_getChild( json_getProperty( json, "ints" ) ); item; item = json_getSibling( item ), ++i ) {
+        check( JSON_INTEGER == json_getType( item ) );
+        check( ints[i] == json_getInteger( item ) );
+        check( (double)ints[i] == json_getReal( item ) );
+    }
+    check( i == 10 );
+    // the text is still there
+    check( !strcmp( "-4294967296", json_getValue( json_getChild( json_getProperty( json, "ints" ) )->sibling->sibling->sibling->sibling->sibling ) ) );
+
+    static double const reals[] = { 2.5, -0.125, 1e3, -2E-2 };
+    i = 0;
+    for( json_t const* item = json_getChild( json_getProperty( json, "reals" ) ); item; item = json_getSibling( item ), ++i ) {
+        check( JSON_REAL == json_getType( item ) );
+        check( reals[i] == json_getReal( item ) );
+    }
+    check( i == 4 );
+    check( 2 == json_getInteger( json_getChild( json_getProperty( json, "reals" ) ) ) );
+
+    {
+        char str[] = "{\"var\":00}";
+        check( !json_create( str, pool, qty ) );
+    }
+    {
+        char str[] = "{\"var\":-}";
+        check( !json_create( str, pool, qty ) );
+    }
+    {
+        char str[] = "{\"var\":99999999999999999999}";
+        check( !json_create( str, pool, qty ) );
+    }
+    done();
+}
+
+/* Walk a json_t tree and a compact one side by side. */
+static bool sameTree( json_t const* json, jsoncDoc_t const* doc, jsonc_t const* jsonc ) {
+    for( ; json && jsonc; json = json_getSibling( json ), jsonc = jsonc_getSibling( doc, jsonc ) ) {
+        if ( json_getType( json ) != jsonc_getType( jsonc ) ) return false;
+        char const* name = json_getName( json );
+        char const* namec = jsonc_getName( doc, jsonc );
+        if ( !name != !namec || ( name && strcmp( name, namec ) ) ) return false;
+        if ( json_getType( json ) <= JSON_ARRAY ) {
+            if ( !sameTree( json_getChild( json ), doc, jsonc_getChild( jsonc ) ) ) return false;
+        }
+        else if ( strcmp( json_getValue( json ), jsonc_getValue( doc, jsonc ) ) ) return false;
+    }
+    return !json && !jsonc;
+}
+
+static int compact( void ) {
+    static char const* const docs[] = {
+        "{}",
+        "[]",
+        "{\"a\":[]}",
+        "{\"a\":[{},{}],\"b\":{}}",
+        "[1,[2,[3,[4,[]]]],{\"x\":{\"y\":{\"z\":null}}}]",
+        "{\"ok\":true,\"result\":[{\"update_id\":500123,\"message\":{\"message_id\":77,"
+        "\"from\":{\"id\":123456789,\"is_bot\":false},\"chat\":{\"id\":-1001234567890,\"type\":\"group\"},"
+        "\"text\":\"\\\"/on\\\" gen2\",\"entities\":[{\"offset\":0,\"length\":3}]}}],\"load\":-0.25e1}",
+    };
+    json_t pool[32];
+    jsonc_t cpool[32];
+    char str[256], strc[256];
+
+    check( sizeof( jsonc_t ) == 12 );
+    for( unsigned int i = 0; i < sizeof docs / sizeof *docs; ++i ) {
+        strcpy( str, docs[i] );
+        strcpy( strc, docs[i] );
+        json_t const* json = json_create( str, pool, sizeof pool / sizeof *pool );
+        jsoncDoc_t doc;
+        jsonc_t const* jsonc = jsonc_create( &doc, strc, cpool, sizeof cpool / sizeof *cpool );
+        check( json && jsonc );
+        check( sameTree( json, &doc, jsonc ) );
+    }
+
+    // the last document: lookups, values and the adapter
+    strcpy( strc, docs[5] );
+    jsoncDoc_t doc;
+    jsonc_t const* root = jsonc_create( &doc, strc, cpool, sizeof cpool / sizeof *cpool );
+    check( root );
+    check( doc.used == 19 );
+    jsonc_t const* result = jsonc_getProperty( &doc, root, "result" );
+    check( result && jsonc_getType( result ) == JSON_ARRAY );
+    jsonc_t const* message = jsonc_getProperty( &doc, jsonc_getChild( result ), "message" );
+    check( message );
+    check( jsonc_getInteger( &doc, jsonc_getProperty( &doc, jsonc_getProperty( &doc, message, "chat" ), "id" ) ) == -1001234567890LL );
+    check( !strcmp( jsonc_getPropertyValue( &doc, message, "text" ), "\"/on\" gen2" ) );
+    check( !jsonc_getPropertyValue( &doc, message, "chat" ) );
+    check( !jsonc_getProperty( &doc, message, "nothing" ) );
+    check( jsonc_getBoolean( &doc, jsonc_getProperty( &doc, root, "ok" ) ) );
+    check( jsonc_getReal( &doc, jsonc_getProperty( &doc, root, "load" ) ) == -2.5 );
+
+    // a part of it for code written against json_t
+    check( !jsonc_toJson( &doc, message, pool, 12 ) );
+    json_t const* json = jsonc_toJson( &doc, message, pool, 13 );
+    check( json );
+    check( !strcmp( json_getName( json ), "message" ) );
+    check( json_getInteger( json_getProperty( json_getProperty( json, "from" ), "id" ) ) == 123456789 );
+    check( json_getInteger( json_getProperty( json_getChild( json_getProperty( json, "entities" ) ), "length" ) ) == 3 );
+    check( sameTree( json_getChild( json ), &doc, jsonc_getChild( message ) ) );
+    json = jsonc_toJson( &doc, root, pool, sizeof pool / sizeof *pool );
+    check( json && sameTree( json, &doc, root ) );
+
+    // too small and bad formats
+    strcpy( strc, docs[5] );
+    check( !jsonc_create( &doc, strc, cpool, 18 ) );
+    static char const* const bad[] = { "{\"a\":[1,2}", "{\"a\" 1}", "[1,]]", "{\"a\":tru}", "{\"a\":01}", "" };
+    for( unsigned int i = 0; i < sizeof bad / sizeof *bad; ++i ) {
+        strcpy( strc, bad[i] );
+        strcpy( str, bad[i] );
+        check( !jsonc_create( &doc, strc, cpool, sizeof cpool / sizeof *cpool ) == !json_create( str, pool, sizeof pool / sizeof *pool ) );
+    }
+    done();
+}
+
+static int count( void ) {
+    static char const* const docs[] = {
+        "{}",
+        " [ ] ",
+        "{\"a\":[ ],\"b\":{\n}}",
+        "[1,[2,[3,[4,[]]]],{\"x\":{\"y\":{\"z\":null}}}]",
+        "{\"t\":\"a,b{c}[d]\",\"e\":\"\\\",[\",\"u\":\"\\\\\",\"v\":[true,false]}",
+        "{\"ok\":true,\"result\":[{\"update_id\":500123,\"message\":{\"message_id\":77,"
+        "\"chat\":{\"id\":-1001234567890,\"type\":\"group\"},\"text\":\"/on gen2\","
+        "\"entities\":[{\"offset\":0,\"length\":3}]}}],\"load\":-0.25e1}",
+    };
+    json_t pool[32];
+    jsonc_t cpool[32];
+    char str[256];
+    for( unsigned int i = 0; i < sizeof docs / sizeof *docs; ++i ) {
+        strcpy( str, docs[i] );
+        unsigned int const qty = json_count( str );
+        check( !strcmp( str, docs[i] ) );
+        check( qty <= sizeof pool / sizeof *pool );
+        check( json_create( str, pool, qty ) );
+        strcpy( str, docs[i] );
+        // the root is taken without a room check
+        if ( qty > 1 ) check( !json_create( str, pool, qty - 1 ) );
+        jsoncDoc_t doc;
+        strcpy( str, docs[i] );
+        check( jsonc_create( &doc, str, cpool, qty ) );
+        check( doc.used == qty );
+    }
+    done();
+}
+
+/* Walk a json_t tree and a read-only one side by side. */
+static bool sameView( json_t const* json, jsonv_t const* parent, jsonv_t const* jsonv ) {
+    char text[64];
+    for( ; json && jsonv; json = json_getSibling( json ), jsonv = jsonv_getSibling( jsonv ) ) {
+        if ( json_getType( json ) != jsonv_getType( jsonv ) ) return false;
+        char const* name = json_getName( json );
+        if ( !name != !jsonv_getName( jsonv ).ptr ) return false;
+        if ( name && jsonv_getProperty( parent, name ) != jsonv ) return false;
+        jsonType_t const type = json_getType( json );
+        if ( type <= JSON_ARRAY ) {
+            if ( !sameView( json_getChild( json ), jsonv, jsonv_getChild( jsonv ) ) ) return false;
+        }
+        else if ( type == JSON_TEXT ) {
+            if ( jsonv_getText( jsonv, text, sizeof text ) != (int)strlen( json_getValue( json ) ) ) return false;
+            if ( strcmp( text, json_getValue( json ) ) || !jsonv_isText( jsonv, text ) ) return false;
+        }
+        else {
+            jsonSpan_t const value = jsonv_getValue( jsonv );
+            if ( value.len != strlen( json_getValue( json ) ) ) return false;
+            if ( memcmp( value.ptr, json_getValue( json ), value.len ) ) return false;
+        }
+    }
+    return !json && !jsonv;
+}
+
+static int view( void ) {
+    static char const* const docs[] = {
+        "{}",
+        " [ ] ",
+        "{\"a\":[ ],\"b\":{\n}}",
+        "[1,[2,[3,[4,[]]]],{\"x\":{\"y\":{\"z\":null}}}]",
+        "{\"t\":\"a,b{c}[d]\",\"e\\n\":\"\\\",[\\u0041\",\"u\":\"\\\\\",\"v\":[true,false]}",
+        "{\"ok\":true,\"result\":[{\"update_id\":500123,\"message\":{\"message_id\":77,"
+        "\"chat\":{\"id\":-1001234567890,\"type\":\"group\"},\"text\":\"\\\"/on\\\" gen2\","
+        "\"entities\":[{\"offset\":0,\"length\":3}]}}],\"load\":-0.25e1,"
+        "\"max\":9223372036854775807,\"min\":-9223372036854775808}",
+    };
+    json_t pool[32];
+    jsonv_t vpool[32];
+    char str[256], input[256];
+
+    for( unsigned int i = 0; i < sizeof docs / sizeof *docs; ++i ) {
+        // no null character after the input
+        size_t const len = strlen( docs[i] );
+        memset( input, 'x', sizeof input );
+        memcpy( input, docs[i], len );
+        unsigned int const qty = jsonv_count( input, len );
+        check( qty == json_count( docs[i] ) );
+        if ( qty > 1 ) check( !jsonv_create( input, len, vpool, qty - 1 ) );
+        jsonv_t const* jsonv = jsonv_create( input, len, vpool, qty );
+        check( jsonv );
+        check( !memcmp( input, docs[i], len ) );
+        strcpy( str, docs[i] );
+        json_t const* json = json_create( str, pool, sizeof pool / sizeof *pool );
+        check( json );
+        check( sameView( json, NULL, jsonv ) );
+        // cut anywhere before the root is closed
+        size_t closed = len;
+        while( input[closed - 1] != '}' && input[closed - 1] != ']' ) --closed;
+        for( size_t cut = 0; cut < closed; ++cut )
+            check( !jsonv_create( input, cut, vpool, qty ) );
+    }
+
+    // the last document, read like bot.c does
+    size_t const len = strlen( docs[5] );
+    jsonv_t const* root = jsonv_create( docs[5], len, vpool, sizeof vpool / sizeof *vpool );
+    check( root );
+    check( jsonv_getBoolean( jsonv_getProperty( root, "ok" ) ) );
+    check( jsonv_getReal( jsonv_getProperty( root, "load" ) ) == -2.5 );
+    check( jsonv_getInteger( jsonv_getProperty( root, "max" ) ) == INT64_MAX );
+    check( jsonv_getInteger( jsonv_getProperty( root, "min" ) ) == INT64_MIN );
+    jsonv_t const* message = jsonv_getProperty( jsonv_getChild( jsonv_getProperty( root, "result" ) ), "message" );
+    check( message );
+    check( jsonv_getInteger( jsonv_getProperty( jsonv_getProperty( message, "chat" ), "id" ) ) == -1001234567890LL );
+    check( jsonv_isText( jsonv_getProperty( jsonv_getProperty( message, "chat" ), "type" ), "group" ) );
+    check( !jsonv_isText( jsonv_getProperty( jsonv_getProperty( message, "chat" ), "type" ), "grou" ) );
+    check( !jsonv_isText( jsonv_getProperty( message, "chat" ), "group" ) );
+    jsonv_t const* text = jsonv_getProperty( message, "text" );
+    check( jsonv_getValue( text ).len == 12 );
+    check( jsonv_getText( text, str, 10 ) == -1 );
+    check( jsonv_getText( text, str, 11 ) == 10 );
+    check( !strcmp( str, "\"/on\" gen2" ) );
+    check( jsonv_getText( jsonv_getProperty( message, "chat" ), str, sizeof str ) == -1 );
+    check( !jsonv_getProperty( message, "nothing" ) );
+
+    // the same errors as json_create
+    static char const* const bad[] = {
+        "{\"a\":[1,2}", "{\"a\" 1}", "[1,]]", "{\"a\":tru}", "{\"a\":01}", "",
+        "[\"\\x\"]", "[\"\\u12G4\"]", "[9223372036854775808]", "[-9223372036854775809]", "[1.]", "[1e]", "[-]",
+    };
+    for( unsigned int i = 0; i < sizeof bad / sizeof *bad; ++i ) {
+        strcpy( str, bad[i] );
+        check( !jsonv_create( bad[i], strlen( bad[i] ), vpool, sizeof vpool / sizeof *vpool ) == !json_create( str, pool, sizeof pool / sizeof *pool ) );
+    }
+    done();
+}
+
+static int stream( void ) {
+    json_t pool[8];
+    jsonStream_t stream;
+    {
+        char str[] = "{\"id\":1,\"t\":\"on\"}\n{\"id\":2}\r\n\n[3,4]{\"id\":5}[]\n";
+        static size_t const offsets[] = { 0, 18, 29, 34, 42 };
+        json_streamInit( &stream, str );
+        json_t const* json;
+        unsigned int i = 0;
+        while( ( json = json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) ) ) {
+            check( i < sizeof offsets / sizeof *offsets );
+            check( stream.offset == offsets[i] );
+            check( json == pool );
+            ++i;
+            if ( i == 2 ) check( json_getInteger( json_getProperty( json, "id" ) ) == 2 );
+            if ( i == 3 ) check( json_getInteger( json_getSibling( json_getChild( json ) ) ) == 4 );
+        }
+        check( i == 5 );
+        check( !stream.error );
+        check( !json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) );
+    }
+    {
+        char str[] = " \n ";
+        json_streamInit( &stream, str );
+        check( !json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) );
+        check( !stream.error );
+    }
+    {
+        char str[] = "{\"a\":1}\n{\"a\":}\n{\"a\":3}\n";
+        json_streamInit( &stream, str );
+        check( json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) );
+        check( !json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) );
+        check( stream.error );
+        check( stream.offset == 8 );
+        check( !json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) );
+    }
+    {
+        // a document larger than the pool stops the iteration too
+        char str[] = "[1]\n[1,2,3,4,5,6,7,8]\n";
+        json_streamInit( &stream, str );
+        check( json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) );
+        check( !json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) );
+        check( stream.error && stream.offset == 4 );
+    }
+    {
+        char str[] = "{}\n5\n";
+        json_streamInit( &stream, str );
+        check( json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) );
+        check( !json_streamNext( &stream, pool, sizeof pool / sizeof *pool ) );
+        check( stream.error && stream.offset == 3 );
+    }
+    done();
+}
+
 
 // --------------------------------------------------------- Execute tests: ---
 
@@ -374,6 +688,11 @@ int main( void ) {
         { array,       "Array"                  },
         { badformat,   "Bad format"             },
         { goodformats, "Formats"                },
+        { numbers,     "Numbers"                },
+        { compact,     "Compact layout"         },
+        { count,       "Pre-count"              },
+        { view,        "Read-only parse"        },
+        { stream,      "Document stream"        },
     };
     return test_suit( tests, sizeof tests / sizeof *tests );
 }
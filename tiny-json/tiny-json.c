@@ -66,17 +66,29 @@ static char* objValue( char* ptr, json_t* obj, jsonPool_t* pool );
 static char* setToNull( char* ch );
 static bool isEndOfPrimitive( char ch );
 
-/* Parse a string to get a json. */
-json_t const* json_createWithPool( char *str, jsonPool_t *pool ) {
-    char* ptr = goBlank( str );
-    if ( !ptr || (*ptr != '{' && *ptr != '[') ) return 0;
+/** Parse a json object or array.
+  * @param ptr Pointer to its first character, '{' or '['.
+  * @param pool The handler of a json pool for creating json instances.
+  * @param json The handler of the json if success.
+  * @retval Pointer to first character after the value. If success.
+  * @retval Null pointer if any error occur. */
+static char* document( char* ptr, jsonPool_t* pool, json_t const** json ) {
     json_t* obj = pool->init( pool );
     obj->name    = 0;
     obj->sibling = 0;
     obj->u.c.child = 0;
     ptr = objValue( ptr, obj, pool );
-    if ( !ptr ) return 0;
-    return obj;
+    *json = obj;
+    return ptr;
+}
+
+/* Parse a string to get a json. */
+json_t const* json_createWithPool( char *str, jsonPool_t *pool ) {
+    char* ptr = goBlank( str );
+    if ( !ptr || (*ptr != '{' && *ptr != '[') ) return 0;
+    json_t const* json;
+    if ( !document( ptr, pool, &json ) ) return 0;
+    return json;
 }
 
 /* Parse a string to get a json. */
@@ -89,6 +101,41 @@ json_t const* json_create( char* str, json_t mem[], unsigned int qty ) {
     return json_createWithPool( str, &spool.pool );
 }
 
+/* Start the iteration of a stream. */
+void json_streamInit( jsonStream_t* stream, char* str ) {
+    stream->str = str;
+    stream->next = str;
+    stream->offset = 0;
+    stream->error = false;
+}
+
+/* Parse the next document of a stream with a custom pool. */
+json_t const* json_streamNextWithPool( jsonStream_t* stream, jsonPool_t* pool ) {
+    if ( !stream->next ) return 0;
+    char* ptr = goBlank( stream->next );
+    if ( !ptr ) {
+        stream->next = 0;
+        return 0;
+    }
+    stream->offset = (size_t)( ptr - stream->str );
+    json_t const* json = 0;
+    if ( *ptr == '{' || *ptr == '[' ) ptr = document( ptr, pool, &json );
+    else ptr = 0;
+    stream->next = ptr;
+    stream->error = !ptr;
+    return ptr ? json : 0;
+}
+
+/* Parse the next document of a stream. */
+json_t const* json_streamNext( jsonStream_t* stream, json_t mem[], unsigned int qty ) {
+    jsonStaticPool_t spool;
+    spool.mem = mem;
+    spool.qty = qty;
+    spool.pool.init = poolInit;
+    spool.pool.alloc = poolAlloc;
+    return json_streamNextWithPool( stream, &spool.pool );
+}
+
 /** Get a special character with its escape character. Examples:
   * 'b' -> '\\b', 'n' -> '\\n', 't' -> '\\t'
   * @param ch The escape character.
@@ -258,6 +305,25 @@ static char* fraqValue( char* ptr ) {
     return ptr;
 }
 
+/** Convert the digits of an integer and check its range in one pass.
+  * Up to 19 digits cannot overflow 64 bits, so the loop needs no checks.
+  * @param str Pointer to the first character, a '-' or a digit.
+  * @param end Pointer to the first character after the digits.
+  * @param integer The value if success.
+  * @retval true if the value fits in int64_t. */
+static bool integerValue( char const* str, char const* end, int64_t* integer ) {
+    bool const negative = *str == '-';
+    if ( negative ) ++str;
+    if ( end - str > 19 ) return false;
+    uint64_t value = 0;
+    for( ; str < end; ++str )
+        value = value * 10 + (unsigned)( *str - '0' );
+    if ( value > (uint64_t)INT64_MAX + negative ) return false;
+    if ( !negative ) *integer = (int64_t)value;
+    else *integer = value ? -(int64_t)( value - 1 ) - 1 : 0;
+    return true;
+}
+
 /** Parser a string to get a numerical value.
   * If the first character after the value is different of '}' or ']' is set to '\0'.
   * @param ptr Pointer to first character.
@@ -284,6 +350,15 @@ static char* numValue( char* ptr, json_t* property ) {
         property->type = JSON_REAL;
     }
     if ( !isEndOfPrimitive( *ptr ) ) return 0;
+#ifdef JSON_NUMBER_CACHE
+    /* Reals are left to json_getReal(), strtod() costs more than the
+       parsing around it and most of them are never read. */
+    if ( JSON_INTEGER == property->type ) {
+        int64_t integer;
+        if ( !integerValue( property->u.value, ptr, &integer ) ) return 0;
+        memcpy( property->u.n.bits, &integer, sizeof integer );
+    }
+#else
     if ( JSON_INTEGER == property->type ) {
         char const* value = property->u.value;
         bool const negative = *value == '-';
@@ -300,6 +375,7 @@ static char* numValue( char* ptr, json_t* property ) {
             *ptr = tmp;
         }
     }
+#endif
     ptr = setToNull( ptr );
     return ptr;
 }
@@ -381,6 +457,147 @@ static char* objValue( char* ptr, json_t* obj, jsonPool_t* pool ) {
     }
 }
 
+/** Pack the type and the index of the next sibling of a compact property. */
+static uint32_t compactSibling( jsonType_t type, uint32_t index ) {
+    return ( (uint32_t)type << JSONC_TYPE_SHIFT ) | index;
+}
+
+/** Parser a string to get a json object value in the compact layout.
+  * The same walk as objValue. While an object or array is open its sibling
+  * index holds its parent and its value the last child, the first child is
+  * the property right after it.
+  * @param ptr Pointer to first character.
+  * @param doc The document with the array of properties, mem[0] is the root.
+  * @retval Pointer to first character after the value. If success.
+  * @retval Null pointer if any error occur. */
+static char* objValueCompact( char* ptr, jsoncDoc_t* doc ) {
+    jsonc_t* const mem = doc->mem;
+    uint32_t obj = 0;
+    mem[0].sibling = compactSibling( *ptr == '{' ? JSON_OBJ : JSON_ARRAY, 0 );
+    mem[0].name = 0;
+    mem[0].value = 0;
+    doc->used = 1;
+    ptr++;
+    for(;;) {
+        ptr = goBlank( ptr );
+        if ( !ptr ) return 0;
+        if ( *ptr == ',' ) {
+            ++ptr;
+            continue;
+        }
+        jsonType_t const objType = jsonc_getType( mem + obj );
+        char const endchar = ( objType == JSON_OBJ )? '}': ']';
+        if ( *ptr == endchar ) {
+            *ptr = '\0';
+            if ( obj == 0 ) return ++ptr;
+            uint32_t const parentObj = mem[obj].sibling & JSONC_INDEX_MASK;
+            mem[obj].sibling = compactSibling( objType, 0 );
+            obj = parentObj;
+            ++ptr;
+            continue;
+        }
+        if ( doc->used >= doc->qty ) return 0;
+        uint32_t const index = doc->used++;
+        jsonc_t* const property = mem + index;
+        json_t scratch;
+        if( objType != JSON_ARRAY ) {
+            if ( *ptr != '\"' ) return 0;
+            ptr = propertyName( ptr, &scratch );
+            if ( !ptr ) return 0;
+            property->name = (uint32_t)( scratch.name - doc->str ) + 1;
+        }
+        else property->name = 0;
+        if ( mem[obj].value ) mem[mem[obj].value].sibling |= index;
+        mem[obj].value = index;
+        scratch.u.value = ptr;
+        switch( *ptr ) {
+            case '{':
+            case '[':
+                property->sibling = compactSibling( *ptr == '{' ? JSON_OBJ : JSON_ARRAY, obj );
+                property->value = 0;
+                obj = index;
+                ++ptr;
+                continue;
+            case '\"': ptr = textValue( ptr, &scratch );  break;
+            case 't':  ptr = trueValue( ptr, &scratch );  break;
+            case 'f':  ptr = falseValue( ptr, &scratch ); break;
+            case 'n':  ptr = nullValue( ptr, &scratch );  break;
+            default:   ptr = numValue( ptr, &scratch );   break;
+        }
+        if ( !ptr ) return 0;
+        property->sibling = compactSibling( scratch.type, 0 );
+        property->value = (uint32_t)( scratch.u.value - doc->str );
+    }
+}
+
+/* Parse a string to get a json in the compact layout. */
+jsonc_t const* jsonc_create( jsoncDoc_t* doc, char* str, jsonc_t mem[], unsigned int qty ) {
+    doc->str = str;
+    doc->mem = mem;
+    doc->qty = qty < JSONC_INDEX_MASK ? qty : JSONC_INDEX_MASK;
+    doc->used = 0;
+    char* ptr = goBlank( str );
+    if ( !ptr || (*ptr != '{' && *ptr != '[') || !qty ) return 0;
+    ptr = objValueCompact( ptr, doc );
+    if ( !ptr ) return 0;
+    return mem;
+}
+
+/* Search a property by its name in a JSON object. */
+jsonc_t const* jsonc_getProperty( jsoncDoc_t const* doc, jsonc_t const* obj, char const* property ) {
+    jsonc_t const* sibling;
+    for( sibling = jsonc_getChild( obj ); sibling; sibling = jsonc_getSibling( doc, sibling ) )
+        if ( sibling->name && !strcmp( jsonc_getName( doc, sibling ), property ) )
+            return sibling;
+    return 0;
+}
+
+/* Search a property by its name in a JSON object and return its value. */
+char const* jsonc_getPropertyValue( jsoncDoc_t const* doc, jsonc_t const* obj, char const* property ) {
+    jsonc_t const* field = jsonc_getProperty( doc, obj, property );
+    if ( !field ) return 0;
+    if ( JSON_ARRAY >= jsonc_getType( field ) ) return 0;
+    return jsonc_getValue( doc, field );
+}
+
+/* Build a compact property and everything below it as json_t. */
+json_t const* jsonc_toJson( jsoncDoc_t const* doc, jsonc_t const* json, json_t mem[], unsigned int qty ) {
+    /* The subtree ends with the last descendant, down the last children. */
+    jsonc_t const* last = json;
+    while( jsonc_getType( last ) <= JSON_ARRAY && last->value )
+        last = doc->mem + last->value;
+    unsigned int const count = (unsigned int)( last - json ) + 1;
+    if ( count > qty ) return 0;
+
+    unsigned int i;
+    for( i = 0; i < count; ++i ) {
+        jsonc_t const* src = json + i;
+        json_t* dst = mem + i;
+        dst->sibling = 0;
+        dst->name = jsonc_getName( doc, src );
+        dst->type = jsonc_getType( src );
+        if ( dst->type <= JSON_ARRAY ) {
+            dst->u.c.child = 0;
+            continue;
+        }
+        dst->u.value = jsonc_getValue( doc, src );
+#ifdef JSON_NUMBER_CACHE
+        if ( dst->type == JSON_INTEGER ) {
+            int64_t const integer = strtoll( dst->u.value, (char**)NULL, 10 );
+            memcpy( dst->u.n.bits, &integer, sizeof integer );
+        }
+#endif
+    }
+    /* The children of each one follow the compact sibling indexes. */
+    for( i = 0; i < count; ++i ) {
+        if ( mem[i].type > JSON_ARRAY ) continue;
+        jsonc_t const* child;
+        for( child = jsonc_getChild( json + i ); child; child = jsonc_getSibling( doc, child ) )
+            add( mem + i, mem + ( child - json ) );
+    }
+    return mem;
+}
+
 /** Initialize a json pool.
   * @param pool The handler of the pool.
   * @return a instance of a json. */
@@ -459,3 +676,283 @@ static char* setToNull( char* ch ) {
 static bool isEndOfPrimitive( char ch ) {
     return ch == ',' || isOneOfThem( ch, blank ) || isOneOfThem( ch, endofblock );
 }
+
+/** Count the properties that parsing a string needs. Every property but the
+  * root follows a comma or opens a non-empty container.
+  * @param str Pointer to the first character.
+  * @param end Pointer to the first character after the string.
+  * @return The number of properties. */
+static unsigned int countProperties( char const* str, char const* end ) {
+    unsigned int qty = 1;
+    for( ; str < end; ++str ) {
+        switch( *str ) {
+            case ',':
+                ++qty;
+                break;
+            case '{':
+            case '[': {
+                char const* next = str + 1;
+                while( next < end && isOneOfThem( *next, blank ) ) ++next;
+                if ( next < end && !isOneOfThem( *next, endofblock ) ) ++qty;
+                break;
+            }
+            case '\"':
+                for( ++str; str < end && *str != '\"'; ++str )
+                    if ( *str == '\\' ) ++str;
+                break;
+        }
+    }
+    return qty;
+}
+
+/* Count the properties that parsing a string needs. */
+unsigned int json_count( char const* str ) {
+    return countProperties( str, str + strlen( str ) );
+}
+
+/* Count the properties that a read-only parse needs. */
+unsigned int jsonv_count( char const* str, size_t len ) {
+    return countProperties( str, str + len );
+}
+
+/** Increases a pointer while it points to a white space character and it
+  * is before the end of the input.
+  * @param ptr The initial pointer value.
+  * @param end Pointer to the first character after the input.
+  * @return The final pointer value, end if the input is over. */
+static char const* viewBlank( char const* ptr, char const* end ) {
+    while( ptr < end && isOneOfThem( *ptr, blank ) ) ++ptr;
+    return ptr;
+}
+
+/** Increases a pointer while it points to a decimal digit character and it
+  * is before the end of the input. */
+static char const* viewNum( char const* ptr, char const* end ) {
+    while( ptr < end && isdigit( (int)(*ptr) ) ) ++ptr;
+    return ptr;
+}
+
+/** Check a string with the rules of parseString without unescaping it.
+  * @param ptr Pointer to the first character after '\"'.
+  * @param end Pointer to the first character after the input.
+  * @retval Pointer to the closing '\"'. If success.
+  * @retval Null pointer if any error occur. */
+static char const* viewString( char const* ptr, char const* end ) {
+    for( ; ptr < end && *ptr; ++ptr ) {
+        if ( *ptr == '\"' ) return ptr;
+        if ( *ptr != '\\' ) continue;
+        if ( ++ptr == end ) return 0;
+        if ( *ptr == 'u' ) {
+            if ( end - ptr < 5 ) return 0;
+            if ( !getCharFromUnicode( (unsigned char const*)ptr + 1 ) ) return 0;
+            ptr += 4;
+        }
+        else if ( !getEscape( *ptr ) ) return 0;
+    }
+    return 0;
+}
+
+/** Read a character of a checked string, unescaping it.
+  * @param ptr Pointer to the character or its escape sequence.
+  * @param ch The character.
+  * @return Pointer to the next character. */
+static char const* viewChar( char const* ptr, char* ch ) {
+    if ( *ptr != '\\' ) {
+        *ch = *ptr;
+        return ptr + 1;
+    }
+    if ( *++ptr == 'u' ) {
+        *ch = '?';
+        return ptr + 5;
+    }
+    *ch = getEscape( *ptr );
+    return ptr + 1;
+}
+
+/** Compare a span of a checked string with a null-terminated one. */
+static bool viewEqual( jsonSpan_t span, char const* str ) {
+    char const* ptr = span.ptr;
+    char const* const end = ptr + span.len;
+    while( ptr < end ) {
+        char ch;
+        ptr = viewChar( ptr, &ch );
+        if ( ch != *str++ ) return false;
+    }
+    return *str == '\0';
+}
+
+/** Parser a primitive literal without modifying the input.
+  * @retval Pointer to the first character after the value. If success.
+  * @retval Null pointer if any error occur. */
+static char const* viewPrimitive( char const* ptr, char const* end, jsonv_t* property, char const* value, jsonType_t type ) {
+    size_t const len = strlen( value );
+    if ( (size_t)( end - ptr ) <= len || memcmp( ptr, value, len ) ) return 0;
+    if ( !isEndOfPrimitive( ptr[len] ) ) return 0;
+    property->type = type;
+    property->u.value.len = (unsigned int)len;
+    return ptr + len;
+}
+
+/** Parser a number with the rules of numValue without modifying the input.
+  * @retval Pointer to the first character after the value. If success.
+  * @retval Null pointer if any error occur. */
+static char const* viewNumber( char const* ptr, char const* end, jsonv_t* property ) {
+    char const* const start = ptr;
+    if ( *ptr == '-' ) ++ptr;
+    if ( ptr == end || !isdigit( (int)(*ptr) ) ) return 0;
+    if ( *ptr != '0' ) ptr = viewNum( ptr, end );
+    else if ( ++ptr < end && isdigit( (int)(*ptr) ) ) return 0;
+    property->type = JSON_INTEGER;
+    if ( ptr < end && *ptr == '.' ) {
+        if ( ++ptr == end || !isdigit( (int)(*ptr) ) ) return 0;
+        ptr = viewNum( ptr, end );
+        property->type = JSON_REAL;
+    }
+    if ( ptr < end && ( *ptr == 'e' || *ptr == 'E' ) ) {
+        if ( ++ptr < end && ( *ptr == '-' || *ptr == '+' ) ) ++ptr;
+        if ( ptr == end || !isdigit( (int)(*ptr) ) ) return 0;
+        ptr = viewNum( ptr, end );
+        property->type = JSON_REAL;
+    }
+    if ( ptr == end || !isEndOfPrimitive( *ptr ) ) return 0;
+    if ( JSON_INTEGER == property->type ) {
+        int64_t integer;
+        if ( !integerValue( start, ptr, &integer ) ) return 0;
+    }
+    property->u.value.len = (unsigned int)( ptr - start );
+    return ptr;
+}
+
+/** Add a property to a JSON object or array of a read-only parse. */
+static void addView( jsonv_t* obj, jsonv_t* property ) {
+    property->sibling = 0;
+    if ( !obj->u.c.child )
+        obj->u.c.child = property;
+    else
+        obj->u.c.last_child->sibling = property;
+    obj->u.c.last_child = property;
+}
+
+/** Parser a string to get a json object value without modifying it.
+  * The same walk as objValue, the input ends at end instead of at a null
+  * character.
+  * @param ptr Pointer to first character.
+  * @param end Pointer to the first character after the input.
+  * @param mem Array of json properties, mem[0] is the root.
+  * @param qty Number of elements of mem.
+  * @retval Pointer to first character after the value. If success.
+  * @retval Null pointer if any error occur. */
+static char const* objValueView( char const* ptr, char const* end, jsonv_t mem[], unsigned int qty ) {
+    jsonv_t* obj = mem;
+    unsigned int used = 1;
+    obj->type = *ptr == '{' ? JSON_OBJ : JSON_ARRAY;
+    obj->name.ptr = 0;
+    obj->name.len = 0;
+    obj->u.c.child = 0;
+    obj->sibling = 0;
+    ptr++;
+    for(;;) {
+        ptr = viewBlank( ptr, end );
+        if ( ptr == end ) return 0;
+        if ( *ptr == ',' ) {
+            ++ptr;
+            continue;
+        }
+        char const endchar = ( obj->type == JSON_OBJ )? '}': ']';
+        if ( *ptr == endchar ) {
+            jsonv_t* parentObj = obj->sibling;
+            if ( !parentObj ) return ++ptr;
+            obj->sibling = 0;
+            obj = parentObj;
+            ++ptr;
+            continue;
+        }
+        if ( used >= qty ) return 0;
+        jsonv_t* property = mem + used++;
+        if( obj->type != JSON_ARRAY ) {
+            if ( *ptr != '\"' ) return 0;
+            char const* close = viewString( ++ptr, end );
+            if ( !close ) return 0;
+            property->name.ptr = ptr;
+            property->name.len = (unsigned int)( close - ptr );
+            ptr = viewBlank( close + 1, end );
+            if ( ptr == end || *ptr++ != ':' ) return 0;
+            ptr = viewBlank( ptr, end );
+            if ( ptr == end ) return 0;
+        }
+        else {
+            property->name.ptr = 0;
+            property->name.len = 0;
+        }
+        addView( obj, property );
+        property->u.value.ptr = ptr;
+        switch( *ptr ) {
+            case '{':
+            case '[':
+                property->type = *ptr == '{' ? JSON_OBJ : JSON_ARRAY;
+                property->u.c.child = 0;
+                property->sibling = obj;
+                obj = property;
+                ++ptr;
+                continue;
+            case '\"': {
+                char const* close = viewString( ++ptr, end );
+                if ( !close ) return 0;
+                property->type = JSON_TEXT;
+                property->u.value.ptr = ptr;
+                property->u.value.len = (unsigned int)( close - ptr );
+                ptr = close + 1;
+                break;
+            }
+            case 't':  ptr = viewPrimitive( ptr, end, property, "true", JSON_BOOLEAN );  break;
+            case 'f':  ptr = viewPrimitive( ptr, end, property, "false", JSON_BOOLEAN ); break;
+            case 'n':  ptr = viewPrimitive( ptr, end, property, "null", JSON_NULL );     break;
+            default:   ptr = viewNumber( ptr, end, property );                          break;
+        }
+        if ( !ptr ) return 0;
+    }
+}
+
+/* Parse a string without modifying it. */
+jsonv_t const* jsonv_create( char const* str, size_t len, jsonv_t mem[], unsigned int qty ) {
+    char const* const end = str + len;
+    char const* ptr = viewBlank( str, end );
+    if ( ptr == end || (*ptr != '{' && *ptr != '[') || !qty ) return 0;
+    if ( !objValueView( ptr, end, mem, qty ) ) return 0;
+    return mem;
+}
+
+/* Search a property by its unescaped name in a JSON object. */
+jsonv_t const* jsonv_getProperty( jsonv_t const* obj, char const* property ) {
+    jsonv_t const* sibling;
+    for( sibling = obj->u.c.child; sibling; sibling = sibling->sibling )
+        if ( sibling->name.ptr && viewEqual( sibling->name, property ) )
+            return sibling;
+    return 0;
+}
+
+/* Check if a property is a text equal to str once unescaped. */
+bool jsonv_isText( jsonv_t const* property, char const* str ) {
+    return property->type == JSON_TEXT && viewEqual( property->u.value, str );
+}
+
+/* Unescape a text into a buffer. */
+int jsonv_getText( jsonv_t const* property, char* buf, unsigned int size ) {
+    if ( property->type != JSON_TEXT || !size ) return -1;
+    char const* ptr = property->u.value.ptr;
+    char const* const end = ptr + property->u.value.len;
+    unsigned int len = 0;
+    while( ptr < end ) {
+        if ( len + 1 >= size ) return -1;
+        ptr = viewChar( ptr, buf + len++ );
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+/* Get the value of a json integer property. */
+int64_t jsonv_getInteger( jsonv_t const* property ) {
+    int64_t integer = 0;
+    integerValue( property->u.value.ptr, property->u.value.ptr + property->u.value.len, &integer );
+    return integer;
+}
@@ -38,6 +38,7 @@ extern "C" {
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #define json_containerOf( ptr, type, member ) \
     ((type*)( (char*)ptr - offsetof( type, member ) ))
@@ -51,7 +52,12 @@ typedef enum {
     JSON_INTEGER, JSON_REAL, JSON_NULL
 } jsonType_t;
 
-/** Structure to handle JSON properties. */
+/** Structure to handle JSON properties.
+  * If JSON_NUMBER_CACHE is defined the parser converts integers once and
+  * json_getInteger() only reads the result, reals are still converted by
+  * json_getReal() when they are read. The integer is stored next to the
+  * text of the value, where objects keep their last child, so a property
+  * does not grow on 64-bit targets and grows by 4 bytes on 32-bit ones. The library and its users must agree on the macro. */
 typedef struct json_s {
     struct json_s* sibling;
     char const* name;
@@ -61,6 +67,12 @@ typedef struct json_s {
             struct json_s* child;
             struct json_s* last_child;
         } c;
+#ifdef JSON_NUMBER_CACHE
+        struct {
+            char const* value;
+            uint32_t bits[2]; /**< int64_t, 4-byte aligned. */
+        } n;
+#endif
     } u;
     jsonType_t type;
 } json_t;
@@ -74,6 +86,14 @@ typedef struct json_s {
   *         This property is always unnamed and its type is JSON_OBJ. */
 json_t const* json_create( char* str, json_t mem[], unsigned int qty );
 
+/** Count the json properties a string needs to be parsed, without modifying
+  * it. One pass, no memory, so the array for json_create() can be allocated
+  * once with the exact length.
+  * @param str String pointer with a JSON object.
+  * @retval The number of properties if the string is valid json. For any
+  *         other string the parse will fail anyway. */
+unsigned int json_count( char const* str );
+
 /** Get the name of a json property.
   * @param json A valid handler of a json property.
   * @retval Pointer to null-terminated if property has name.
@@ -140,14 +160,31 @@ static inline bool json_getBoolean( json_t const* property ) {
   * @param property A valid handler of a json object. Its type must be JSON_INTEGER.
   * @return The value stdint. */
 static inline int64_t json_getInteger( json_t const* property ) {
+#ifdef JSON_NUMBER_CACHE
+    if ( property->type == JSON_REAL )
+        return (int64_t)strtod( property->u.value, (char**)NULL );
+    int64_t integer;
+    memcpy( &integer, property->u.n.bits, sizeof integer );
+    return integer;
+#else
   return strtoll( property->u.value,(char**)NULL, 10);
+#endif
 }
 
 /** Get the value of a json real property.
   * @param property A valid handler of a json object. Its type must be JSON_REAL.
   * @return The value. */
 static inline double json_getReal( json_t const* property ) {
+#ifdef JSON_NUMBER_CACHE
+    if ( property->type == JSON_INTEGER ) {
+        int64_t integer;
+        memcpy( &integer, property->u.n.bits, sizeof integer );
+        return (double)integer;
+    }
+    return strtod( property->u.value, (char**)NULL );
+#else
   return strtod( property->u.value,(char**)NULL );
+#endif
 }
 
 
@@ -167,6 +204,225 @@ struct jsonPool_s {
   *         This property is always unnamed and its type is JSON_OBJ. */
 json_t const* json_createWithPool( char* str, jsonPool_t* pool );
 
+/** Structure to iterate the documents of a stream: json values one after
+  * the other, concatenated or one per line as in NDJSON. */
+typedef struct jsonStream_s {
+    char* str;     /**< Start of the stream. */
+    char* next;    /**< Rest of the stream, null once it is over. */
+    size_t offset; /**< Byte offset of the last document tried. */
+    bool error;    /**< The last document tried is not valid, the iteration stops. */
+} jsonStream_t;
+
+/** Start the iteration of a stream.
+  * @param stream The stream to set up.
+  * @param str String pointer with the documents. It will be modified. */
+void json_streamInit( jsonStream_t* stream, char* str );
+
+/** Parse the next document of a stream.
+  * The same array is used again for each document, so the properties of
+  * a document are valid until the next call.
+  * @param stream The stream.
+  * @param mem Array of json properties to allocate.
+  * @param qty Number of elements of mem.
+  * @retval Null pointer at the end of the stream or if the document is not
+  *         valid, stream->error tells which.
+  * @retval The handler of the document, its offset is stream->offset. */
+json_t const* json_streamNext( jsonStream_t* stream, json_t mem[], unsigned int qty );
+
+/** Parse the next document of a stream with a custom pool, its init is
+  * called for each document. */
+json_t const* json_streamNextWithPool( jsonStream_t* stream, jsonPool_t* pool );
+
+/** @defgroup tinyJsonCompact Compact layout.
+  * The same tree in 12 bytes per property on any target: offsets into the
+  * parsed string and indexes into the property array instead of pointers,
+  * the type in the top bits of the sibling index. The properties are kept
+  * in document order, so the first child of an object or array is the one
+  * right after it. The accessors need the document for the offsets.
+  * @{ */
+
+/** Bits of jsonc_t::sibling below the type. */
+#define JSONC_TYPE_SHIFT 29
+#define JSONC_INDEX_MASK ( ( (uint32_t)1 << JSONC_TYPE_SHIFT ) - 1 )
+
+/** Structure to handle JSON properties in the compact layout. */
+typedef struct jsonc_s {
+    uint32_t sibling; /**< Type on top, index of the next sibling below, 0 if none. */
+    uint32_t name;    /**< Offset of the name plus one, 0 if unnamed. */
+    uint32_t value;   /**< Offset of the value, for objects and arrays the index of the last child. */
+} jsonc_t;
+
+/** Structure to handle a document parsed in the compact layout. */
+typedef struct jsoncDoc_s {
+    char const* str;   /**< The parsed string. */
+    jsonc_t* mem;      /**< Array of json properties. */
+    unsigned int qty;  /**< Length of the array of json properties. */
+    unsigned int used; /**< Properties used by the last parse. */
+} jsoncDoc_t;
+
+/** Parse a string to get a json in the compact layout.
+  * @param doc The document to set up, the accessors need it.
+  * @param str String pointer with a JSON object. It will be modified.
+  * @param mem Array of json properties to allocate.
+  * @param qty Number of elements of mem.
+  * @retval Null pointer if any was wrong in the parse process.
+  * @retval If the parser process was successfully a valid handler of a json.
+  *         This property is always mem[0]. */
+jsonc_t const* jsonc_create( jsoncDoc_t* doc, char* str, jsonc_t mem[], unsigned int qty );
+
+/** Get the type of a json property. */
+static inline jsonType_t jsonc_getType( jsonc_t const* json ) {
+    return (jsonType_t)( json->sibling >> JSONC_TYPE_SHIFT );
+}
+
+/** Get the name of a json property, null pointer if it is unnamed. */
+static inline char const* jsonc_getName( jsoncDoc_t const* doc, jsonc_t const* json ) {
+    return json->name ? doc->str + json->name - 1 : 0;
+}
+
+/** Get the value of a json property. Its type cannot be JSON_OBJ or JSON_ARRAY. */
+static inline char const* jsonc_getValue( jsoncDoc_t const* doc, jsonc_t const* property ) {
+    return doc->str + property->value;
+}
+
+/** Get the next sibling of a json property, null pointer if it is the last one. */
+static inline jsonc_t const* jsonc_getSibling( jsoncDoc_t const* doc, jsonc_t const* json ) {
+    uint32_t const index = json->sibling & JSONC_INDEX_MASK;
+    return index ? doc->mem + index : 0;
+}
+
+/** Get the first property of a JSON object or array, null pointer if it is empty. */
+static inline jsonc_t const* jsonc_getChild( jsonc_t const* json ) {
+    return json->value ? json + 1 : 0;
+}
+
+/** Search a property by its name in a JSON object. */
+jsonc_t const* jsonc_getProperty( jsoncDoc_t const* doc, jsonc_t const* obj, char const* property );
+
+/** Search a property by its name in a JSON object and return its value.
+  * @retval Null pointer if not found or it is an array or an object. */
+char const* jsonc_getPropertyValue( jsoncDoc_t const* doc, jsonc_t const* obj, char const* property );
+
+static inline bool jsonc_getBoolean( jsoncDoc_t const* doc, jsonc_t const* property ) {
+    return *jsonc_getValue( doc, property ) == 't';
+}
+
+static inline int64_t jsonc_getInteger( jsoncDoc_t const* doc, jsonc_t const* property ) {
+    return strtoll( jsonc_getValue( doc, property ), (char**)NULL, 10 );
+}
+
+static inline double jsonc_getReal( jsoncDoc_t const* doc, jsonc_t const* property ) {
+    return strtod( jsonc_getValue( doc, property ), (char**)NULL );
+}
+
+/** Build a compact property and everything below it as json_t, so code
+  * written for the json_ accessors can work on a part of a compact document.
+  * The strings are shared with the document.
+  * @param mem Array of json properties to allocate.
+  * @param qty Number of elements of mem.
+  * @retval Null pointer if the properties do not fit.
+  * @retval The handler of the json property, always mem[0]. */
+json_t const* jsonc_toJson( jsoncDoc_t const* doc, jsonc_t const* json, json_t mem[], unsigned int qty );
+
+/** @ } */
+
+/** @defgroup tinyJsonView Read-only parse.
+  * The input is not modified and needs no terminating null character, so
+  * it can be logged or parsed again afterwards and may be in flash or in a
+  * DMA buffer. Names and values are spans of the input, texts still escaped
+  * and without their quotes. A text is unescaped when it is read.
+  * @{ */
+
+/** A part of the input. */
+typedef struct jsonSpan_s {
+    char const* ptr;  /**< First character, null for no span. */
+    unsigned int len; /**< Number of characters. */
+} jsonSpan_t;
+
+/** Structure to handle JSON properties of a read-only parse. */
+typedef struct jsonv_s {
+    struct jsonv_s* sibling;
+    jsonSpan_t name;
+    union {
+        jsonSpan_t value;
+        struct {
+            struct jsonv_s* child;
+            struct jsonv_s* last_child;
+        } c;
+    } u;
+    jsonType_t type;
+} jsonv_t;
+
+/** Parse a string without modifying it.
+  * @param str Pointer to the JSON object, it is not modified.
+  * @param len Length of str, a null character is not needed.
+  * @param mem Array of json properties to allocate.
+  * @param qty Number of elements of mem.
+  * @retval Null pointer if any was wrong in the parse process.
+  * @retval If the parser process was successfully a valid handler of a json.
+  *         This property is always unnamed and it is mem[0]. */
+jsonv_t const* jsonv_create( char const* str, size_t len, jsonv_t mem[], unsigned int qty );
+
+/** Count the json properties jsonv_create() needs, as json_count() does. */
+unsigned int jsonv_count( char const* str, size_t len );
+
+/** Get the type of a json property. */
+static inline jsonType_t jsonv_getType( jsonv_t const* json ) {
+    return json->type;
+}
+
+/** Get the name of a json property, still escaped. The span has a null
+  * pointer for items of arrays. */
+static inline jsonSpan_t jsonv_getName( jsonv_t const* json ) {
+    return json->name;
+}
+
+/** Get the value of a json property in text format, still escaped.
+  * It is only valid for primitive properties. */
+static inline jsonSpan_t jsonv_getValue( jsonv_t const* property ) {
+    return property->u.value;
+}
+
+/** Get the next sibling of a JSON property that is within a JSON object or array. */
+static inline jsonv_t const* jsonv_getSibling( jsonv_t const* json ) {
+    return json->sibling;
+}
+
+/** Get the first property of a JSON object or array. */
+static inline jsonv_t const* jsonv_getChild( jsonv_t const* json ) {
+    return json->u.c.child;
+}
+
+/** Search a property by its unescaped name in a JSON object. */
+jsonv_t const* jsonv_getProperty( jsonv_t const* obj, char const* property );
+
+/** Check if a property is a text equal to str once unescaped. */
+bool jsonv_isText( jsonv_t const* property, char const* str );
+
+/** Unescape a text into a buffer.
+  * @param property A property of type JSON_TEXT.
+  * @param buf Buffer for the text and its null character.
+  * @param size Size of buf.
+  * @retval The length of the text.
+  * @retval -1 if the property is not a text or the text does not fit. */
+int jsonv_getText( jsonv_t const* property, char* buf, unsigned int size );
+
+/** Get the value of a json boolean property. */
+static inline bool jsonv_getBoolean( jsonv_t const* property ) {
+    return *property->u.value.ptr == 't';
+}
+
+/** Get the value of a json integer property. */
+int64_t jsonv_getInteger( jsonv_t const* property );
+
+/** Get the value of a json real property. */
+static inline double jsonv_getReal( jsonv_t const* property ) {
+    // valid json has a delimiter after any number
+    return strtod( property->u.value.ptr, (char**)NULL );
+}
+
+/** @ } */
+
 /** @ } */
 
 #ifdef __cplusplus
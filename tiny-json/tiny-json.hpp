@@ -0,0 +1,324 @@
+
+/*
+
+<https://github.com/rafagafe/tiny-json>
+
+  Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+  SPDX-License-Identifier: MIT
+  Copyright (c) 2016-2018 Rafa Garcia <rafagarcia77@gmail.com>.
+
+  Permission is hereby  granted, free of charge, to any  person obtaining a copy
+  of this software and associated  documentation files (the "Software"), to deal
+  in the Software  without restriction, including without  limitation the rights
+  to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+  copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+  IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+  FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+  AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+  LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+*/
+
+#ifndef _TINY_JSON_HPP_
+#define	_TINY_JSON_HPP_
+
+/* C++17 interface on top of json_createWithPool. The properties live in one
+ * contiguous arena, inline in the document or in a single heap block, and
+ * the strings are views into the parsed buffer, so nothing is copied. The
+ * buffer is modified by the parser and must outlive the document. */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "tiny-json.h"
+
+namespace tinyjson {
+
+/** FNV-1a of a property name, usable at compile time. */
+constexpr std::uint32_t hash( std::string_view str ) {
+    std::uint32_t h = 2166136261u;
+    for( char ch : str ) {
+        h ^= (unsigned char)ch;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/** A property name with its hash, computed at compile time for literals. */
+struct key {
+    std::string_view name;
+    std::uint32_t hash;
+    constexpr key( std::string_view str ) : name{ str }, hash{ tinyjson::hash( str ) } {}
+    constexpr key( char const* str ) : key{ std::string_view{ str } } {}
+};
+
+namespace literals {
+constexpr key operator""_key( char const* str, std::size_t len ) {
+    return key{ std::string_view{ str, len } };
+}
+}
+
+class arena;
+
+/** Handle of a json property, a null handle stands for a missing one.
+  * Lookups on a null handle give null handles again, so chains need only
+  * one check at the end. */
+class value {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = tinyjson::value;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = tinyjson::value;
+
+        iterator() = default;
+        tinyjson::value operator*() const { return tinyjson::value{ _json, _arena }; }
+        iterator& operator++() { _json = json_getSibling( _json ); return *this; }
+        iterator operator++( int ) { iterator it = *this; ++*this; return it; }
+        bool operator==( iterator const& other ) const { return _json == other._json; }
+        bool operator!=( iterator const& other ) const { return _json != other._json; }
+
+    private:
+        friend class value;
+        iterator( json_t const* json, arena const* owner ) : _json{ json }, _arena{ owner } {}
+        json_t const* _json{};
+        arena const* _arena{};
+    };
+
+    value() = default;
+    value( json_t const* json, arena const* owner ) : _json{ json }, _arena{ owner } {}
+
+    explicit operator bool() const { return _json != nullptr; }
+    json_t const* get() const { return _json; }
+
+    jsonType_t type() const { return json_getType( _json ); }
+    bool is_object() const { return _json && type() == JSON_OBJ; }
+    bool is_array() const { return _json && type() == JSON_ARRAY; }
+    bool is_text() const { return _json && type() == JSON_TEXT; }
+    bool is_null() const { return _json && type() == JSON_NULL; }
+
+    /** Empty for a null handle and for array items. */
+    std::string_view name() const {
+        char const* str = _json ? json_getName( _json ) : nullptr;
+        return str ? std::string_view{ str } : std::string_view{};
+    }
+
+    /** The value in text format, empty for objects, arrays and null handles. */
+    std::string_view text() const {
+        if ( !_json || type() <= JSON_ARRAY ) return {};
+        return std::string_view{ json_getValue( _json ) };
+    }
+
+    /** The value as T if the property has a matching type and, for integers,
+      * the value fits. T may be bool, an integral or floating point type,
+      * std::string_view or char const*. */
+    template <typename T>
+    std::optional<T> get() const;
+
+    template <typename T>
+    T get_or( T fallback ) const {
+        std::optional<T> v = get<T>();
+        return v ? *v : fallback;
+    }
+
+    /** Property of an object by its name. */
+    value operator[]( key const& k ) const { return find( k ); }
+    value find( key const& k ) const;
+
+    /** Item of an array or property of an object by its position. */
+    value operator[]( std::size_t index ) const {
+        iterator it = begin();
+        for( ; it != end() && index; --index ) ++it;
+        return *it;
+    }
+
+    iterator begin() const {
+        return iterator{ _json && type() <= JSON_ARRAY ? json_getChild( _json ) : nullptr, _arena };
+    }
+    iterator end() const { return iterator{ nullptr, _arena }; }
+
+    std::size_t size() const {
+        std::size_t n = 0;
+        for( iterator it = begin(); it != end(); ++it ) ++n;
+        return n;
+    }
+
+private:
+    json_t const* _json{};
+    arena const* _arena{};
+};
+
+/** Properties of a document, the storage is up to the derived class. The
+  * name hashes are kept next to the properties and computed on the first
+  * lookup by key. */
+class arena : jsonPool_t {
+public:
+    arena( arena const& ) = delete;
+    arena& operator=( arena const& ) = delete;
+
+    /** Parse str in place. Returns a null handle if it is not valid json or
+      * does not fit, exhausted() tells which. */
+    value parse( char* str ) {
+        _used = 0;
+        _exhausted = false;
+        _hashed = false;
+        _root = json_createWithPool( str, this );
+        return root();
+    }
+    value parse( std::string& str ) { return parse( str.data() ); }
+
+    value root() const { return value{ _root, this }; }
+    std::size_t size() const { return _used; }
+    std::size_t capacity() const { return _capacity; }
+    bool exhausted() const { return _exhausted; }
+
+protected:
+    arena( json_t* nodes, std::uint32_t* hashes, std::size_t capacity )
+        : jsonPool_t{ &init_fn, &alloc_fn }, _nodes{ nodes }, _hashes{ hashes }, _capacity{ capacity } {}
+
+private:
+    friend class value;
+
+    static json_t* init_fn( jsonPool_t* pool ) {
+        arena* self = static_cast<arena*>( pool );
+        self->_used = 0;
+        return alloc_fn( pool );
+    }
+
+    static json_t* alloc_fn( jsonPool_t* pool ) {
+        arena* self = static_cast<arena*>( pool );
+        if ( self->_used >= self->_capacity ) {
+            self->_exhausted = true;
+            return nullptr;
+        }
+        return self->_nodes + self->_used++;
+    }
+
+    /** Hash of the name of a property of this arena. */
+    std::uint32_t name_hash( json_t const* json ) const {
+        if ( !_hashed ) {
+            for( std::size_t i = 0; i < _used; ++i ) {
+                char const* name = json_getName( _nodes + i );
+                _hashes[i] = name ? hash( name ) : 0;
+            }
+            _hashed = true;
+        }
+        return _hashes[json - _nodes];
+    }
+
+    json_t* _nodes;
+    std::uint32_t* _hashes;
+    std::size_t _capacity;
+    std::size_t _used{};
+    json_t const* _root{};
+    bool _exhausted{};
+    mutable bool _hashed{};
+};
+
+inline value value::find( key const& k ) const {
+    if ( !is_object() ) return {};
+    for( json_t const* json = json_getChild( _json ); json; json = json_getSibling( json ) ) {
+        char const* name = json_getName( json );
+        if ( _arena && _arena->name_hash( json ) != k.hash ) continue;
+        if ( !strncmp( name, k.name.data(), k.name.size() ) && name[k.name.size()] == '\0' )
+            return value{ json, _arena };
+    }
+    return {};
+}
+
+template <typename T>
+std::optional<T> value::get() const {
+    if ( !_json ) return std::nullopt;
+    jsonType_t const t = type();
+    if constexpr ( std::is_same_v<T, bool> ) {
+        if ( t != JSON_BOOLEAN ) return std::nullopt;
+        return json_getBoolean( _json );
+    }
+    else if constexpr ( std::is_integral_v<T> ) {
+        if ( t != JSON_INTEGER ) return std::nullopt;
+        std::int64_t const v = json_getInteger( _json );
+        if constexpr ( std::is_signed_v<T> ) {
+            if ( v < std::numeric_limits<T>::min() || v > std::numeric_limits<T>::max() ) return std::nullopt;
+        }
+        else {
+            if ( v < 0 || (std::uint64_t)v > std::numeric_limits<T>::max() ) return std::nullopt;
+        }
+        return (T)v;
+    }
+    else if constexpr ( std::is_floating_point_v<T> ) {
+        if ( t != JSON_REAL && t != JSON_INTEGER ) return std::nullopt;
+        return (T)json_getReal( _json );
+    }
+    else if constexpr ( std::is_same_v<T, std::string_view> ) {
+        if ( t != JSON_TEXT ) return std::nullopt;
+        return std::string_view{ json_getValue( _json ) };
+    }
+    else if constexpr ( std::is_same_v<T, char const*> ) {
+        if ( t != JSON_TEXT ) return std::nullopt;
+        return json_getValue( _json );
+    }
+    else {
+        static_assert( !sizeof( T ), "unsupported type" );
+    }
+}
+
+namespace detail {
+// a base so it is there before the arena is handed its address
+template <std::size_t Capacity>
+struct inline_storage {
+    std::array<json_t, Capacity> nodes;
+    std::array<std::uint32_t, Capacity> hashes;
+};
+}
+
+/** Room for Capacity properties inside the object, no heap at all. */
+template <std::size_t Capacity>
+class document : private detail::inline_storage<Capacity>, public arena {
+public:
+    document() : arena{ this->nodes.data(), this->hashes.data(), Capacity } {}
+    explicit document( char* str ) : document() { parse( str ); }
+    explicit document( std::string& str ) : document() { parse( str ); }
+};
+
+/** Room for a number of properties chosen at run time, one allocation. */
+class dynamic_document : public arena {
+public:
+    explicit dynamic_document( std::size_t capacity ) : dynamic_document{ capacity, make( capacity ) } {}
+
+private:
+    // the nodes first, then the hashes, in one block
+    static std::unique_ptr<unsigned char[]> make( std::size_t capacity ) {
+        return std::unique_ptr<unsigned char[]>{
+            new unsigned char[capacity * ( sizeof( json_t ) + sizeof( std::uint32_t ) )] };
+    }
+
+    dynamic_document( std::size_t capacity, std::unique_ptr<unsigned char[]> mem )
+        : arena{ reinterpret_cast<json_t*>( mem.get() ),
+                 reinterpret_cast<std::uint32_t*>( mem.get() + capacity * sizeof( json_t ) ),
+                 capacity }
+        , _mem{ std::move( mem ) } {}
+
+    std::unique_ptr<unsigned char[]> _mem;
+};
+
+} // namespace tinyjson
+
+#endif	/* _TINY_JSON_HPP_ */
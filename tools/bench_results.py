@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Collect the results of the benchmark firmware, see components/bench.
+
+    idf.py -B build-bench -D SDKCONFIG=build-bench/sdkconfig -D SDKCONFIG_DEFAULTS="sdkconfig.defaults;sdkconfig.bench" build flash
+    idf.py -B build-bench monitor | tee bench.log
+    tools/bench_results.py bench.log              table in microseconds
+    tools/bench_results.py --ndjson bench.log     one json object per case
+
+The BENCH lines are picked out of the log, whatever else the console prints
+in between is skipped. Without a file the log is read from stdin.
+"""
+
+import argparse
+import json
+import sys
+
+FIELDS = ["case", "input", "code", "cache", "rounds", "min_cycles", "median_cycles", "max_cycles", "cpu_mhz"]
+
+
+def parse(lines):
+    done = False
+    rows = []
+    for line in lines:
+        line = line.strip()
+        if line == "BENCH_DONE":
+            done = True
+            continue
+        if not line.startswith("BENCH,"):
+            continue
+        values = line.split(",")[1:]
+        if len(values) != len(FIELDS) or values[0] == "case":
+            continue
+        row = dict(zip(FIELDS, values))
+        for name in FIELDS[4:]:
+            row[name] = int(row[name])
+        rows.append(row)
+    return rows, done
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r", errors="replace"), default=sys.stdin)
+    parser.add_argument("--ndjson", action="store_true", help="print json lines instead of a table")
+    args = parser.parse_args()
+
+    rows, done = parse(args.log)
+    if not rows:
+        sys.exit("no BENCH lines in the log")
+
+    for row in rows:
+        mhz = row["cpu_mhz"]
+        row["median_us"] = round(row["median_cycles"] / mhz, 2)
+        if args.ndjson:
+            print(json.dumps(row))
+        else:
+            print(f"{row['case']:<22} {row['input']:<17} {row['code']:<11} {row['cache']:<5} "
+                  f"{row['min_cycles'] / mhz:9.1f} {row['median_us']:9.1f} {row['max_cycles'] / mhz:9.1f} us")
+    if not done:
+        print("the log ends before BENCH_DONE", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+"""Make delta patches for /ota, see components/ota/delta.h for the format.
+
+    tools/mkdelta.py diff old.bin new.bin patch.rdp    make a patch
+    tools/mkdelta.py apply old.bin patch.rdp out.bin   apply it like the device
+    tools/mkdelta.py bench old.bin new.bin             sizes and timings
+
+old.bin must be the image the device runs now, the patch is refused by any
+other image. The matcher is bsdiff-like: approximate matches (more than half
+of the bytes equal) are stored as bytewise differences, which are mostly
+zeros when code only moved and compress well.
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"RDP1"
+FLAG_DEFLATE = 0x01
+# must match DELTA_WINDOW_BITS, the device inflates into a ring of this size
+WINDOW_BITS = 12
+
+APP_DESC_OFFSET = 32
+APP_DESC_MAGIC = 0xABCD5432
+ELF_SHA256_OFFSET = APP_DESC_OFFSET + 144
+
+KEY = 8
+MIN_MATCH = 16
+GIVE_UP = 64
+
+
+def elf_sha256(image):
+    (magic,) = struct.unpack_from("<I", image, APP_DESC_OFFSET)
+    if image[0] != 0xE9 or magic != APP_DESC_MAGIC:
+        sys.exit("not an esp32 app image")
+    return image[ELF_SHA256_OFFSET : ELF_SHA256_OFFSET + 32]
+
+
+def build_index(old):
+    index = {}
+    # backwards, so the first occurrence wins
+    for i in range(len(old) - KEY, -1, -1):
+        index[old[i : i + KEY]] = i
+    return index
+
+
+def extend(old, new, o, n):
+    """Length of the best approximate match of new[n:] against old[o:]."""
+    limit = min(len(old) - o, len(new) - n)
+    score = best_score = best_len = k = 0
+    while k < limit:
+        # equal runs are the common case, skip them quickly
+        if k + 64 <= limit and old[o + k : o + k + 64] == new[n + k : n + k + 64]:
+            k += 64
+            score += 64
+        else:
+            if old[o + k] == new[n + k]:
+                score += 1
+            k += 1
+        if score * 2 - k > best_score * 2 - best_len:
+            best_score, best_len = score, k
+        elif k - best_len > GIVE_UP:
+            break
+    return best_len
+
+
+def find_matches(old, new):
+    """Greedy list of (new offset, old offset, length)."""
+    index = build_index(old)
+    matches = []
+    align = 0
+    i = 0
+    while i < len(new):
+        best_len = best_old = 0
+        # keep the previous alignment when it still works, then try the index
+        for o in (i + align, index.get(new[i : i + KEY])):
+            if o is None or not 0 <= o < len(old):
+                continue
+            length = extend(old, new, o, i)
+            if length > best_len:
+                best_len, best_old = length, o
+        if best_len >= MIN_MATCH:
+            matches.append((i, best_old, best_len))
+            align = best_old - i
+            i += best_len
+        else:
+            i += 1
+    return matches
+
+
+def make_records(old, new, matches):
+    out = bytearray()
+    # a leading empty match covers new data before the first real one
+    matches = [(0, 0, 0)] + matches
+    for k, (n, o, length) in enumerate(matches):
+        if k + 1 < len(matches):
+            extra_end, next_old = matches[k + 1][0], matches[k + 1][1]
+        else:
+            extra_end, next_old = len(new), o + length
+        out += struct.pack("<IIi", length, extra_end - n - length, next_old - o - length)
+        out += bytes((new[n + j] - old[o + j]) & 0xFF for j in range(length))
+        out += new[n + length : extra_end]
+    return bytes(out)
+
+
+def make_patch(old, new, deflate=True):
+    body = make_records(old, new, find_matches(old, new))
+    flags = 0
+    if deflate:
+        compressor = zlib.compressobj(9, zlib.DEFLATED, -WINDOW_BITS, 9)
+        body = compressor.compress(body) + compressor.flush()
+        flags |= FLAG_DEFLATE
+    header = MAGIC + bytes([flags, 0, 0, 0]) + struct.pack("<II", len(new), len(old)) + elf_sha256(old)
+    return header + body
+
+
+def apply_patch(old, patch):
+    if patch[:4] != MAGIC:
+        sys.exit("not a patch")
+    flags = patch[4]
+    target_size, source_size = struct.unpack_from("<II", patch, 8)
+    if patch[16:48] != elf_sha256(old) or source_size > len(old):
+        sys.exit("the patch was made for another image")
+    body = patch[48:]
+    if flags & FLAG_DEFLATE:
+        body = zlib.decompressobj(-WINDOW_BITS).decompress(body)
+
+    out = bytearray()
+    pos = src = 0
+    while len(out) < target_size:
+        diff_len, extra_len, seek = struct.unpack_from("<IIi", body, pos)
+        pos += 12
+        if len(out) + diff_len + extra_len > target_size or src < 0 or src + diff_len > source_size:
+            sys.exit("corrupted patch")
+        out += bytes((body[pos + j] + old[src + j]) & 0xFF for j in range(diff_len))
+        pos += diff_len
+        out += body[pos : pos + extra_len]
+        pos += extra_len
+        src += diff_len + seek
+    return bytes(out)
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def write(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def bench(old, new):
+    started = time.perf_counter()
+    raw = make_patch(old, new, deflate=False)
+    diff_s = time.perf_counter() - started
+    patch = make_patch(old, new)
+    started = time.perf_counter()
+    ok = apply_patch(old, patch) == new
+    apply_s = time.perf_counter() - started
+    full = len(zlib.compress(new, 9))
+
+    print("image          %8d bytes" % len(new))
+    print("image deflated %8d bytes" % full)
+    print("patch          %8d bytes" % len(raw))
+    print("patch deflated %8d bytes, %.1f%% of the image" % (len(patch), 100.0 * len(patch) / len(new)))
+    print("diff time      %8.2f s" % diff_s)
+    print("apply time     %8.2f s on the host, %s" % (apply_s, "matches" if ok else "MISMATCH"))
+    return 0 if ok else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("diff")
+    p.add_argument("old")
+    p.add_argument("new")
+    p.add_argument("patch")
+    p.add_argument("--raw", action="store_true", help="do not deflate the records")
+    p = sub.add_parser("apply")
+    p.add_argument("old")
+    p.add_argument("patch")
+    p.add_argument("out")
+    p = sub.add_parser("bench")
+    p.add_argument("old")
+    p.add_argument("new")
+    args = parser.parse_args()
+
+    if args.command == "diff":
+        new = read(args.new)
+        patch = make_patch(read(args.old), new, deflate=not args.raw)
+        write(args.patch, patch)
+        print("%d bytes, %.1f%% of the image" % (len(patch), 100.0 * len(patch) / len(new)))
+    elif args.command == "apply":
+        write(args.out, apply_patch(read(args.old), read(args.patch)))
+    else:
+        return bench(read(args.old), read(args.new))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
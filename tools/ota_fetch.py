@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Download an image the way the device does for /ota and check it.
+
+Resumes with a Range request after every interruption, throws away the
+head of the body when the server ignores the range, and gives up after
+--attempts interruptions in a row without progress, like ota.c with
+CONFIG_OTA_RESUME_ATTEMPTS. The result is compared with --expect.
+
+    tools/ota_fetch.py https://<host ip>:8070/fw.bin --cafile components/ota/ota_server_ca.pem --expect build/remote_elgen.bin
+
+--selftest serves a random image through ota_server.py with dropped
+connections, with and without range support, and fetches it back.
+"""
+
+import argparse
+import hashlib
+import http.client
+import os
+import ssl
+import sys
+import tempfile
+import threading
+import urllib.parse
+
+CHUNK = 4096
+
+
+def connect(url, context):
+    parts = urllib.parse.urlsplit(url)
+    if parts.scheme == "https":
+        return http.client.HTTPSConnection(parts.hostname, parts.port or 443, timeout=10, context=context)
+    return http.client.HTTPConnection(parts.hostname, parts.port or 80, timeout=10)
+
+
+def fetch(url, context=None, attempts=5, log=print):
+    """Returns the image and the number of interruptions it took."""
+    path = urllib.parse.urlsplit(url).path or "/"
+    data = bytearray()
+    total = None
+    drops = 0
+    failures = 0
+
+    while total is None or len(data) < total:
+        resumed_at = len(data)
+        conn = connect(url, context)
+        try:
+            headers = {"Range": "bytes=%d-" % resumed_at} if resumed_at else {}
+            conn.request("GET", path, headers=headers)
+            response = conn.getresponse()
+            skip = 0
+            if response.status == 206 and resumed_at:
+                log("resuming at %d" % resumed_at)
+            elif response.status == 200:
+                if resumed_at:
+                    log("server ignores ranges, skipping %d bytes" % resumed_at)
+                skip = resumed_at
+                total = int(response.getheader("Content-Length"))
+            else:
+                raise RuntimeError("unexpected status %d" % response.status)
+
+            while True:
+                chunk = response.read1(CHUNK)
+                if not chunk:
+                    break
+                drop = min(skip, len(chunk))
+                skip -= drop
+                data += chunk[drop:]
+        except (OSError, http.client.HTTPException) as e:
+            log("interrupted at %d: %s" % (len(data), e))
+        finally:
+            conn.close()
+
+        if total is not None and len(data) >= total:
+            break
+        drops += 1
+        # only interruptions without any progress count against the limit
+        failures = 0 if len(data) > resumed_at else failures + 1
+        if failures > attempts:
+            raise RuntimeError("gave up after %d bytes" % len(data))
+
+    return bytes(data), drops
+
+
+def selftest():
+    sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+    import ota_server
+
+    image = os.urandom(1000 * 1000 + 123)
+    digest = hashlib.sha256(image).hexdigest()
+    with tempfile.NamedTemporaryFile(suffix=".bin") as f:
+        f.write(image)
+        f.flush()
+        for no_range in (False, True):
+            # without ranges every retry starts over, so only a few responses may be cut
+            drops = 3 if no_range else -1
+            server = ota_server.make_server(f.name, 0, drop_after=200 * 1000, drops=drops, no_range=no_range)
+            server.RequestHandlerClass.log_message = lambda *args: None
+            threading.Thread(target=server.serve_forever, daemon=True).start()
+            url = "http://127.0.0.1:%d/fw.bin" % server.server_address[1]
+            try:
+                data, drops = fetch(url, log=lambda text: None)
+            finally:
+                server.shutdown()
+                server.server_close()
+            ok = hashlib.sha256(data).hexdigest() == digest
+            print("%s: %d bytes, %d drops, sha256 %s" % (
+                "no range" if no_range else "range", len(data), drops, "matches" if ok else "DIFFERS"))
+            if not ok:
+                return 1
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("url", nargs="?")
+    parser.add_argument("--cafile", help="the pinned CA, components/ota/ota_server_ca.pem")
+    parser.add_argument("--expect", help="the image the download must equal")
+    parser.add_argument("--attempts", type=int, default=5, help="CONFIG_OTA_RESUME_ATTEMPTS")
+    parser.add_argument("--selftest", action="store_true")
+    args = parser.parse_args()
+
+    if args.selftest:
+        return selftest()
+    if not args.url:
+        parser.error("url is required")
+
+    context = ssl.create_default_context(cafile=args.cafile) if args.cafile else None
+    data, drops = fetch(args.url, context, args.attempts)
+    print("%d bytes, %d drops, sha256 %s" % (len(data), drops, hashlib.sha256(data).hexdigest()))
+    if args.expect:
+        with open(args.expect, "rb") as f:
+            if f.read() != data:
+                print("download differs from %s" % args.expect)
+                return 1
+        print("matches %s" % args.expect)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Serve a firmware image for /ota over https.
+
+The device only accepts a server certificate signed by the CA in
+components/ota/ota_server_ca.pem, that file tells how to make both.
+Range requests are honoured so an interrupted download can resume.
+--drop-after cuts every response (or the first --drops ones) after that
+many bytes to exercise the resume path, --rate limits the bandwidth like a weak mobile link.
+
+    idf.py build
+    tools/ota_server.py build/remote_elgen.bin --cert server.pem --key server.key --drop-after 300000
+    # in the bot: /ota https://<host ip>:8070/fw.bin
+    # the resume path without a device:
+    tools/ota_fetch.py https://<host ip>:8070/fw.bin --cafile components/ota/ota_server_ca.pem --expect build/remote_elgen.bin
+    # steady TLS load for CONFIG_CONTROL_LATENCY_PROBE, a handshake every 16 KB:
+    tools/ota_server.py build/remote_elgen.bin --cert server.pem --key server.key --drop-after 16384 --rate 20000
+"""
+
+import argparse
+import http.server
+import os
+import re
+import ssl
+import time
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_GET(self):
+        size = os.path.getsize(self.server.image)
+        start = 0
+        match = re.match(r"bytes=(\d+)-$", self.headers.get("Range", ""))
+        if match and not self.server.no_range:
+            start = int(match.group(1))
+            if start >= size:
+                self.send_error(416)
+                return
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, size - 1, size))
+        else:
+            self.send_response(200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(size - start))
+        self.end_headers()
+
+        sent = 0
+        began = time.monotonic()
+        with open(self.server.image, "rb") as f:
+            f.seek(start)
+            while True:
+                chunk = f.read(4096)
+                if not chunk:
+                    break
+                if self.server.drop_after and sent + len(chunk) > self.server.drop_after and self.server.drops != 0:
+                    self.server.drops -= 1
+                    self.log_message("dropping the connection at %d", start + sent)
+                    self.close_connection = True
+                    return
+                self.wfile.write(chunk)
+                sent += len(chunk)
+                if self.server.rate:
+                    delay = sent / self.server.rate - (time.monotonic() - began)
+                    if delay > 0:
+                        time.sleep(delay)
+
+        elapsed = time.monotonic() - began
+        self.log_message("sent %d bytes from %d in %.1f s", sent, start, elapsed)
+
+
+def make_server(image, port, drop_after=0, drops=-1, rate=0, no_range=False):
+    server = http.server.ThreadingHTTPServer(("", port), Handler)
+    server.image = image
+    server.drop_after = drop_after
+    server.drops = drops
+    server.rate = rate
+    server.no_range = no_range
+    return server
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image")
+    parser.add_argument("--port", type=int, default=8070)
+    parser.add_argument("--drop-after", type=int, default=0, help="cut each response after this many bytes")
+    parser.add_argument("--drops", type=int, default=-1, help="cut only this many responses, -1 is all")
+    parser.add_argument("--rate", type=int, default=0, help="bytes per second, 0 is unlimited")
+    parser.add_argument("--no-range", action="store_true", help="ignore Range like a dumb server")
+    parser.add_argument("--cert", help="server certificate, signed by the pinned CA")
+    parser.add_argument("--key", help="key of the server certificate")
+    parser.add_argument("--plain", action="store_true", help="plain http, for tools/ota_fetch.py only")
+    args = parser.parse_args()
+    if not args.plain and not (args.cert and args.key):
+        parser.error("the device only updates over https, pass --cert and --key")
+
+    server = make_server(args.image, args.port, args.drop_after, args.drops, args.rate, args.no_range)
+    if not args.plain:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.key)
+        server.socket = context.wrap_socket(server.socket, server_side=True)
+    print("serving %s on port %d" % (args.image, server.server_address[1]))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()